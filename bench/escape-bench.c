@@ -0,0 +1,287 @@
+#define _DEFAULT_SOURCE 1
+
+// Throughput of the log format escaping (escape.c) per implementation,
+// compared to the old encoders that wrote every run with fwrite().
+//
+//     make bench
+//     build/bin/escape-bench [MiB]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "service-runner.h"
+
+#define DEFAULT_INPUT_MIB 5
+#define ROUNDS 5
+
+enum BenchInput {
+    INPUT_BASE64, // like tests/services/creates_big_log.sh
+    INPUT_TEXT,   // log messages with some quotes and paths
+    INPUT_HEAVY,  // mostly characters that need escaping
+    INPUT_UTF8,   // mostly non-ASCII text
+    INPUT_COUNT,
+};
+
+static const char *const input_names[INPUT_COUNT] = {
+    [INPUT_BASE64] = "base64",
+    [INPUT_TEXT]   = "text",
+    [INPUT_HEAVY]  = "heavy",
+    [INPUT_UTF8]   = "utf8",
+};
+
+static const char *const impl_names[] = {
+    [ESCAPE_IMPL_AUTO]   = "auto",
+    [ESCAPE_IMPL_SCALAR] = "scalar",
+    [ESCAPE_IMPL_SSE2]   = "sse2",
+    [ESCAPE_IMPL_AVX2]   = "avx2",
+};
+
+// ======== old encoders ========
+// As service-runner had them before escape.c, writing straight to the FILE.
+
+static void old_json_string(FILE *fp, const char *str) {
+    const char *prev = str;
+    for (const char *ptr = str;;) {
+        char ch = *ptr;
+        switch (ch) {
+        case 0:
+            fwrite(prev, ptr - prev, 1, fp);
+            return;
+
+        case '\\':
+        case '"':
+        case '/':
+            fwrite(prev, ptr - prev, 1, fp);
+            fputc('\\', fp);
+            fputc(ch, fp);
+            prev = ++ ptr;
+            break;
+
+        case '\r': fwrite(prev, ptr - prev, 1, fp); fwrite("\\r", 2, 1, fp); prev = ++ ptr; break;
+        case '\n': fwrite(prev, ptr - prev, 1, fp); fwrite("\\n", 2, 1, fp); prev = ++ ptr; break;
+        case '\t': fwrite(prev, ptr - prev, 1, fp); fwrite("\\t", 2, 1, fp); prev = ++ ptr; break;
+        case '\b': fwrite(prev, ptr - prev, 1, fp); fwrite("\\b", 2, 1, fp); prev = ++ ptr; break;
+        case '\f': fwrite(prev, ptr - prev, 1, fp); fwrite("\\f", 2, 1, fp); prev = ++ ptr; break;
+        case '<':  fwrite(prev, ptr - prev, 1, fp); fwrite("\\u003c", 6, 1, fp); prev = ++ ptr; break;
+        case '>':  fwrite(prev, ptr - prev, 1, fp); fwrite("\\u003e", 6, 1, fp); prev = ++ ptr; break;
+
+        default:
+            ++ ptr;
+            break;
+        }
+    }
+}
+
+static void old_xml_string(FILE *fp, const char *str) {
+    const char *prev = str;
+    for (const char *ptr = str;;) {
+        char ch = *ptr;
+        switch (ch) {
+        case 0:
+            fwrite(prev, ptr - prev, 1, fp);
+            return;
+
+        case '&':  fwrite(prev, ptr - prev, 1, fp); fwrite("&amp;", 5, 1, fp);  prev = ++ ptr; break;
+        case '"':  fwrite(prev, ptr - prev, 1, fp); fwrite("&quot;", 6, 1, fp); prev = ++ ptr; break;
+        case '\'': fwrite(prev, ptr - prev, 1, fp); fwrite("&#39;", 5, 1, fp);  prev = ++ ptr; break;
+        case '<':  fwrite(prev, ptr - prev, 1, fp); fwrite("&lt;", 4, 1, fp);   prev = ++ ptr; break;
+        case '>':  fwrite(prev, ptr - prev, 1, fp); fwrite("&gt;", 4, 1, fp);   prev = ++ ptr; break;
+        case '\r': fwrite(prev, ptr - prev, 1, fp); fwrite("&#13;", 5, 1, fp);  prev = ++ ptr; break;
+        case '\n': fwrite(prev, ptr - prev, 1, fp); fwrite("&#10;", 5, 1, fp);  prev = ++ ptr; break;
+
+        default:
+            ++ ptr;
+            break;
+        }
+    }
+}
+
+static void old_sql_string(FILE *fp, const char *str) {
+    const char *prev = str;
+    for (const char *ptr = str;;) {
+        char ch = *ptr;
+        switch (ch) {
+        case 0:
+            fwrite(prev, ptr - prev, 1, fp);
+            return;
+
+        case '\'':
+            fwrite(prev, ptr - prev, 1, fp);
+            fwrite("''", 2, 1, fp);
+            prev = ++ ptr;
+            break;
+
+        default:
+            ++ ptr;
+            break;
+        }
+    }
+}
+
+static void fill_input(enum BenchInput input, char *buf, size_t size) {
+    static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char text[] =
+        "GET \"/api/v1/items?id=42\" from 10.0.0.1 took 12 ms, "
+        "user 'admin' <admin@example.com> & session refreshed\n";
+    static const char heavy[] = "<\"&'>/\\\n\r\t";
+    static const char utf8[] = "Grüße aus Köln, naïve café, ΑΒΓΔ αβγδ, Москва, 東京都 ";
+
+    srand(0);
+    for (size_t index = 0; index < size; ++ index) {
+        switch (input) {
+            case INPUT_BASE64: buf[index] = base64[rand() % (sizeof(base64) - 1)]; break;
+            case INPUT_TEXT:   buf[index] = text[index % (sizeof(text) - 1)]; break;
+            case INPUT_HEAVY:  buf[index] = heavy[rand() % (sizeof(heavy) - 1)]; break;
+            case INPUT_UTF8:   buf[index] = utf8[index % (sizeof(utf8) - 1)]; break;
+            case INPUT_COUNT:  break;
+        }
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+enum BenchEncoder {
+    ENCODER_JSON,
+    ENCODER_JSON_UTF8,
+    ENCODER_XML,
+    ENCODER_SQL,
+    ENCODER_COUNT,
+};
+
+static const char *const encoder_names[ENCODER_COUNT] = {
+    [ENCODER_JSON]      = "json",
+    [ENCODER_JSON_UTF8] = "json+utf8",
+    [ENCODER_XML]       = "xml",
+    [ENCODER_SQL]       = "sql/csv",
+};
+
+// best of ROUNDS, in MiB/s of input
+static double bench(enum BenchEncoder encoder, char *out, const char *in, size_t size) {
+    double best = 0;
+    size_t checksum = 0;
+    for (int round = 0; round < ROUNDS; ++ round) {
+        const double start = now_seconds();
+        switch (encoder) {
+            case ENCODER_JSON:      checksum += escape_json(out, in, size, false); break;
+            case ENCODER_JSON_UTF8: checksum += escape_json(out, in, size, true); break;
+            case ENCODER_XML:       checksum += escape_xml(out, in, size); break;
+            case ENCODER_SQL:       checksum += escape_quotes(out, in, size, '\''); break;
+            case ENCODER_COUNT:     break;
+        }
+        const double elapsed = now_seconds() - start;
+        const double speed = (double)size / (1024 * 1024) / elapsed;
+        if (speed > best) {
+            best = speed;
+        }
+    }
+    // keep the compiler from dropping the calls
+    if (checksum == 0 && size > 0) {
+        fputs("*** error: nothing escaped\n", stderr);
+    }
+    return best;
+}
+
+// The old encoders with the same stdout buffer size as the service-runner.
+// Their input has to be NUL terminated. Returns -1 if there is no old
+// encoder.
+static double bench_old(enum BenchEncoder encoder, FILE *fp, const char *in, size_t size) {
+    double best = 0;
+    for (int round = 0; round < ROUNDS; ++ round) {
+        const double start = now_seconds();
+        switch (encoder) {
+            case ENCODER_JSON:  old_json_string(fp, in); break;
+            case ENCODER_XML:   old_xml_string(fp, in); break;
+            case ENCODER_SQL:   old_sql_string(fp, in); break;
+            default:            return -1;
+        }
+        fflush(fp);
+        const double elapsed = now_seconds() - start;
+        const double speed = (double)size / (1024 * 1024) / elapsed;
+        if (speed > best) {
+            best = speed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    size_t mib = DEFAULT_INPUT_MIB;
+    if (argc > 1) {
+        char *endptr = NULL;
+        unsigned long value = strtoul(argv[1], &endptr, 10);
+        if (*argv[1] == '\0' || *endptr || value == 0 || value > 1024) {
+            fprintf(stderr, "*** error: illegal input size: %s\n", argv[1]);
+            return 1;
+        }
+        mib = value;
+    }
+
+    const size_t size = mib * 1024 * 1024;
+    char *in  = malloc(size + 1);
+    char *out = malloc(size * ESCAPE_JSON_MAX_FACTOR);
+    if (in == NULL || out == NULL) {
+        fprintf(stderr, "*** error: malloc: %s\n", strerror(errno));
+        free(in);
+        free(out);
+        return 1;
+    }
+    in[size] = 0;
+
+    static char old_buffer[65536];
+    FILE *devnull = fopen("/dev/null", "w");
+    if (devnull == NULL || setvbuf(devnull, old_buffer, _IOFBF, sizeof(old_buffer)) != 0) {
+        fprintf(stderr, "*** error: opening /dev/null: %s\n", strerror(errno));
+        if (devnull != NULL) {
+            fclose(devnull);
+        }
+        free(in);
+        free(out);
+        return 1;
+    }
+
+    printf("%-8s %-7s", "input", "impl");
+    for (int encoder = 0; encoder < ENCODER_COUNT; ++ encoder) {
+        printf(" %13s", encoder_names[encoder]);
+    }
+    putchar('\n');
+
+    for (int input = 0; input < INPUT_COUNT; ++ input) {
+        fill_input(input, in, size);
+
+        printf("%-8s %-7s", input_names[input], "old");
+        for (int encoder = 0; encoder < ENCODER_COUNT; ++ encoder) {
+            const double speed = bench_old(encoder, devnull, in, size);
+            if (speed < 0) {
+                printf(" %13s", "-");
+            } else {
+                printf(" %7.0f MiB/s", speed);
+            }
+        }
+        putchar('\n');
+
+        for (int impl = ESCAPE_IMPL_SCALAR; impl <= ESCAPE_IMPL_AVX2; ++ impl) {
+            if (!set_escape_impl(impl)) {
+                printf("%-8s %-7s %13s\n", input_names[input], impl_names[impl], "unsupported");
+                continue;
+            }
+            printf("%-8s %-7s", input_names[input], impl_names[impl]);
+            for (int encoder = 0; encoder < ENCODER_COUNT; ++ encoder) {
+                printf(" %7.0f MiB/s", bench(encoder, out, in, size));
+            }
+            putchar('\n');
+        }
+    }
+
+    fclose(devnull);
+    free(in);
+    free(out);
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+#define _DEFAULT_SOURCE 1
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "service-runner.h"
+
+// how long to wait for a service-runner without control socket to write the dump
+#define DEBUG_DUMP_TIMEOUT_MS 5000
+#define DEBUG_DUMP_POLL_MS      50
+
+enum {
+    OPT_DEBUG_DUMP_PIDFILE,
+    OPT_DEBUG_DUMP_CONFIG,
+    OPT_DEBUG_DUMP_COUNT,
+};
+
+static const struct option debug_dump_options[] = {
+    [OPT_DEBUG_DUMP_PIDFILE] = { "pidfile", required_argument, 0, 'p' },
+    [OPT_DEBUG_DUMP_CONFIG]  = { "config",  required_argument, 0, 'c' },
+    [OPT_DEBUG_DUMP_COUNT]   = { 0, 0, 0, 0 },
+};
+
+static bool is_same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// The dump is renamed into place, so a new inode means a new dump.
+static int wait_for_dump(const char *dump_path, const struct stat *old_meta, bool had_old) {
+    struct stat meta;
+    for (int waited = 0; waited < DEBUG_DUMP_TIMEOUT_MS; waited += DEBUG_DUMP_POLL_MS) {
+        if (stat(dump_path, &meta) == 0) {
+            if (!had_old || !is_same_file(old_meta, &meta)) {
+                return 0;
+            }
+        } else if (errno != ENOENT) {
+            return -1;
+        }
+
+        const struct timespec delay = {
+            .tv_sec  = 0,
+            .tv_nsec = DEBUG_DUMP_POLL_MS * 1000000L,
+        };
+        nanosleep(&delay, NULL);
+    }
+
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+static int print_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    char buf[BUFSIZ];
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        if (fwrite(buf, 1, count, stdout) != count) {
+            const int errnum = errno;
+            fclose(fp);
+            errno = errnum;
+            return -1;
+        }
+    }
+
+    const bool failed = ferror(fp);
+    fclose(fp);
+
+    if (failed) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+int command_debug_dump(int argc, char *argv[]) {
+    if (argc < 2) {
+        return 1;
+    }
+
+    int longind = 0;
+
+    const char *pidfile = NULL;
+    const char *config_path = NULL;
+
+    for (;;) {
+        int opt = getopt_long(argc - 1, argv + 1, "p:c:", debug_dump_options, &longind);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'p':
+                pidfile = optarg;
+                break;
+
+            case 'c':
+                config_path = optarg;
+                break;
+
+            case '?':
+                short_usage(argc, argv);
+                return 1;
+        }
+    }
+
+    // because of skipped first argument:
+    ++ optind;
+
+    const char *name = NULL;
+    struct service_config config = {
+        .path    = NULL,
+        .name    = NULL,
+        .content = NULL,
+        .entries = NULL,
+        .count   = 0,
+    };
+
+    if (get_service_name(argc, argv, config_path, &config, &name, &pidfile) != 0) {
+        return 1;
+    }
+
+    int status = 0;
+    bool free_pidfile = false;
+    char *pidfile_runner = NULL;
+    char *dump_path = NULL;
+
+    switch (get_pidfile_abspath((char**)&pidfile, name)) {
+        case ABS_PATH_NEW:
+            free_pidfile = true;
+            break;
+
+        case ABS_PATH_ORIG:
+            break;
+
+        case ABS_PATH_ERR:
+            status = 1;
+            goto cleanup;
+    }
+
+    {
+        size_t pidfile_runner_size = strlen(pidfile) + strlen(".runner") + 1;
+        pidfile_runner = malloc(pidfile_runner_size);
+        if (pidfile_runner == NULL) {
+            fprintf(stderr, "*** error: malloc: %s\n", strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
+        int count = snprintf(pidfile_runner, pidfile_runner_size, "%s.runner", pidfile);
+        assert(count >= 0 && (size_t)count == pidfile_runner_size - 1); (void)count;
+    }
+
+    {
+        size_t dump_path_size = strlen(pidfile) + strlen(".dump") + 1;
+        dump_path = malloc(dump_path_size);
+        if (dump_path == NULL) {
+            fprintf(stderr, "*** error: malloc: %s\n", strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
+        int count = snprintf(dump_path, dump_path_size, "%s.dump", pidfile);
+        assert(count >= 0 && (size_t)count == dump_path_size - 1); (void)count;
+    }
+
+    pid_t runner_pid = 0;
+    bool pidfile_runner_ok = read_pidfile(pidfile_runner, &runner_pid) == 0;
+
+    if (!pidfile_runner_ok) {
+        fprintf(stderr, "*** error: reading pidfile: %s: %s\n", pidfile_runner, strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
+
+    struct stat old_meta;
+    const bool had_old = stat(dump_path, &old_meta) == 0;
+
+    char reply[CONTROL_MESSAGE_SIZE];
+    int result = control_request(pidfile, "debug-dump", reply, sizeof(reply), -1);
+    if (result == 1) {
+        fprintf(stderr, "*** error: dumping flight recorder of %s: %s\n", name, reply);
+        status = 1;
+        goto cleanup;
+    }
+
+    if (result == -1) {
+        if (errno != ENOENT && errno != ECONNREFUSED) {
+            fprintf(stderr, "*** error: sending debug-dump request to service runner PID %d: %s\n", runner_pid, strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
+        // service-runner without control socket
+        if (kill(runner_pid, SIGUSR2) != 0) {
+            fprintf(stderr, "*** error: sending SIGUSR2 to service runner PID %d: %s\n", runner_pid, strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
+        if (wait_for_dump(dump_path, &old_meta, had_old) != 0) {
+            fprintf(stderr, "*** error: waiting for %s: %s\n", dump_path, strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+    }
+
+    if (print_file(dump_path) != 0) {
+        fprintf(stderr, "*** error: reading %s: %s\n", dump_path, strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
+
+cleanup:
+    free(dump_path);
+    free(pidfile_runner);
+
+    if (free_pidfile) {
+        free((char*)pidfile);
+    }
+
+    free_service_config(&config);
+
+    return status;
+}
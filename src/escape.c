@@ -0,0 +1,449 @@
+#define _DEFAULT_SOURCE 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "service-runner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #if defined(__GNUC__) || defined(__clang__)
+        #define ESCAPE_X86 1
+        #include <immintrin.h>
+    #endif
+#endif
+
+// The escaping functions find the next byte that needs escaping with a scan
+// function, copy the clean run before it in one go, and only handle that
+// byte on its own. On x86 the scan looks at 16 (SSE2) or 32 (AVX2) bytes at
+// once, which for typical log messages means the whole message at once.
+//
+// out must have room for length * ESCAPE_*_MAX_FACTOR bytes.
+
+enum {
+    JSON_CLEAN,
+    JSON_SHORT,   // \X
+    JSON_UNICODE, // \u00XX
+    JSON_NON_ASCII,
+};
+
+// what JSON needs escaped, plus the start of multibyte UTF-8 sequences
+static const unsigned char json_class[256] = {
+    [0x00 ... 0x1F] = JSON_UNICODE,
+    ['\b'] = JSON_SHORT,
+    ['\t'] = JSON_SHORT,
+    ['\n'] = JSON_SHORT,
+    ['\f'] = JSON_SHORT,
+    ['\r'] = JSON_SHORT,
+    ['"']  = JSON_SHORT,
+    ['/']  = JSON_SHORT,
+    ['\\'] = JSON_SHORT,
+    ['<']  = JSON_UNICODE,
+    ['>']  = JSON_UNICODE,
+    [0x80 ... 0xFF] = JSON_NON_ASCII,
+};
+
+static const char json_short[256] = {
+    ['\b'] = 'b',
+    ['\t'] = 't',
+    ['\n'] = 'n',
+    ['\f'] = 'f',
+    ['\r'] = 'r',
+    ['"']  = '"',
+    ['/']  = '/',
+    ['\\'] = '\\',
+};
+
+static const bool xml_special[256] = {
+    ['&']  = true,
+    ['"']  = true,
+    ['\''] = true,
+    ['<']  = true,
+    ['>']  = true,
+    ['\r'] = true,
+    ['\n'] = true,
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// After a clean run shorter than this the next one is looked for with the
+// scalar scanner first. On text that is mostly escapes, setting up a vector
+// scan for every byte or two in between costs more than it saves.
+#define SHORT_CLEAN_RUN 8
+
+// ======== scanners ========
+// They return the index of the first byte that needs attention, or length.
+
+static size_t scan_json_scalar(const unsigned char *str, size_t length, bool stop_at_non_ascii) {
+    for (size_t index = 0; index < length; ++ index) {
+        const unsigned char cls = json_class[str[index]];
+        if (cls != JSON_CLEAN && (cls != JSON_NON_ASCII || stop_at_non_ascii)) {
+            return index;
+        }
+    }
+    return length;
+}
+
+static size_t scan_xml_scalar(const unsigned char *str, size_t length) {
+    for (size_t index = 0; index < length; ++ index) {
+        if (xml_special[str[index]]) {
+            return index;
+        }
+    }
+    return length;
+}
+
+#ifdef ESCAPE_X86
+
+__attribute__((target("sse2")))
+static size_t scan_json_sse2(const unsigned char *str, size_t length, bool stop_at_non_ascii) {
+    const __m128i quote     = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i slash     = _mm_set1_epi8('/');
+    const __m128i lt        = _mm_set1_epi8('<');
+    const __m128i gt        = _mm_set1_epi8('>');
+    const __m128i max_ctrl  = _mm_set1_epi8(0x1F);
+    const int high_mask     = stop_at_non_ascii ? 0xFFFF : 0;
+
+    size_t index = 0;
+    for (; index + 16 <= length; index += 16) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i*)(str + index));
+        // unsigned chunk <= 0x1F
+        const __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(chunk, max_ctrl), chunk);
+        const __m128i special = _mm_or_si128(
+            _mm_or_si128(ctrl, _mm_cmpeq_epi8(chunk, quote)),
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash), _mm_cmpeq_epi8(chunk, slash)),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, gt))));
+        const int mask = _mm_movemask_epi8(special) | (_mm_movemask_epi8(chunk) & high_mask);
+        if (mask != 0) {
+            return index + __builtin_ctz(mask);
+        }
+    }
+
+    return index + scan_json_scalar(str + index, length - index, stop_at_non_ascii);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_json_avx2(const unsigned char *str, size_t length, bool stop_at_non_ascii) {
+    const __m256i quote     = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i slash     = _mm256_set1_epi8('/');
+    const __m256i lt        = _mm256_set1_epi8('<');
+    const __m256i gt        = _mm256_set1_epi8('>');
+    const __m256i max_ctrl  = _mm256_set1_epi8(0x1F);
+    const unsigned int high_mask = stop_at_non_ascii ? 0xFFFFFFFF : 0;
+
+    size_t index = 0;
+    for (; index + 32 <= length; index += 32) {
+        const __m256i chunk = _mm256_loadu_si256((const __m256i*)(str + index));
+        const __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, max_ctrl), chunk);
+        const __m256i special = _mm256_or_si256(
+            _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(chunk, quote)),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, backslash), _mm256_cmpeq_epi8(chunk, slash)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, lt), _mm256_cmpeq_epi8(chunk, gt))));
+        const unsigned int mask = (unsigned int)_mm256_movemask_epi8(special) |
+            ((unsigned int)_mm256_movemask_epi8(chunk) & high_mask);
+        if (mask != 0) {
+            return index + __builtin_ctz(mask);
+        }
+    }
+
+    // GCC doesn't clear the upper halves before this call, and leaving them
+    // dirty makes all following SSE code slow until the next AVX2 scan.
+    _mm256_zeroupper();
+    return index + scan_json_sse2(str + index, length - index, stop_at_non_ascii);
+}
+
+__attribute__((target("sse2")))
+static size_t scan_xml_sse2(const unsigned char *str, size_t length) {
+    const __m128i amp   = _mm_set1_epi8('&');
+    const __m128i quot  = _mm_set1_epi8('"');
+    const __m128i apos  = _mm_set1_epi8('\'');
+    const __m128i lt    = _mm_set1_epi8('<');
+    const __m128i gt    = _mm_set1_epi8('>');
+    const __m128i cr    = _mm_set1_epi8('\r');
+    const __m128i lf    = _mm_set1_epi8('\n');
+
+    size_t index = 0;
+    for (; index + 16 <= length; index += 16) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i*)(str + index));
+        const __m128i special = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, quot)),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, apos), _mm_cmpeq_epi8(chunk, lt))),
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, gt), _mm_cmpeq_epi8(chunk, cr)),
+                _mm_cmpeq_epi8(chunk, lf)));
+        const int mask = _mm_movemask_epi8(special);
+        if (mask != 0) {
+            return index + __builtin_ctz(mask);
+        }
+    }
+
+    return index + scan_xml_scalar(str + index, length - index);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_xml_avx2(const unsigned char *str, size_t length) {
+    const __m256i amp   = _mm256_set1_epi8('&');
+    const __m256i quot  = _mm256_set1_epi8('"');
+    const __m256i apos  = _mm256_set1_epi8('\'');
+    const __m256i lt    = _mm256_set1_epi8('<');
+    const __m256i gt    = _mm256_set1_epi8('>');
+    const __m256i cr    = _mm256_set1_epi8('\r');
+    const __m256i lf    = _mm256_set1_epi8('\n');
+
+    size_t index = 0;
+    for (; index + 32 <= length; index += 32) {
+        const __m256i chunk = _mm256_loadu_si256((const __m256i*)(str + index));
+        const __m256i special = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, amp), _mm256_cmpeq_epi8(chunk, quot)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, apos), _mm256_cmpeq_epi8(chunk, lt))),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, gt), _mm256_cmpeq_epi8(chunk, cr)),
+                _mm256_cmpeq_epi8(chunk, lf)));
+        const unsigned int mask = (unsigned int)_mm256_movemask_epi8(special);
+        if (mask != 0) {
+            return index + __builtin_ctz(mask);
+        }
+    }
+
+    _mm256_zeroupper();
+    return index + scan_xml_sse2(str + index, length - index);
+}
+
+#endif
+
+// ======== dispatch ========
+
+static size_t (*scan_json)(const unsigned char *str, size_t length, bool stop_at_non_ascii) = NULL;
+static size_t (*scan_xml)(const unsigned char *str, size_t length) = NULL;
+
+// ESCAPE_IMPL_AUTO picks the best one the CPU supports. Returns false if
+// the CPU (or the build) doesn't support impl. Mostly for the benchmark.
+bool set_escape_impl(enum EscapeImpl impl) {
+#ifdef ESCAPE_X86
+    if (impl == ESCAPE_IMPL_AUTO) {
+        __builtin_cpu_init();
+        impl = __builtin_cpu_supports("avx2") ? ESCAPE_IMPL_AVX2 :
+               __builtin_cpu_supports("sse2") ? ESCAPE_IMPL_SSE2 : ESCAPE_IMPL_SCALAR;
+    }
+
+    switch (impl) {
+        case ESCAPE_IMPL_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2")) {
+                return false;
+            }
+            scan_json = scan_json_avx2;
+            scan_xml  = scan_xml_avx2;
+            return true;
+
+        case ESCAPE_IMPL_SSE2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("sse2")) {
+                return false;
+            }
+            scan_json = scan_json_sse2;
+            scan_xml  = scan_xml_sse2;
+            return true;
+
+        default:
+            break;
+    }
+#else
+    if (impl != ESCAPE_IMPL_AUTO && impl != ESCAPE_IMPL_SCALAR) {
+        return false;
+    }
+#endif
+
+    scan_json = scan_json_scalar;
+    scan_xml  = scan_xml_scalar;
+    return true;
+}
+
+// ======== encoders ========
+
+// Length of the valid UTF-8 sequence at str, or 0 if it is invalid
+// (overlong, surrogate, above U+10FFFF, or truncated).
+static size_t utf8_sequence_length(const unsigned char *str, size_t length) {
+    const unsigned char byte1 = str[0];
+    if (byte1 >= 0xC2 && byte1 <= 0xDF) {
+        return length >= 2 && (str[1] & 0xC0) == 0x80 ? 2 : 0;
+    }
+
+    if (byte1 >= 0xE0 && byte1 <= 0xEF) {
+        if (length < 3 || (str[1] & 0xC0) != 0x80 || (str[2] & 0xC0) != 0x80) {
+            return 0;
+        }
+        if ((byte1 == 0xE0 && str[1] < 0xA0) || (byte1 == 0xED && str[1] > 0x9F)) {
+            return 0;
+        }
+        return 3;
+    }
+
+    if (byte1 >= 0xF0 && byte1 <= 0xF4) {
+        if (length < 4 || (str[1] & 0xC0) != 0x80 || (str[2] & 0xC0) != 0x80 || (str[3] & 0xC0) != 0x80) {
+            return 0;
+        }
+        if ((byte1 == 0xF0 && str[1] < 0x90) || (byte1 == 0xF4 && str[1] > 0x8F)) {
+            return 0;
+        }
+        return 4;
+    }
+
+    return 0;
+}
+
+// Length of the valid UTF-8 text at str that needs no escaping. In text with
+// many non-ASCII characters going back to the scanner after each one costs
+// more than checking the ASCII characters in between right here.
+static size_t utf8_run_length(const unsigned char *str, size_t length) {
+    size_t index = 0;
+    while (index < length) {
+        const unsigned char cls = json_class[str[index]];
+        if (cls == JSON_CLEAN) {
+            ++ index;
+        } else if (cls == JSON_NON_ASCII) {
+            const size_t seq_len = utf8_sequence_length(str + index, length - index);
+            if (seq_len == 0) {
+                break;
+            }
+            index += seq_len;
+        } else {
+            break;
+        }
+    }
+    return index;
+}
+
+// With validate_utf8 invalid UTF-8 is replaced by U+FFFD, so the result is
+// always valid JSON.
+size_t escape_json(char *out, const char *str, size_t length, bool validate_utf8) {
+    if (scan_json == NULL) {
+        set_escape_impl(ESCAPE_IMPL_AUTO);
+    }
+
+    const unsigned char *ptr = (const unsigned char*)str;
+    const unsigned char *end = ptr + length;
+    char *out_ptr = out;
+
+    size_t clean = SHORT_CLEAN_RUN;
+    while (ptr < end) {
+        if (clean < SHORT_CLEAN_RUN) {
+            const size_t limit = end - ptr < SHORT_CLEAN_RUN ? end - ptr : SHORT_CLEAN_RUN;
+            clean = scan_json_scalar(ptr, limit, validate_utf8);
+            if (clean == SHORT_CLEAN_RUN) {
+                clean += scan_json(ptr + clean, end - ptr - clean, validate_utf8);
+            }
+        } else {
+            clean = scan_json(ptr, end - ptr, validate_utf8);
+        }
+        memcpy(out_ptr, ptr, clean);
+        out_ptr += clean;
+        ptr     += clean;
+
+        // Escapes tend to come in bunches, so stay in here as long as they
+        // do instead of starting a new scan for every single one.
+        while (ptr < end) {
+            const unsigned char ch = *ptr;
+            const unsigned char cls = json_class[ch];
+
+            if (cls == JSON_SHORT) {
+                *out_ptr ++ = '\\';
+                *out_ptr ++ = json_short[ch];
+                ++ ptr;
+            } else if (cls == JSON_UNICODE) {
+                memcpy(out_ptr, "\\u00", 4);
+                out_ptr[4] = hex_digits[ch >> 4];
+                out_ptr[5] = hex_digits[ch & 0xF];
+                out_ptr += 6;
+                ++ ptr;
+            } else if (cls == JSON_NON_ASCII && validate_utf8) {
+                const size_t run_len = utf8_run_length(ptr, end - ptr);
+                if (run_len == 0) {
+                    memcpy(out_ptr, "\\ufffd", 6);
+                    out_ptr += 6;
+                    ++ ptr;
+                } else {
+                    memcpy(out_ptr, ptr, run_len);
+                    out_ptr += run_len;
+                    ptr     += run_len;
+                }
+            } else {
+                break;
+            }
+        }
+    }
+
+    return out_ptr - out;
+}
+
+size_t escape_xml(char *out, const char *str, size_t length) {
+    if (scan_xml == NULL) {
+        set_escape_impl(ESCAPE_IMPL_AUTO);
+    }
+
+    const unsigned char *ptr = (const unsigned char*)str;
+    const unsigned char *end = ptr + length;
+    char *out_ptr = out;
+
+    size_t clean = SHORT_CLEAN_RUN;
+    while (ptr < end) {
+        if (clean < SHORT_CLEAN_RUN) {
+            const size_t limit = end - ptr < SHORT_CLEAN_RUN ? end - ptr : SHORT_CLEAN_RUN;
+            clean = scan_xml_scalar(ptr, limit);
+            if (clean == SHORT_CLEAN_RUN) {
+                clean += scan_xml(ptr + clean, end - ptr - clean);
+            }
+        } else {
+            clean = scan_xml(ptr, end - ptr);
+        }
+        memcpy(out_ptr, ptr, clean);
+        out_ptr += clean;
+        ptr     += clean;
+
+        while (ptr < end && xml_special[*ptr]) {
+            const char *escaped;
+            size_t escaped_len = 5;
+            switch (*ptr ++) {
+                case '&':  escaped = "&amp;"; break;
+                case '"':  escaped = "&quot;"; escaped_len = 6; break;
+                case '\'': escaped = "&#39;"; break;
+                case '<':  escaped = "&lt;"; escaped_len = 4; break;
+                case '>':  escaped = "&gt;"; escaped_len = 4; break;
+                case '\r': escaped = "&#13;"; break;
+                default:   escaped = "&#10;"; break;
+            }
+            memcpy(out_ptr, escaped, escaped_len);
+            out_ptr += escaped_len;
+        }
+    }
+
+    return out_ptr - out;
+}
+
+// SQL and CSV strings only double their quote character. memchr() is
+// already vectorized by the C library.
+size_t escape_quotes(char *out, const char *str, size_t length, char quote) {
+    const char *prev = str;
+    const char *end  = str + length;
+    char *out_ptr = out;
+    const char *ptr;
+
+    while ((ptr = memchr(prev, quote, end - prev)) != NULL) {
+        const size_t count = ptr - prev + 1;
+        memcpy(out_ptr, prev, count);
+        out_ptr += count;
+        *out_ptr ++ = quote;
+        prev = ptr + 1;
+    }
+
+    memcpy(out_ptr, prev, end - prev);
+    out_ptr += end - prev;
+
+    return out_ptr - out;
+}
@@ -0,0 +1,189 @@
+#define _DEFAULT_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "service-runner.h"
+
+struct flight_event {
+    uint64_t time_ns; // CLOCK_MONOTONIC
+    uint32_t service_index;
+    uint32_t type;
+    int64_t  a;
+    int64_t  b;
+};
+
+_Static_assert((FLIGHT_RING_SIZE & (FLIGHT_RING_SIZE - 1)) == 0, "FLIGHT_RING_SIZE must be a power of 2");
+
+static struct flight_event flight_ring[FLIGHT_RING_SIZE];
+static uint64_t flight_next = 0;
+
+static const char *const flight_event_names[FLIGHT_EVENT_COUNT] = {
+    [FLIGHT_STATE]        = "state",
+    [FLIGHT_ERROR]        = "error",
+    [FLIGHT_SIGNAL]       = "signal",
+    [FLIGHT_FORK]         = "fork",
+    [FLIGHT_EXEC]         = "exec",
+    [FLIGHT_REAP]         = "reap",
+    [FLIGHT_SPLICE]       = "splice",
+    [FLIGHT_LOGFILE_OPEN] = "logfile-open",
+    [FLIGHT_LOGFILE_SWAP] = "logfile-swap",
+    [FLIGHT_REPORT_START] = "crash-report-start",
+    [FLIGHT_REPORT_STOP]  = "crash-report-stop",
+};
+
+// Old events are simply overwritten, so this never fails and never blocks.
+void flight_record(enum FlightEventType type, uint32_t service_index, int64_t a, int64_t b) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct flight_event *event = &flight_ring[flight_next & (FLIGHT_RING_SIZE - 1)];
+    event->time_ns       = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    event->service_index = service_index;
+    event->type          = type;
+    event->a             = a;
+    event->b             = b;
+
+    ++ flight_next;
+}
+
+static void print_wait_status(FILE *fp, int64_t value) {
+    const int status = (int)value;
+    if (value < 0) {
+        fputs("status=unknown", fp);
+    } else if (WIFEXITED(status)) {
+        fprintf(fp, "exited=%d", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        fprintf(fp, "signal=%d%s", WTERMSIG(status), WCOREDUMP(status) ? " core-dumped" : "");
+    } else {
+        fprintf(fp, "status=0x%x", status);
+    }
+}
+
+static void print_flight_event(FILE *fp, const struct flight_event *event, const struct timespec *mono_now, time_t wall_now) {
+    // Monotonic time is what is recorded, the wall clock time is only for
+    // matching it up with the logfile.
+    const int64_t now_ns = (int64_t)mono_now->tv_sec * 1000000000 + mono_now->tv_nsec;
+    const int64_t age_ns = now_ns - (int64_t)event->time_ns;
+    const time_t when = wall_now - (time_t)((age_ns + 999999999) / 1000000000);
+    struct tm local;
+    char timestamp[32] = "?";
+    if (localtime_r(&when, &local) != NULL) {
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &local);
+    }
+
+    fprintf(fp, "%s %+14.6f %-18s ", timestamp, -(double)age_ns / 1e9,
+        event->type < FLIGHT_EVENT_COUNT ? flight_event_names[event->type] : "?");
+
+    switch ((enum FlightEventType)event->type) {
+        case FLIGHT_STATE:
+            fprintf(fp, "%s -> %s", event->a < 0 ? "none" : get_service_state_name(event->a), get_service_state_name(event->b));
+            break;
+
+        case FLIGHT_ERROR:
+            // only the format string, the arguments are long gone
+            fprintf(fp, "line=%d errno=%d \"%s\"", (int)(event->b >> 32), (int)(uint32_t)event->b, (const char*)(intptr_t)event->a);
+            break;
+
+        case FLIGHT_SIGNAL:
+            fprintf(fp, "signal=%" PRId64 " (%s)", event->a, strsignal((int)event->a));
+            break;
+
+        case FLIGHT_FORK:
+            fprintf(fp, "pid=%" PRId64 "%s", event->a, event->b ? " standby" : "");
+            break;
+
+        case FLIGHT_EXEC:
+            fprintf(fp, "pid=%" PRId64 "%s", event->a, event->b ? " failed" : "");
+            break;
+
+        case FLIGHT_REAP:
+        case FLIGHT_REPORT_STOP:
+            fprintf(fp, "pid=%" PRId64 " ", event->a);
+            print_wait_status(fp, event->b);
+            break;
+
+        case FLIGHT_SPLICE:
+        case FLIGHT_LOGFILE_OPEN:
+            if (event->a < 0) {
+                fprintf(fp, "error=%s", strerror((int)-event->a));
+            } else {
+                fprintf(fp, "%s=%" PRId64, event->type == FLIGHT_SPLICE ? "bytes" : "fd", event->a);
+            }
+            break;
+
+        case FLIGHT_LOGFILE_SWAP:
+            fprintf(fp, "fd=%" PRId64 " -> fd=%" PRId64, event->a, event->b);
+            break;
+
+        case FLIGHT_REPORT_START:
+            fprintf(fp, "pid=%" PRId64, event->a);
+            break;
+
+        case FLIGHT_EVENT_COUNT:
+            break;
+    }
+
+    putc('\n', fp);
+}
+
+// Writes the events of the given service and the ones not bound to any
+// service, oldest first. The file is replaced atomically and only readable by
+// the owner, like the control socket.
+int flight_dump(const char *path, uint32_t service_index, const char *name) {
+    char tmpfile[PATH_MAX];
+    int count = snprintf(tmpfile, sizeof(tmpfile), "%s.%d.tmp", path, getpid());
+    if (count < 0 || (size_t)count >= sizeof(tmpfile)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+
+    FILE *fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        const int errnum = errno;
+        close(fd);
+        unlink(tmpfile);
+        errno = errnum;
+        return -1;
+    }
+
+    struct timespec mono_now;
+    clock_gettime(CLOCK_MONOTONIC, &mono_now);
+    const time_t wall_now = time(NULL);
+
+    const uint64_t end   = flight_next;
+    const uint64_t start = end > FLIGHT_RING_SIZE ? end - FLIGHT_RING_SIZE : 0;
+
+    fprintf(fp, "# flight recorder of %s (service-runner PID %d), %" PRIu64 " events recorded in total\n",
+        name, getpid(), end);
+
+    for (uint64_t index = start; index < end; ++ index) {
+        const struct flight_event *event = &flight_ring[index & (FLIGHT_RING_SIZE - 1)];
+        if (event->service_index == service_index || event->service_index == FLIGHT_NO_SERVICE) {
+            print_flight_event(fp, event, &mono_now, wall_now);
+        }
+    }
+
+    if (fclose(fp) != 0 || rename(tmpfile, path) != 0) {
+        const int errnum = errno;
+        unlink(tmpfile);
+        errno = errnum;
+        return -1;
+    }
+
+    return 0;
+}
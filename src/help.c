@@ -46,6 +46,9 @@
 #define HELP_OPT_PIDFILE \
         "       -p, --pidfile=FILE              Use FILE as the pidfile. default: /var/run/NAME.pid\n"
 
+#define HELP_OPT_CONFIG \
+        "       -c, --config=FILE               Take <name> and the pidfile from the service definition FILE (see start).\n"
+
 #define HELP_CMD_START_HDR                                                                                                      \
         "   %s start <name> [options] [--] <command> [argument...]\n"
 #define HELP_CMD_START_DESCR \
@@ -53,8 +56,13 @@
         "       Start <command> as service <name>. Does nothing if the service is already running. This automatically deamonizes, handles PID- and log-files, and restarts on crash.\n" \
         "\n"                                                                                                                    \
         "   OPTIONS:\n"                                                                                                         \
+        "       -c, --config=FILE               Read the service definition FILE instead of passing <name> and <command>. It consists of KEY = VALUE lines, empty lines and lines starting with # are ignored. Keys are the long options described here, e.g. `rlimit = NOFILE:1024`, plus name and command. Options without a value take yes or no. name defaults to the file name without extension. command is split into arguments like in the shell. The file is completely checked before anything is started. Further options on the command line take precedence. The other commands accept --config=FILE to find the service.\n" \
+        "           --all=DIR                   Instead of <name> and <command> take the service definitions DIR/NAME.service (see --config), or only the ones given as <name> arguments, and start each of them with its own service-runner. The other options on the command line apply to all of them, except for --pidfile, --logfile and --config, which can't be used with --all.\n" \
+        "       -j, --jobs=COUNT                With --all start at most COUNT services at once. default: 16\n" \
         HELP_OPT_PIDFILE                                                                                                        \
         "                                       Note that a second pidfile with the name FILE.runner is created containing the process ID of the service-runner process itself.\n" \
+        "                                       The service-runner also listens on the unix domain socket FILE.sock (SOCK_SEQPACKET, one request per message). Requests: stop, restart, logrotate, debug-dump, status, ping, signal NUMBER. Replies start with \"ok\" or \"error\" and are sent once the requested action has finished. The stop, restart, logrotate, and debug-dump commands use this socket if it exists and fall back to signals otherwise.\n" \
+        "                                       The current state of the service is published in the shared memory file FILE.state, which the status command reads without sending any request.\n" \
         "       -l, --logfile=FILE              Write service output to FILE. default: /var/log/NAME-%Y-%m-%d.log\n"            \
         "                                       This implements log-rotating based on the file name pattern. See `man strftime` for a description of the pattern language.\n" \
         "           --chown-logfile             Change owner of the logfile to user/group specified by --user/--group.\n"       \
@@ -88,12 +96,14 @@
         "               %ga ... GMT abbreviated day in the week name\n"                                                         \
         "               %gb ... GMT abbreviated month name\n"                                                                   \
         "               %s .... log message\n"                                                                                  \
-        "               %js ... JSON encoded log message (no enclosing quotes)\n"                                               \
+        "               %js ... JSON encoded log message (no enclosing quotes), invalid UTF-8 is replaced with U+FFFD\n"        \
+        "               %Js ... like %js, but without UTF-8 validation (faster, for services that only log valid UTF-8)\n"      \
         "               %xs ... XML encoded log message\n"                                                                      \
         "               %qs ... SQL encoded log message (no enclosing quotes)\n"                                                \
         "               %cs ... CSV encoded log message (no enclosing quotes)\n"                                                \
         "               %f .... source filename\n"                                                                              \
         "               %jf ... JSON encoded filename (no enclosing quotes)\n"                                                  \
+        "               %Jf ... like %jf, but without UTF-8 validation\n"                                                       \
         "               %xf ... XML encoded filename\n"                                                                         \
         "               %qf ... SQL encoded filename (no enclosing quotes)\n"                                                   \
         "               %cf ... CSV encoded filename (no enclosing quotes)\n"                                                   \
@@ -115,6 +125,16 @@
         "               ALWAYS .... restart no matter if the service exited normally or with an error status.\n"                \
         "               FAILURE ... (default) only restart the service if it exited with an error status or crashed.\n"         \
         "\n"                                                                                                                    \
+        "           --restart-mode=MODE\n"                                                                                      \
+        "\n"                                                                                                                    \
+        "             How the restart command restarts the service. Possible values for MODE:\n"                                 \
+        "               STOP ...... (default) stop the old service process, then start the new one.\n"                            \
+        "               OVERLAP ... start the new service process first and only stop the old one once the new one is ready (see --notify) and, if configured, has passed its first health check. The pidfile is switched over at that point. If the new process exits before that the old one keeps running. Use with --listen or SO_REUSEPORT.\n" \
+        "\n"                                                                                                                    \
+        "           --standby\n"                                                                                                \
+        "\n"                                                                                                                    \
+        "             Keep a second, already started service process around. Requires --notify. It is stopped with SIGSTOP once it sent READY=1 and when the service process exits unexpectedly it is continued with SIGCONT and takes over instead of starting a new process. A new standby process is started in the background after that. The restart command discards the standby process. Use with --listen: a parked standby process that opened its own SO_REUSEPORT listener still gets its share of the connections from the kernel, but never accepts them.\n" \
+        "\n"                                                                                                                    \
         "       -u, --user=USER                 Run service as USER (name or UID).\n"                                           \
         "       -g, --group=GROUP               Run service as GROUP (name or GID).\n"                                          \
         "       -N, --priority=PRIORITY         Run service and service-runner(!) under process scheduling priority PRIORITY. From -20 (maximum priority) to +19 (minimum priority).\n" \
@@ -131,7 +151,13 @@
         "       -k, --umask=UMASK               Run service with umask UMASK. Octal values only.\n"                             \
         "       -C, --chdir=PATH                Change to directory PATH before running the service. When --chroot is used chdir happens after chroot. The service binary path is relative to this PATH, even without \"./\" prefix.\n" \
         "           --chroot=PATH               Call chroot with PATH before running the service (and before calling chdir, if given). Unless --chdir is also given the service binary path is relative to this PATH, even without \"./\" prefix.\n" \
-        "           --restart-sleep=SECONDS     Wait SECONDS before restarting service. default: 1\n"                           \
+        "           --restart-sleep=SECONDS     Wait SECONDS before restarting a crashed service. Millisecond precision, e.g. 0.25. default: 1\n" \
+        "           --restart-sleep-factor=FACTOR  Multiply the restart delay by FACTOR after each crash (exponential backoff). default: 1\n" \
+        "           --restart-sleep-max=SECONDS  Don't let the restart delay grow beyond SECONDS. default: 300\n"                  \
+        "           --restart-sleep-jitter=PERCENT  Randomly vary each restart delay by up to PERCENT percent so that many services don't restart in lockstep. default: 0\n" \
+        "           --restart-sleep-reset=SECONDS  Start over with --restart-sleep if the service was running for at least SECONDS before it crashed. default: 60\n" \
+        "           --start-limit-burst=COUNT   If the service was automatically restarted COUNT times within --start-limit-interval give up and go into failed state. The service-runner keeps running and the status command reports the failure. Use the restart command to try again. 0 means no limit. default: 0\n" \
+        "           --start-limit-interval=SECONDS  See --start-limit-burst. default: 10\n"                                       \
         "           --crash-report=COMMAND\n"                                                                                   \
         "       -f, --foreground                Don't daemonize, but keep running in foreground.\n"                             \
         "\n"                                                                                                                    \
@@ -139,17 +165,39 @@
         "             CODE values:\n"                                                                                           \
         "               EXITED ... service has exited, STATUS is it's exit status\n"                                            \
         "               KILLED ... service was killed, STATUS is the killing signal\n"                                          \
-        "               DUMPED ... service core dumped, STATUS is the killing signal\n"
+        "               DUMPED ... service core dumped, STATUS is the killing signal\n"                                          \
+        "\n"                                                                                                                    \
+        "             The crash reporter runs concurrently to the service-runner. The service is restarted once both the crash reporter has finished and --restart-sleep is over.\n" \
+        "\n"                                                                                                                    \
+        "           --crash-report-timeout=SECONDS  Send SIGKILL to the crash reporter if it is still running after SECONDS. 0 means no timeout. default: 0\n" \
+        "           --notify                    The service reports its readiness itself. The environment variable NOTIFY_SOCKET is set to the unix domain socket FILE.notify (SOCK_DGRAM) to which the service sends newline separated VARIABLE=VALUE messages compatible with sd_notify(). Supported are READY=1, RELOADING=1, and STATUS=TEXT. See the notify command. Without this option the service counts as ready as soon as it is executed.\n" \
+        "           --wait-ready[=SECONDS]      Don't return before the service is ready. Fails and prints the log output of the service if it exits before that or if SECONDS are given and it takes longer than that.\n" \
+        "           --watchdog=SECONDS          Restart the service if it doesn't send WATCHDOG=1 to the notify socket at least every SECONDS (see --notify). WATCHDOG_USEC and WATCHDOG_PID are set for the service. WATCHDOG=trigger restarts it right away.\n" \
+        "           --shutdown-timeout=SECONDS  If the service doesn't exit within SECONDS after the service-runner sent SIGTERM (because of the stop or restart command or a missed watchdog deadline) send SIGKILL. -1 means no timeout. default: -1\n" \
+        "           --health-cmd=COMMAND        Check the health of the service by running COMMAND via /bin/sh. It is healthy if COMMAND exits with status 0.\n" \
+        "           --health-tcp=HOST:PORT      Check the health of the service by connecting to HOST:PORT. HOST is only resolved once on start.\n" \
+        "           --health-unix=PATH          Check the health of the service by connecting to the unix domain stream socket PATH.\n" \
+        "           --health-interval=SECONDS   Run the health check every SECONDS. default: 10\n" \
+        "           --health-timeout=SECONDS    A health check that takes longer than SECONDS fails. default: 5\n" \
+        "           --health-retries=COUNT      Restart the service after COUNT failed health checks in a row. default: 3\n" \
+        "           --health-start-period=SECONDS  Don't check the health of the service during the first SECONDS after it was started. With --notify no checks are done before it is ready. default: 0\n" \
+        "           --listen=tcp:HOST:PORT\n" \
+        "           --listen=unix:PATH          Create a listening socket and pass it to the service as file descriptor 3 (then 4, 5, ... for further sockets) with LISTEN_FDS and LISTEN_PID set like systemd's socket activation does. The socket is kept open by the service-runner, so connections are queued while the service restarts. An empty HOST means any address. This option can be defined multiple times.\n" \
+        "           --metrics=unix:PATH\n" \
+        "           --metrics=FILE              Expose metrics of the service-runner and the service (log throughput, restarts, exits, durations of log-rotation, crash reports, and restarts) in the Prometheus text format. With unix:PATH they are served via HTTP on a unix domain stream socket, otherwise they are written to FILE every 15 seconds for the textfile collector of the node exporter.\n"
 
 #define HELP_CMD_STOP_HDR                                                                                           \
-        "   %s stop <name> [options]\n"
+        "   %s stop <name>... [options]\n"
 #define HELP_CMD_STOP_DESCR                                                                                         \
         "\n"                                                                                                        \
-        "       Stop service <name>. If --pidfile was passed to the corresponding start command it must be passed with the same argument here again.\n" \
+        "       Stop service <name>. If --pidfile was passed to the corresponding start command it must be passed with the same argument here again. With more than one <name> or with --all the services are stopped concurrently and --shutdown-timeout applies to each of them.\n" \
         "\n"                                                                                                        \
         "   OPTIONS:\n"                                                                                             \
         HELP_OPT_PIDFILE                                                                                            \
-        "           --shutdown-timeout=SECONDS  If the service doesn't shut down after SECONDS after sending SIGTERM send SIGKILL. -1 means no timeout, just wait forever. default: -1\n"
+        HELP_OPT_CONFIG                                                                                             \
+        "           --shutdown-timeout=SECONDS  If the service doesn't shut down after SECONDS after sending SIGTERM send SIGKILL. -1 means no timeout, just wait forever. default: -1\n" \
+        "           --all[=DIR]                 Stop all services that have a service-runner pidfile DIR/NAME.pid.runner. default DIR: /var/run\n" \
+        "       -j, --jobs=COUNT                Stop at most COUNT services at once. default: 16\n"
 
 #define HELP_CMD_RESTART_HDR                                                    \
         "   %s restart <name> [options]\n"
@@ -158,16 +206,21 @@
         "       Restart service <name>. Error if it's not already running.\n"   \
         "\n"                                                                    \
         "   OPTIONS:\n"                                                         \
-        HELP_OPT_PIDFILE
+        HELP_OPT_PIDFILE                                                        \
+        HELP_OPT_CONFIG                                                         \
+        "           --wait[=SECONDS]            Wait until the new service process is started (with --notify until it is ready) and print the old and new service PID and how long stopping and starting took. Fail if the new process doesn't start, e.g. because the service entered the failed state. If SECONDS is given fail if the restart takes longer than that.\n"
 
 #define HELP_CMD_STATUS_HDR                                             \
-        "   %s status <name> [options]\n"
+        "   %s status <name>... [options]\n"
 #define HELP_CMD_STATUS_DESCR                                           \
         "\n"                                                            \
-        "       Print some status information about service <name>.\n"  \
+        "       Print some status information about service <name>. With more than one service a table of their state, PIDs, uptime, restart count, and logfile is printed and the exit status is the worst one of them. This only reads the pidfiles, /proc, and the state records of the service-runners, falling back to asking them via their control sockets.\n" \
         "\n"                                                            \
         "   OPTIONS:\n"                                                 \
-        HELP_OPT_PIDFILE
+        HELP_OPT_PIDFILE \
+        HELP_OPT_CONFIG  \
+        "           --all[=DIR]                 Print the status of all services that have a service-runner pidfile DIR/NAME.pid.runner. default DIR: /var/run\n" \
+        "           --json                      Print a JSON array with an object per service instead. It also contains the last exit status or signal of the service process and the number of bytes the service-runner copied to the logfile.\n"
 
 #define HELP_CMD_LOGROTATE_HDR                                                  \
         "   %s logrotate <name> [options]\n"
@@ -176,7 +229,18 @@
         "       Issue manual log-rotate to service-runner process. The service-runner has to be started with the --manual-logrotate argument for this command to have any effect.\n" \
         "\n"                                                                    \
         "   OPTIONS:\n"                                                         \
-        HELP_OPT_PIDFILE
+        HELP_OPT_PIDFILE \
+        HELP_OPT_CONFIG
+
+#define HELP_CMD_DEBUG_DUMP_HDR                                                 \
+        "   %s debug-dump <name> [options]\n"
+#define HELP_CMD_DEBUG_DUMP_DESCR                                               \
+        "\n"                                                                    \
+        "       Print the flight recorder of the service-runner process: its last internal events, like state changes, failed system calls, signals, forks, exits, and the sizes of the log chunks it copied, with monotonic timestamps. The service-runner writes them to the file PIDFILE.dump, which this command prints. Sending SIGUSR2 to the service-runner writes that file too, and so does a service-runner that fails.\n" \
+        "\n"                                                                    \
+        "   OPTIONS:\n"                                                         \
+        HELP_OPT_PIDFILE \
+        HELP_OPT_CONFIG
 
 #define HELP_CMD_LOGS_HDR                                                                \
         "   %s logs <name> [options]\n"
@@ -186,8 +250,21 @@
         "\n"                                                                             \
         "   OPTIONS:\n"                                                                  \
         HELP_OPT_PIDFILE \
+        HELP_OPT_CONFIG  \
         "       -f, --follow                    Output new logs as they are written.\n"
 
+#define HELP_CMD_NOTIFY_HDR                                                     \
+        "   %s notify <VARIABLE=VALUE>...\n"
+#define HELP_CMD_NOTIFY_DESCR                                                   \
+        "\n"                                                                    \
+        "       Send a notification message to the service-runner of the calling service. For use in services started with --notify, e.g.: service-runner notify READY=1 \"STATUS=accepting connections\"\n"
+
+#define HELP_CMD_SUPERVISE_HDR                                                  \
+        "   %s supervise <directory>\n"
+#define HELP_CMD_SUPERVISE_DESCR                                                \
+        "\n"                                                                    \
+        "       Run all services defined in <directory> from this one process, which stays in the foreground. Each file NAME.service is a service definition as read by start --config. All files are checked before any service is started, services that are already running are skipped. The pidfiles, logfiles, and control sockets are the same as with start, so the other commands work as usual. Stopping a service only stops that service, SIGTERM to the supervisor stops all of them. The supervisor exits once all of its services have stopped. --foreground and --wait-ready are not supported here.\n"
+
 #define HELP_CMD_HELP_HDR           \
         "   %s help [command]\n"
 #define HELP_CMD_HELP_DESCR         \
@@ -524,11 +601,15 @@ void short_usage(int argc, char *argv[]) {
     const char *progname = get_progname(argc, argv);
     printf("\n");
     printf("Usage: %s start     <name> [options] [--] <command> [argument...]\n", progname);
-    printf("       %s stop      <name> [options]\n", progname);
+    printf("       %s start     --all=<directory> [options] [name...]\n", progname);
+    printf("       %s stop      <name>... [options]\n", progname);
     printf("       %s restart   <name> [options]\n", progname);
-    printf("       %s status    <name> [options]\n", progname);
+    printf("       %s status    <name>... [options]\n", progname);
     printf("       %s logrotate <name> [options]\n", progname);
+    printf("       %s debug-dump <name> [options]\n", progname);
     printf("       %s logs      <name> [options]\n", progname);
+    printf("       %s notify    <VARIABLE=VALUE>...\n", progname);
+    printf("       %s supervise <directory>\n", progname);
     printf("       %s help [command]\n", progname);
     printf("       %s version\n", progname);
 }
@@ -566,9 +647,18 @@ void usage(int argc, char *argv[]) {
     printf(HELP_CMD_LOGROTATE_HDR, progname);
     print_wrapped_text(stdout, HELP_CMD_LOGROTATE_DESCR "\n", wsize.ws_col);
 
+    printf(HELP_CMD_DEBUG_DUMP_HDR, progname);
+    print_wrapped_text(stdout, HELP_CMD_DEBUG_DUMP_DESCR "\n", wsize.ws_col);
+
     printf(HELP_CMD_LOGS_HDR, progname);
     print_wrapped_text(stdout, HELP_CMD_LOGS_DESCR "\n", wsize.ws_col);
 
+    printf(HELP_CMD_NOTIFY_HDR, progname);
+    print_wrapped_text(stdout, HELP_CMD_NOTIFY_DESCR "\n", wsize.ws_col);
+
+    printf(HELP_CMD_SUPERVISE_HDR, progname);
+    print_wrapped_text(stdout, HELP_CMD_SUPERVISE_DESCR "\n", wsize.ws_col);
+
     printf(HELP_CMD_HELP_HDR, progname);
     print_wrapped_text(stdout, HELP_CMD_HELP_DESCR "\n", wsize.ws_col);
 
@@ -629,10 +719,22 @@ int command_help(int argc, char *argv[]) {
         printf("\n" HELP_CMD_LOGROTATE_HDR, progname);
         print_wrapped_text(stdout, HELP_CMD_LOGROTATE_DESCR, wsize.ws_col);
         return 0;
+    } else if (strcmp(command, "debug-dump") == 0) {
+        printf("\n" HELP_CMD_DEBUG_DUMP_HDR, progname);
+        print_wrapped_text(stdout, HELP_CMD_DEBUG_DUMP_DESCR, wsize.ws_col);
+        return 0;
     } else if (strcmp(command, "logs") == 0) {
         printf("\n" HELP_CMD_LOGS_HDR, progname);
         print_wrapped_text(stdout, HELP_CMD_LOGS_DESCR, wsize.ws_col);
         return 0;
+    } else if (strcmp(command, "notify") == 0) {
+        printf("\n" HELP_CMD_NOTIFY_HDR, progname);
+        print_wrapped_text(stdout, HELP_CMD_NOTIFY_DESCR, wsize.ws_col);
+        return 0;
+    } else if (strcmp(command, "supervise") == 0) {
+        printf("\n" HELP_CMD_SUPERVISE_HDR, progname);
+        print_wrapped_text(stdout, HELP_CMD_SUPERVISE_DESCR, wsize.ws_col);
+        return 0;
     } else if (strcmp(command, "help") == 0) {
         printf("\n" HELP_CMD_HELP_HDR, progname);
         print_wrapped_text(stdout, HELP_CMD_HELP_DESCR, wsize.ws_col);
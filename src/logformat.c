@@ -0,0 +1,565 @@
+#define _DEFAULT_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "service-runner.h"
+
+// A --log-format template is compiled once into a list of ops. Literal text
+// (with %% already resolved) is copied into the text of the template, so the
+// compiled template doesn't depend on the memory of the original string.
+
+enum LogOpType {
+    LOG_OP_LITERAL,     // offset and length into text
+    LOG_OP_MESSAGE,
+    LOG_OP_FILENAME,
+    LOG_OP_LINENO,
+    LOG_OP_LEVEL_LOWER,
+    LOG_OP_LEVEL_UPPER,
+    LOG_OP_YEAR,
+    LOG_OP_MONTH,
+    LOG_OP_DAY,
+    LOG_OP_HOUR,
+    LOG_OP_MINUTE,
+    LOG_OP_SECOND,
+    LOG_OP_WDAY_NAME,
+    LOG_OP_MONTH_NAME,
+    LOG_OP_TZ_OFFSET,
+    LOG_OP_DATETIME,    // %t and %gt
+    LOG_OP_ISO_DATETIME, // %T and %gT
+    LOG_OP_HTTP_DATE,
+};
+
+enum LogEscape {
+    LOG_ESCAPE_NONE,
+    LOG_ESCAPE_JSON,
+    LOG_ESCAPE_JSON_RAW, // without UTF-8 validation
+    LOG_ESCAPE_XML,
+    LOG_ESCAPE_SQL,
+    LOG_ESCAPE_CSV,
+};
+
+struct log_op {
+    uint8_t  type;   // enum LogOpType
+    uint8_t  escape; // enum LogEscape
+    bool     gmt;
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct log_template {
+    char  *text; // stored behind the ops
+    size_t op_count;
+    struct log_op ops[];
+};
+
+static const char *const wdays[] = {
+    "Sun",
+    "Mon",
+    "Tue",
+    "Wed",
+    "Thu",
+    "Fri",
+    "Sat",
+};
+
+static const char *const months[] = {
+    "Jan",
+    "Feb",
+    "Mar",
+    "Apr",
+    "May",
+    "Jun",
+    "Jul",
+    "Aug",
+    "Sep",
+    "Oct",
+    "Nov",
+    "Dec",
+};
+
+static const char *const builtin_sources[LOG_FORMAT_COUNT] = {
+    [LOG_FORMAT_TEXT] = LOG_TEMPLATE_TEXT,
+    [LOG_FORMAT_JSON] = LOG_TEMPLATE_JSON,
+    [LOG_FORMAT_XML]  = LOG_TEMPLATE_XML,
+    [LOG_FORMAT_SQL]  = LOG_TEMPLATE_SQL,
+    [LOG_FORMAT_CSV]  = LOG_TEMPLATE_CSV,
+};
+
+static struct log_template *builtin_templates[LOG_FORMAT_COUNT] = { NULL };
+
+static void add_op(struct log_template *template, enum LogOpType type, enum LogEscape escape, bool gmt) {
+    template->ops[template->op_count ++] = (struct log_op){
+        .type   = type,
+        .escape = escape,
+        .gmt    = gmt,
+        .offset = 0,
+        .length = 0,
+    };
+}
+
+// Literal text directly following a literal op is merged into it.
+static void add_literal(struct log_template *template, size_t *text_size, const char *str, size_t length) {
+    struct log_op *last = template->op_count > 0 ? &template->ops[template->op_count - 1] : NULL;
+    if (last == NULL || last->type != LOG_OP_LITERAL) {
+        template->ops[template->op_count ++] = (struct log_op){
+            .type   = LOG_OP_LITERAL,
+            .escape = LOG_ESCAPE_NONE,
+            .gmt    = false,
+            .offset = *text_size,
+            .length = 0,
+        };
+        last = &template->ops[template->op_count - 1];
+    }
+
+    memcpy(template->text + *text_size, str, length);
+    *text_size   += length;
+    last->length += length;
+}
+
+// Returns NULL with errno set to EINVAL if source is not a valid template.
+// A template is only valid if it contains the log message.
+struct log_template *compile_log_template(const char *source) {
+    const size_t source_len = strlen(source);
+    if (source_len > UINT32_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // every op takes at least one byte of the source
+    const size_t max_ops = source_len + 1;
+    struct log_template *template = malloc(sizeof(struct log_template) + max_ops * sizeof(struct log_op) + source_len + 1);
+    if (template == NULL) {
+        return NULL;
+    }
+
+    template->text     = (char*)(template->ops + max_ops);
+    template->op_count = 0;
+
+    size_t text_size = 0;
+    bool has_message = false;
+    const char *prev = source;
+    const char *ptr  = source;
+
+    while (*ptr) {
+        if (*ptr != '%') {
+            ++ ptr;
+            continue;
+        }
+
+        if (ptr > prev) {
+            add_literal(template, &text_size, prev, ptr - prev);
+        }
+
+        char ch = *++ ptr;
+        switch (ch) {
+            case 's': add_op(template, LOG_OP_MESSAGE,     LOG_ESCAPE_NONE, false); has_message = true; break;
+            case 'f': add_op(template, LOG_OP_FILENAME,    LOG_ESCAPE_NONE, false); break;
+            case 'n': add_op(template, LOG_OP_LINENO,      LOG_ESCAPE_NONE, false); break;
+            case 'l': add_op(template, LOG_OP_LEVEL_LOWER, LOG_ESCAPE_NONE, false); break;
+            case 'L': add_op(template, LOG_OP_LEVEL_UPPER, LOG_ESCAPE_NONE, false); break;
+            case 'Y': add_op(template, LOG_OP_YEAR,        LOG_ESCAPE_NONE, false); break;
+            case 'm': add_op(template, LOG_OP_MONTH,       LOG_ESCAPE_NONE, false); break;
+            case 'd': add_op(template, LOG_OP_DAY,         LOG_ESCAPE_NONE, false); break;
+            case 'H': add_op(template, LOG_OP_HOUR,        LOG_ESCAPE_NONE, false); break;
+            case 'M': add_op(template, LOG_OP_MINUTE,      LOG_ESCAPE_NONE, false); break;
+            case 'S': add_op(template, LOG_OP_SECOND,      LOG_ESCAPE_NONE, false); break;
+            case 'a': add_op(template, LOG_OP_WDAY_NAME,   LOG_ESCAPE_NONE, false); break;
+            case 'b': add_op(template, LOG_OP_MONTH_NAME,  LOG_ESCAPE_NONE, false); break;
+            case 'z': add_op(template, LOG_OP_TZ_OFFSET,   LOG_ESCAPE_NONE, false); break;
+            case 't': add_op(template, LOG_OP_DATETIME,    LOG_ESCAPE_NONE, false); break;
+            case 'T': add_op(template, LOG_OP_ISO_DATETIME, LOG_ESCAPE_NONE, false); break;
+            case 'h': add_op(template, LOG_OP_HTTP_DATE,   LOG_ESCAPE_NONE, true);  break;
+            case '%': add_literal(template, &text_size, "%", 1); break;
+
+            case 'j':
+            case 'J':
+            case 'x':
+            case 'q':
+            case 'c':
+            {
+                const enum LogEscape escape =
+                    ch == 'j' ? LOG_ESCAPE_JSON :
+                    ch == 'J' ? LOG_ESCAPE_JSON_RAW :
+                    ch == 'x' ? LOG_ESCAPE_XML  :
+                    ch == 'q' ? LOG_ESCAPE_SQL  : LOG_ESCAPE_CSV;
+
+                switch (*++ ptr) {
+                    case 's': add_op(template, LOG_OP_MESSAGE,     escape, false); has_message = true; break;
+                    case 'f': add_op(template, LOG_OP_FILENAME,    escape, false); break;
+                    // the level names never need escaping
+                    case 'l': add_op(template, LOG_OP_LEVEL_LOWER, LOG_ESCAPE_NONE, false); break;
+                    case 'L': add_op(template, LOG_OP_LEVEL_UPPER, LOG_ESCAPE_NONE, false); break;
+                    default:  goto error;
+                }
+                break;
+            }
+            case 'g':
+                switch (*++ ptr) {
+                    case 'Y': add_op(template, LOG_OP_YEAR,         LOG_ESCAPE_NONE, true); break;
+                    case 'm': add_op(template, LOG_OP_MONTH,        LOG_ESCAPE_NONE, true); break;
+                    case 'd': add_op(template, LOG_OP_DAY,          LOG_ESCAPE_NONE, true); break;
+                    case 'H': add_op(template, LOG_OP_HOUR,         LOG_ESCAPE_NONE, true); break;
+                    case 'M': add_op(template, LOG_OP_MINUTE,       LOG_ESCAPE_NONE, true); break;
+                    case 'S': add_op(template, LOG_OP_SECOND,       LOG_ESCAPE_NONE, true); break;
+                    case 'a': add_op(template, LOG_OP_WDAY_NAME,    LOG_ESCAPE_NONE, true); break;
+                    case 'b': add_op(template, LOG_OP_MONTH_NAME,   LOG_ESCAPE_NONE, true); break;
+                    case 't': add_op(template, LOG_OP_DATETIME,     LOG_ESCAPE_NONE, true); break;
+                    case 'T': add_op(template, LOG_OP_ISO_DATETIME, LOG_ESCAPE_NONE, true); break;
+                    default:  goto error;
+                }
+                break;
+
+            default:
+                goto error;
+        }
+
+        prev = ++ ptr;
+    }
+
+    if (ptr > prev) {
+        add_literal(template, &text_size, prev, ptr - prev);
+    }
+
+    if (!has_message) {
+        goto error;
+    }
+
+    return template;
+
+error:
+    free(template);
+    errno = EINVAL;
+    return NULL;
+}
+
+void free_log_template(struct log_template *template) {
+    for (size_t index = 0; index < LOG_FORMAT_COUNT; ++ index) {
+        if (template == builtin_templates[index]) {
+            return;
+        }
+    }
+    free(template);
+}
+
+// Compiled on first use and kept until the process ends.
+const struct log_template *get_builtin_log_template(enum LogFormat format) {
+    struct log_template *template = builtin_templates[format];
+    if (template == NULL) {
+        template = compile_log_template(builtin_sources[format]);
+        if (template == NULL) {
+            // only if out of memory
+            return NULL;
+        }
+        builtin_templates[format] = template;
+    }
+    return template;
+}
+
+// ======== rendering ========
+
+// Line and message buffers are reused for every message and only ever grow.
+struct log_buffer {
+    char  *data;
+    size_t size;
+    size_t capacity;
+    char   initial[4096];
+};
+
+static struct log_buffer log_line    = { .data = NULL, .size = 0, .capacity = 0 };
+static struct log_buffer log_message = { .data = NULL, .size = 0, .capacity = 0 };
+
+static bool reserve_log_buffer(struct log_buffer *buf, size_t size) {
+    if (buf->data == NULL) {
+        buf->data     = buf->initial;
+        buf->capacity = sizeof(buf->initial);
+    }
+
+    if (buf->capacity - buf->size >= size) {
+        return true;
+    }
+
+    if (size > SIZE_MAX / 2 - buf->size) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    size_t capacity = buf->capacity * 2;
+    while (capacity - buf->size < size) {
+        capacity *= 2;
+    }
+
+    char *data = buf->data == buf->initial ? malloc(capacity) : realloc(buf->data, capacity);
+    if (data == NULL) {
+        return false;
+    }
+
+    if (buf->data == buf->initial) {
+        memcpy(data, buf->initial, buf->size);
+    }
+
+    buf->data     = data;
+    buf->capacity = capacity;
+    return true;
+}
+
+static inline void append_unchecked(struct log_buffer *buf, const char *str, size_t length) {
+    memcpy(buf->data + buf->size, str, length);
+    buf->size += length;
+}
+
+static void append(struct log_buffer *buf, const char *str, size_t length) {
+    if (reserve_log_buffer(buf, length)) {
+        append_unchecked(buf, str, length);
+    }
+}
+
+static inline void append_digits(char *out, unsigned int value, size_t count) {
+    for (size_t index = count; index > 0; -- index) {
+        out[index - 1] = '0' + value % 10;
+        value /= 10;
+    }
+}
+
+// The escaping functions reserve space for the worst case up front, so
+// that clean runs can be copied in bulk without further checks.
+
+// The escaping itself is in escape.c. By default invalid UTF-8 is replaced,
+// so that the JSON output stays parseable whatever the service logs. %Js
+// skips that for services known to log valid UTF-8, which is a lot faster
+// for text with many non-ASCII characters.
+static void append_json_string(struct log_buffer *buf, const char *str, size_t length, bool validate_utf8) {
+    if (length > SIZE_MAX / ESCAPE_JSON_MAX_FACTOR || !reserve_log_buffer(buf, length * ESCAPE_JSON_MAX_FACTOR)) {
+        return;
+    }
+    buf->size += escape_json(buf->data + buf->size, str, length, validate_utf8);
+}
+
+static void append_xml_string(struct log_buffer *buf, const char *str, size_t length) {
+    if (length > SIZE_MAX / ESCAPE_XML_MAX_FACTOR || !reserve_log_buffer(buf, length * ESCAPE_XML_MAX_FACTOR)) {
+        return;
+    }
+    buf->size += escape_xml(buf->data + buf->size, str, length);
+}
+
+static void append_doubled_quotes(struct log_buffer *buf, const char *str, size_t length, char quote) {
+    if (length > SIZE_MAX / ESCAPE_QUOTE_MAX_FACTOR || !reserve_log_buffer(buf, length * ESCAPE_QUOTE_MAX_FACTOR)) {
+        return;
+    }
+    buf->size += escape_quotes(buf->data + buf->size, str, length, quote);
+}
+
+static void append_escaped(struct log_buffer *buf, enum LogEscape escape, const char *str, size_t length) {
+    switch (escape) {
+        case LOG_ESCAPE_NONE:     append(buf, str, length); break;
+        case LOG_ESCAPE_JSON:     append_json_string(buf, str, length, true); break;
+        case LOG_ESCAPE_JSON_RAW: append_json_string(buf, str, length, false); break;
+        case LOG_ESCAPE_XML:      append_xml_string(buf, str, length); break;
+        case LOG_ESCAPE_SQL:      append_doubled_quotes(buf, str, length, '\''); break;
+        case LOG_ESCAPE_CSV:      append_doubled_quotes(buf, str, length, '"'); break;
+    }
+}
+
+// The broken down time is only computed once per second, together with the
+// timestamps most templates use.
+struct log_time {
+    time_t    second;
+    struct tm local;
+    struct tm gmt;
+    char      tz_offset[6];      // +hhmm
+    char      datetime[2][25];   // local and GMT %t
+    char      iso_datetime[2][25];
+    size_t    datetime_len[2];
+    char      http_date[64];
+};
+
+static struct log_time log_time = { .second = -1 };
+
+static void format_datetime(char *out, const struct tm *tm, char separator, const char *tz) {
+    append_digits(out,      tm->tm_year + 1900, 4);
+    out[4]  = '-';
+    append_digits(out + 5,  tm->tm_mon + 1, 2);
+    out[7]  = '-';
+    append_digits(out + 8,  tm->tm_mday, 2);
+    out[10] = separator;
+    append_digits(out + 11, tm->tm_hour, 2);
+    out[13] = ':';
+    append_digits(out + 14, tm->tm_min, 2);
+    out[16] = ':';
+    append_digits(out + 17, tm->tm_sec, 2);
+    strcpy(out + 19, tz);
+}
+
+static const struct log_time *get_log_time(void) {
+    const time_t now = time(NULL);
+    if (now == log_time.second) {
+        return &log_time;
+    }
+
+    if (localtime_r(&now, &log_time.local) == NULL || gmtime_r(&now, &log_time.gmt) == NULL) {
+        memset(&log_time.local, 0, sizeof(log_time.local));
+        memset(&log_time.gmt,   0, sizeof(log_time.gmt));
+        log_time.local.tm_year = log_time.gmt.tm_year = -1900;
+    }
+    log_time.second = now;
+
+    int tzoff = log_time.local.tm_gmtoff / 60;
+    log_time.tz_offset[0] = tzoff < 0 ? '-' : '+';
+    if (tzoff < 0) {
+        tzoff = -tzoff;
+    }
+    append_digits(log_time.tz_offset + 1, (tzoff / 60) % 100, 2);
+    append_digits(log_time.tz_offset + 3, tzoff % 60, 2);
+    log_time.tz_offset[5] = 0;
+
+    format_datetime(log_time.datetime[0],     &log_time.local, ' ', log_time.tz_offset);
+    format_datetime(log_time.iso_datetime[0], &log_time.local, 'T', log_time.tz_offset);
+    format_datetime(log_time.datetime[1],     &log_time.gmt,   ' ', "Z");
+    format_datetime(log_time.iso_datetime[1], &log_time.gmt,   'T', "Z");
+    log_time.datetime_len[0] = strlen(log_time.datetime[0]);
+    log_time.datetime_len[1] = strlen(log_time.datetime[1]);
+
+    const struct tm *gmt = &log_time.gmt;
+    snprintf(log_time.http_date, sizeof(log_time.http_date), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+        wdays[gmt->tm_wday % 7], gmt->tm_mday, months[gmt->tm_mon % 12], gmt->tm_year + 1900,
+        gmt->tm_hour, gmt->tm_min, gmt->tm_sec);
+
+    return &log_time;
+}
+
+static void append_number(struct log_buffer *buf, int value, size_t digits) {
+    if (reserve_log_buffer(buf, digits)) {
+        append_digits(buf->data + buf->size, value < 0 ? 0 : value, digits);
+        buf->size += digits;
+    }
+}
+
+static void format_message(const char *fmt, va_list ap) {
+    va_list ap2;
+    va_copy(ap2, ap);
+
+    reserve_log_buffer(&log_message, 0);
+    log_message.size = 0;
+
+    int count = vsnprintf(log_message.data, log_message.capacity, fmt, ap);
+    if (count < 0) {
+        const char *error = strerror(errno);
+        count = snprintf(log_message.data, log_message.capacity, "%s", error);
+    } else if ((size_t)count >= log_message.capacity) {
+        if (reserve_log_buffer(&log_message, (size_t)count + 1)) {
+            count = vsnprintf(log_message.data, log_message.capacity, fmt, ap2);
+        } else {
+            // truncated
+            count = log_message.capacity - 1;
+        }
+    }
+    va_end(ap2);
+
+    log_message.size = count < 0 ? 0 : (size_t)count;
+}
+
+// Renders one log line including the trailing newline into a buffer that is
+// reused by the next call. template NULL means the text format.
+const char *format_log_line(const struct log_template *template, enum LogLevel level, const char *filename, size_t lineno, const char *fmt, va_list ap, size_t *size_ptr) {
+    if (template == NULL) {
+        template = get_builtin_log_template(LOG_FORMAT_TEXT);
+    }
+
+    format_message(fmt, ap);
+    log_line.size = 0;
+
+    if (template == NULL) {
+        // out of memory, just the message
+        append(&log_line, log_message.data, log_message.size);
+        append(&log_line, "\n", 1);
+        *size_ptr = log_line.size;
+        return log_line.data;
+    }
+
+    const struct log_time *tm = NULL;
+    for (size_t index = 0; index < template->op_count; ++ index) {
+        const struct log_op *op = &template->ops[index];
+        if (op->type >= LOG_OP_YEAR && tm == NULL) {
+            tm = get_log_time();
+        }
+        const struct tm *broken = tm == NULL ? NULL : op->gmt ? &tm->gmt : &tm->local;
+
+        switch ((enum LogOpType)op->type) {
+            case LOG_OP_LITERAL:
+                append(&log_line, template->text + op->offset, op->length);
+                break;
+
+            case LOG_OP_MESSAGE:
+                append_escaped(&log_line, op->escape, log_message.data, log_message.size);
+                break;
+
+            case LOG_OP_FILENAME:
+                append_escaped(&log_line, op->escape, filename, strlen(filename));
+                break;
+
+            case LOG_OP_LINENO:
+            {
+                char num[24];
+                int count = snprintf(num, sizeof(num), "%zu", lineno);
+                append(&log_line, num, count);
+                break;
+            }
+            case LOG_OP_LEVEL_LOWER:
+                if (level == LOG_LEVEL_INFO) {
+                    append(&log_line, LOG_LEVEL_LOWER_INFO_STR, LOG_LEVEL_INFO_LEN);
+                } else {
+                    append(&log_line, LOG_LEVEL_LOWER_ERROR_STR, LOG_LEVEL_ERROR_LEN);
+                }
+                break;
+
+            case LOG_OP_LEVEL_UPPER:
+                if (level == LOG_LEVEL_INFO) {
+                    append(&log_line, LOG_LEVEL_UPPER_INFO_STR, LOG_LEVEL_INFO_LEN);
+                } else {
+                    append(&log_line, LOG_LEVEL_UPPER_ERROR_STR, LOG_LEVEL_ERROR_LEN);
+                }
+                break;
+
+            case LOG_OP_YEAR:   append_number(&log_line, broken->tm_year + 1900, 4); break;
+            case LOG_OP_MONTH:  append_number(&log_line, broken->tm_mon + 1, 2); break;
+            case LOG_OP_DAY:    append_number(&log_line, broken->tm_mday, 2); break;
+            case LOG_OP_HOUR:   append_number(&log_line, broken->tm_hour, 2); break;
+            case LOG_OP_MINUTE: append_number(&log_line, broken->tm_min, 2); break;
+            case LOG_OP_SECOND: append_number(&log_line, broken->tm_sec, 2); break;
+
+            case LOG_OP_WDAY_NAME:
+                append(&log_line, wdays[broken->tm_wday % 7], 3);
+                break;
+
+            case LOG_OP_MONTH_NAME:
+                append(&log_line, months[broken->tm_mon % 12], 3);
+                break;
+
+            case LOG_OP_TZ_OFFSET:
+                append(&log_line, tm->tz_offset, 5);
+                break;
+
+            case LOG_OP_DATETIME:
+                append(&log_line, tm->datetime[op->gmt], tm->datetime_len[op->gmt]);
+                break;
+
+            case LOG_OP_ISO_DATETIME:
+                append(&log_line, tm->iso_datetime[op->gmt], tm->datetime_len[op->gmt]);
+                break;
+
+            case LOG_OP_HTTP_DATE:
+                append(&log_line, tm->http_date, strlen(tm->http_date));
+                break;
+        }
+    }
+
+    append(&log_line, "\n", 1);
+
+    *size_ptr = log_line.size;
+    return log_line.data;
+}
@@ -18,11 +18,13 @@
 
 enum {
     OPT_LOGROTATE_PIDFILE,
+    OPT_LOGROTATE_CONFIG,
     OPT_LOGROTATE_COUNT,
 };
 
 static const struct option restart_options[] = {
     [OPT_LOGROTATE_PIDFILE] = { "pidfile", required_argument, 0, 'p' },
+    [OPT_LOGROTATE_CONFIG]  = { "config",  required_argument, 0, 'c' },
     [OPT_LOGROTATE_COUNT]   = { 0, 0, 0, 0 },
 };
 
@@ -34,9 +36,10 @@ int command_logrotate(int argc, char *argv[]) {
     int longind = 0;
 
     const char *pidfile = NULL;
+    const char *config_path = NULL;
 
     for (;;) {
-        int opt = getopt_long(argc - 1, argv + 1, "p:", restart_options, &longind);
+        int opt = getopt_long(argc - 1, argv + 1, "p:c:", restart_options, &longind);
 
         if (opt == -1) {
             break;
@@ -47,6 +50,10 @@ int command_logrotate(int argc, char *argv[]) {
                 pidfile = optarg;
                 break;
 
+            case 'c':
+                config_path = optarg;
+                break;
+
             case '?':
                 short_usage(argc, argv);
                 return 1;
@@ -56,15 +63,19 @@ int command_logrotate(int argc, char *argv[]) {
     // because of skipped first argument:
     ++ optind;
 
-    int count = argc - optind;
-    if (count != 1) {
-        fprintf(stderr, "*** error: illegal number of arguments\n");
-        short_usage(argc, argv);
+    const char *name = NULL;
+    struct service_config config = {
+        .path    = NULL,
+        .name    = NULL,
+        .content = NULL,
+        .entries = NULL,
+        .count   = 0,
+    };
+
+    if (get_service_name(argc, argv, config_path, &config, &name, &pidfile) != 0) {
         return 1;
     }
 
-    const char *name = argv[optind ++];
-
     int status = 0;
     bool free_pidfile = false;
     char *pidfile_runner = NULL;
@@ -104,12 +115,29 @@ int command_logrotate(int argc, char *argv[]) {
         goto cleanup;
     }
 
-    if (kill(runner_pid, SIGHUP) != 0) {
-        fprintf(stderr, "*** error: sending SIGHUP to service runner PID %d: %s\n", runner_pid, strerror(errno));
+    char reply[CONTROL_MESSAGE_SIZE];
+    int result = control_request(pidfile, "logrotate", reply, sizeof(reply), -1);
+    if (result == 1) {
+        fprintf(stderr, "*** error: log-rotating %s: %s\n", name, reply);
         status = 1;
         goto cleanup;
     }
 
+    if (result == -1) {
+        if (errno != ENOENT && errno != ECONNREFUSED) {
+            fprintf(stderr, "*** error: sending logrotate request to service runner PID %d: %s\n", runner_pid, strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
+        // service-runner without control socket
+        if (kill(runner_pid, SIGHUP) != 0) {
+            fprintf(stderr, "*** error: sending SIGHUP to service runner PID %d: %s\n", runner_pid, strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+    }
+
 cleanup:
     free(pidfile_runner);
 
@@ -117,5 +145,7 @@ cleanup:
         free((char*)pidfile);
     }
 
+    free_service_config(&config);
+
     return status;
 }
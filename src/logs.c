@@ -20,12 +20,14 @@
 
 enum {
     OPT_LOGS_PIDFILE,
+    OPT_LOGS_CONFIG,
     OPT_LOGS_FOLLOW,
     OPT_LOGS_COUNT,
 };
 
 static const struct option logs_options[] = {
     [OPT_LOGS_PIDFILE] = { "pidfile", required_argument, 0, 'p' },
+    [OPT_LOGS_CONFIG]  = { "config",  required_argument, 0, 'c' },
     [OPT_LOGS_FOLLOW]  = { "follow",  no_argument,       0, 'f' },
     [OPT_LOGS_COUNT]   = { 0, 0, 0, 0 },
 };
@@ -36,10 +38,11 @@ int command_logs(int argc, char *argv[]) {
     }
 
     const char *pidfile = NULL;
+    const char *config_path = NULL;
     bool follow = false;
 
     for (;;) {
-        int opt = getopt_long(argc - 1, argv + 1, "p:f", logs_options, NULL);
+        int opt = getopt_long(argc - 1, argv + 1, "p:c:f", logs_options, NULL);
 
         if (opt == -1) {
             break;
@@ -50,6 +53,10 @@ int command_logs(int argc, char *argv[]) {
                 pidfile = optarg;
                 break;
 
+            case 'c':
+                config_path = optarg;
+                break;
+
             case 'f':
                 follow = true;
                 break;
@@ -63,15 +70,19 @@ int command_logs(int argc, char *argv[]) {
     // because of skipped first argument:
     ++ optind;
 
-    int count = argc - optind;
-    if (count != 1) {
-        fprintf(stderr, "*** error: illegal number of arguments\n");
-        short_usage(argc, argv);
+    const char *name = NULL;
+    struct service_config config = {
+        .path    = NULL,
+        .name    = NULL,
+        .content = NULL,
+        .entries = NULL,
+        .count   = 0,
+    };
+
+    if (get_service_name(argc, argv, config_path, &config, &name, &pidfile) != 0) {
         return 1;
     }
 
-    const char *name = argv[optind ++];
-
     int status = 0;
     bool free_pidfile = false;
     char *pidfile_runner = NULL;
@@ -352,5 +363,7 @@ cleanup:
         close(inotify_fd);
     }
 
+    free_service_config(&config);
+
     return status;
 }
@@ -22,8 +22,14 @@ int main(int argc, char *argv[]) {
         return command_status(argc, argv);
     } else if (strcmp(command, "logrotate") == 0) {
         return command_logrotate(argc, argv);
+    } else if (strcmp(command, "debug-dump") == 0) {
+        return command_debug_dump(argc, argv);
     } else if (strcmp(command, "logs") == 0) {
         return command_logs(argc, argv);
+    } else if (strcmp(command, "notify") == 0) {
+        return command_notify(argc, argv);
+    } else if (strcmp(command, "supervise") == 0) {
+        return command_supervise(argc, argv);
     } else if (strcmp(command, "help") == 0) {
         return command_help(argc, argv);
     } else if (strcmp(command, "version") == 0) {
@@ -0,0 +1,171 @@
+#define _DEFAULT_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <inttypes.h>
+
+#include "service-runner.h"
+
+// in seconds, covers a fast logrotate up to a hanging crash reporter
+static const double metrics_buckets[METRICS_BUCKET_COUNT] = {
+    0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60,
+};
+
+static const char *const metrics_exit_names[METRICS_EXIT_COUNT] = {
+    [METRICS_EXIT_EXITED] = "EXITED",
+    [METRICS_EXIT_KILLED] = "KILLED",
+    [METRICS_EXIT_DUMPED] = "DUMPED",
+};
+
+void observe_histogram(struct metrics_histogram *histogram, double value) {
+    size_t index = 0;
+    while (index < METRICS_BUCKET_COUNT && value > metrics_buckets[index]) {
+        ++ index;
+    }
+
+    if (index < METRICS_BUCKET_COUNT) {
+        ++ histogram->buckets[index];
+    }
+    ++ histogram->count;
+    histogram->sum += value;
+}
+
+static void print_label_value(FILE *fp, const char *value) {
+    putc('"', fp);
+    for (const char *ptr = value; *ptr; ++ ptr) {
+        switch (*ptr) {
+            case '"':  fputs("\\\"", fp); break;
+            case '\\': fputs("\\\\", fp); break;
+            case '\n': fputs("\\n",  fp); break;
+            default:   putc(*ptr, fp);
+        }
+    }
+    putc('"', fp);
+}
+
+static void print_header(FILE *fp, const char *metric, const char *type, const char *help) {
+    fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", metric, help, metric, type);
+}
+
+static void print_value(FILE *fp, const char *metric, const char *name, uint64_t value) {
+    fprintf(fp, "%s{service=", metric);
+    print_label_value(fp, name);
+    fprintf(fp, "} %" PRIu64 "\n", value);
+}
+
+static void print_histogram(FILE *fp, const char *metric, const char *help, const char *name, const struct metrics_histogram *histogram) {
+    print_header(fp, metric, "histogram", help);
+
+    uint64_t count = 0;
+    for (size_t index = 0; index < METRICS_BUCKET_COUNT; ++ index) {
+        count += histogram->buckets[index];
+        fprintf(fp, "%s_bucket{service=", metric);
+        print_label_value(fp, name);
+        fprintf(fp, ",le=\"%g\"} %" PRIu64 "\n", metrics_buckets[index], count);
+    }
+
+    fprintf(fp, "%s_bucket{service=", metric);
+    print_label_value(fp, name);
+    fprintf(fp, ",le=\"+Inf\"} %" PRIu64 "\n", histogram->count);
+
+    fprintf(fp, "%s_sum{service=", metric);
+    print_label_value(fp, name);
+    fprintf(fp, "} %.6f\n", histogram->sum);
+
+    fprintf(fp, "%s_count{service=", metric);
+    print_label_value(fp, name);
+    fprintf(fp, "} %" PRIu64 "\n", histogram->count);
+}
+
+static int print_metrics(FILE *fp, const char *name, const struct service_metrics *metrics) {
+    print_header(fp, "service_runner_up", "gauge", "Whether the service process is running.");
+    print_value(fp, "service_runner_up", name, metrics->up);
+
+    print_header(fp, "service_runner_start_time_seconds", "gauge", "Start time of the service process since the epoch, 0 if it isn't running.");
+    print_value(fp, "service_runner_start_time_seconds", name, metrics->start_time);
+
+    print_header(fp, "service_runner_restarts_total", "counter", "Restarts of the service.");
+    print_value(fp, "service_runner_restarts_total", name, metrics->restarts);
+
+    print_header(fp, "service_runner_exits_total", "counter", "Exits of the service process by how it ended.");
+    for (size_t index = 0; index < METRICS_EXIT_COUNT; ++ index) {
+        fputs("service_runner_exits_total{service=", fp);
+        print_label_value(fp, name);
+        fprintf(fp, ",code=\"%s\"} %" PRIu64 "\n", metrics_exit_names[index], metrics->exits[index]);
+    }
+
+    print_header(fp, "service_runner_log_bytes_total", "counter", "Bytes copied from the log pipe of the service to the logfile.");
+    print_value(fp, "service_runner_log_bytes_total", name, metrics->log_bytes);
+
+    print_header(fp, "service_runner_log_chunks_total", "counter", "Chunks copied from the log pipe of the service to the logfile.");
+    print_value(fp, "service_runner_log_chunks_total", name, metrics->log_chunks);
+
+    print_header(fp, "service_runner_wakeups_total", "counter", "Wakeups of the event loop of the service-runner process.");
+    print_value(fp, "service_runner_wakeups_total", name, metrics->wakeups);
+
+    print_histogram(fp, "service_runner_logrotate_duration_seconds", "Time spent opening a new logfile.",
+        name, &metrics->logrotate_seconds);
+    print_histogram(fp, "service_runner_crash_report_duration_seconds", "Run time of the crash reporter.",
+        name, &metrics->crash_report_seconds);
+    print_histogram(fp, "service_runner_restart_delay_seconds", "Time from the exit of the service process until it was started again.",
+        name, &metrics->restart_delay_seconds);
+
+    return ferror(fp) ? -1 : 0;
+}
+
+// Returns a malloc()ed buffer with the metrics in the Prometheus text format.
+char *format_metrics(const char *name, const struct service_metrics *metrics, size_t *size_ptr) {
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    const int result = print_metrics(fp, name, metrics);
+    if (fclose(fp) != 0 || result != 0) {
+        free(buf);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    *size_ptr = size;
+    return buf;
+}
+
+// For the textfile collector of the node exporter. Like the pidfile it is
+// replaced atomically, so it is never scraped half written.
+int write_metrics_file(const char *path, const char *name, const struct service_metrics *metrics) {
+    char tmpfile[PATH_MAX];
+    int count = snprintf(tmpfile, sizeof(tmpfile), "%s.%d.tmp", path, getpid());
+    if (count < 0 || (size_t)count >= sizeof(tmpfile)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    FILE *fp = fopen(tmpfile, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    if (print_metrics(fp, name, metrics) != 0) {
+        const int errnum = errno;
+        fclose(fp);
+        unlink(tmpfile);
+        errno = errnum;
+        return -1;
+    }
+
+    if (fclose(fp) != 0 || rename(tmpfile, path) != 0) {
+        const int errnum = errno;
+        unlink(tmpfile);
+        errno = errnum;
+        return -1;
+    }
+
+    return 0;
+}
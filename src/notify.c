@@ -0,0 +1,103 @@
+#define _DEFAULT_SOURCE 1
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "service-runner.h"
+
+int command_notify(int argc, char *argv[]) {
+    if (argc < 2) {
+        return 1;
+    }
+
+    if (argc < 3) {
+        fprintf(stderr, "*** error: illegal number of arguments\n");
+        short_usage(argc, argv);
+        return 1;
+    }
+
+    int status = 0;
+    int sock = -1;
+    char *message = NULL;
+
+    const char *socket_path = getenv("NOTIFY_SOCKET");
+    if (socket_path == NULL || !*socket_path) {
+        fprintf(stderr, "*** error: NOTIFY_SOCKET is not set\n");
+        status = 1;
+        goto cleanup;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    const size_t path_len = strlen(socket_path);
+    if (path_len >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "*** error: NOTIFY_SOCKET is too long: %s\n", socket_path);
+        status = 1;
+        goto cleanup;
+    }
+
+    memcpy(addr.sun_path, socket_path, path_len);
+    socklen_t addr_len = sizeof(addr);
+    if (socket_path[0] == '@') {
+        // abstract namespace
+        addr.sun_path[0] = 0;
+        addr_len = offsetof(struct sockaddr_un, sun_path) + path_len;
+    }
+
+    size_t message_size = 0;
+    for (int index = 2; index < argc; ++ index) {
+        if (strchr(argv[index], '=') == NULL) {
+            fprintf(stderr, "*** error: illegal argument, expected VARIABLE=VALUE: %s\n", argv[index]);
+            status = 1;
+            goto cleanup;
+        }
+        message_size += strlen(argv[index]) + 1;
+    }
+
+    message = malloc(message_size);
+    if (message == NULL) {
+        fprintf(stderr, "*** error: malloc(%zu): %s\n", message_size, strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
+
+    char *ptr = message;
+    for (int index = 2; index < argc; ++ index) {
+        const size_t len = strlen(argv[index]);
+        memcpy(ptr, argv[index], len);
+        ptr += len;
+        *ptr ++ = '\n';
+    }
+
+    sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        fprintf(stderr, "*** error: socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0): %s\n", strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
+
+    // the last newline is not sent
+    if (sendto(sock, message, message_size - 1, MSG_NOSIGNAL, (const struct sockaddr*)&addr, addr_len) == -1) {
+        fprintf(stderr, "*** error: sending notification to %s: %s\n", socket_path, strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
+
+cleanup:
+    if (sock != -1) {
+        close(sock);
+    }
+
+    free(message);
+
+    return status;
+}
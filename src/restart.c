@@ -13,19 +13,66 @@
 #include <assert.h>
 #include <limits.h>
 #include <poll.h>
+#include <inttypes.h>
 
 #include "service-runner.h"
 
 enum {
     OPT_RESTART_PIDFILE,
+    OPT_RESTART_CONFIG,
+    OPT_RESTART_WAIT,
     OPT_RESTART_COUNT,
 };
 
 static const struct option restart_options[] = {
     [OPT_RESTART_PIDFILE] = { "pidfile", required_argument, 0, 'p' },
+    [OPT_RESTART_CONFIG]  = { "config",  required_argument, 0, 'c' },
+    [OPT_RESTART_WAIT]    = { "wait",    optional_argument, 0,  0  },
     [OPT_RESTART_COUNT]   = { 0, 0, 0, 0 },
 };
 
+static void print_restart_report(const char *name, pid_t old_pid, pid_t new_pid, uint64_t stop_ms, uint64_t start_ms) {
+    if (old_pid > 0) {
+        printf("%s restarted: PID %d -> %d, stopping took %" PRIu64 ".%03" PRIu64 " seconds, starting took %" PRIu64 ".%03" PRIu64 " seconds\n",
+            name, old_pid, new_pid, stop_ms / 1000, stop_ms % 1000, start_ms / 1000, start_ms % 1000);
+    } else {
+        printf("%s restarted: PID %d, starting took %" PRIu64 ".%03" PRIu64 " seconds\n",
+            name, new_pid, start_ms / 1000, start_ms % 1000);
+    }
+}
+
+// Fallback for service-runners without control socket: poll the pidfile
+// until it contains the PID of a new running service process.
+static int wait_for_new_pid(const char *name, const char *pidfile, pid_t old_pid, int timeout_ms) {
+    const uint64_t started_ms = get_monotonic_ms();
+    uint64_t stopped_ms = old_pid > 0 ? 0 : started_ms;
+
+    for (;;) {
+        struct timespec wait_time = {
+            .tv_sec  = 0,
+            .tv_nsec = 50000000,
+        };
+        nanosleep(&wait_time, NULL);
+
+        const uint64_t now_ms = get_monotonic_ms();
+
+        if (stopped_ms == 0 && kill(old_pid, 0) != 0 && errno == ESRCH) {
+            stopped_ms = now_ms;
+        }
+
+        pid_t new_pid = 0;
+        if (stopped_ms != 0 && read_pidfile(pidfile, &new_pid) == 0 && new_pid != old_pid && kill(new_pid, 0) == 0) {
+            print_restart_report(name, old_pid, new_pid, stopped_ms - started_ms, now_ms - stopped_ms);
+            return 0;
+        }
+
+        if (timeout_ms >= 0 && now_ms - started_ms >= (uint64_t)timeout_ms) {
+            fprintf(stderr, "*** error: timeout waiting for %s to restart\n", name);
+            return 1;
+        }
+    }
+}
+
 int command_restart(int argc, char *argv[]) {
     if (argc < 2) {
         return 1;
@@ -34,19 +81,42 @@ int command_restart(int argc, char *argv[]) {
     int longind = 0;
 
     const char *pidfile = NULL;
+    const char *config_path = NULL;
+    bool wait = false;
+    int wait_timeout = -1;
 
     for (;;) {
-        int opt = getopt_long(argc - 1, argv + 1, "p:", restart_options, &longind);
+        int opt = getopt_long(argc - 1, argv + 1, "p:c:", restart_options, &longind);
 
         if (opt == -1) {
             break;
         }
 
         switch (opt) {
+            case 0:
+                switch (longind) {
+                    case OPT_RESTART_WAIT:
+                        wait = true;
+                        if (optarg != NULL) {
+                            uint64_t value = 0;
+                            if (parse_seconds_ms(optarg, &value) != 0 || value > INT_MAX) {
+                                fprintf(stderr, "*** error: illegal value for --wait: %s\n", optarg);
+                                return 1;
+                            }
+                            wait_timeout = (int)value;
+                        }
+                        break;
+                }
+                break;
+
             case 'p':
                 pidfile = optarg;
                 break;
 
+            case 'c':
+                config_path = optarg;
+                break;
+
             case '?':
                 short_usage(argc, argv);
                 return 1;
@@ -56,15 +126,19 @@ int command_restart(int argc, char *argv[]) {
     // because of skipped first argument:
     ++ optind;
 
-    int count = argc - optind;
-    if (count != 1) {
-        fprintf(stderr, "*** error: illegal number of arguments\n");
-        short_usage(argc, argv);
+    const char *name = NULL;
+    struct service_config config = {
+        .path    = NULL,
+        .name    = NULL,
+        .content = NULL,
+        .entries = NULL,
+        .count   = 0,
+    };
+
+    if (get_service_name(argc, argv, config_path, &config, &name, &pidfile) != 0) {
         return 1;
     }
 
-    const char *name = argv[optind ++];
-
     int status = 0;
     bool free_pidfile = false;
     char *pidfile_runner = NULL;
@@ -104,10 +178,52 @@ int command_restart(int argc, char *argv[]) {
         goto cleanup;
     }
 
-    if (kill(runner_pid, SIGUSR1) != 0) {
-        fprintf(stderr, "*** error: sending SIGUSR1 to service runner PID %d: %s\n", runner_pid, strerror(errno));
+    char reply[CONTROL_MESSAGE_SIZE];
+    // Without --wait the service-runner replies right away.
+    int result = control_request(pidfile, wait ? "restart" : "restart nowait", reply, sizeof(reply), wait_timeout);
+    if (result == 0) {
+        if (wait) {
+            pid_t new_pid = 0;
+            pid_t old_pid = 0;
+            uint64_t stop_ms = 0;
+            uint64_t start_ms = 0;
+
+            if (sscanf(reply, "pid=%d old_pid=%d stop_ms=%" SCNu64 " start_ms=%" SCNu64, &new_pid, &old_pid, &stop_ms, &start_ms) != 4) {
+                fprintf(stderr, "*** error: illegal reply from service runner PID %d: %s\n", runner_pid, reply);
+                status = 1;
+                goto cleanup;
+            }
+
+            print_restart_report(name, old_pid, new_pid, stop_ms, start_ms);
+        }
+    } else if (result == 1) {
+        fprintf(stderr, "*** error: restarting %s: %s\n", name, reply);
+        status = 1;
+        goto cleanup;
+    } else if (errno == ETIMEDOUT) {
+        fprintf(stderr, "*** error: timeout waiting for %s to restart\n", name);
+        status = 1;
+        goto cleanup;
+    } else if (errno != ENOENT && errno != ECONNREFUSED) {
+        fprintf(stderr, "*** error: sending restart request to service runner PID %d: %s\n", runner_pid, strerror(errno));
         status = 1;
         goto cleanup;
+    } else {
+        // service-runner without control socket
+        pid_t old_pid = 0;
+        if (read_pidfile(pidfile, &old_pid) != 0) {
+            old_pid = 0;
+        }
+
+        if (kill(runner_pid, SIGUSR1) != 0) {
+            fprintf(stderr, "*** error: sending SIGUSR1 to service runner PID %d: %s\n", runner_pid, strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
+        if (wait) {
+            status = wait_for_new_pid(name, pidfile, old_pid, wait_timeout);
+        }
     }
 
 cleanup:
@@ -117,5 +233,7 @@ cleanup:
         free((char*)pidfile);
     }
 
+    free_service_config(&config);
+
     return status;
 }
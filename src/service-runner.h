@@ -2,7 +2,11 @@
 #define SERVICE_RUNNER_H
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
 #include <sys/types.h>
+#include <time.h>
 #include <sys/syscall.h>
 
 #ifdef __cplusplus
@@ -30,6 +34,54 @@ extern "C" {
 #define LOG_TEMPLATE_CSV LOG_TEMPLATE_CSV_ "\r"
 #define LOG_TEMPLATE_CSV_HELP LOG_TEMPLATE_CSV_ "\\r"
 
+#define LOG_LEVEL_UPPER_INFO_STR  "INFO"
+#define LOG_LEVEL_UPPER_ERROR_STR "ERROR"
+
+#define LOG_LEVEL_LOWER_INFO_STR  "info"
+#define LOG_LEVEL_LOWER_ERROR_STR "error"
+
+#define LOG_LEVEL_INFO_LEN  4
+#define LOG_LEVEL_ERROR_LEN 5
+
+enum LogLevel {
+    LOG_LEVEL_INFO  = 1,
+    LOG_LEVEL_ERROR = 2,
+};
+
+enum LogFormat {
+    LOG_FORMAT_TEXT,
+    LOG_FORMAT_JSON,
+    LOG_FORMAT_XML,
+    LOG_FORMAT_SQL,
+    LOG_FORMAT_CSV,
+    LOG_FORMAT_COUNT,
+};
+
+// compiled --log-format template, see logformat.c
+struct log_template;
+
+struct log_template *compile_log_template(const char *source);
+void free_log_template(struct log_template *template);
+const struct log_template *get_builtin_log_template(enum LogFormat format);
+const char *format_log_line(const struct log_template *template, enum LogLevel level, const char *filename, size_t lineno, const char *fmt, va_list ap, size_t *size_ptr);
+
+// string escaping for the log formats, see escape.c
+#define ESCAPE_JSON_MAX_FACTOR  6
+#define ESCAPE_XML_MAX_FACTOR   6
+#define ESCAPE_QUOTE_MAX_FACTOR 2
+
+enum EscapeImpl {
+    ESCAPE_IMPL_AUTO,
+    ESCAPE_IMPL_SCALAR,
+    ESCAPE_IMPL_SSE2,
+    ESCAPE_IMPL_AVX2,
+};
+
+bool set_escape_impl(enum EscapeImpl impl);
+size_t escape_json(char *out, const char *str, size_t length, bool validate_utf8);
+size_t escape_xml(char *out, const char *str, size_t length);
+size_t escape_quotes(char *out, const char *str, size_t length, char quote);
+
 #ifdef __ILP32__
     #ifndef SYS_pidfd_open
         #define SYS_pidfd_open (__X32_SYSCALL_BIT + 434)
@@ -54,6 +106,8 @@ extern "C" {
 #define pidfd_send_signal(pidfd, sig, info, flags) \
     syscall(SYS_pidfd_send_signal, (pidfd), (sig), (info), (flags))
 
+#define CONTROL_MESSAGE_SIZE 512
+
 char *abspath(const char *path);
 
 void usage        (int argc, char *argv[]);
@@ -64,7 +118,10 @@ int command_stop     (int argc, char *argv[]);
 int command_restart  (int argc, char *argv[]);
 int command_status   (int argc, char *argv[]);
 int command_logrotate(int argc, char *argv[]);
+int command_debug_dump(int argc, char *argv[]);
 int command_logs     (int argc, char *argv[]);
+int command_notify   (int argc, char *argv[]);
+int command_supervise(int argc, char *argv[]);
 int command_help     (int argc, char *argv[]);
 
 enum AbsPathResult {
@@ -78,12 +135,167 @@ enum AbsPathResult get_logfile_abspath(char **logfile_ptr, const char *name);
 
 int write_pidfile(const char *pidfile, pid_t pid);
 int read_pidfile(const char *pidfile, pid_t *pidptr);
+int read_pidfile_mtime(const char *pidfile, pid_t *pidptr, time_t *mtime_ptr);
+int get_process_start_ticks(pid_t pid, uint64_t *ticks_ptr);
+int get_process_uptime(pid_t pid, time_t *uptime_ptr);
+
+// How much later than its pidfile was written a process may have started
+// before is_pidfile_process_alive() takes it for one that reused the PID.
+// Only used if the start ticks of the process aren't known.
+#define PIDFILE_CLOCK_SLACK (24 * 60 * 60)
+
+int is_pidfile_process_alive(pid_t pid, time_t pidfile_mtime, uint64_t start_ticks);
 
 char *join_pathv(const char *basepath, ...);
 #define join_path(...) join_pathv(__VA_ARGS__, NULL)
 
 char *normpath_no_escape(const char *path);
 
+int parse_seconds_ms(const char *str, uint64_t *msptr);
+uint64_t get_monotonic_ms(void);
+
+// The live state of a service, published by its service-runner in the file
+// PIDFILE.state. Both the runner and the readers map the file into memory.
+// It is updated with a seqlock: seq is odd while the runner writes the
+// record, so readers retry if it was odd or changed while they copied it.
+#define SERVICE_STATE_MAGIC   0x54535253 // "SRST"
+#define SERVICE_STATE_VERSION 2
+#define SERVICE_STATE_SIZE    4096
+
+// runner_pid is a supervisor that also runs other services
+#define SERVICE_STATE_FLAG_SUPERVISED 1
+
+enum ServiceState {
+    SERVICE_STATE_STARTING,
+    SERVICE_STATE_RUNNING,
+    SERVICE_STATE_RELOADING,
+    SERVICE_STATE_STOPPING,
+    SERVICE_STATE_RESTARTING,
+    SERVICE_STATE_FAILED,
+    SERVICE_STATE_COUNT,
+};
+
+struct service_state {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    uint32_t state;
+    int32_t  pid;                // 0 if the service process isn't running
+    int32_t  runner_pid;
+    int64_t  started_at;         // seconds since the epoch, 0 if not running
+    uint32_t restarts;
+    int32_t  exit_status;        // of the last exit, -1 if none
+    int32_t  exit_signal;        // that killed the last process, 0 if none
+    uint32_t flags;              // SERVICE_STATE_FLAG_*
+    uint64_t bytes_logged;       // only counted when logging via a pipe
+    int32_t  last_pid;           // last service process, it stays in the pidfile
+    uint32_t reserved;
+    uint64_t last_start_ticks;   // of last_pid, see get_process_start_ticks(), 0 if unknown
+    uint64_t runner_start_ticks; // of runner_pid, 0 if unknown
+    char     logfile[SERVICE_STATE_SIZE - 80];
+};
+
+_Static_assert(sizeof(struct service_state) == SERVICE_STATE_SIZE, "struct service_state has the wrong size");
+
+const char *get_service_state_name(uint32_t state);
+int read_service_state(const char *pidfile, struct service_state *state);
+
+int control_connect(const char *pidfile, const char *request);
+int control_read_reply(int fd, char *reply, size_t reply_size);
+int control_request(const char *pidfile, const char *request, char *reply, size_t reply_size, int timeout_ms);
+
+struct service_config_entry {
+    const char *key;
+    const char *value;
+    unsigned int lineno;
+};
+
+struct service_config {
+    const char *path;
+    char *name;
+    char *content;
+    struct service_config_entry *entries;
+    size_t count;
+};
+
+int read_service_config(const char *path, struct service_config *config);
+void free_service_config(struct service_config *config);
+const char *get_service_config_value(const struct service_config *config, const char *key);
+int get_service_name(int argc, char *argv[], const char *config_path, struct service_config *config, const char **name_ptr, const char **pidfile_ptr);
+
+// How many services the bulk commands (e.g. stop --all) handle at once.
+#define DEFAULT_JOBS 16
+#define MAX_JOBS 1024
+
+struct service_ref {
+    char *name;
+    char *pidfile;
+};
+
+int get_service_refs(int argc, char *argv[], const char *dirname, struct service_ref **refs_ptr, size_t *count_ptr);
+void free_service_refs(struct service_ref *refs, size_t count);
+int parse_jobs(const char *str, size_t *jobs_ptr);
+
+// Metrics of a service as exposed by start --metrics in the Prometheus text
+// format. The counters are plain integers updated by the event loop of the
+// service-runner, the gauges are filled in right before formatting.
+#define METRICS_BUCKET_COUNT 11
+
+struct metrics_histogram {
+    uint64_t buckets[METRICS_BUCKET_COUNT]; // not cumulative, +Inf is count
+    uint64_t count;
+    double sum;
+};
+
+enum MetricsExit {
+    METRICS_EXIT_EXITED,
+    METRICS_EXIT_KILLED,
+    METRICS_EXIT_DUMPED,
+    METRICS_EXIT_COUNT,
+};
+
+struct service_metrics {
+    uint64_t log_bytes;
+    uint64_t log_chunks;
+    uint64_t exits[METRICS_EXIT_COUNT];
+    uint64_t wakeups;
+    uint32_t restarts;
+    int32_t  up;
+    int64_t  start_time; // seconds since the epoch, 0 if not running
+    struct metrics_histogram logrotate_seconds;
+    struct metrics_histogram crash_report_seconds;
+    struct metrics_histogram restart_delay_seconds;
+};
+
+void observe_histogram(struct metrics_histogram *histogram, double value);
+char *format_metrics(const char *name, const struct service_metrics *metrics, size_t *size_ptr);
+int write_metrics_file(const char *path, const char *name, const struct service_metrics *metrics);
+
+// The flight recorder keeps the most recent internal events of the
+// service-runner in memory, so they can be dumped on demand (see the
+// debug-dump command). Only the event loop thread writes to it, which makes
+// recording an event just a timestamp and a few stores.
+#define FLIGHT_RING_SIZE  4096 // must be a power of 2
+#define FLIGHT_NO_SERVICE UINT32_MAX
+
+enum FlightEventType {
+    FLIGHT_STATE,        // a: old state, b: new state (enum ServiceState)
+    FLIGHT_ERROR,        // a: format string literal, b: source line << 32 | errno (might be stale)
+    FLIGHT_SIGNAL,       // a: signal number
+    FLIGHT_FORK,         // a: PID, b: standby
+    FLIGHT_EXEC,         // a: PID, b: failed
+    FLIGHT_REAP,         // a: PID, b: wait status
+    FLIGHT_SPLICE,       // a: bytes copied to the logfile or -errno
+    FLIGHT_LOGFILE_OPEN, // a: file descriptor or -errno
+    FLIGHT_LOGFILE_SWAP, // a: old file descriptor, b: new file descriptor
+    FLIGHT_REPORT_START, // a: PID
+    FLIGHT_REPORT_STOP,  // a: PID, b: wait status
+    FLIGHT_EVENT_COUNT,
+};
+
+void flight_record(enum FlightEventType type, uint32_t service_index, int64_t a, int64_t b);
+int flight_dump(const char *path, uint32_t service_index, const char *name);
+
 #ifdef __cplusplus
 }
 #endif
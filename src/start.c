@@ -3,6 +3,7 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
@@ -16,6 +17,13 @@
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <netdb.h>
 // #include <sys/prctl.h>
 // #include <linux/capability.h>
 #include <signal.h>
@@ -28,11 +36,13 @@
 #include <libgen.h>
 #include <signal.h>
 #include <assert.h>
-#include <poll.h>
 #include <spawn.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <dirent.h>
 
 #include "service-runner.h"
+#include "trace.h"
 
 #ifndef P_PIDFD
     #define P_PIDFD 3
@@ -42,19 +52,14 @@
 #define PIPE_WRITE 1
 #define SPLICE_SIZE ((size_t)2 * 1024 * 1024 * 1024)
 
-#define LOG_LEVEL_UPPER_INFO_STR  "INFO"
-#define LOG_LEVEL_UPPER_ERROR_STR "ERROR"
-
-#define LOG_LEVEL_LOWER_INFO_STR  "info"
-#define LOG_LEVEL_LOWER_ERROR_STR "error"
-
-#define LOG_LEVEL_INFO_LEN  4
-#define LOG_LEVEL_ERROR_LEN 5
+// ends of the socketpair between the start command and the service-runner
+#define STARTUP_COMMAND 0
+#define STARTUP_RUNNER  1
 
-enum LogLevel {
-    LOG_LEVEL_INFO  = 1,
-    LOG_LEVEL_ERROR = 2,
-};
+// messages from the service-runner to the start command
+#define STARTUP_RUNNING 'S'
+#define STARTUP_READY   'R'
+#define STARTUP_FAILED  'F'
 
 extern char **environ;
 
@@ -76,6 +81,17 @@ struct rlimit_params {
 // Currently there are only 16 different rlimit values anyway.
 #define RLIMITS_GROW ((size_t) 16)
 
+// --listen=tcp:HOST:PORT or --listen=unix:PATH
+struct listen_socket {
+    const char *spec;
+    int fd;
+};
+
+#define LISTEN_SOCKETS_GROW ((size_t) 4)
+
+// like systemd's SD_LISTEN_FDS_START
+#define LISTEN_FDS_START 3
+
 static bool parse_rlimit_params(const char *arg, struct rlimit_params *limitptr) {
     char *endptr = strchr(arg, ':');
     if (endptr == NULL) {
@@ -226,29 +242,81 @@ enum {
     // TODO: --procsched and --iosched?
     OPT_START_RESTART,
     OPT_START_CRASH_REPORT,
+    OPT_START_CRASH_REPORT_TIMEOUT,
     OPT_START_RESTART_SLEEP,
+    OPT_START_RESTART_SLEEP_MAX,
+    OPT_START_RESTART_SLEEP_FACTOR,
+    OPT_START_RESTART_SLEEP_JITTER,
+    OPT_START_RESTART_SLEEP_RESET,
+    OPT_START_START_LIMIT_BURST,
+    OPT_START_START_LIMIT_INTERVAL,
+    OPT_START_NOTIFY,
+    OPT_START_WAIT_READY,
+    OPT_START_WATCHDOG,
+    OPT_START_SHUTDOWN_TIMEOUT,
+    OPT_START_HEALTH_CMD,
+    OPT_START_HEALTH_TCP,
+    OPT_START_HEALTH_UNIX,
+    OPT_START_HEALTH_INTERVAL,
+    OPT_START_HEALTH_TIMEOUT,
+    OPT_START_HEALTH_RETRIES,
+    OPT_START_HEALTH_START_PERIOD,
+    OPT_START_LISTEN,
+    OPT_START_RESTART_MODE,
+    OPT_START_STANDBY,
+    OPT_START_METRICS,
     OPT_START_FOREGROUND,
+    OPT_START_CONFIG,
+    OPT_START_ALL,
+    OPT_START_JOBS,
     OPT_START_COUNT,
 };
 
+#define START_SHORT_OPTIONS "p:l:u:g:N:k:r:C:c:j:"
+
 static const struct option start_options[] = {
-    [OPT_START_PIDFILE]          = { "pidfile",          required_argument, 0, 'p' },
-    [OPT_START_LOGFILE]          = { "logfile",          required_argument, 0, 'l' },
-    [OPT_START_CHOWN_LOGFILE]    = { "chown-logfile",    no_argument,       0,  0  },
-    [OPT_START_LOG_FORMAT]       = { "log-format",       required_argument, 0,  0  },
-    [OPT_START_MANUAL_LOGROTATE] = { "manual-logrotate", no_argument,       0,  0  },
-    [OPT_START_USER]             = { "user",             required_argument, 0, 'u' },
-    [OPT_START_GROUP]            = { "group",            required_argument, 0, 'g' },
-    [OPT_START_PRIORITY]         = { "priority",         required_argument, 0, 'N' },
-    [OPT_START_RLIMIT]           = { "rlimit",           required_argument, 0, 'r' },
-    [OPT_START_UMASK]            = { "umask",            required_argument, 0, 'k' },
-    [OPT_START_CHROOT]           = { "chroot",           required_argument, 0,  0  },
-    [OPT_START_CHDIR]            = { "chdir",            required_argument, 0, 'C' },
-    [OPT_START_RESTART]          = { "restart",          required_argument, 0,  0  },
-    [OPT_START_CRASH_REPORT]     = { "crash-report",     required_argument, 0,  0  },
-    [OPT_START_RESTART_SLEEP]    = { "restart-sleep",    required_argument, 0,  0  },
-    [OPT_START_FOREGROUND]       = { "foreground",       no_argument,       0, 'f' },
-    [OPT_START_COUNT]            = { 0, 0, 0, 0 },
+    [OPT_START_PIDFILE]              = { "pidfile",              required_argument, 0, 'p' },
+    [OPT_START_LOGFILE]              = { "logfile",              required_argument, 0, 'l' },
+    [OPT_START_CHOWN_LOGFILE]        = { "chown-logfile",        no_argument,       0,  0  },
+    [OPT_START_LOG_FORMAT]           = { "log-format",           required_argument, 0,  0  },
+    [OPT_START_MANUAL_LOGROTATE]     = { "manual-logrotate",     no_argument,       0,  0  },
+    [OPT_START_USER]                 = { "user",                 required_argument, 0, 'u' },
+    [OPT_START_GROUP]                = { "group",                required_argument, 0, 'g' },
+    [OPT_START_PRIORITY]             = { "priority",             required_argument, 0, 'N' },
+    [OPT_START_RLIMIT]               = { "rlimit",               required_argument, 0, 'r' },
+    [OPT_START_UMASK]                = { "umask",                required_argument, 0, 'k' },
+    [OPT_START_CHROOT]               = { "chroot",               required_argument, 0,  0  },
+    [OPT_START_CHDIR]                = { "chdir",                required_argument, 0, 'C' },
+    [OPT_START_RESTART]              = { "restart",              required_argument, 0,  0  },
+    [OPT_START_CRASH_REPORT]         = { "crash-report",         required_argument, 0,  0  },
+    [OPT_START_CRASH_REPORT_TIMEOUT] = { "crash-report-timeout", required_argument, 0,  0  },
+    [OPT_START_RESTART_SLEEP]        = { "restart-sleep",        required_argument, 0,  0  },
+    [OPT_START_RESTART_SLEEP_MAX]    = { "restart-sleep-max",    required_argument, 0,  0  },
+    [OPT_START_RESTART_SLEEP_FACTOR] = { "restart-sleep-factor", required_argument, 0,  0  },
+    [OPT_START_RESTART_SLEEP_JITTER] = { "restart-sleep-jitter", required_argument, 0,  0  },
+    [OPT_START_RESTART_SLEEP_RESET]  = { "restart-sleep-reset",  required_argument, 0,  0  },
+    [OPT_START_START_LIMIT_BURST]    = { "start-limit-burst",    required_argument, 0,  0  },
+    [OPT_START_START_LIMIT_INTERVAL] = { "start-limit-interval", required_argument, 0,  0  },
+    [OPT_START_NOTIFY]               = { "notify",               no_argument,       0,  0  },
+    [OPT_START_WAIT_READY]           = { "wait-ready",           optional_argument, 0,  0  },
+    [OPT_START_WATCHDOG]             = { "watchdog",             required_argument, 0,  0  },
+    [OPT_START_SHUTDOWN_TIMEOUT]     = { "shutdown-timeout",     required_argument, 0,  0  },
+    [OPT_START_HEALTH_CMD]           = { "health-cmd",           required_argument, 0,  0  },
+    [OPT_START_HEALTH_TCP]           = { "health-tcp",           required_argument, 0,  0  },
+    [OPT_START_HEALTH_UNIX]          = { "health-unix",          required_argument, 0,  0  },
+    [OPT_START_HEALTH_INTERVAL]      = { "health-interval",      required_argument, 0,  0  },
+    [OPT_START_HEALTH_TIMEOUT]       = { "health-timeout",       required_argument, 0,  0  },
+    [OPT_START_HEALTH_RETRIES]       = { "health-retries",       required_argument, 0,  0  },
+    [OPT_START_HEALTH_START_PERIOD]  = { "health-start-period",  required_argument, 0,  0  },
+    [OPT_START_LISTEN]               = { "listen",               required_argument, 0,  0  },
+    [OPT_START_RESTART_MODE]         = { "restart-mode",         required_argument, 0,  0  },
+    [OPT_START_STANDBY]              = { "standby",              no_argument,       0,  0  },
+    [OPT_START_METRICS]              = { "metrics",              required_argument, 0,  0  },
+    [OPT_START_FOREGROUND]           = { "foreground",           no_argument,       0, 'f' },
+    [OPT_START_CONFIG]               = { "config",               required_argument, 0, 'c' },
+    [OPT_START_ALL]                  = { "all",                  required_argument, 0,  0  },
+    [OPT_START_JOBS]                 = { "jobs",                 required_argument, 0, 'j' },
+    [OPT_START_COUNT]                = { 0, 0, 0, 0 },
 };
 
 enum Restart {
@@ -257,663 +325,67 @@ enum Restart {
     RESTART_FAILURE = 2,
 };
 
-enum LogFormat {
-    LOG_FORMAT_TEXT = 0,
-    LOG_FORMAT_JSON = 1,
+enum RestartMode {
+    RESTART_MODE_STOP    = 0,
+    RESTART_MODE_OVERLAP = 1,
+};
+
+enum HealthCheck {
+    HEALTH_NONE = 0,
+    HEALTH_CMD  = 1,
+    HEALTH_TCP  = 2,
+    HEALTH_UNIX = 3,
 };
 
-static const char *log_format = LOG_TEMPLATE_TEXT;
-static pid_t service_pid = 0;
-static int service_pidfd = -1;
-static volatile bool running = false;
-static volatile bool restart_issued = false;
-static volatile bool logrotate_issued = false;
-static volatile bool got_sigchld = false;
+// NULL means the text format
+static const struct log_template *log_format = NULL;
 
 #if !defined(__GNUC__) && !defined(__clang__)
     #define __attribute__(X)
 #endif
 
-static void print_json_string(FILE *fp, const char *str) {
-    const char *prev = str;
-    for (const char *ptr = str;;) {
-        char ch = *ptr;
-        switch (ch) {
-        case 0:
-            fwrite(prev, ptr - prev, 1, fp);
-            return;
-
-        case '\\':
-        case '"':
-        case '/':
-            fwrite(prev, ptr - prev, 1, fp);
-            fputc('\\', fp);
-            fputc(ch, fp);
-            prev = ++ ptr;
-            break;
-
-        case '\r':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("\\r", 2, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '\n':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("\\n", 2, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '\t':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("\\t", 2, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '\b':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("\\b", 2, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '\f':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("\\f", 2, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '<':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("\\u003c", 6, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '>':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("\\u003e", 6, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        default:
-            ++ ptr;
-            break;
-        }
-    }
-}
-
-static void print_xml_string(FILE *fp, const char *str) {
-    const char *prev = str;
-    for (const char *ptr = str;;) {
-        char ch = *ptr;
-        switch (ch) {
-        case 0:
-            fwrite(prev, ptr - prev, 1, fp);
-            return;
-
-        case '&':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("&amp;", 5, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '"':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("&quot;", 6, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '\'':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("&#39;", 5, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '<':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("&lt;", 4, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '>':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("&gt;", 4, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '\r':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("&#13;", 5, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        case '\n':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("&#10;", 5, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        default:
-            ++ ptr;
-            break;
-        }
-    }
-}
-
-static void print_sql_string(FILE *fp, const char *str) {
-    const char *prev = str;
-    for (const char *ptr = str;;) {
-        char ch = *ptr;
-        switch (ch) {
-        case 0:
-            fwrite(prev, ptr - prev, 1, fp);
-            return;
-
-        case '\'':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("''", 2, 1, fp);
-            prev = ++ ptr;
-            break;
-
-        default:
-            ++ ptr;
-            break;
-        }
-    }
-}
-
-static void print_csv_string(FILE *fp, const char *str) {
-    const char *prev = str;
-    for (const char *ptr = str;;) {
-        char ch = *ptr;
-        switch (ch) {
-        case 0:
-            fwrite(prev, ptr - prev, 1, fp);
-            return;
+// The log lines of the service-runner process are collected in this buffer
+// and written once per event loop iteration (see flush_runner_log()). The
+// logfile is shared with the service, so only whole lines may be written.
+#define RUNNER_LOG_BUFFER_SIZE 65536
 
-        case '"':
-            fwrite(prev, ptr - prev, 1, fp);
-            fwrite("\"\"", 2, 1, fp);
-            prev = ++ ptr;
-            break;
+static char runner_log_buffer[RUNNER_LOG_BUFFER_SIZE];
 
-        default:
-            ++ ptr;
-            break;
-        }
+static bool set_runner_log_buffer(void) {
+    if (setvbuf(stdout, runner_log_buffer, _IOFBF, sizeof(runner_log_buffer)) != 0) {
+        perror("*** error: setvbuf(stdout, runner_log_buffer, _IOFBF, sizeof(runner_log_buffer))");
+        return false;
     }
+    return true;
 }
 
-static bool is_valid_log_template(const char *template) {
-    bool ok = false;
-    for (const char *ptr = template; *ptr; ++ ptr) {
-        char ch = *ptr;
-        if (ch == '%') {
-            ch = * ++ ptr;
-            switch (ch) {
-                case 's':
-                    ok = true;
-                    break;
-
-                case 'j':
-                case 'x':
-                case 'q':
-                case 'c':
-                    ch = * ++ ptr;
-                    switch (ch) {
-                        case 's':
-                            ok = true;
-                            break;
-
-                        case 'f':
-                        case 'l':
-                        case 'L':
-                            break;
-
-                        default:
-                            return false;
-                    }
-                    break;
-
-                case 'g':
-                    ch = * ++ ptr;
-                    switch (ch) {
-                        case 'Y':
-                        case 'm':
-                        case 'd':
-                        case 'H':
-                        case 'M':
-                        case 'S':
-                        case 't':
-                        case 'T':
-                        case 'a':
-                        case 'b':
-                            break;
-
-                        default:
-                            return false;
-                    }
-                    break;
-
-                case 'Y':
-                case 'm':
-                case 'd':
-                case 'H':
-                case 'M':
-                case 'S':
-                case 'z':
-                case 't':
-                case 'T':
-                case 'f':
-                case 'n':
-                case 'l':
-                case 'L':
-                case 'h':
-                case 'a':
-                case 'b':
-                case '%':
-                    break;
-
-                default:
-                    return false;
-            }
-        }
-    }
-
-    return ok;
+static void flush_runner_log(void) {
+    fflush(stdout);
 }
 
-static const char *wdays[] = {
-    "Sun",
-    "Mon",
-    "Tue",
-    "Wed",
-    "Thu",
-    "Fri",
-    "Sat",
-};
-
-static const char *months[] = {
-    "Jan",
-    "Feb",
-    "Mar",
-    "Apr",
-    "May",
-    "Jun",
-    "Jul",
-    "Aug",
-    "Sep",
-    "Oct",
-    "Nov",
-    "Dec",
-};
-
-#define FORMAT_ARG(FMT, PRINT)                  \
-    ch = *ptr;                                  \
-    if (ch == 0) {                              \
-        fwrite(FMT, 2, 1, fp);                  \
-        break;                                  \
-    }                                           \
-    switch (ch) {                               \
-        case 's':                               \
-            PRINT(fp, msg);                     \
-            prev = ++ ptr;                      \
-            break;                              \
-                                                \
-        case 'f':                               \
-            PRINT(fp, filename);                \
-            prev = ++ ptr;                      \
-            break;                              \
-                                                \
-        case 'l':                               \
-            PRINT(fp, level == LOG_LEVEL_INFO ? \
-                LOG_LEVEL_LOWER_INFO_STR :      \
-                LOG_LEVEL_LOWER_ERROR_STR);     \
-            prev = ++ ptr;                      \
-            break;                              \
-                                                \
-        case 'L':                               \
-            PRINT(fp, level == LOG_LEVEL_INFO ? \
-                LOG_LEVEL_UPPER_INFO_STR :      \
-                LOG_LEVEL_UPPER_ERROR_STR);     \
-            prev = ++ ptr;                      \
-            break;                              \
-                                                \
-        default:                                \
-            fwrite(FMT, 2, 1, fp);              \
-            break;                              \
-    }
-
-__attribute__((format(printf, 6, 7))) static void print_log_template(FILE *fp, const char *template, enum LogLevel level, const char *filename, size_t lineno, const char *fmt, ...) {
-    char buf[4096];
-    const char *msg = buf;
-    bool free_msg = false;
-    const time_t now = time(NULL);
-    struct tm local_now = {
-        .tm_year   = -1900,
-        .tm_mon    = 0,
-        .tm_mday   = 0,
-        .tm_wday   = 0,
-        .tm_hour   = 0,
-        .tm_min    = 0,
-        .tm_sec    = 0,
-        .tm_isdst  = 0,
-        .tm_gmtoff = 0,
-        .tm_zone   = NULL,
-    };
-
-    struct tm *tmptr = localtime_r(&now, &local_now);
-    assert(tmptr != NULL); (void)tmptr;
-
+__attribute__((format(printf, 6, 7))) static void print_log_template(FILE *fp, const struct log_template *template, enum LogLevel level, const char *filename, size_t lineno, const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    int count = vsnprintf(buf, sizeof(buf), fmt, ap);
+    size_t size = 0;
+    const char *line = format_log_line(template, level, filename, lineno, fmt, ap, &size);
     va_end(ap);
 
-    if (count >= 0) {
-        if (count < sizeof(buf)) {
-            msg = buf;
-        } else {
-            size_t size = (size_t)count + 1;
-            char *buf = malloc(size);
-            if (buf == NULL) {
-                msg = strerror(errno);
-            } else {
-                free_msg = true;
-                va_start(ap, fmt);
-                count = vsnprintf(buf, size, fmt, ap);
-                assert(count >= 0 && (size_t)count < size);
-                va_end(ap);
-            }
-        }
-    } else {
-        msg = strerror(errno);
-    }
-
-    int tzoff = local_now.tm_gmtoff / 60;
-    char tzsign;
-    if (tzoff < 0) {
-        tzsign = '-';
-        tzoff  = -tzoff;
-    } else {
-        tzsign = '+';
-    }
-    int tzhour = tzoff / 60;
-    int tzmin  = tzoff % 60;
-
-    const char *prev = template;
-    for (const char *ptr = template;;) {
-        char ch = *ptr;
-
-        if (ch == 0) {
-            fwrite(prev, ptr - prev, 1, fp);
-            break;
-        } else if (ch == '%') {
-            fwrite(prev, ptr - prev, 1, fp);
-            ++ ptr;
-            ch = *ptr;
-            if (ch == 0) {
-                fputc('%', fp);
-                break;
-            }
-            prev = ++ ptr;
-            switch (ch) {
-                case 'Y':
-                    fprintf(fp, "%04d", local_now.tm_year + 1900);
-                    break;
-
-                case 'm':
-                    fprintf(fp, "%02d", local_now.tm_mon + 1);
-                    break;
-
-                case 'd':
-                    fprintf(fp, "%02d", local_now.tm_mday);
-                    break;
-
-                case 'H':
-                    fprintf(fp, "%02d", local_now.tm_hour);
-                    break;
-
-                case 'M':
-                    fprintf(fp, "%02d", local_now.tm_min);
-                    break;
-
-                case 'S':
-                    fprintf(fp, "%02d", local_now.tm_sec);
-                    break;
-
-                case 'z':
-                    fprintf(fp, "%c%02d%02d", tzsign, tzhour, tzmin);
-                    break;
-
-                case 't':
-                    fprintf(fp, "%04d-%02d-%02d %02d:%02d:%02d%c%02d%02d",
-                        local_now.tm_year + 1900,
-                        local_now.tm_mon + 1,
-                        local_now.tm_mday,
-                        local_now.tm_hour,
-                        local_now.tm_min,
-                        local_now.tm_sec,
-                        tzsign,
-                        tzhour,
-                        tzmin
-                    );
-                    break;
-
-                case 'T':
-                    fprintf(fp, "%04d-%02d-%02dT%02d:%02d:%02d%c%02d%02d",
-                        local_now.tm_year + 1900,
-                        local_now.tm_mon + 1,
-                        local_now.tm_mday,
-                        local_now.tm_hour,
-                        local_now.tm_min,
-                        local_now.tm_sec,
-                        tzsign,
-                        tzhour,
-                        tzmin
-                    );
-                    break;
-
-                case 's':
-                    fwrite(msg, strlen(msg), 1, fp);
-                    break;
-
-                case 'j':
-                    FORMAT_ARG("%j", print_json_string);
-                    break;
-
-                case 'x':
-                    FORMAT_ARG("%x", print_xml_string);
-                    break;
-
-                case 'q':
-                    FORMAT_ARG("%q", print_sql_string);
-                    break;
-
-                case 'c':
-                    FORMAT_ARG("%c", print_csv_string);
-                    break;
-
-                case 'f':
-                    fwrite(filename, strlen(filename), 1, fp);
-                    break;
-
-                case 'n':
-                    fprintf(fp, "%zu", lineno);
-                    break;
-
-                case 'l':
-                    if (level == LOG_LEVEL_INFO) {
-                        fwrite(LOG_LEVEL_LOWER_INFO_STR, LOG_LEVEL_INFO_LEN, 1, fp);
-                    } else {
-                        fwrite(LOG_LEVEL_LOWER_ERROR_STR, LOG_LEVEL_ERROR_LEN, 1, fp);
-                    }
-                    break;
-
-                case 'L':
-                    if (level == LOG_LEVEL_INFO) {
-                        fwrite(LOG_LEVEL_UPPER_INFO_STR, LOG_LEVEL_INFO_LEN, 1, fp);
-                    } else {
-                        fwrite(LOG_LEVEL_UPPER_ERROR_STR, LOG_LEVEL_ERROR_LEN, 1, fp);
-                    }
-                    break;
-
-                case 'h':
-                {
-                    struct tm gm_now = {
-                        .tm_year   = -1900,
-                        .tm_mon    = 0,
-                        .tm_mday   = 0,
-                        .tm_wday   = 0,
-                        .tm_hour   = 0,
-                        .tm_min    = 0,
-                        .tm_sec    = 0,
-                        .tm_isdst  = 0,
-                        .tm_gmtoff = 0,
-                        .tm_zone   = NULL,
-                    };
-                    struct tm *tmptr = gmtime_r(&now, &gm_now);
-                    assert(tmptr != NULL); (void)tmptr;
-                    fprintf(fp, "%s, %02d %s %04d %02d:%02d:%02d GMT",
-                        wdays[gm_now.tm_wday],
-                        gm_now.tm_mday,
-                        months[gm_now.tm_mon],
-                        gm_now.tm_year + 1900,
-                        gm_now.tm_hour,
-                        gm_now.tm_min,
-                        gm_now.tm_sec
-                    );
-                    break;
-                }
-                case 'g':
-                {
-                    struct tm gm_now = {
-                        .tm_year   = -1900,
-                        .tm_mon    = 0,
-                        .tm_mday   = 0,
-                        .tm_wday   = 0,
-                        .tm_hour   = 0,
-                        .tm_min    = 0,
-                        .tm_sec    = 0,
-                        .tm_isdst  = 0,
-                        .tm_gmtoff = 0,
-                        .tm_zone   = NULL,
-                    };
-                    ch = *ptr;
-                    if (ch == 0) {
-                        fwrite("%g", 2, 1, fp);
-                        break;
-                    }
-                    struct tm *tmptr = gmtime_r(&now, &gm_now);
-                    assert(tmptr != NULL); (void)tmptr;
-                    switch (ch) {
-                        case 'Y':
-                            fprintf(fp, "%04d", gm_now.tm_year + 1900);
-                            prev = ++ ptr;
-                            break;
-
-                        case 'm':
-                            fprintf(fp, "%02d", gm_now.tm_mon + 1);
-                            prev = ++ ptr;
-                            break;
-
-                        case 'd':
-                            fprintf(fp, "%02d", gm_now.tm_mday);
-                            prev = ++ ptr;
-                            break;
-
-                        case 'H':
-                            fprintf(fp, "%02d", gm_now.tm_hour);
-                            prev = ++ ptr;
-                            break;
-
-                        case 'M':
-                            fprintf(fp, "%02d", gm_now.tm_min);
-                            prev = ++ ptr;
-                            break;
-
-                        case 'S':
-                            fprintf(fp, "%02d", gm_now.tm_sec);
-                            prev = ++ ptr;
-                            break;
-
-                        case 't':
-                            fprintf(fp, "%04d-%02d-%02d %02d:%02d:%02dZ",
-                                gm_now.tm_year + 1900,
-                                gm_now.tm_mon + 1,
-                                gm_now.tm_mday,
-                                gm_now.tm_hour,
-                                gm_now.tm_min,
-                                gm_now.tm_sec
-                            );
-                            prev = ++ ptr;
-                            break;
-
-                        case 'T':
-                            fprintf(fp, "%04d-%02d-%02dT%02d:%02d:%02dZ",
-                                gm_now.tm_year + 1900,
-                                gm_now.tm_mon + 1,
-                                gm_now.tm_mday,
-                                gm_now.tm_hour,
-                                gm_now.tm_min,
-                                gm_now.tm_sec
-                            );
-                            prev = ++ ptr;
-                            break;
-
-                        case 'a':
-                        {
-                            const char *mon = months[gm_now.tm_mon];
-                            fwrite(mon, strlen(mon), 1, fp);
-                            prev = ++ ptr;
-                            break;
-                        }
-                        case 'b':
-                        {
-                            const char *wday = wdays[gm_now.tm_wday];
-                            fwrite(wday, strlen(wday), 1, fp);
-                            prev = ++ ptr;
-                            break;
-                        }
-                        default:
-                            fwrite("%g", 2, 1, fp);
-                            break;
-                    }
-                    break;
-                }
-                case 'a':
-                {
-                    const char *mon = months[local_now.tm_mon];
-                    fwrite(mon, strlen(mon), 1, fp);
-                    break;
-                }
-                case 'b':
-                {
-                    const char *wday = wdays[local_now.tm_wday];
-                    fwrite(wday, strlen(wday), 1, fp);
-                    break;
-                }
-                case '%':
-                    fputc('%', fp);
-                    break;
-
-                default:
-                    fwrite(ptr - 2, 2, 1, fp);
-                    break;
-            }
-        } else {
-            ++ ptr;
-        }
+    // Make room for the whole line, so that stdio doesn't flush in the
+    // middle of it. A line longer than the buffer is written on its own.
+    if (__fpending(fp) + size > RUNNER_LOG_BUFFER_SIZE) {
+        fflush(fp);
     }
 
-    fputc('\n', fp);
-
-    if (free_msg) {
-        free((char*)msg);
-    }
+    fwrite(line, size, 1, fp);
 }
 
+// the service whose log is selected, see select_service_log()
+static uint32_t flight_service_index = FLIGHT_NO_SERVICE;
+
 #define print_info(FMT, ...)  print_log_template(stdout, log_format, LOG_LEVEL_INFO,  __FILE__, __LINE__, FMT, ## __VA_ARGS__)
-#define print_error(FMT, ...) print_log_template(stdout, log_format, LOG_LEVEL_ERROR, __FILE__, __LINE__, FMT, ## __VA_ARGS__)
+#define print_error(FMT, ...) ( \
+    flight_record(FLIGHT_ERROR, flight_service_index, (intptr_t)(FMT), (int64_t)__LINE__ << 32 | (uint32_t)errno), \
+    print_log_template(stdout, log_format, LOG_LEVEL_ERROR, __FILE__, __LINE__, FMT, ## __VA_ARGS__))
 
 static bool is_valid_name(const char *name) {
     if (!*name) {
@@ -1070,16 +542,6 @@ static bool can_read_write(const char *filename, uid_t uid, gid_t gid) {
     return false;
 }
 
-static void signal_premature_exit(pid_t runner_pid) {
-    // This attempts to stop the service-runner process so that an crash-restart-loop
-    // is prevented if the service process doesn't even manage to exec.
-    print_error("(child) premature exit before execv() or failed execv() -> don't restart");
-    if (kill(runner_pid, SIGTERM) != 0) {
-        print_error("(child) signaling premature exit to service-runner: %s",
-            strerror(errno));
-    }
-}
-
 static int get_uid_from_name(const char *username, uid_t *uidptr) {
     if (!*username) {
         errno = EINVAL;
@@ -1200,96 +662,4208 @@ static int get_gid_from_name(const char *groupname, gid_t *gidptr) {
     return 0;
 }
 
-static void handle_stop_signal(int sig) {
-    if (service_pid == 0) {
-        print_error("received signal %d, but service process is not running -> ignored", sig);
-        return;
-    }
+// Finest unit of time that appears in a --logfile pattern. The logfile name
+// can only change when a boundary of that unit is crossed.
+enum LogrotateInterval {
+    LOGROTATE_NEVER  = 0,
+    LOGROTATE_YEAR   = 1,
+    LOGROTATE_MONTH  = 2,
+    LOGROTATE_DAY    = 3,
+    LOGROTATE_HOUR   = 4,
+    LOGROTATE_MINUTE = 5,
+    LOGROTATE_SECOND = 6,
+};
 
-    assert(getpid() != service_pid);
+// Re-check the logfile name at least this often (in seconds) no matter what
+// the pattern says, so that clock steps and time zone changes are picked up.
+#define LOGROTATE_MAX_WAIT 60
 
-    print_info("received signal %d, forwarding to service PID %u", sig, service_pid);
-    running = false;
+static enum LogrotateInterval get_logrotate_interval(const char *pattern) {
+    enum LogrotateInterval interval = LOGROTATE_NEVER;
 
-    if (service_pidfd != -1) {
-        if (pidfd_send_signal(service_pidfd, sig, NULL, 0) != 0) {
-            if (errno == EBADFD || errno == ENOSYS) {
-                print_error("pidfd_send_signal(service_pidfd, %d, NULL, 0) failed, using kill(%d, %d): %s",
-                    sig, service_pid, sig, strerror(errno));
-                if (service_pid != 0 && kill(service_pid, sig) != 0) {
-                    print_error("forwarding signal %d to PID %d: %s", sig, service_pid, strerror(errno));
-                }
-            } else {
-                print_error("forwarding signal %d to PID %d via pidfd: %s", sig, service_pid, strerror(errno));
-            }
+    for (const char *ptr = pattern; *ptr; ++ ptr) {
+        if (*ptr != '%') {
+            continue;
         }
-    } else if (kill(service_pid, sig) != 0) {
-        print_error("forwarding signal %d to PID %d: %s", sig, service_pid, strerror(errno));
-    }
-}
+        ++ ptr;
 
-static void handles_logrotate(int sig) {
-    print_info("received signal %d, performing manual log-rotate...", sig);
-    logrotate_issued = true;
-}
+        // skip GNU flags, field width and E/O modifiers
+        while (*ptr == '_' || *ptr == '-' || *ptr == '0' || *ptr == '^' || *ptr == '#') {
+            ++ ptr;
+        }
 
-static void handle_restart_signal(int sig) {
-    if (service_pid == 0) {
-        print_error("received signal %d, but service process is not running -> ignored", sig);
-        return;
-    }
+        while (*ptr >= '0' && *ptr <= '9') {
+            ++ ptr;
+        }
 
-    assert(getpid() != service_pid);
+        if (*ptr == 'E' || *ptr == 'O') {
+            ++ ptr;
+        }
 
-    print_info("received signal %d, restarting service...", sig);
-    restart_issued = true;
+        enum LogrotateInterval conv_interval;
+        switch (*ptr) {
+            case 0:
+                return interval;
 
-    if (service_pidfd != -1) {
-        if (pidfd_send_signal(service_pidfd, SIGTERM, NULL, 0) != 0) {
-            if (errno == EBADFD || errno == ENOSYS) {
-                print_error("pidfd_send_signal(%d, SIGTERM, NULL, 0) failed, using kill(%d, SIGTERM): %s",
-                    service_pidfd, service_pid, strerror(errno));
-                if (service_pid != 0 && kill(service_pid, SIGTERM) != 0) {
-                    print_error("sending SIGTERM to PID %d: %s", service_pid, strerror(errno));
-                }
-            } else {
-                print_error("sending SIGTERM to PID %d via pidfd: %s", service_pid, strerror(errno));
-            }
-        }
-    } else if (kill(service_pid, SIGTERM) != 0) {
-        print_error("sending SIGTERM to PID %d: %s", service_pid, strerror(errno));
-    }
-}
+            case '%':
+            case 'n':
+            case 't':
+                conv_interval = LOGROTATE_NEVER;
+                break;
 
-static void handle_child(int sig) {
-    // for when pidfd is not supported handle child exiting via SIGCHLD and EINTR of poll()
-    got_sigchld = true;
-}
+            case 'Y':
+            case 'y':
+            case 'C':
+                conv_interval = LOGROTATE_YEAR;
+                break;
 
-int command_start(int argc, char *argv[]) {
-    if (argc < 2) {
-        return 1;
-    }
+            case 'm':
+            case 'b':
+            case 'B':
+            case 'h':
+                conv_interval = LOGROTATE_MONTH;
+                break;
 
-    // Ensure that stdout is line buffered, no matter if it is a tty.
-    // This is so that lines appear correctly in the logfile.
-    // This needs to happen before any write to stdout.
-    if (setvbuf(stdout, NULL, _IOLBF, 0) != 0) {
-        perror("*** error: setvbuf(stdout, NULL, _IOLBF, 0)");
-        return 1;
-    }
+            case 'd':
+            case 'e':
+            case 'j':
+            case 'a':
+            case 'A':
+            case 'u':
+            case 'w':
+            case 'D':
+            case 'F':
+            case 'x':
+            case 'U':
+            case 'W':
+            case 'V':
+            case 'G':
+            case 'g':
+                conv_interval = LOGROTATE_DAY;
+                break;
 
-    // Also set stderr to be line buffered so that concurrent writes
-    // between the service-runner process and the service itself have
-    // a smaller chance to interfere.
-    // This is ok since log messages as written here are always single
-    // and whole lines (assuming strerror(errno) never returns a
-    // multiline string).
-    if (setvbuf(stderr, NULL, _IOLBF, 0) != 0) {
-        perror("*** error: setvbuf(stderr, NULL, _IOLBF, 0)");
+            case 'H':
+            case 'I':
+            case 'k':
+            case 'l':
+            case 'p':
+            case 'P':
+                conv_interval = LOGROTATE_HOUR;
+                break;
+
+            case 'M':
+            case 'R':
+            // time zone offset/name changes at DST transitions, which
+            // aren't always on the full hour
+            case 'z':
+            case 'Z':
+                conv_interval = LOGROTATE_MINUTE;
+                break;
+
+            default:
+                // %S, %s, %T, %r, %c, %X and anything unknown
+                conv_interval = LOGROTATE_SECOND;
+                break;
+        }
+
+        if (conv_interval > interval) {
+            interval = conv_interval;
+        }
+    }
+
+    return interval;
+}
+
+static time_t get_next_logrotate(time_t now, enum LogrotateInterval interval) {
+    struct tm local_now;
+
+    if (interval == LOGROTATE_NEVER || interval == LOGROTATE_SECOND) {
+        return now + (interval == LOGROTATE_NEVER ? LOGROTATE_MAX_WAIT : 1);
+    }
+
+    if (localtime_r(&now, &local_now) == NULL) {
+        return now + 1;
+    }
+
+    time_t next;
+    switch (interval) {
+        case LOGROTATE_MINUTE:
+            next = now - local_now.tm_sec + 60;
+            break;
+
+        case LOGROTATE_HOUR:
+            next = now - local_now.tm_min * 60 - local_now.tm_sec + 60 * 60;
+            break;
+
+        default:
+            // Let mktime() figure out DST transitions. tm_isdst = -1 means
+            // it has to determine whether DST is in effect at that time.
+            local_now.tm_sec  = 0;
+            local_now.tm_min  = 0;
+            local_now.tm_hour = 0;
+            local_now.tm_isdst = -1;
+
+            if (interval == LOGROTATE_DAY) {
+                local_now.tm_mday += 1;
+            } else if (interval == LOGROTATE_MONTH) {
+                local_now.tm_mday  = 1;
+                local_now.tm_mon  += 1;
+            } else {
+                local_now.tm_mday  = 1;
+                local_now.tm_mon   = 0;
+                local_now.tm_year += 1;
+            }
+
+            next = mktime(&local_now);
+            if (next == (time_t)-1 || next <= now) {
+                next = now + 1;
+            }
+            break;
+    }
+
+    return next;
+}
+
+// Calculates when the logfile name needs to be checked next as a
+// CLOCK_MONOTONIC time, so that the log handling only needs to
+// compare that against the current monotonic time.
+static bool get_logrotate_deadline(enum LogrotateInterval interval, struct timespec *deadline) {
+    struct timespec real_now;
+    struct timespec mono_now;
+
+    if (clock_gettime(CLOCK_REALTIME, &real_now) != 0) {
+        return false;
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &mono_now) != 0) {
+        return false;
+    }
+
+    // pick up changes of /etc/localtime or TZ
+    tzset();
+
+    time_t next = get_next_logrotate(real_now.tv_sec, interval);
+    if (next - real_now.tv_sec > LOGROTATE_MAX_WAIT) {
+        next = real_now.tv_sec + LOGROTATE_MAX_WAIT;
+    }
+
+    deadline->tv_sec  = mono_now.tv_sec + (next - real_now.tv_sec);
+    deadline->tv_nsec = mono_now.tv_nsec - real_now.tv_nsec;
+    if (deadline->tv_nsec < 0) {
+        deadline->tv_nsec += 1000000000L;
+        deadline->tv_sec  -= 1;
+    } else if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_nsec -= 1000000000L;
+        deadline->tv_sec  += 1;
+    }
+
+    return true;
+}
+
+// Open the next logfile this long before it is due, so that open() and
+// fchown() are done by the time the logfile has to be swapped.
+#define LOGROTATE_PREOPEN_NSEC 500000000L
+
+struct logrotate_timer {
+    int fd;
+    bool at_boundary;
+    time_t boundary;
+    int next_logfile_fd;
+    char next_logfile_path[PATH_MAX];
+};
+
+static bool format_logfile(const char *pattern, time_t when, char *buf, size_t size) {
+    struct tm local_when;
+
+    if (localtime_r(&when, &local_when) == NULL) {
+        print_error("(parent) getting local time: %s", strerror(errno));
+        return false;
+    }
+
+    if (strftime(buf, size, pattern, &local_when) == 0) {
+        print_error("(parent) cannot format logfile \"%s\": %s", pattern, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static int open_logfile(const char *path, bool chown_logfile, uid_t uid, gid_t gid) {
+    TRACE(logfile_open_entry, path);
+    int fd = open(path, O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND, 0644);
+    TRACE(logfile_open_return, path, fd);
+    flight_record(FLIGHT_LOGFILE_OPEN, flight_service_index, fd == -1 ? -errno : fd, 0);
+    if (fd == -1) {
+        print_error("(parent) cannot open logfile: %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (chown_logfile && fchown(fd, uid, gid) != 0) {
+        print_error("(parent) cannot change owner of logfile: %s: %s", path, strerror(errno));
+    }
+
+    return fd;
+}
+
+static void replace_logfile(int *logfile_fd, int new_logfile_fd) {
+    TRACE(logfile_swap, *logfile_fd, new_logfile_fd);
+    flight_record(FLIGHT_LOGFILE_SWAP, flight_service_index, *logfile_fd, new_logfile_fd);
+    if (close(*logfile_fd) != 0) {
+        print_error("(parent) close(logfile_fd): %s", strerror(errno));
+    }
+
+    *logfile_fd = new_logfile_fd;
+    fflush(stdout);
+    if (dup2(new_logfile_fd, STDOUT_FILENO) == -1) {
+        print_error("(parent) dup2(logfile_fd, STDOUT_FILENO): %s", strerror(errno));
+    }
+
+    fflush(stderr);
+    if (dup2(new_logfile_fd, STDERR_FILENO) == -1) {
+        print_error("(parent) dup2(logfile_fd, STDERR_FILENO): %s", strerror(errno));
+    }
+}
+
+// Arms the timer to fire shortly before the next possible change of the
+// logfile name. TFD_TIMER_CANCEL_ON_SET makes the read() fail with
+// ECANCELED when the system clock is set, so that it can be re-scheduled.
+// The timer fires on the precise clock, but time() may still return the
+// previous second at that point. Never schedule a boundary that was already
+// handled.
+static bool schedule_logrotate(struct logrotate_timer *timer, enum LogrotateInterval interval) {
+    struct timespec real_now;
+
+    if (clock_gettime(CLOCK_REALTIME, &real_now) != 0) {
+        print_error("(parent) clock_gettime(CLOCK_REALTIME, &real_now): %s", strerror(errno));
+        return false;
+    }
+
+    time_t now = real_now.tv_sec;
+    if (timer->at_boundary && now < timer->boundary) {
+        now = timer->boundary;
+    }
+
+    tzset();
+
+    time_t next = get_next_logrotate(now, interval);
+    if (next - now > LOGROTATE_MAX_WAIT) {
+        next = now + LOGROTATE_MAX_WAIT;
+    }
+
+    struct itimerspec spec = {
+        .it_interval = { .tv_sec = 0,        .tv_nsec = 0 },
+        .it_value    = { .tv_sec = next - 1, .tv_nsec = 1000000000L - LOGROTATE_PREOPEN_NSEC },
+    };
+
+    if (timerfd_settime(timer->fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL) != 0) {
+        print_error("(parent) timerfd_settime(logrotate_timer.fd, ...): %s", strerror(errno));
+        return false;
+    }
+
+    timer->boundary    = next;
+    timer->at_boundary = false;
+
+    return true;
+}
+
+static void discard_next_logfile(struct logrotate_timer *timer) {
+    if (timer->next_logfile_fd != -1) {
+        if (close(timer->next_logfile_fd) != 0) {
+            print_error("(parent) close(next_logfile_fd): %s", strerror(errno));
+        }
+        timer->next_logfile_fd = -1;
+    }
+}
+
+static void handle_logrotate_timer(
+        struct logrotate_timer *timer, enum LogrotateInterval interval, const char *pattern,
+        int *logfile_fd, char *logfile_path, size_t logfile_path_size,
+        bool chown_logfile, uid_t uid, gid_t gid) {
+    uint64_t expirations = 0;
+    ssize_t rcount = read(timer->fd, &expirations, sizeof(expirations));
+
+    if (rcount < 0) {
+        if (errno == ECANCELED) {
+            // The system clock was set, the pre-opened file might be wrong.
+            discard_next_logfile(timer);
+            timer->at_boundary = false;
+            schedule_logrotate(timer, interval);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) read(logrotate_timer.fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+        }
+        return;
+    }
+
+    if (!timer->at_boundary) {
+        // pre-open and chown the next logfile ahead of time
+        discard_next_logfile(timer);
+        if (format_logfile(pattern, timer->boundary, timer->next_logfile_path, sizeof(timer->next_logfile_path)) &&
+            strcmp(timer->next_logfile_path, logfile_path) != 0) {
+            timer->next_logfile_fd = open_logfile(timer->next_logfile_path, chown_logfile, uid, gid);
+        }
+
+        struct itimerspec spec = {
+            .it_interval = { .tv_sec = 0,               .tv_nsec = 0 },
+            .it_value    = { .tv_sec = timer->boundary, .tv_nsec = 0 },
+        };
+
+        if (timerfd_settime(timer->fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL) != 0) {
+            print_error("(parent) timerfd_settime(logrotate_timer.fd, ...): %s", strerror(errno));
+            discard_next_logfile(timer);
+            schedule_logrotate(timer, interval);
+            return;
+        }
+
+        timer->at_boundary = true;
+        return;
+    }
+
+    // boundary reached -> swap in the pre-opened logfile
+    if (timer->next_logfile_fd != -1) {
+        replace_logfile(logfile_fd, timer->next_logfile_fd);
+        strcpy(logfile_path, timer->next_logfile_path);
+        timer->next_logfile_fd = -1;
+    } else {
+        // Nothing pre-opened (or open failed), but make sure nothing changed
+        // in the meantime (e.g. time zone).
+        char new_logfile_path[PATH_MAX];
+        const time_t now = time(NULL);
+        if (format_logfile(pattern, now > timer->boundary ? now : timer->boundary, new_logfile_path, sizeof(new_logfile_path)) &&
+            strcmp(new_logfile_path, logfile_path) != 0) {
+            int new_logfile_fd = open_logfile(new_logfile_path, chown_logfile, uid, gid);
+            if (new_logfile_fd != -1) {
+                replace_logfile(logfile_fd, new_logfile_fd);
+                assert(strlen(new_logfile_path) < logfile_path_size);
+                strcpy(logfile_path, new_logfile_path);
+            }
+        }
+    }
+
+    schedule_logrotate(timer, interval);
+}
+
+// epoll_event.data.u64 tags
+enum EventSource {
+    EVENT_SIGNAL         = 0,
+    EVENT_SERVICE        = 1,
+    EVENT_LOGPIPE        = 2,
+    EVENT_LOGROTATE      = 3,
+    EVENT_RESTART        = 4,
+    EVENT_REPORT         = 5,
+    EVENT_REPORT_TIMEOUT = 6,
+    EVENT_CONTROL        = 7,
+    EVENT_CONTROL_CLIENT = 8, // the client index is stored in bits 8 to 31
+    EVENT_EXEC           = 9,
+    EVENT_NOTIFY         = 10,
+    EVENT_WATCHDOG       = 11,
+    EVENT_KILL_TIMEOUT   = 12,
+    EVENT_HEALTH         = 13,
+    EVENT_HEALTH_PROBE   = 14,
+    EVENT_HEALTH_TIMEOUT = 15,
+    EVENT_OLD_SERVICE    = 16,
+    EVENT_STANDBY        = 17,
+    EVENT_STANDBY_EXEC   = 18,
+    EVENT_STANDBY_NOTIFY = 19,
+    EVENT_METRICS        = 20,
+    EVENT_METRICS_CLIENT = 21, // the client index is stored in bits 8 to 31
+    EVENT_METRICS_TIMER  = 22,
+    EVENT_OLD_KILL_TIMEOUT = 23,
+    EVENT_STANDBY_KILL_TIMEOUT = 24,
+};
+
+// The lower 8 bits are the EventSource, the upper 32 bits the index of the
+// service in the services array of run_services().
+#define EVENT_DATA(SERVICE, SOURCE) ((uint64_t)(SOURCE) | (uint64_t)(SERVICE)->index << 32)
+#define EVENT_SOURCE(DATA) ((enum EventSource)((DATA) & 0xFF))
+#define EVENT_CLIENT_INDEX(DATA) ((size_t)(((DATA) >> 8) & 0xFFFFFF))
+#define EVENT_SERVICE_INDEX(DATA) ((size_t)((DATA) >> 32))
+
+// for the metrics, shared by all services of a supervisor
+static uint64_t loop_wakeups = 0;
+
+#define MAX_EVENTS 16
+#define SIGNAL_BATCH_SIZE 16
+#define MAX_CONTROL_CLIENTS 8
+#define MAX_METRICS_CLIENTS 4
+
+// how often --metrics=FILE is written
+#define METRICS_FILE_INTERVAL_MS 15000
+
+enum ControlPending {
+    CONTROL_PENDING_NONE,
+    CONTROL_PENDING_STOP,
+    CONTROL_PENDING_RESTART,
+};
+
+struct control_client {
+    int fd;
+    enum ControlPending pending;
+};
+
+struct service {
+    // configuration
+    const char *name;
+    const char *command;
+    char **command_argv;
+    const char *pidfile;
+    const char *pidfile_failed;
+    const char *logfile;
+    const char *user;
+    const char *group;
+    uid_t uid;
+    gid_t gid;
+    uid_t logfile_uid;
+    gid_t logfile_gid;
+    bool chown_logfile;
+    const char *chroot_path;
+    const char *chdir_path;
+    const struct rlimit_params *rlimits;
+    size_t rlimits_count;
+    const struct listen_socket *listen_sockets;
+    size_t listen_sockets_count;
+    size_t index; // in the services array of run_services()
+    bool supervised;
+    bool set_umask;
+    int umask_value;
+    const char *crash_report;
+    unsigned int crash_report_timeout;
+    enum Restart restart;
+    enum RestartMode restart_mode;
+    bool standby;
+    const char *metrics_path; // --metrics=unix:PATH or --metrics=FILE
+    bool metrics_unix;
+    uint64_t restart_sleep_ms;
+    uint64_t restart_sleep_max_ms;
+    double restart_sleep_factor;
+    unsigned int restart_sleep_jitter;
+    uint64_t restart_sleep_reset_ms;
+    unsigned int start_limit_burst;
+    uint64_t start_limit_interval_ms;
+    bool notify;
+    uint64_t watchdog_ms;
+    int64_t shutdown_timeout_ms;
+    enum HealthCheck health_check;
+    const char *health_target;
+    struct sockaddr_storage health_addr;
+    socklen_t health_addr_len;
+    uint64_t health_interval_ms;
+    uint64_t health_timeout_ms;
+    unsigned int health_retries;
+    uint64_t health_start_period_ms;
+    bool manual_logrotate;
+    bool do_pipe;
+    bool do_logrotate;
+    enum LogrotateInterval logrotate_interval;
+    const struct log_template *log_format; // NULL for text
+    struct log_template *log_template;     // the compiled --log-format=template:..., if any
+    char *pidfile_runner;
+    bool set_priority;
+    int priority;
+    bool free_pidfile;
+    bool free_logfile;
+    bool free_command;
+    bool free_chdir_path;
+    bool unlink_listen_sockets;
+
+    // state
+    pid_t runner_pid;
+    pid_t pid;
+    int pidfd;
+    pid_t old_pid;
+    int old_pidfd;
+    bool old_stopping;
+    pid_t standby_pid;
+    int standby_pidfd;
+    int standby_exec_fd;
+    bool standby_parked;
+    bool standby_stopping;
+    bool standby_failed;
+    bool is_standby; // only set in the forked standby process
+    int exec_fd;
+    bool running;
+    bool finished; // cleaned up by run_services()
+    bool restart_issued;
+    bool restart_pending;
+    bool restart_due;
+    uint64_t restart_delay_ms;
+    struct timespec started_at;
+    bool failed;
+    uint64_t *restart_times;
+    size_t restart_times_index;
+    int restart_timer_fd;
+    pid_t report_pid;
+    int report_pidfd;
+    int report_timer_fd;
+    int pipefd[2];
+    int logfile_fd;
+    const char *logfile_path;
+    char logfile_path_buf[PATH_MAX];
+    struct timespec logrotate_deadline;
+    struct logrotate_timer logrotate_timer;
+    unsigned int restart_count;
+    pid_t restart_old_pid;
+    uint64_t restart_requested_ms;
+    uint64_t exited_ms;
+    int startup_fd;
+    int notify_fd;
+    char notify_path[sizeof(((struct sockaddr_un*)NULL)->sun_path)];
+    int standby_notify_fd;
+    char standby_notify_path[sizeof(((struct sockaddr_un*)NULL)->sun_path)];
+    bool ready;
+    bool reloading;
+    char status_text[256];
+    int watchdog_timer_fd;
+    int kill_timer_fd;
+    int old_kill_timer_fd;
+    int standby_kill_timer_fd;
+    int health_timer_fd;
+    int health_timeout_fd;
+    int health_probe_fd;
+    pid_t health_probe_pid;
+    int health_probe_pidfd;
+    pid_t health_probe_service_pid;
+    bool health_probe_timed_out;
+    unsigned int health_failures;
+    int control_fd;
+    char control_path[sizeof(((struct sockaddr_un*)NULL)->sun_path)];
+    struct control_client control_clients[MAX_CONTROL_CLIENTS];
+    struct service_state *state_record;
+    char state_path[PATH_MAX];
+    int exit_status; // -1 if the service process did not exit yet
+    int exit_signal;
+    int metrics_fd; // listening socket or timer for the metrics file
+    int metrics_clients[MAX_METRICS_CLIENTS];
+    uint64_t metrics_clients_ms[MAX_METRICS_CLIENTS]; // when they were accepted
+    uint64_t report_started_ms;
+    struct service_metrics metrics;
+    int flight_state; // last state recorded in the flight recorder, -1 for none
+};
+
+static bool add_event_source(int epoll_fd, int fd, uint64_t data) {
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data   = { .u64 = data },
+    };
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        print_error("(parent) epoll_ctl(epoll_fd, EPOLL_CTL_ADD, %d, &event): %s", fd, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static void signal_premature_exit(struct service *service) {
+    if (service->is_standby) {
+        // The service itself keeps running, there just won't be a standby.
+        print_error("(child) premature exit of standby process before execv() or failed execv()");
+    } else if (service->supervised) {
+        // The supervisor runs other services too, it stops only this one
+        // when it reads the failure from the exec pipe.
+        print_error("(child) premature exit before execv() or failed execv() -> don't restart");
+    } else {
+        // This attempts to stop the service-runner process so that an crash-restart-loop
+        // is prevented if the service process doesn't even manage to exec.
+        print_error("(child) premature exit before execv() or failed execv() -> don't restart");
+        if (kill(service->runner_pid, SIGTERM) != 0) {
+            print_error("(child) signaling premature exit to service-runner: %s",
+                strerror(errno));
+        }
+    }
+
+    // tell the service-runner that the service wasn't started
+    if (service->exec_fd != -1) {
+        const char failed = 1;
+        if (write(service->exec_fd, &failed, 1) != 1) {
+            print_error("(child) write(exec_fd, &failed, 1): %s", strerror(errno));
+        }
+    }
+}
+
+// Moves the listening sockets to the file descriptors 3, 4, ... of the
+// service process and sets LISTEN_FDS and LISTEN_PID accordingly.
+static bool pass_listen_sockets(struct service *service) {
+    const size_t count = service->listen_sockets_count;
+    if (count == 0) {
+        return true;
+    }
+
+    const int fds_end = LISTEN_FDS_START + (int)count;
+
+    // Get everything that is still needed out of the way first.
+    if (service->exec_fd != -1 && service->exec_fd < fds_end) {
+        int fd = fcntl(service->exec_fd, F_DUPFD_CLOEXEC, fds_end);
+        if (fd == -1) {
+            print_error("(child) fcntl(exec_fd, F_DUPFD_CLOEXEC, %d): %s", fds_end, strerror(errno));
+            return false;
+        }
+        service->exec_fd = fd;
+    }
+
+    int fds[count];
+    for (size_t index = 0; index < count; ++ index) {
+        fds[index] = fcntl(service->listen_sockets[index].fd, F_DUPFD_CLOEXEC, fds_end);
+        if (fds[index] == -1) {
+            print_error("(child) fcntl(%d, F_DUPFD_CLOEXEC, %d): %s", service->listen_sockets[index].fd, fds_end, strerror(errno));
+            return false;
+        }
+    }
+
+    // dup2() clears O_CLOEXEC on the new file descriptor
+    for (size_t index = 0; index < count; ++ index) {
+        const int target_fd = LISTEN_FDS_START + (int)index;
+        if (dup2(fds[index], target_fd) == -1) {
+            print_error("(child) dup2(%d, %d): %s", fds[index], target_fd, strerror(errno));
+            return false;
+        }
+    }
+
+    char listen_fds[24];
+    char listen_pid[24];
+    snprintf(listen_fds, sizeof(listen_fds), "%zu", count);
+    snprintf(listen_pid, sizeof(listen_pid), "%d", getpid());
+
+    if (setenv("LISTEN_FDS", listen_fds, 1) != 0) {
+        print_error("(child) setenv(\"LISTEN_FDS\", \"%s\", 1): %s", listen_fds, strerror(errno));
+        return false;
+    }
+
+    if (setenv("LISTEN_PID", listen_pid, 1) != 0) {
+        print_error("(child) setenv(\"LISTEN_PID\", \"%s\", 1): %s", listen_pid, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+__attribute__((noreturn))
+static void exec_service(struct service *service) {
+    // child: service process
+    // With --restart-mode=OVERLAP the service-runner replaces the pidfile
+    // once the new service process is ready, with --standby once the standby
+    // process is promoted.
+    if (!service->is_standby && service->old_pid <= 0 && write_pidfile(service->pidfile, getpid()) != 0) {
+        print_error("(child) write_pidfile(\"%s\", %u): %s", service->pidfile, getpid(), strerror(errno));
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    // All other file descriptors of the service-runner are O_CLOEXEC.
+    if (close(service->logfile_fd) != 0) {
+        print_error("(child) close(logfile_fd): %s", strerror(errno));
+    }
+
+    if (service->notify_fd != -1 && setenv("NOTIFY_SOCKET", service->notify_path, 1) != 0) {
+        print_error("(child) setenv(\"NOTIFY_SOCKET\", \"%s\", 1): %s", service->notify_path, strerror(errno));
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    if (service->watchdog_ms > 0) {
+        char watchdog_usec[24];
+        char watchdog_pid[24];
+        snprintf(watchdog_usec, sizeof(watchdog_usec), "%" PRIu64, service->watchdog_ms * 1000);
+        snprintf(watchdog_pid, sizeof(watchdog_pid), "%d", getpid());
+
+        if (setenv("WATCHDOG_USEC", watchdog_usec, 1) != 0) {
+            print_error("(child) setenv(\"WATCHDOG_USEC\", \"%s\", 1): %s", watchdog_usec, strerror(errno));
+            signal_premature_exit(service);
+            exit(1);
+        }
+
+        if (setenv("WATCHDOG_PID", watchdog_pid, 1) != 0) {
+            print_error("(child) setenv(\"WATCHDOG_PID\", \"%s\", 1): %s", watchdog_pid, strerror(errno));
+            signal_premature_exit(service);
+            exit(1);
+        }
+    }
+
+    // Because I don't know how to check if the target priority value is
+    // allowed I have to already set it for the whole service-runner
+    // process. (See above.) Only a supervisor runs services with different
+    // priorities, so there it is set here.
+    if (service->supervised && service->set_priority && setpriority(PRIO_PROCESS, 0, service->priority) != 0) {
+        print_error("(child) cannot set process priority of service to %d: %s", service->priority, strerror(errno));
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    // Maybe I should do setrlimit() in the parent, too?
+    // But a user would expect things like RLIMIT_FSIZE to only apply to the service and
+    // not the service runner, i.e. the logfile shouldn't be limited by it.
+    for (size_t index = 0; index < service->rlimits_count; ++ index) {
+        const struct rlimit_params *lim = &service->rlimits[index];
+        if (setrlimit(lim->resource, &lim->limit) != 0) {
+            print_error("(child) setrlimit(%d, { .rlim_cur = %ld, .rlim_max = %ld }): %s",
+                lim->resource,
+                lim->limit.rlim_cur,
+                lim->limit.rlim_max,
+                strerror(errno));
+            signal_premature_exit(service);
+            exit(1);
+        }
+    }
+
+    if (service->set_umask) {
+        umask(service->umask_value);
+    }
+
+    if (service->do_pipe) {
+        const int pipe_write = service->pipefd[PIPE_WRITE];
+
+        if (pipe_write != STDOUT_FILENO) {
+            fflush(stdout);
+            if (dup2(pipe_write, STDOUT_FILENO) == -1) {
+                print_error("(child) dup2(pipefd[PIPE_WRITE], STDOUT_FILENO): %s", strerror(errno));
+                signal_premature_exit(service);
+                exit(1);
+            }
+        }
+
+        if (pipe_write != STDERR_FILENO) {
+            fflush(stderr);
+            if (dup2(pipe_write, STDERR_FILENO) == -1) {
+                print_error("(child) dup2(pipefd[PIPE_WRITE], STDERR_FILENO): %s", strerror(errno));
+                signal_premature_exit(service);
+                exit(1);
+            }
+        }
+    }
+
+    if (!pass_listen_sockets(service)) {
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    if (service->chroot_path != NULL && chroot(service->chroot_path) != 0) {
+        print_error("(child) chroot(\"%s\"): %s", service->chroot_path, strerror(errno));
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    if (service->chdir_path != NULL && chdir(service->chdir_path) != 0) {
+        print_error("(child) chdir(\"%s\"): %s", service->chdir_path, strerror(errno));
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    // signal masks are preserved across exec*()
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_UNBLOCK, &mask, NULL) != 0) {
+        print_error("(child) sigprocmask(SIG_UNBLOCK, &mask, NULL): %s", strerror(errno));
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    // drop _supplementary_ group IDs
+    if (service->group != NULL && setgroups(0, NULL) != 0) {
+        print_error("(child) setgroups(0, NULL): %s", strerror(errno));
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    if (service->group != NULL && setgid(service->gid) != 0) {
+        print_error("(child) setgid(%u): %s", service->gid, strerror(errno));
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    if (service->user != NULL && setuid(service->uid) != 0) {
+        print_error("(child) setuid(%u): %s", service->uid, strerror(errno));
+        signal_premature_exit(service);
+        exit(1);
+    }
+
+    // start service
+    execv(service->command, service->command_argv);
+
+    print_error("(child) execv(\"%s\", command_argv): %s", service->command, strerror(errno));
+    signal_premature_exit(service);
+    exit(1);
+}
+
+static void control_reply(struct control_client *client, const char *reply) {
+    // the client might look at the logfile right after the reply
+    flush_runner_log();
+
+    if (send(client->fd, reply, strlen(reply), MSG_NOSIGNAL) == -1 && errno != EPIPE) {
+        print_error("(parent) send(%d, \"%s\"): %s", client->fd, reply, strerror(errno));
+    }
+}
+
+// Replies to all control clients that wait for the given action to finish.
+static void complete_control_requests(struct service *service, enum ControlPending pending, const char *reply) {
+    for (size_t index = 0; index < MAX_CONTROL_CLIENTS; ++ index) {
+        struct control_client *client = &service->control_clients[index];
+        if (client->fd != -1 && client->pending == pending) {
+            control_reply(client, reply);
+            client->pending = CONTROL_PENDING_NONE;
+        }
+    }
+}
+
+// for the duration metrics, which need sub-millisecond resolution
+static double get_monotonic_seconds(void) {
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+        return 0;
+    }
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void set_timer(int timer_fd, uint64_t delay_ms) {
+    if (timer_fd == -1) {
+        return;
+    }
+
+    struct itimerspec spec = {
+        .it_interval = { .tv_sec = 0, .tv_nsec = 0 },
+        .it_value    = {
+            .tv_sec  = delay_ms / 1000,
+            .tv_nsec = (delay_ms % 1000) * 1000000,
+        },
+    };
+
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) != 0) {
+        print_error("(parent) timerfd_settime(%d, ...): %s", timer_fd, strerror(errno));
+    }
+}
+
+// The watchdog deadline is reset by every WATCHDOG=1 message of the service.
+static void reset_watchdog(struct service *service) {
+    set_timer(service->watchdog_timer_fd, service->watchdog_ms);
+}
+
+// Stops the watchdog and shutdown timers once the service process is gone.
+static void disarm_service_timers(struct service *service) {
+    // a zero value disarms the timer
+    set_timer(service->watchdog_timer_fd, 0);
+    set_timer(service->kill_timer_fd, 0);
+}
+
+static void send_signal(pid_t pid, int pidfd, int sig) {
+    if (pidfd != -1) {
+        if (pidfd_send_signal(pidfd, sig, NULL, 0) == 0) {
+            return;
+        }
+
+        if (errno != EBADFD && errno != ENOSYS) {
+            print_error("sending signal %d to PID %d via pidfd: %s", sig, pid, strerror(errno));
+            return;
+        }
+
+        print_error("pidfd_send_signal(%d, %d, NULL, 0) failed, using kill(%d, %d): %s",
+            pidfd, sig, pid, sig, strerror(errno));
+    }
+
+    if (kill(pid, sig) != 0) {
+        print_error("sending signal %d to PID %d: %s", sig, pid, strerror(errno));
+    }
+}
+
+static void signal_service(struct service *service, int sig) {
+    send_signal(service->pid, service->pidfd, sig);
+}
+
+// Sends SIGKILL if a process doesn't exit within --shutdown-timeout. The
+// service process, the old process of an overlap restart, and the standby
+// process each have their own timer, because any one might be reaped first.
+static void arm_kill_timer(const struct service *service, int timer_fd) {
+    if (service->shutdown_timeout_ms >= 0) {
+        // a zero value would disarm the timer
+        set_timer(timer_fd, service->shutdown_timeout_ms > 0 ? (uint64_t)service->shutdown_timeout_ms : 1);
+    }
+}
+
+static void start_kill_timer(struct service *service) {
+    arm_kill_timer(service, service->kill_timer_fd);
+}
+
+static void set_service_event(int epoll_fd, int pidfd, uint64_t data) {
+    if (pidfd == -1) {
+        return;
+    }
+
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data   = { .u64 = data },
+    };
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, pidfd, &event) != 0) {
+        print_error("(parent) epoll_ctl(epoll_fd, EPOLL_CTL_MOD, %d, &event): %s", pidfd, strerror(errno));
+    }
+}
+
+// --restart-mode=OVERLAP: The new service process is ready (and healthy, if
+// health checks are configured), so the pidfile is switched over to it and
+// the old one is stopped.
+static void finish_overlap_restart(struct service *service) {
+    if (service->old_pid <= 0 || service->old_stopping) {
+        return;
+    }
+
+    // write_pidfile() replaces the pidfile atomically
+    if (write_pidfile(service->pidfile, service->pid) != 0) {
+        print_error("write_pidfile(\"%s\", %u): %s", service->pidfile, service->pid, strerror(errno));
+    }
+
+    print_info("%s PID %d is ready, stopping old PID %d", service->name, service->pid, service->old_pid);
+    service->old_stopping = true;
+    send_signal(service->old_pid, service->old_pidfd, SIGTERM);
+    arm_kill_timer(service, service->old_kill_timer_fd);
+}
+
+// Tells a start --wait-ready command how starting the service went.
+static void report_startup(struct service *service, char result) {
+    if (service->startup_fd == -1) {
+        return;
+    }
+
+    if (send(service->startup_fd, &result, 1, MSG_NOSIGNAL) != 1 && errno != EPIPE) {
+        print_error("(parent) send(startup_fd, &result, 1, MSG_NOSIGNAL): %s", strerror(errno));
+    }
+
+    close(service->startup_fd);
+    service->startup_fd = -1;
+}
+
+// The old PID is only reported to the clients waiting right now.
+static void complete_restart_requests(struct service *service, const char *reply) {
+    complete_control_requests(service, CONTROL_PENDING_RESTART, reply);
+    service->restart_old_pid      = 0;
+    service->restart_requested_ms = 0;
+}
+
+// Called once the service process has called execv(), or with --notify once
+// it has sent READY=1. Restart requests are answered with the old and new
+// PID and how long stopping and starting took.
+static void handle_service_started(struct service *service) {
+    const uint64_t now_ms = get_monotonic_ms();
+    uint64_t stop_ms = 0;
+    uint64_t start_from_ms = service->restart_requested_ms;
+
+    if (service->restart_old_pid > 0 && service->exited_ms >= service->restart_requested_ms) {
+        stop_ms = service->exited_ms - service->restart_requested_ms;
+        start_from_ms = service->exited_ms;
+    }
+
+    const uint64_t start_ms = now_ms >= start_from_ms ? now_ms - start_from_ms : 0;
+
+    service->ready = true;
+
+    char reply[CONTROL_MESSAGE_SIZE];
+    snprintf(reply, sizeof(reply), "ok pid=%d old_pid=%d stop_ms=%" PRIu64 " start_ms=%" PRIu64,
+        service->pid, service->restart_old_pid, stop_ms, start_ms);
+    complete_restart_requests(service, reply);
+
+    report_startup(service, STARTUP_READY);
+
+    // otherwise done once the first health check passed
+    if (service->health_check == HEALTH_NONE) {
+        finish_overlap_restart(service);
+    }
+}
+
+// Reads the exec pipe of the service process. EOF means execv() succeeded,
+// a byte means the service process exited before that. Once the service
+// process has exited the pipe is closed in any case.
+static void handle_service_exec(struct service *service, bool exited) {
+    if (service->exec_fd == -1) {
+        return;
+    }
+
+    char failed = 0;
+    ssize_t count = read(service->exec_fd, &failed, 1);
+    if (count < 0) {
+        if (!exited && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        print_error("(parent) read(exec_fd, &failed, 1): %s", strerror(errno));
+    }
+
+    TRACE(service_exec, service->name, service->pid, (int)(count == 1 && failed));
+    flight_record(FLIGHT_EXEC, service->index, service->pid, count == 1 && failed);
+
+    // closing the pipe also removes it from the epoll set
+    if (close(service->exec_fd) != 0) {
+        print_error("(parent) close(exec_fd): %s", strerror(errno));
+    }
+    service->exec_fd = -1;
+
+    if (count == 0 && !service->notify) {
+        handle_service_started(service);
+    } else if (count == 1 && failed && service->supervised) {
+        service->running = false;
+    }
+}
+
+// Forks a service process, or with standby = true a standby process. The
+// read end of the exec pipe of the new process is added to the epoll set as
+// exec_source and stored in *exec_fd_ptr (-1 if there is none).
+static pid_t fork_service(struct service *service, int epoll_fd, bool standby, enum EventSource exec_source, int *exec_fd_ptr) {
+    // The write end of this pipe is closed by execv(), which tells the
+    // service-runner that the service was actually started.
+    int exec_pipe[2] = { -1, -1 };
+    if (pipe2(exec_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        // Not fatal, the service is then considered started right after fork().
+        print_error("(parent) pipe2(exec_pipe, O_CLOEXEC | O_NONBLOCK): %s", strerror(errno));
+    }
+
+    // don't duplicate buffered log lines in the child
+    flush_runner_log();
+
+    TRACE(service_fork, service->name, (int)standby);
+    const pid_t pid = fork();
+
+    if (pid < 0) {
+        print_error("fork for starting service failed: %s", strerror(errno));
+        if (exec_pipe[PIPE_READ] != -1) {
+            close(exec_pipe[PIPE_READ]);
+            close(exec_pipe[PIPE_WRITE]);
+        }
+        return -1;
+    }
+
+    if (pid == 0) {
+        service->exec_fd = exec_pipe[PIPE_WRITE];
+        if (standby) {
+            service->is_standby = true;
+            service->notify_fd  = service->standby_notify_fd;
+            memcpy(service->notify_path, service->standby_notify_path, sizeof(service->notify_path));
+        }
+        exec_service(service);
+    }
+
+    TRACE(service_forked, service->name, pid);
+    flight_record(FLIGHT_FORK, service->index, pid, standby);
+
+    *exec_fd_ptr = -1;
+    if (exec_pipe[PIPE_READ] != -1) {
+        if (close(exec_pipe[PIPE_WRITE]) != 0) {
+            print_error("(parent) close(exec_pipe[PIPE_WRITE]): %s", strerror(errno));
+        }
+
+        if (add_event_source(epoll_fd, exec_pipe[PIPE_READ], EVENT_DATA(service, exec_source))) {
+            *exec_fd_ptr = exec_pipe[PIPE_READ];
+        } else {
+            close(exec_pipe[PIPE_READ]);
+        }
+    }
+
+    return pid;
+}
+
+static int watch_process(int epoll_fd, pid_t pid, uint64_t data) {
+    int pidfd = pidfd_open(pid, 0);
+
+    if (pidfd == -1) {
+        // Not fatal, the exit is still noticed via SIGCHLD.
+        if (errno != ENOSYS) {
+            print_error("(parent) pidfd_open(%u): %s", pid, strerror(errno));
+        }
+    } else if (!add_event_source(epoll_fd, pidfd, data)) {
+        close(pidfd);
+        pidfd = -1;
+    }
+
+    return pidfd;
+}
+
+static bool start_service(struct service *service, int epoll_fd) {
+    int exec_fd = -1;
+    const pid_t pid = fork_service(service, epoll_fd, false, EVENT_EXEC, &exec_fd);
+
+    if (pid < 0) {
+        return false;
+    }
+
+    service->ready        = false;
+    service->reloading    = false;
+    service->status_text[0] = 0;
+    service->health_failures = 0;
+    service->standby_failed  = false;
+
+    reset_watchdog(service);
+
+    // parent: service-runner process
+    if (clock_gettime(CLOCK_MONOTONIC, &service->started_at) != 0) {
+        print_error("(parent) clock_gettime(CLOCK_MONOTONIC, &started_at): %s", strerror(errno));
+        service->started_at.tv_sec  = 0;
+        service->started_at.tv_nsec = 0;
+    }
+
+    service->exec_fd = exec_fd;
+    service->pid     = pid;
+    service->pidfd   = watch_process(epoll_fd, pid, EVENT_DATA(service, EVENT_SERVICE));
+
+    if (service->exec_fd == -1 && !service->notify) {
+        handle_service_started(service);
+    }
+
+    return true;
+}
+
+// --standby: The standby process is stopped with SIGSTOP once it is ready
+// (see --notify), so it doesn't do anything until it is promoted.
+static void park_standby(struct service *service) {
+    if (service->standby_pid <= 0 || service->standby_parked || service->standby_stopping) {
+        return;
+    }
+
+    send_signal(service->standby_pid, service->standby_pidfd, SIGSTOP);
+    service->standby_parked = true;
+    print_info("standby %s PID %d is ready and parked", service->name, service->standby_pid);
+}
+
+// --standby: Starts a new standby process once the service is up. Nothing is
+// done while the service is (re)starting or stopping, or if the last standby
+// process of this service process failed.
+static void start_standby_if_due(struct service *service, int epoll_fd) {
+    if (!service->standby || service->standby_pid > 0 || service->standby_failed ||
+        !service->running || service->failed || service->restart_pending || service->restart_issued ||
+        service->pid <= 0 || !service->ready || service->old_pid > 0) {
+        return;
+    }
+
+    int exec_fd = -1;
+    const pid_t pid = fork_service(service, epoll_fd, true, EVENT_STANDBY_EXEC, &exec_fd);
+
+    if (pid < 0) {
+        service->standby_failed = true;
+        return;
+    }
+
+    print_info("starting standby %s process PID %d...", service->name, pid);
+
+    service->standby_pid      = pid;
+    service->standby_pidfd    = watch_process(epoll_fd, pid, EVENT_DATA(service, EVENT_STANDBY));
+    service->standby_exec_fd  = exec_fd;
+    service->standby_parked   = false;
+    service->standby_stopping = false;
+}
+
+// Like handle_service_exec(), but for the standby process.
+static void handle_standby_exec(struct service *service, bool exited) {
+    if (service->standby_exec_fd == -1) {
+        return;
+    }
+
+    char failed = 0;
+    ssize_t count = read(service->standby_exec_fd, &failed, 1);
+    if (count < 0) {
+        if (!exited && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        print_error("(parent) read(standby_exec_fd, &failed, 1): %s", strerror(errno));
+    }
+
+    // closing the pipe also removes it from the epoll set
+    if (close(service->standby_exec_fd) != 0) {
+        print_error("(parent) close(standby_exec_fd): %s", strerror(errno));
+    }
+    service->standby_exec_fd = -1;
+}
+
+// Stops the standby process, e.g. because after an explicit restart it
+// would still run the old version of the service.
+static void stop_standby(struct service *service) {
+    if (service->standby_pid <= 0 || service->standby_stopping) {
+        return;
+    }
+
+    service->standby_stopping = true;
+    service->standby_parked   = false;
+    send_signal(service->standby_pid, service->standby_pidfd, SIGTERM);
+
+    // a stopped process only handles SIGTERM once it is continued
+    send_signal(service->standby_pid, service->standby_pidfd, SIGCONT);
+    arm_kill_timer(service, service->standby_kill_timer_fd);
+}
+
+static void reap_standby(struct service *service) {
+    if (service->standby_pid <= 0) {
+        return;
+    }
+
+    int standby_status = 0;
+    pid_t result = waitpid(service->standby_pid, &standby_status, WNOHANG);
+    if (result == 0) {
+        // still running
+        return;
+    }
+
+    handle_standby_exec(service, true);
+    set_timer(service->standby_kill_timer_fd, 0);
+
+    if (result < 0) {
+        print_error("(parent) waitpid(%d, &standby_status, WNOHANG): %s", service->standby_pid, strerror(errno));
+    } else if (service->standby_stopping) {
+        print_info("standby %s PID %d stopped", service->name, service->standby_pid);
+    } else if (WIFSIGNALED(standby_status)) {
+        print_error("standby %s PID %d was killed by signal %d", service->name, service->standby_pid, WTERMSIG(standby_status));
+    } else {
+        print_error("standby %s PID %d exited with status %d", service->name, service->standby_pid, WEXITSTATUS(standby_status));
+    }
+
+    // Don't start the next one before the service itself was (re)started,
+    // so a failing standby process doesn't end up in a fork loop.
+    if (!service->standby_stopping) {
+        service->standby_failed = true;
+    }
+
+    // closing the pidfd also removes it from the epoll set
+    if (service->standby_pidfd != -1 && close(service->standby_pidfd) != 0) {
+        print_error("(parent) close(standby_pidfd): %s", strerror(errno));
+    }
+    service->standby_pidfd    = -1;
+    service->standby_pid      = 0;
+    service->standby_parked   = false;
+    service->standby_stopping = false;
+}
+
+// --standby: The service process exited unexpectedly, so the parked standby
+// process takes over. It keeps its NOTIFY_SOCKET, therefore the notify
+// sockets swap places, too.
+static void promote_standby(struct service *service, int epoll_fd) {
+    service->pid   = service->standby_pid;
+    service->pidfd = service->standby_pidfd;
+    service->standby_pid    = 0;
+    service->standby_pidfd  = -1;
+    service->standby_parked = false;
+
+    set_service_event(epoll_fd, service->pidfd, EVENT_DATA(service, EVENT_SERVICE));
+
+    if (service->standby_notify_fd != -1) {
+        char notify_path[sizeof(service->notify_path)];
+        const int notify_fd = service->notify_fd;
+
+        memcpy(notify_path, service->notify_path, sizeof(notify_path));
+        memcpy(service->notify_path, service->standby_notify_path, sizeof(service->notify_path));
+        memcpy(service->standby_notify_path, notify_path, sizeof(service->standby_notify_path));
+
+        service->notify_fd         = service->standby_notify_fd;
+        service->standby_notify_fd = notify_fd;
+
+        set_service_event(epoll_fd, service->notify_fd, EVENT_DATA(service, EVENT_NOTIFY));
+        set_service_event(epoll_fd, service->standby_notify_fd, EVENT_DATA(service, EVENT_STANDBY_NOTIFY));
+    }
+
+    if (write_pidfile(service->pidfile, service->pid) != 0) {
+        print_error("write_pidfile(\"%s\", %u): %s", service->pidfile, service->pid, strerror(errno));
+    }
+
+    ++ service->restart_count;
+    print_info("promoting standby %s PID %d", service->name, service->pid);
+
+    if (clock_gettime(CLOCK_MONOTONIC, &service->started_at) != 0) {
+        print_error("(parent) clock_gettime(CLOCK_MONOTONIC, &started_at): %s", strerror(errno));
+        service->started_at.tv_sec  = 0;
+        service->started_at.tv_nsec = 0;
+    }
+
+    service->reloading       = false;
+    service->status_text[0]  = 0;
+    service->health_failures = 0;
+
+    reset_watchdog(service);
+    send_signal(service->pid, service->pidfd, SIGCONT);
+
+    // it already is initialized
+    handle_service_started(service);
+}
+
+static void terminate_for_restart(struct service *service) {
+    service->restart_issued = true;
+    signal_service(service, SIGTERM);
+    start_kill_timer(service);
+}
+
+// --restart-mode=OVERLAP: Start the new service process while the old one
+// keeps running. See finish_overlap_restart().
+static bool start_overlap_restart(struct service *service, int epoll_fd) {
+    service->old_pid      = service->pid;
+    service->old_pidfd    = service->pidfd;
+    service->old_stopping = false;
+    service->pid   = 0;
+    service->pidfd = -1;
+
+    set_service_event(epoll_fd, service->old_pidfd, EVENT_DATA(service, EVENT_OLD_SERVICE));
+    disarm_service_timers(service);
+
+    ++ service->restart_count;
+    print_info("starting new %s process while old PID %d keeps running...", service->name, service->old_pid);
+
+    return start_service(service, epoll_fd);
+}
+
+static void reap_old_service(struct service *service) {
+    if (service->old_pid <= 0) {
+        return;
+    }
+
+    int old_status = 0;
+    pid_t result = waitpid(service->old_pid, &old_status, WNOHANG);
+    if (result == 0) {
+        // still running
+        return;
+    }
+
+    if (result < 0) {
+        print_error("(parent) waitpid(%d, &old_status, WNOHANG): %s", service->old_pid, strerror(errno));
+    } else if (WIFSIGNALED(old_status)) {
+        print_info("old %s PID %d was killed by signal %d", service->name, service->old_pid, WTERMSIG(old_status));
+    } else {
+        print_info("old %s PID %d exited with status %d", service->name, service->old_pid, WEXITSTATUS(old_status));
+    }
+
+    set_timer(service->old_kill_timer_fd, 0);
+
+    // closing the pidfd also removes it from the epoll set
+    if (service->old_pidfd != -1 && close(service->old_pidfd) != 0) {
+        print_error("(parent) close(old_pidfd): %s", strerror(errno));
+    }
+    service->old_pidfd    = -1;
+    service->old_pid      = 0;
+    service->old_stopping = false;
+}
+
+// --restart-mode=OVERLAP: The new service process exited before it was
+// ready, so the old one just keeps running.
+static void abort_overlap_restart(struct service *service, int epoll_fd) {
+    print_error("new %s process exited before becoming ready, keeping old PID %d", service->name, service->old_pid);
+
+    service->pid       = service->old_pid;
+    service->pidfd     = service->old_pidfd;
+    service->old_pid   = 0;
+    service->old_pidfd = -1;
+    service->ready     = true;
+    service->running   = true;
+
+    set_service_event(epoll_fd, service->pidfd, EVENT_DATA(service, EVENT_SERVICE));
+    reset_watchdog(service);
+
+    complete_restart_requests(service, "error new service process exited before becoming ready");
+}
+
+static void handle_kill_timeout(struct service *service) {
+    uint64_t expirations = 0;
+    if (read(service->kill_timer_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) read(kill_timer_fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+        }
+        return;
+    }
+
+    // only if SIGTERM was sent to it
+    if (service->pid > 0 && (!service->running || service->restart_issued)) {
+        print_error("%s didn't exit within %" PRId64 ".%03" PRId64 " seconds, sending SIGKILL",
+            service->name, service->shutdown_timeout_ms / 1000, service->shutdown_timeout_ms % 1000);
+        signal_service(service, SIGKILL);
+    }
+}
+
+static void handle_old_kill_timeout(struct service *service) {
+    uint64_t expirations = 0;
+    if (read(service->old_kill_timer_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) read(old_kill_timer_fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+        }
+        return;
+    }
+
+    if (service->old_pid > 0 && service->old_stopping) {
+        print_error("old %s PID %d didn't exit within %" PRId64 ".%03" PRId64 " seconds, sending SIGKILL",
+            service->name, service->old_pid, service->shutdown_timeout_ms / 1000, service->shutdown_timeout_ms % 1000);
+        send_signal(service->old_pid, service->old_pidfd, SIGKILL);
+    }
+}
+
+static void handle_standby_kill_timeout(struct service *service) {
+    uint64_t expirations = 0;
+    if (read(service->standby_kill_timer_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) read(standby_kill_timer_fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+        }
+        return;
+    }
+
+    if (service->standby_pid > 0 && service->standby_stopping) {
+        print_error("standby %s PID %d didn't exit within %" PRId64 ".%03" PRId64 " seconds, sending SIGKILL",
+            service->name, service->standby_pid, service->shutdown_timeout_ms / 1000, service->shutdown_timeout_ms % 1000);
+        send_signal(service->standby_pid, service->standby_pidfd, SIGKILL);
+    }
+}
+
+// Called with the result of a health probe. Restarts the service after
+// --health-retries failed probes in a row.
+static void finish_health_probe(struct service *service, bool healthy, const char *reason) {
+    const pid_t probed_pid = service->health_probe_service_pid;
+
+    set_timer(service->health_timeout_fd, 0);
+
+    if (service->health_probe_fd != -1) {
+        // closing the socket also removes it from the epoll set
+        close(service->health_probe_fd);
+        service->health_probe_fd = -1;
+    }
+    service->health_probe_service_pid = 0;
+    service->health_probe_timed_out   = false;
+
+    if (probed_pid != service->pid || !service->running || service->restart_issued) {
+        // the probed service process is gone or is being stopped anyway
+        return;
+    }
+
+    if (healthy) {
+        finish_overlap_restart(service);
+
+        if (service->health_failures > 0) {
+            print_info("%s is healthy again", service->name);
+            service->health_failures = 0;
+        }
+        return;
+    }
+
+    ++ service->health_failures;
+    print_error("health check of %s failed (%u/%u): %s",
+        service->name, service->health_failures, service->health_retries, reason);
+
+    if (service->health_failures >= service->health_retries) {
+        print_error("%s is unhealthy, restarting...", service->name);
+        service->health_failures = 0;
+        terminate_for_restart(service);
+    }
+}
+
+static void start_health_probe(struct service *service, int epoll_fd) {
+    service->health_probe_service_pid = service->pid;
+    service->health_probe_timed_out   = false;
+
+    if (service->health_check == HEALTH_CMD) {
+        // Like the crash reporter the probe must not inherit the blocked
+        // signals of the service-runner.
+        posix_spawnattr_t attr;
+        sigset_t mask;
+        sigemptyset(&mask);
+
+        int result = posix_spawnattr_init(&attr);
+        if (result != 0) {
+            print_error("(parent) posix_spawnattr_init(&attr): %s", strerror(result));
+            service->health_probe_service_pid = 0;
+            return;
+        }
+
+        posix_spawnattr_setsigmask(&attr, &mask);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+        pid_t probe_pid = 0;
+        result = posix_spawn(&probe_pid, "/bin/sh", NULL, &attr,
+            (char*[]){ "sh", "-c", (char*)service->health_target, NULL },
+            environ);
+
+        posix_spawnattr_destroy(&attr);
+
+        if (result != 0) {
+            finish_health_probe(service, false, strerror(result));
+            return;
+        }
+
+        service->health_probe_pid   = probe_pid;
+        service->health_probe_pidfd = pidfd_open(probe_pid, 0);
+
+        if (service->health_probe_pidfd == -1) {
+            // Not fatal, the exit is still noticed via SIGCHLD.
+            if (errno != ENOSYS) {
+                print_error("(parent) pidfd_open(%u): %s", probe_pid, strerror(errno));
+            }
+        } else if (!add_event_source(epoll_fd, service->health_probe_pidfd, EVENT_DATA(service, EVENT_HEALTH_PROBE))) {
+            close(service->health_probe_pidfd);
+            service->health_probe_pidfd = -1;
+        }
+    } else {
+        // non-blocking connect(), the result is reported via EPOLLOUT
+        int sock = socket(service->health_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock == -1) {
+            print_error("(parent) socket(%d, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0): %s",
+                service->health_addr.ss_family, strerror(errno));
+            service->health_probe_service_pid = 0;
+            return;
+        }
+
+        if (connect(sock, (const struct sockaddr*)&service->health_addr, service->health_addr_len) == 0) {
+            close(sock);
+            finish_health_probe(service, true, NULL);
+            return;
+        }
+
+        if (errno != EINPROGRESS) {
+            const int errnum = errno;
+            close(sock);
+            finish_health_probe(service, false, strerror(errnum));
+            return;
+        }
+
+        struct epoll_event event = {
+            .events = EPOLLOUT,
+            .data   = { .u64 = EVENT_DATA(service, EVENT_HEALTH_PROBE) },
+        };
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event) != 0) {
+            print_error("(parent) epoll_ctl(epoll_fd, EPOLL_CTL_ADD, %d, &event): %s", sock, strerror(errno));
+            close(sock);
+            service->health_probe_service_pid = 0;
+            return;
+        }
+
+        service->health_probe_fd = sock;
+    }
+
+    set_timer(service->health_timeout_fd, service->health_timeout_ms);
+}
+
+static void handle_health_timer(struct service *service, int epoll_fd) {
+    uint64_t expirations = 0;
+    if (read(service->health_timer_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) read(health_timer_fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+        }
+        return;
+    }
+
+    if (service->health_probe_fd != -1 || service->health_probe_pid > 0) {
+        // previous probe still running
+        return;
+    }
+
+    if (service->pid <= 0 || !service->running || service->restart_issued || (service->notify && !service->ready)) {
+        return;
+    }
+
+    const uint64_t now_ms = get_monotonic_ms();
+    const uint64_t started_ms = (uint64_t)service->started_at.tv_sec * 1000 + service->started_at.tv_nsec / 1000000;
+    if (now_ms - started_ms < service->health_start_period_ms) {
+        return;
+    }
+
+    start_health_probe(service, epoll_fd);
+}
+
+static void handle_health_probe_connect(struct service *service) {
+    int errnum = 0;
+    socklen_t len = sizeof(errnum);
+
+    if (getsockopt(service->health_probe_fd, SOL_SOCKET, SO_ERROR, &errnum, &len) != 0) {
+        errnum = errno;
+    }
+
+    finish_health_probe(service, errnum == 0, errnum == 0 ? NULL : strerror(errnum));
+}
+
+static void reap_health_probe(struct service *service) {
+    if (service->health_probe_pid <= 0) {
+        return;
+    }
+
+    int probe_status = 0;
+    pid_t result = waitpid(service->health_probe_pid, &probe_status, WNOHANG);
+    if (result == 0) {
+        // still running
+        return;
+    }
+
+    if (service->health_probe_pidfd != -1 && close(service->health_probe_pidfd) != 0) {
+        print_error("(parent) close(health_probe_pidfd): %s", strerror(errno));
+    }
+    service->health_probe_pidfd = -1;
+    service->health_probe_pid   = 0;
+
+    char reason[64];
+    if (result < 0) {
+        snprintf(reason, sizeof(reason), "waitpid(): %s", strerror(errno));
+        finish_health_probe(service, false, reason);
+    } else if (service->health_probe_timed_out) {
+        finish_health_probe(service, false, "timeout");
+    } else if (WIFSIGNALED(probe_status)) {
+        snprintf(reason, sizeof(reason), "command was killed by signal %d", WTERMSIG(probe_status));
+        finish_health_probe(service, false, reason);
+    } else if (WEXITSTATUS(probe_status) != 0) {
+        snprintf(reason, sizeof(reason), "command exited with status %d", WEXITSTATUS(probe_status));
+        finish_health_probe(service, false, reason);
+    } else {
+        finish_health_probe(service, true, NULL);
+    }
+}
+
+static void handle_health_probe_timeout(struct service *service) {
+    uint64_t expirations = 0;
+    if (read(service->health_timeout_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) read(health_timeout_fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+        }
+        return;
+    }
+
+    if (service->health_probe_pid > 0) {
+        // reported once the probe process is reaped
+        service->health_probe_timed_out = true;
+        send_signal(service->health_probe_pid, service->health_probe_pidfd, SIGKILL);
+    } else if (service->health_probe_fd != -1) {
+        finish_health_probe(service, false, "timeout");
+    }
+}
+
+static void handle_watchdog_timeout(struct service *service) {
+    uint64_t expirations = 0;
+    if (read(service->watchdog_timer_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) read(watchdog_timer_fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+        }
+        return;
+    }
+
+    if (service->pid <= 0 || !service->running || service->restart_issued) {
+        // already exiting anyway
+        return;
+    }
+
+    print_error("%s missed its watchdog deadline of %" PRIu64 ".%03" PRIu64 " seconds, restarting...",
+        service->name, service->watchdog_ms / 1000, service->watchdog_ms % 1000);
+    terminate_for_restart(service);
+}
+
+static void close_log_pipe(struct service *service) {
+    // No new service instance will be started, so the pipe reaches EOF
+    // once the last process writing to it is gone.
+    if (service->pipefd[PIPE_WRITE] != -1) {
+        if (close(service->pipefd[PIPE_WRITE]) != 0) {
+            print_error("(parent) close(pipefd[PIPE_WRITE]): %s", strerror(errno));
+        }
+        service->pipefd[PIPE_WRITE] = -1;
+    }
+}
+
+static void reopen_logfile(struct service *service, const char *new_logfile_path) {
+    const double start = get_monotonic_seconds();
+    int new_logfile_fd = open_logfile(new_logfile_path, service->chown_logfile, service->logfile_uid, service->logfile_gid);
+    if (new_logfile_fd != -1) {
+        replace_logfile(&service->logfile_fd, new_logfile_fd);
+
+        if (new_logfile_path != service->logfile_path) {
+            assert(strlen(new_logfile_path) < sizeof(service->logfile_path_buf));
+            strcpy(service->logfile_path_buf, new_logfile_path);
+        }
+    }
+
+    observe_histogram(&service->metrics.logrotate_seconds, get_monotonic_seconds() - start);
+}
+
+static bool restart_service(struct service *service, int epoll_fd) {
+    service->restart_pending = false;
+    service->restart_due     = false;
+    ++ service->restart_count;
+    print_info("restarting %s...", service->name);
+
+    if (service->exited_ms > 0) {
+        observe_histogram(&service->metrics.restart_delay_seconds, (double)(get_monotonic_ms() - service->exited_ms) / 1000);
+    }
+
+    return start_service(service, epoll_fd);
+}
+
+// The service is restarted once the restart delay is over and the crash
+// reporter (if any) has finished.
+static bool restart_if_due(struct service *service, int epoll_fd) {
+    if (!service->restart_pending || !service->restart_due || service->report_pid > 0) {
+        return true;
+    }
+
+    return restart_service(service, epoll_fd);
+}
+
+// Start over with the initial restart delay if the service ran for long
+// enough to be considered stable.
+static void reset_restart_delay_if_stable(struct service *service) {
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+        print_error("(parent) clock_gettime(CLOCK_MONOTONIC, &now): %s", strerror(errno));
+        return;
+    }
+
+    const int64_t uptime_ms =
+        (int64_t)(now.tv_sec  - service->started_at.tv_sec) * 1000 +
+        (now.tv_nsec - service->started_at.tv_nsec) / 1000000;
+
+    if (uptime_ms >= 0 && (uint64_t)uptime_ms >= service->restart_sleep_reset_ms) {
+        service->restart_delay_ms = service->restart_sleep_ms;
+    }
+}
+
+// Returns the delay before restarting a crashed service and advances the
+// exponential backoff.
+static uint64_t next_restart_delay(struct service *service) {
+    uint64_t delay_ms = service->restart_delay_ms;
+
+    double next_delay_ms = (double)delay_ms * service->restart_sleep_factor;
+    if (next_delay_ms > (double)service->restart_sleep_max_ms) {
+        service->restart_delay_ms = service->restart_sleep_max_ms;
+    } else {
+        service->restart_delay_ms = (uint64_t)next_delay_ms;
+    }
+
+    if (service->restart_sleep_jitter > 0 && delay_ms > 0) {
+        // So that many services crashing at the same time (e.g. because of a
+        // shared backend) don't restart in lockstep.
+        const uint64_t range_ms = delay_ms * service->restart_sleep_jitter / 100;
+        delay_ms = delay_ms - range_ms + (uint64_t)random() % (2 * range_ms + 1);
+    }
+
+    return delay_ms;
+}
+
+static bool schedule_restart(struct service *service, uint64_t delay_ms) {
+    struct itimerspec spec = {
+        .it_interval = { .tv_sec = 0, .tv_nsec = 0 },
+        .it_value    = {
+            .tv_sec  = delay_ms / 1000,
+            .tv_nsec = (delay_ms % 1000) * 1000000,
+        },
+    };
+
+    if (timerfd_settime(service->restart_timer_fd, 0, &spec, NULL) != 0) {
+        print_error("(parent) timerfd_settime(restart_timer_fd, ...): %s", strerror(errno));
+        return false;
+    }
+
+    service->restart_pending = true;
+    service->restart_due     = false;
+    return true;
+}
+
+static void cancel_restart(struct service *service) {
+    struct itimerspec spec = {
+        .it_interval = { .tv_sec = 0, .tv_nsec = 0 },
+        .it_value    = { .tv_sec = 0, .tv_nsec = 0 },
+    };
+
+    if (timerfd_settime(service->restart_timer_fd, 0, &spec, NULL) != 0) {
+        print_error("(parent) timerfd_settime(restart_timer_fd, ...): %s", strerror(errno));
+    }
+
+    service->restart_pending = false;
+    service->restart_due     = false;
+}
+
+// Starts the crash reporter. It is supervised by the event loop like the
+// service itself, so log output keeps being forwarded while it runs.
+static void start_crash_report(struct service *service, int epoll_fd, const char *code_str, int param) {
+    char param_str[24];
+    int result = snprintf(param_str, sizeof(param_str), "%d", param);
+    assert(result > 0 && result < sizeof(param_str));
+
+    // The crash reporter must not inherit the blocked signals of the
+    // service-runner.
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    sigemptyset(&mask);
+
+    result = posix_spawnattr_init(&attr);
+    if (result != 0) {
+        print_error("(parent) posix_spawnattr_init(&attr): %s", strerror(result));
+        return;
+    }
+
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    pid_t report_pid = 0;
+    result = posix_spawn(&report_pid, service->crash_report, NULL, &attr,
+        (char*[]){ (char*)service->crash_report, (char*)service->name, (char*)code_str, param_str, (char*)service->logfile_path, NULL },
+        environ);
+
+    posix_spawnattr_destroy(&attr);
+
+    if (result != 0) {
+        print_error("(parent) starting crash reporter: %s", strerror(result));
+        return;
+    }
+
+    TRACE(crash_report_start, service->name, report_pid);
+    flight_record(FLIGHT_REPORT_START, service->index, report_pid, 0);
+
+    service->report_pid        = report_pid;
+    service->report_pidfd      = pidfd_open(report_pid, 0);
+    service->report_started_ms = get_monotonic_ms();
+
+    if (service->report_pidfd == -1) {
+        // Not fatal, the exit is still noticed via SIGCHLD.
+        if (errno != ENOSYS) {
+            print_error("(parent) pidfd_open(%u): %s", report_pid, strerror(errno));
+        }
+    } else if (!add_event_source(epoll_fd, service->report_pidfd, EVENT_DATA(service, EVENT_REPORT))) {
+        close(service->report_pidfd);
+        service->report_pidfd = -1;
+    }
+
+    if (service->report_timer_fd != -1) {
+        struct itimerspec spec = {
+            .it_interval = { .tv_sec = 0,                             .tv_nsec = 0 },
+            .it_value    = { .tv_sec = service->crash_report_timeout, .tv_nsec = 0 },
+        };
+
+        if (timerfd_settime(service->report_timer_fd, 0, &spec, NULL) != 0) {
+            print_error("(parent) timerfd_settime(report_timer_fd, ...): %s", strerror(errno));
+        }
+    }
+}
+
+static bool reap_crash_report(struct service *service, int epoll_fd) {
+    if (service->report_pid <= 0) {
+        return true;
+    }
+
+    int report_status = 0;
+    pid_t result = waitpid(service->report_pid, &report_status, WNOHANG);
+    if (result == 0) {
+        // still running
+        return true;
+    }
+
+    TRACE(crash_report_stop, service->name, service->report_pid, result == -1 ? -1 : report_status);
+    flight_record(FLIGHT_REPORT_STOP, service->index, service->report_pid, result == -1 ? -1 : report_status);
+
+    if (result < 0) {
+        print_error("(parent) waitpid(%u, &report_status, WNOHANG): %s", service->report_pid, strerror(errno));
+    } else if (WIFSIGNALED(report_status)) {
+        print_error("crash report PID %u exited with signal %d", service->report_pid, WTERMSIG(report_status));
+    } else if (WEXITSTATUS(report_status) != 0) {
+        print_error("crash report PID %u exited with status %d", service->report_pid, WEXITSTATUS(report_status));
+    } else {
+        print_info("crash report PID %u finished", service->report_pid);
+    }
+
+    observe_histogram(&service->metrics.crash_report_seconds, (double)(get_monotonic_ms() - service->report_started_ms) / 1000);
+
+    if (service->report_pidfd != -1 && close(service->report_pidfd) != 0) {
+        print_error("(parent) close(report_pidfd): %s", strerror(errno));
+    }
+    service->report_pidfd = -1;
+    service->report_pid   = 0;
+
+    if (service->report_timer_fd != -1) {
+        struct itimerspec spec = {
+            .it_interval = { .tv_sec = 0, .tv_nsec = 0 },
+            .it_value    = { .tv_sec = 0, .tv_nsec = 0 },
+        };
+
+        if (timerfd_settime(service->report_timer_fd, 0, &spec, NULL) != 0) {
+            print_error("(parent) timerfd_settime(report_timer_fd, ...): %s", strerror(errno));
+        }
+    }
+
+    return restart_if_due(service, epoll_fd);
+}
+
+static void handle_crash_report_timeout(struct service *service) {
+    uint64_t expirations = 0;
+    if (read(service->report_timer_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) read(report_timer_fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+        }
+        return;
+    }
+
+    if (service->report_pid > 0) {
+        print_error("crash report PID %u didn't finish within %u seconds, sending SIGKILL",
+            service->report_pid, service->crash_report_timeout);
+        send_signal(service->report_pid, service->report_pidfd, SIGKILL);
+    }
+}
+
+// Returns false if the service was already restarted --start-limit-burst
+// times within --start-limit-interval, otherwise records the restart.
+static bool check_start_limit(struct service *service) {
+    if (service->start_limit_burst == 0) {
+        return true;
+    }
+
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+        print_error("(parent) clock_gettime(CLOCK_MONOTONIC, &now): %s", strerror(errno));
+        return true;
+    }
+
+    // restart_times is a ring buffer of the last start_limit_burst restarts,
+    // restart_times_index points to the oldest one. Unused entries are 0.
+    const uint64_t now_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    const uint64_t oldest_ms = service->restart_times[service->restart_times_index];
+
+    if (oldest_ms != 0 && now_ms - oldest_ms < service->start_limit_interval_ms) {
+        return false;
+    }
+
+    service->restart_times[service->restart_times_index] = now_ms;
+    service->restart_times_index = (service->restart_times_index + 1) % service->start_limit_burst;
+
+    return true;
+}
+
+static void reset_start_limit(struct service *service) {
+    if (service->restart_times != NULL) {
+        memset(service->restart_times, 0, sizeof(*service->restart_times) * service->start_limit_burst);
+    }
+    service->restart_times_index = 0;
+}
+
+static void enter_failed_state(struct service *service) {
+    stop_standby(service);
+
+    print_error("%s was restarted %u times within %" PRIu64 ".%03" PRIu64 " seconds -> giving up, use the restart command to try again",
+        service->name, service->start_limit_burst,
+        service->start_limit_interval_ms / 1000, service->start_limit_interval_ms % 1000);
+
+    service->failed = true;
+    complete_restart_requests(service, "error service entered failed state");
+
+    // The pidfiles are kept and the failed state is marked by an additional
+    // file so that the status command can report the failure.
+    int fd = open(service->pidfile_failed, O_CREAT | O_WRONLY | O_CLOEXEC | O_TRUNC, 0644);
+    if (fd == -1) {
+        print_error("open(\"%s\", O_CREAT | O_WRONLY | O_CLOEXEC | O_TRUNC, 0644): %s",
+            service->pidfile_failed, strerror(errno));
+    } else {
+        close(fd);
+    }
+}
+
+static bool leave_failed_state(struct service *service, int epoll_fd) {
+    service->failed = false;
+    service->restart_delay_ms = service->restart_sleep_ms;
+    reset_start_limit(service);
+
+    if (unlink(service->pidfile_failed) != 0 && errno != ENOENT) {
+        print_error("unlink(\"%s\"): %s", service->pidfile_failed, strerror(errno));
+    }
+
+    return restart_service(service, epoll_fd);
+}
+
+static bool handle_service_exit(struct service *service, int epoll_fd, int service_status) {
+    const bool stopping = !service->running;
+
+    // The exec pipe might not have been handled yet if the service exited
+    // right after starting.
+    handle_service_exec(service, true);
+    service->exited_ms = get_monotonic_ms();
+
+    // start --wait-ready fails if the service exits before it is ready
+    report_startup(service, STARTUP_FAILED);
+    disarm_service_timers(service);
+
+    // closing the pidfd also removes it from the epoll set
+    if (service->pidfd != -1 && close(service->pidfd) != 0) {
+        print_error("(parent) close(pidfd): %s", strerror(errno));
+    }
+    service->pidfd = -1;
+    service->pid   = 0;
+
+    bool crash = false;
+    int param = 0;
+    const char *code_str = NULL;
+    const char *name = service->name;
+
+    if (WIFEXITED(service_status)) {
+        param = WEXITSTATUS(service_status);
+        code_str = "EXITED";
+        ++ service->metrics.exits[METRICS_EXIT_EXITED];
+        service->exit_status = param;
+        service->exit_signal = 0;
+
+        if (param == 0) {
+            print_info("%s exited normally", name);
+            if (!service->restart_issued && service->restart != RESTART_ALWAYS) {
+                service->running = false;
+            }
+        } else {
+            print_error("%s exited with error status %d", name, param);
+            crash = true;
+            if (!service->restart_issued && service->restart == RESTART_NEVER) {
+                service->running = false;
+            }
+        }
+    } else if (WIFSIGNALED(service_status)) {
+        param = WTERMSIG(service_status);
+        service->exit_status = -1;
+        service->exit_signal = param;
+        if (WCOREDUMP(service_status)) {
+            code_str = "DUMPED";
+            ++ service->metrics.exits[METRICS_EXIT_DUMPED];
+            print_error("%s was killed by signal %d and dumped core", name, param);
+            crash = true;
+            if (!service->restart_issued && service->restart == RESTART_NEVER) {
+                service->running = false;
+            }
+        } else {
+            code_str = "KILLED";
+            ++ service->metrics.exits[METRICS_EXIT_KILLED];
+            print_error("%s was killed by signal %d", name, param);
+
+            switch (param) {
+                case SIGTERM:
+                case SIGKILL:
+                    // We send SIGTERM for restart and SIGKILL after
+                    // --shutdown-timeout, so only do this in these cases.
+                    if (service->restart_issued) {
+                        // don't set running to false
+                        break;
+                    }
+                case SIGQUIT:
+                case SIGINT:
+                    if (service->restart != RESTART_ALWAYS) {
+                        print_info("service stopped via signal %d -> don't restart", param);
+                        service->running = false;
+                    }
+                    break;
+
+                default:
+                    crash = true;
+                    if (!service->restart_issued && service->restart == RESTART_NEVER) {
+                        service->running = false;
+                    }
+                    break;
+            }
+        }
+    } else {
+        assert(false);
+    }
+
+    const bool restart_issued = service->restart_issued;
+    service->restart_issued = false;
+
+    if (service->old_pid > 0 && !service->old_stopping && !stopping) {
+        abort_overlap_restart(service, epoll_fd);
+        return true;
+    }
+
+    reset_restart_delay_if_stable(service);
+
+    if (crash && service->crash_report != NULL) {
+        start_crash_report(service, epoll_fd, code_str, param);
+    }
+
+    if (!service->running) {
+        stop_standby(service);
+        close_log_pipe(service);
+        return true;
+    }
+
+    if (!restart_issued && !check_start_limit(service)) {
+        enter_failed_state(service);
+        return true;
+    }
+
+    if (service->standby_parked) {
+        promote_standby(service, epoll_fd);
+        return true;
+    }
+
+    if (crash) {
+        const uint64_t delay_ms = next_restart_delay(service);
+        if (delay_ms > 0) {
+            print_info("%s will be restarted in %" PRIu64 ".%03" PRIu64 " seconds",
+                service->name, delay_ms / 1000, delay_ms % 1000);
+
+            // the crash reporter and the restart delay run concurrently
+            return schedule_restart(service, delay_ms);
+        }
+    }
+
+    service->restart_pending = true;
+    service->restart_due     = true;
+    return restart_if_due(service, epoll_fd);
+}
+
+static bool reap_service(struct service *service, int epoll_fd) {
+    if (service->pid <= 0) {
+        return true;
+    }
+
+    // waitid() doesn't work for some reason! always produces ECHLD
+    int service_status = 0;
+    pid_t result = waitpid(service->pid, &service_status, WNOHANG);
+    if (result == 0) {
+        // still running
+        return true;
+    }
+
+    TRACE(service_reaped, service->name, service->pid, result == -1 ? -1 : service_status);
+    flight_record(FLIGHT_REAP, service->index, service->pid, result == -1 ? -1 : service_status);
+
+    if (result == -1) {
+        print_error("(parent) waitpid(%d, &service_status, WNOHANG): %s", service->pid, strerror(errno));
+
+        // The exit status is lost, but the process is gone.
+        handle_service_exec(service, true);
+        disarm_service_timers(service);
+
+        if (service->pidfd != -1 && close(service->pidfd) != 0) {
+            print_error("(parent) close(pidfd): %s", strerror(errno));
+        }
+        service->pidfd = -1;
+        service->pid   = 0;
+        service->restart_issued = false;
+
+        if (!service->running) {
+            close_log_pipe(service);
+            return true;
+        }
+
+        service->restart_pending = true;
+        service->restart_due     = true;
+        return restart_if_due(service, epoll_fd);
+    }
+
+    return handle_service_exit(service, epoll_fd, service_status);
+}
+
+// The service whose logfile the runner currently logs to. A supervisor has
+// to switch stdout/stderr to the logfile of the service it is handling.
+static const struct service *log_service = NULL;
+
+static void select_service_log(const struct service *service) {
+    if (log_service == service) {
+        return;
+    }
+
+    log_service = service;
+    log_format  = service->log_format;
+    flight_service_index = service->index;
+
+    if (service->supervised) {
+        fflush(stdout);
+        if (dup2(service->logfile_fd, STDOUT_FILENO) == -1) {
+            print_error("(parent) dup2(logfile_fd, STDOUT_FILENO): %s", strerror(errno));
+        }
+
+        fflush(stderr);
+        if (dup2(service->logfile_fd, STDERR_FILENO) == -1) {
+            print_error("(parent) dup2(logfile_fd, STDERR_FILENO): %s", strerror(errno));
+        }
+    }
+}
+
+static bool handle_signal(struct service *service, int epoll_fd, int sig) {
+    switch (sig) {
+        case SIGTERM:
+        case SIGQUIT:
+        case SIGINT:
+            if (service->failed) {
+                print_info("received signal %d, stopping failed service-runner", sig);
+                service->failed  = false;
+                service->running = false;
+                close_log_pipe(service);
+            } else if (service->restart_pending) {
+                print_info("received signal %d while waiting to restart %s -> don't restart", sig, service->name);
+                cancel_restart(service);
+                service->running = false;
+                stop_standby(service);
+                close_log_pipe(service);
+            } else if (service->pid <= 0) {
+                print_error("received signal %d, but service process is not running -> ignored", sig);
+            } else {
+                print_info("received signal %d, forwarding to service PID %u", sig, service->pid);
+                service->running = false;
+                signal_service(service, sig);
+
+                if (service->old_pid > 0 && !service->old_stopping) {
+                    print_info("forwarding signal %d to old service PID %u", sig, service->old_pid);
+                    service->old_stopping = true;
+                    send_signal(service->old_pid, service->old_pidfd, sig);
+                    arm_kill_timer(service, service->old_kill_timer_fd);
+                }
+
+                stop_standby(service);
+                start_kill_timer(service);
+            }
+            break;
+
+        case SIGUSR1:
+            if (service->failed) {
+                print_info("received signal %d, restarting failed service...", sig);
+                if (!leave_failed_state(service, epoll_fd)) {
+                    return false;
+                }
+            } else if (service->restart_pending) {
+                print_info("received signal %d, restarting service...", sig);
+                stop_standby(service);
+                cancel_restart(service);
+                service->restart_pending = true;
+                service->restart_due     = true;
+                if (!restart_if_due(service, epoll_fd)) {
+                    return false;
+                }
+            } else if (service->pid <= 0) {
+                print_error("received signal %d, but service process is not running -> ignored", sig);
+            } else if (!service->running) {
+                print_error("received signal %d, but service is already stopping -> ignored", sig);
+            } else if (service->old_pid > 0) {
+                print_error("received signal %d, but service is already restarting -> ignored", sig);
+            } else if (service->restart_mode == RESTART_MODE_OVERLAP) {
+                print_info("received signal %d, restarting service...", sig);
+                stop_standby(service);
+                if (!start_overlap_restart(service, epoll_fd)) {
+                    return false;
+                }
+            } else {
+                print_info("received signal %d, restarting service...", sig);
+                stop_standby(service);
+                terminate_for_restart(service);
+            }
+            break;
+
+        case SIGHUP:
+            print_info("received signal %d, performing manual log-rotate...", sig);
+            reopen_logfile(service, service->logfile_path);
+            break;
+
+        case SIGCHLD:
+            if (!reap_service(service, epoll_fd) || !reap_crash_report(service, epoll_fd)) {
+                return false;
+            }
+            reap_health_probe(service);
+            reap_old_service(service);
+            reap_standby(service);
+            break;
+
+        default:
+            print_error("received unexpected signal %d -> ignored", sig);
+            break;
+    }
+
+    return true;
+}
+
+// Writes the flight recorder of the service to PIDFILE.dump and stores that
+// path in dump_path.
+static bool dump_flight_recorder(struct service *service, char *dump_path, size_t dump_path_size) {
+    int count = snprintf(dump_path, dump_path_size, "%s.dump", service->pidfile);
+    if (count < 0 || (size_t)count >= dump_path_size) {
+        print_error("(parent) flight recorder dump path too long: %s.dump", service->pidfile);
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    if (flight_dump(dump_path, service->index, service->name) != 0) {
+        const int errnum = errno;
+        print_error("(parent) writing flight recorder to %s: %s", dump_path, strerror(errnum));
+        errno = errnum;
+        return false;
+    }
+
+    print_info("wrote flight recorder to %s", dump_path);
+    return true;
+}
+
+static bool handle_signals(struct service *services, size_t count, int epoll_fd, int signal_fd) {
+    for (;;) {
+        // a signalfd read returns as many pending signals as fit
+        struct signalfd_siginfo infos[SIGNAL_BATCH_SIZE];
+        ssize_t rcount = read(signal_fd, infos, sizeof(infos));
+
+        if (rcount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                print_error("(parent) read(signal_fd, infos, sizeof(infos)): %s", strerror(errno));
+            }
+            return true;
+        }
+
+        if (rcount == 0 || rcount % sizeof(infos[0]) != 0) {
+            print_error("(parent) read(signal_fd, infos, sizeof(infos)): short read of %zd bytes", rcount);
+            return true;
+        }
+
+        const size_t info_count = rcount / sizeof(infos[0]);
+        for (size_t info_index = 0; info_index < info_count; ++ info_index) {
+            const uint32_t signo = infos[info_index].ssi_signo;
+
+            TRACE(signal, (int)signo);
+            flight_record(FLIGHT_SIGNAL, FLIGHT_NO_SERVICE, signo, 0);
+
+            if (signo == SIGUSR2) {
+                for (size_t index = 0; index < count; ++ index) {
+                    struct service *service = &services[index];
+                    if (!service->finished) {
+                        char dump_path[PATH_MAX];
+                        select_service_log(service);
+                        dump_flight_recorder(service, dump_path, sizeof(dump_path));
+                    }
+                }
+                continue;
+            }
+
+            // a supervisor forwards signals to all of its services
+            for (size_t index = 0; index < count; ++ index) {
+                struct service *service = &services[index];
+                if (service->finished || (signo == SIGHUP && !service->manual_logrotate)) {
+                    continue;
+                }
+
+                select_service_log(service);
+                if (!handle_signal(service, epoll_fd, signo)) {
+                    return false;
+                }
+            }
+        }
+
+        if (info_count < SIGNAL_BATCH_SIZE) {
+            return true;
+        }
+    }
+}
+
+// The control socket is a SOCK_SEQPACKET unix domain socket next to the
+// pidfile. Every message is one request, e.g. "stop", and gets exactly one
+// reply starting with "ok" or "error". Replies to stop and restart are
+// deferred until the action has finished.
+static void open_control_socket(struct service *service, int epoll_fd) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int count = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.sock", service->pidfile);
+    if (count < 0 || (size_t)count >= sizeof(addr.sun_path)) {
+        print_error("control socket path %s.sock is too long -> no control socket, only signals are supported", service->pidfile);
+        return;
+    }
+
+    int control_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (control_fd == -1) {
+        print_error("(parent) socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0): %s", strerror(errno));
+        return;
+    }
+
+    // left behind by a service-runner that was killed
+    if (unlink(addr.sun_path) != 0 && errno != ENOENT) {
+        print_error("(parent) unlink(\"%s\"): %s", addr.sun_path, strerror(errno));
+    }
+
+    if (bind(control_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        print_error("(parent) bind(control_fd, \"%s\"): %s", addr.sun_path, strerror(errno));
+        close(control_fd);
+        return;
+    }
+
+    strcpy(service->control_path, addr.sun_path);
+
+    if (chmod(addr.sun_path, 0600) != 0) {
+        print_error("(parent) chmod(\"%s\", 0600): %s", addr.sun_path, strerror(errno));
+    }
+
+    if (listen(control_fd, MAX_CONTROL_CLIENTS) != 0) {
+        print_error("(parent) listen(control_fd, %d): %s", MAX_CONTROL_CLIENTS, strerror(errno));
+        close(control_fd);
+        return;
+    }
+
+    if (!add_event_source(epoll_fd, control_fd, EVENT_DATA(service, EVENT_CONTROL))) {
+        close(control_fd);
+        return;
+    }
+
+    service->control_fd = control_fd;
+}
+
+static void close_control_client(struct control_client *client) {
+    // closing the socket also removes it from the epoll set
+    if (close(client->fd) != 0) {
+        print_error("(parent) close(%d): %s", client->fd, strerror(errno));
+    }
+    client->fd      = -1;
+    client->pending = CONTROL_PENDING_NONE;
+}
+
+static void accept_control_clients(struct service *service, int epoll_fd) {
+    for (;;) {
+        int client_fd = accept4(service->control_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                print_error("(parent) accept4(control_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC): %s", strerror(errno));
+            }
+            return;
+        }
+
+        size_t index = 0;
+        while (index < MAX_CONTROL_CLIENTS && service->control_clients[index].fd != -1) {
+            ++ index;
+        }
+
+        struct control_client client = {
+            .fd      = client_fd,
+            .pending = CONTROL_PENDING_NONE,
+        };
+
+        if (index == MAX_CONTROL_CLIENTS) {
+            control_reply(&client, "error too many control connections");
+            close(client_fd);
+            continue;
+        }
+
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data   = { .u64 = EVENT_DATA(service, EVENT_CONTROL_CLIENT) | (uint64_t)index << 8 },
+        };
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) != 0) {
+            print_error("(parent) epoll_ctl(epoll_fd, EPOLL_CTL_ADD, %d, &event): %s", client_fd, strerror(errno));
+            close(client_fd);
+            continue;
+        }
+
+        service->control_clients[index] = client;
+    }
+}
+
+static enum ServiceState get_service_state(const struct service *service) {
+    if (service->failed) {
+        return SERVICE_STATE_FAILED;
+    }
+
+    if (service->restart_pending) {
+        return SERVICE_STATE_RESTARTING;
+    }
+
+    if (!service->running) {
+        return SERVICE_STATE_STOPPING;
+    }
+
+    if (service->pid <= 0 || (service->notify && !service->ready)) {
+        return SERVICE_STATE_STARTING;
+    }
+
+    return service->reloading ? SERVICE_STATE_RELOADING : SERVICE_STATE_RUNNING;
+}
+
+// The state record PIDFILE.state is a small shared memory file that status
+// maps and reads without talking to the service-runner. It is written with a
+// sequence lock: seq is odd while an update is in progress. A new file is
+// renamed into place, so readers of a stale one never see it shrink.
+static void open_state_record(struct service *service) {
+    char tmpfile[PATH_MAX];
+    int count = snprintf(service->state_path, sizeof(service->state_path), "%s.state", service->pidfile);
+    if (count < 0 || (size_t)count >= sizeof(service->state_path) ||
+        snprintf(tmpfile, sizeof(tmpfile), "%s.%d.tmp", service->state_path, getpid()) >= (int)sizeof(tmpfile)) {
+        print_error("state record path %s.state is too long -> no state record", service->pidfile);
+        service->state_path[0] = 0;
+        return;
+    }
+
+    int fd = open(tmpfile, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        print_error("(parent) open(\"%s\", O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644): %s", tmpfile, strerror(errno));
+        service->state_path[0] = 0;
+        return;
+    }
+
+    // the umask might have removed read permissions for other users
+    if (fchmod(fd, 0644) != 0) {
+        print_error("(parent) fchmod(\"%s\", 0644): %s", tmpfile, strerror(errno));
+    }
+
+    if (ftruncate(fd, SERVICE_STATE_SIZE) != 0) {
+        print_error("(parent) ftruncate(\"%s\", %d): %s", tmpfile, SERVICE_STATE_SIZE, strerror(errno));
+        goto error;
+    }
+
+    struct service_state *record = mmap(NULL, SERVICE_STATE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (record == MAP_FAILED) {
+        print_error("(parent) mmap(\"%s\"): %s", tmpfile, strerror(errno));
+        goto error;
+    }
+
+    record->magic       = SERVICE_STATE_MAGIC;
+    record->version     = SERVICE_STATE_VERSION;
+    record->exit_status = -1;
+    record->flags       = service->supervised ? SERVICE_STATE_FLAG_SUPERVISED : 0;
+
+    if (rename(tmpfile, service->state_path) != 0) {
+        print_error("(parent) rename(\"%s\", \"%s\"): %s", tmpfile, service->state_path, strerror(errno));
+        munmap(record, SERVICE_STATE_SIZE);
+        goto error;
+    }
+
+    close(fd);
+    service->state_record = record;
+    return;
+
+error:
+    close(fd);
+    unlink(tmpfile);
+    service->state_path[0] = 0;
+}
+
+static void close_state_record(struct service *service) {
+    if (service->state_record != NULL) {
+        munmap(service->state_record, SERVICE_STATE_SIZE);
+        service->state_record = NULL;
+    }
+
+    if (service->state_path[0] && unlink(service->state_path) != 0 && errno != ENOENT) {
+        print_error("(parent) unlink(\"%s\"): %s", service->state_path, strerror(errno));
+    }
+    service->state_path[0] = 0;
+}
+
+// started_at is monotonic, this is the wall clock time of it
+static int64_t get_service_start_time(const struct service *service) {
+    struct timespec now;
+    if (service->pid <= 0 || clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+        return 0;
+    }
+
+    return (int64_t)time(NULL) - (int64_t)(now.tv_sec - service->started_at.tv_sec);
+}
+
+static void publish_service_state(const struct service *service) {
+    struct service_state *record = service->state_record;
+    if (record == NULL) {
+        return;
+    }
+
+    const int64_t started_at = get_service_start_time(service);
+
+    // status compares these with the processes named in the pidfiles, which
+    // unlike their wall clock start times doesn't break when the clock is
+    // stepped. /proc is only read when one of the processes changes.
+    pid_t last_pid = record->last_pid;
+    uint64_t last_start_ticks = record->last_start_ticks;
+    if (service->pid > 0 && service->pid != last_pid) {
+        last_pid = service->pid;
+        if (get_process_start_ticks(last_pid, &last_start_ticks) != 0) {
+            last_start_ticks = 0;
+        }
+    }
+
+    uint64_t runner_start_ticks = record->runner_start_ticks;
+    if (service->runner_pid != record->runner_pid && get_process_start_ticks(service->runner_pid, &runner_start_ticks) != 0) {
+        runner_start_ticks = 0;
+    }
+
+    const uint32_t seq = record->seq;
+    __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->state              = get_service_state(service);
+    record->pid                = service->pid;
+    record->runner_pid         = service->runner_pid;
+    record->started_at         = started_at;
+    record->restarts           = service->restart_count;
+    record->exit_status        = service->exit_status;
+    record->exit_signal        = service->exit_signal;
+    record->bytes_logged       = service->metrics.log_bytes;
+    record->last_pid           = last_pid;
+    record->last_start_ticks   = last_start_ticks;
+    record->runner_start_ticks = runner_start_ticks;
+    // the last byte always stays 0
+    strncpy(record->logfile, service->logfile_path, sizeof(record->logfile) - 1);
+
+    __atomic_store_n(&record->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void record_service_state(struct service *service) {
+    const enum ServiceState state = get_service_state(service);
+    if ((int)state != service->flight_state) {
+        flight_record(FLIGHT_STATE, service->index, service->flight_state, state);
+        service->flight_state = state;
+    }
+}
+
+// Control requests reuse the code paths of the corresponding signals, so
+// both ways of controlling the service-runner behave the same.
+static bool handle_control_request(struct service *service, int epoll_fd, struct control_client *client, const char *request) {
+    char reply[CONTROL_MESSAGE_SIZE];
+
+    if (strcmp(request, "ping") == 0) {
+        control_reply(client, "ok pong");
+    } else if (strcmp(request, "status") == 0) {
+        // The logfile path and the status text of the service might contain
+        // spaces, so they come last. The logfile ends at " status=".
+        snprintf(reply, sizeof(reply), "ok state=%s pid=%d runner_pid=%d restarts=%u logfile=%s%s%s",
+            get_service_state_name(get_service_state(service)), service->pid, service->runner_pid, service->restart_count,
+            service->logfile_path, service->status_text[0] ? " status=" : "", service->status_text);
+        control_reply(client, reply);
+    } else if (strcmp(request, "stop") == 0) {
+        print_info("received stop request via control socket");
+        if (!handle_signal(service, epoll_fd, SIGTERM)) {
+            return false;
+        }
+
+        if (service->running) {
+            control_reply(client, "error service process is not running");
+        } else {
+            client->pending = CONTROL_PENDING_STOP;
+        }
+    } else if (strcmp(request, "restart") == 0 || strcmp(request, "restart nowait") == 0) {
+        print_info("received restart request via control socket");
+
+        // same cases as in handle_signal()
+        if (service->failed || service->restart_pending || (service->pid > 0 && service->running)) {
+            // without --wait the client doesn't wait for the new process
+            const bool nowait = request[strlen("restart")] != 0;
+            if (!nowait) {
+                // answered by handle_service_started()
+                client->pending = CONTROL_PENDING_RESTART;
+                service->restart_old_pid      = service->pid;
+                service->restart_requested_ms = get_monotonic_ms();
+            }
+
+            if (!handle_signal(service, epoll_fd, SIGUSR1)) {
+                return false;
+            }
+
+            if (nowait) {
+                control_reply(client, "ok restarting");
+            }
+        } else if (!service->running) {
+            control_reply(client, "error service is already stopping");
+        } else {
+            control_reply(client, "error service process is not running");
+        }
+    } else if (strcmp(request, "logrotate") == 0) {
+        if (!service->manual_logrotate) {
+            control_reply(client, "error manual log-rotation is not enabled, see --manual-logrotate");
+        } else {
+            print_info("received logrotate request via control socket");
+            if (!handle_signal(service, epoll_fd, SIGHUP)) {
+                return false;
+            }
+            snprintf(reply, sizeof(reply), "ok %s", service->logfile_path);
+            control_reply(client, reply);
+        }
+    } else if (strcmp(request, "debug-dump") == 0) {
+        char dump_path[PATH_MAX];
+        if (dump_flight_recorder(service, dump_path, sizeof(dump_path))) {
+            int count = snprintf(reply, sizeof(reply), "ok %s", dump_path);
+            if (count < 0 || (size_t)count >= sizeof(reply)) {
+                // the dump was written, the client can derive the path itself
+                snprintf(reply, sizeof(reply), "ok");
+            }
+        } else {
+            snprintf(reply, sizeof(reply), "error writing flight recorder: %s", strerror(errno));
+        }
+        control_reply(client, reply);
+    } else if (strncmp(request, "signal ", strlen("signal ")) == 0) {
+        const char *arg = request + strlen("signal ");
+        char *endptr = NULL;
+        long sig = strtol(arg, &endptr, 10);
+
+        if (!*arg || *endptr || sig <= 0 || sig >= NSIG) {
+            // only echo the start of it, it is untrusted input
+            snprintf(reply, sizeof(reply), "error illegal signal: %.64s", arg);
+            control_reply(client, reply);
+        } else if (service->pid <= 0) {
+            control_reply(client, "error service process is not running");
+        } else {
+            print_info("received request to send signal %ld to service PID %u via control socket", sig, service->pid);
+            signal_service(service, (int)sig);
+            control_reply(client, "ok");
+        }
+    } else {
+        snprintf(reply, sizeof(reply), "error unknown request: %.64s", request);
+        control_reply(client, reply);
+    }
+
+    return true;
+}
+
+static bool handle_control_client(struct service *service, int epoll_fd, size_t index, uint32_t events) {
+    struct control_client *client = &service->control_clients[index];
+    if (client->fd == -1) {
+        return true;
+    }
+
+    if (!(events & EPOLLIN)) {
+        // EPOLLHUP or EPOLLERR
+        close_control_client(client);
+        return true;
+    }
+
+    char request[CONTROL_MESSAGE_SIZE];
+    ssize_t count = recv(client->fd, request, sizeof(request) - 1, 0);
+    if (count < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) recv(%d, request, sizeof(request) - 1, 0): %s", client->fd, strerror(errno));
+            close_control_client(client);
+        }
+        return true;
+    }
+
+    if (count == 0) {
+        // client has gone away, pending replies are discarded
+        close_control_client(client);
+        return true;
+    }
+
+    // allow for a trailing newline, e.g. when using socat
+    while (count > 0 && (request[count - 1] == '\n' || request[count - 1] == '\r')) {
+        -- count;
+    }
+    request[count] = 0;
+
+    if (client->pending != CONTROL_PENDING_NONE) {
+        control_reply(client, "error another request is still in progress");
+        return true;
+    }
+
+    return handle_control_request(service, epoll_fd, client, request);
+}
+
+static void close_control_socket(struct service *service, int status) {
+    for (size_t index = 0; index < MAX_CONTROL_CLIENTS; ++ index) {
+        struct control_client *client = &service->control_clients[index];
+        if (client->fd == -1) {
+            continue;
+        }
+
+        switch (client->pending) {
+            case CONTROL_PENDING_STOP:
+                if (status != 0) {
+                    control_reply(client, "error service-runner failed");
+                } else if (service->supervised) {
+                    // the supervisor keeps running, the client must not wait for it
+                    control_reply(client, "ok stopped supervised");
+                } else {
+                    control_reply(client, "ok stopped");
+                }
+                break;
+
+            case CONTROL_PENDING_RESTART:
+                control_reply(client, "error service was stopped");
+                break;
+
+            case CONTROL_PENDING_NONE:
+                break;
+        }
+
+        close_control_client(client);
+    }
+
+    if (service->control_fd != -1) {
+        close(service->control_fd);
+        service->control_fd = -1;
+    }
+
+    if (service->control_path[0] && unlink(service->control_path) != 0 && errno != ENOENT) {
+        print_error("unlink(\"%s\"): %s", service->control_path, strerror(errno));
+    }
+    service->control_path[0] = 0;
+}
+
+static void update_metrics(struct service *service) {
+    service->metrics.up         = service->pid > 0;
+    service->metrics.start_time = get_service_start_time(service);
+    service->metrics.restarts   = service->restart_count;
+    service->metrics.wakeups    = loop_wakeups;
+}
+
+static void write_service_metrics_file(struct service *service) {
+    update_metrics(service);
+    if (write_metrics_file(service->metrics_path, service->name, &service->metrics) != 0) {
+        print_error("(parent) writing metrics file %s: %s", service->metrics_path, strerror(errno));
+    }
+}
+
+// --metrics=unix:PATH serves the metrics via HTTP on a unix domain stream
+// socket, e.g. behind a reverse proxy scraped by Prometheus. --metrics=FILE
+// writes them periodically for the textfile collector of the node exporter.
+static void open_metrics(struct service *service, int epoll_fd) {
+    if (service->metrics_path == NULL) {
+        return;
+    }
+
+    if (!service->metrics_unix) {
+        int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd == -1) {
+            print_error("(parent) timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC): %s", strerror(errno));
+            return;
+        }
+
+        const struct timespec interval = {
+            .tv_sec  = METRICS_FILE_INTERVAL_MS / 1000,
+            .tv_nsec = (METRICS_FILE_INTERVAL_MS % 1000) * 1000000,
+        };
+        // first written right after the service was started
+        const struct itimerspec spec = { .it_interval = interval, .it_value = { .tv_sec = 0, .tv_nsec = 1000000 } };
+
+        if (timerfd_settime(timer_fd, 0, &spec, NULL) != 0) {
+            print_error("(parent) timerfd_settime(metrics_fd, ...): %s", strerror(errno));
+            close(timer_fd);
+            return;
+        }
+
+        if (!add_event_source(epoll_fd, timer_fd, EVENT_DATA(service, EVENT_METRICS_TIMER))) {
+            close(timer_fd);
+            return;
+        }
+
+        service->metrics_fd = timer_fd;
+        return;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    // the length was checked by prepare_service()
+    strcpy(addr.sun_path, service->metrics_path);
+
+    int metrics_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (metrics_fd == -1) {
+        print_error("(parent) socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0): %s", strerror(errno));
+        return;
+    }
+
+    // left behind by a service-runner that was killed
+    struct stat meta;
+    if (lstat(addr.sun_path, &meta) == 0 && S_ISSOCK(meta.st_mode) && unlink(addr.sun_path) != 0) {
+        print_error("(parent) unlink(\"%s\"): %s", addr.sun_path, strerror(errno));
+    }
+
+    if (bind(metrics_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        print_error("(parent) bind(metrics_fd, \"%s\"): %s", addr.sun_path, strerror(errno));
+        close(metrics_fd);
+        return;
+    }
+
+    if (listen(metrics_fd, MAX_METRICS_CLIENTS) != 0) {
+        print_error("(parent) listen(metrics_fd, %d): %s", MAX_METRICS_CLIENTS, strerror(errno));
+        close(metrics_fd);
+        unlink(addr.sun_path);
+        return;
+    }
+
+    if (!add_event_source(epoll_fd, metrics_fd, EVENT_DATA(service, EVENT_METRICS))) {
+        close(metrics_fd);
+        unlink(addr.sun_path);
+        return;
+    }
+
+    service->metrics_fd = metrics_fd;
+}
+
+// The response is small enough to fit into the socket buffer, so it is sent
+// right away without waiting for the request.
+static void send_metrics(struct service *service, int client_fd) {
+    update_metrics(service);
+
+    size_t size = 0;
+    char *body = format_metrics(service->name, &service->metrics, &size);
+    if (body == NULL) {
+        print_error("(parent) formatting metrics: %s", strerror(errno));
+        return;
+    }
+
+    char header[160];
+    const int header_size = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n"
+        "\r\n", size);
+    assert(header_size > 0 && (size_t)header_size < sizeof(header));
+
+    struct iovec iov[] = {
+        { .iov_base = header, .iov_len = header_size },
+        { .iov_base = body,   .iov_len = size },
+    };
+    const struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+
+    const ssize_t count = sendmsg(client_fd, &msg, MSG_NOSIGNAL);
+    if (count < 0) {
+        if (errno != EPIPE && errno != ECONNRESET) {
+            print_error("(parent) sendmsg(metrics client): %s", strerror(errno));
+        }
+    } else if ((size_t)count < header_size + size) {
+        print_error("(parent) sendmsg(metrics client): short write of %zd of %zu bytes", count, header_size + size);
+    }
+
+    shutdown(client_fd, SHUT_WR);
+    free(body);
+}
+
+static void accept_metrics_clients(struct service *service, int epoll_fd) {
+    for (;;) {
+        int client_fd = accept4(service->metrics_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                print_error("(parent) accept4(metrics_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC): %s", strerror(errno));
+            }
+            return;
+        }
+
+        send_metrics(service, client_fd);
+
+        // Closing the socket before the client has sent its request would
+        // reset the connection, which might discard the response. So it is
+        // closed once the client has closed its end.
+        // If all slots are taken the oldest client goes instead of the new
+        // one. It got its response long ago and just never closed its end.
+        size_t index = 0;
+        size_t oldest = 0;
+        while (index < MAX_METRICS_CLIENTS && service->metrics_clients[index] != -1) {
+            if (service->metrics_clients_ms[index] < service->metrics_clients_ms[oldest]) {
+                oldest = index;
+            }
+            ++ index;
+        }
+
+        if (index == MAX_METRICS_CLIENTS) {
+            index = oldest;
+            // closing the socket also removes it from the epoll set
+            close(service->metrics_clients[index]);
+            service->metrics_clients[index] = -1;
+        }
+
+        struct epoll_event event = {
+            .events = EPOLLIN | EPOLLRDHUP,
+            .data   = { .u64 = EVENT_DATA(service, EVENT_METRICS_CLIENT) | (uint64_t)index << 8 },
+        };
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) != 0) {
+            print_error("(parent) epoll_ctl(epoll_fd, EPOLL_CTL_ADD, metrics client, &event): %s", strerror(errno));
+            close(client_fd);
+            continue;
+        }
+
+        service->metrics_clients[index]    = client_fd;
+        service->metrics_clients_ms[index] = get_monotonic_ms();
+    }
+}
+
+static void handle_metrics_client(struct service *service, size_t index) {
+    if (index >= MAX_METRICS_CLIENTS || service->metrics_clients[index] == -1) {
+        return;
+    }
+
+    const int client_fd = service->metrics_clients[index];
+    char buf[1024];
+    for (;;) {
+        const ssize_t count = read(client_fd, buf, sizeof(buf));
+        if (count > 0 || (count < 0 && errno == EINTR)) {
+            continue;
+        }
+
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+
+        break;
+    }
+
+    // closing the socket also removes it from the epoll set
+    close(client_fd);
+    service->metrics_clients[index] = -1;
+}
+
+static void handle_metrics_timer(struct service *service) {
+    uint64_t expirations = 0;
+    if (read(service->metrics_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            print_error("(parent) read(metrics_fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+        }
+        return;
+    }
+
+    write_service_metrics_file(service);
+}
+
+static void close_metrics(struct service *service) {
+    for (size_t index = 0; index < MAX_METRICS_CLIENTS; ++ index) {
+        if (service->metrics_clients[index] != -1) {
+            close(service->metrics_clients[index]);
+            service->metrics_clients[index] = -1;
+        }
+    }
+
+    if (service->metrics_fd == -1) {
+        return;
+    }
+
+    close(service->metrics_fd);
+    service->metrics_fd = -1;
+
+    if (service->metrics_unix) {
+        if (unlink(service->metrics_path) != 0 && errno != ENOENT) {
+            print_error("(parent) unlink(\"%s\"): %s", service->metrics_path, strerror(errno));
+        }
+    } else {
+        // the last values stay for the collector, up is 0 by now
+        write_service_metrics_file(service);
+    }
+}
+
+// The notify socket implements the readiness part of the sd_notify()
+// protocol. The service finds it via $NOTIFY_SOCKET.
+// The standby process gets its own notify socket, so that its messages
+// aren't mistaken for ones of the service process.
+static bool open_notify_socket(struct service *service, int epoll_fd, bool standby) {
+    const char *suffix = standby ? ".standby.notify" : ".notify";
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int count = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", service->pidfile, suffix);
+    if (count < 0 || (size_t)count >= sizeof(addr.sun_path)) {
+        print_error("notify socket path %s%s is too long", service->pidfile, suffix);
+        return false;
+    }
+
+    int notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (notify_fd == -1) {
+        print_error("(parent) socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0): %s", strerror(errno));
+        return false;
+    }
+
+    // left behind by a service-runner that was killed
+    if (unlink(addr.sun_path) != 0 && errno != ENOENT) {
+        print_error("(parent) unlink(\"%s\"): %s", addr.sun_path, strerror(errno));
+    }
+
+    if (bind(notify_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        print_error("(parent) bind(notify_fd, \"%s\"): %s", addr.sun_path, strerror(errno));
+        close(notify_fd);
+        return false;
+    }
+
+    strcpy(standby ? service->standby_notify_path : service->notify_path, addr.sun_path);
+
+    // The service needs to be able to write to the socket after dropping
+    // privileges.
+    if ((service->user != NULL || service->group != NULL) &&
+        chown(addr.sun_path, service->user != NULL ? service->uid : (uid_t)-1, service->group != NULL ? service->gid : (gid_t)-1) != 0) {
+        print_error("(parent) chown(\"%s\", %d, %d): %s", addr.sun_path,
+            service->user != NULL ? (int)service->uid : -1,
+            service->group != NULL ? (int)service->gid : -1,
+            strerror(errno));
+    }
+
+    const mode_t mode = service->user == NULL && service->group != NULL ? 0660 : 0600;
+    if (chmod(addr.sun_path, mode) != 0) {
+        print_error("(parent) chmod(\"%s\", 0%o): %s", addr.sun_path, mode, strerror(errno));
+    }
+
+    if (!add_event_source(epoll_fd, notify_fd, EVENT_DATA(service, standby ? EVENT_STANDBY_NOTIFY : EVENT_NOTIFY))) {
+        close(notify_fd);
+        return false;
+    }
+
+    if (standby) {
+        service->standby_notify_fd = notify_fd;
+    } else {
+        service->notify_fd = notify_fd;
+    }
+
+    return true;
+}
+
+static void handle_notify_message(struct service *service, const char *line, size_t len) {
+    if (len == strlen("READY=1") && memcmp(line, "READY=1", len) == 0) {
+        if (service->reloading) {
+            service->reloading = false;
+            print_info("%s finished reloading", service->name);
+        }
+
+        if (!service->ready && service->pid > 0) {
+            service->ready = true;
+            print_info("%s is ready", service->name);
+            handle_service_started(service);
+        }
+    } else if (len == strlen("RELOADING=1") && memcmp(line, "RELOADING=1", len) == 0) {
+        service->reloading = true;
+        print_info("%s is reloading", service->name);
+    } else if (len == strlen("WATCHDOG=1") && memcmp(line, "WATCHDOG=1", len) == 0) {
+        if (service->pid > 0) {
+            reset_watchdog(service);
+        }
+    } else if (len == strlen("WATCHDOG=trigger") && memcmp(line, "WATCHDOG=trigger", len) == 0) {
+        if (service->pid > 0 && service->watchdog_timer_fd != -1) {
+            print_info("%s triggered its watchdog", service->name);
+            set_timer(service->watchdog_timer_fd, 1);
+        }
+    } else if (len >= strlen("STATUS=") && memcmp(line, "STATUS=", strlen("STATUS=")) == 0) {
+        const size_t status_len = len - strlen("STATUS=");
+        const size_t copy_len = status_len < sizeof(service->status_text) - 1 ? status_len : sizeof(service->status_text) - 1;
+        memcpy(service->status_text, line + strlen("STATUS="), copy_len);
+        service->status_text[copy_len] = 0;
+    }
+    // other variables are ignored
+}
+
+static void handle_notify(struct service *service, bool standby) {
+    const int notify_fd = standby ? service->standby_notify_fd : service->notify_fd;
+
+    for (;;) {
+        char buf[4096];
+        ssize_t count = recv(notify_fd, buf, sizeof(buf), 0);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                print_error("(parent) recv(notify_fd, buf, sizeof(buf), 0): %s", strerror(errno));
+            }
+            return;
+        }
+
+        // newline separated VARIABLE=VALUE assignments
+        const char *ptr = buf;
+        const char *end = buf + count;
+        while (ptr < end) {
+            const char *line_end = memchr(ptr, '\n', end - ptr);
+            if (line_end == NULL) {
+                line_end = end;
+            }
+            if (!standby) {
+                handle_notify_message(service, ptr, line_end - ptr);
+            } else if (line_end - ptr == strlen("READY=1") && memcmp(ptr, "READY=1", line_end - ptr) == 0) {
+                // everything else is only of interest once it is promoted
+                park_standby(service);
+            }
+            ptr = line_end + 1;
+        }
+    }
+}
+
+static void close_notify_socket(struct service *service) {
+    if (service->notify_fd != -1) {
+        close(service->notify_fd);
+        service->notify_fd = -1;
+    }
+
+    if (service->notify_path[0] && unlink(service->notify_path) != 0 && errno != ENOENT) {
+        print_error("unlink(\"%s\"): %s", service->notify_path, strerror(errno));
+    }
+    service->notify_path[0] = 0;
+
+    if (service->standby_notify_fd != -1) {
+        close(service->standby_notify_fd);
+        service->standby_notify_fd = -1;
+    }
+
+    if (service->standby_notify_path[0] && unlink(service->standby_notify_path) != 0 && errno != ENOENT) {
+        print_error("unlink(\"%s\"): %s", service->standby_notify_path, strerror(errno));
+    }
+    service->standby_notify_path[0] = 0;
+}
+
+static void handle_log_pipe(struct service *service, uint32_t events) {
+    if (service->pipefd[PIPE_READ] == -1) {
+        return;
+    }
+
+    if (events & EPOLLIN) {
+        if (service->do_logrotate && service->logrotate_timer.fd == -1) {
+            // fallback for when there is no timerfd
+            // Only format the logfile name once the next possible change of
+            // it is due, not for every chunk of log data.
+            bool logrotate_due = false;
+            struct timespec mono_now;
+            if (clock_gettime(CLOCK_MONOTONIC, &mono_now) != 0) {
+                print_error("(parent) clock_gettime(CLOCK_MONOTONIC, &mono_now): %s", strerror(errno));
+                logrotate_due = true;
+            } else {
+                logrotate_due =
+                    mono_now.tv_sec > service->logrotate_deadline.tv_sec || (
+                    mono_now.tv_sec == service->logrotate_deadline.tv_sec &&
+                    mono_now.tv_nsec >= service->logrotate_deadline.tv_nsec);
+            }
+
+            if (logrotate_due) {
+                char new_logfile_path[PATH_MAX];
+
+                if (format_logfile(service->logfile, time(NULL), new_logfile_path, sizeof(new_logfile_path)) &&
+                    strcmp(new_logfile_path, service->logfile_path) != 0) {
+                    reopen_logfile(service, new_logfile_path);
+                }
+
+                if (!get_logrotate_deadline(service->logrotate_interval, &service->logrotate_deadline)) {
+                    print_error("(parent) clock_gettime(): %s", strerror(errno));
+                }
+            }
+        }
+
+        // handle log messages
+        const int pipe_read = service->pipefd[PIPE_READ];
+        TRACE(splice_entry, service->name);
+        const ssize_t count = splice(pipe_read, NULL, service->logfile_fd, NULL, SPLICE_SIZE, SPLICE_F_NONBLOCK);
+        TRACE(splice_return, service->name, count);
+        if (count >= 0) {
+            flight_record(FLIGHT_SPLICE, service->index, count, 0);
+        }
+        if (count > 0) {
+            service->metrics.log_bytes += count;
+            ++ service->metrics.log_chunks;
+        } else if (count < 0 && errno != EINTR && errno != EAGAIN) {
+            if (errno == EINVAL) {
+                // The docker volume filesystem doesn't support splice()
+                // and sendfile() doesn't support out_fd with O_APPEND set
+                // -> manual read()/write()
+                char buf[BUFSIZ];
+                ssize_t rcount = read(pipe_read, buf, sizeof(buf));
+                if (rcount < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        print_error("(parent) read(pipefd[PIPE_READ], buf, sizeof(buf)): %s",
+                            strerror(errno));
+                    }
+                } else {
+                    size_t offset = 0;
+                    while (offset < rcount) {
+                        ssize_t wcount = write(service->logfile_fd, buf + offset, rcount - offset);
+                        if (wcount < 0) {
+                            if (errno == EINTR) {
+                                continue;
+                            }
+                            print_error("(parent) write(logfile_fd, buf + offset, rcount - offset): %s",
+                                strerror(errno));
+                            break;
+                        }
+
+                        offset += wcount;
+                    }
+                    flight_record(FLIGHT_SPLICE, service->index, offset, 0);
+                    service->metrics.log_bytes += offset;
+                    ++ service->metrics.log_chunks;
+                }
+            } else {
+                flight_record(FLIGHT_SPLICE, service->index, -errno, 0);
+                print_error("(parent) splice(pipefd[PIPE_READ], NULL, logfile_fd, NULL, SPLICE_SIZE, SPLICE_F_NONBLOCK): %s",
+                    strerror(errno));
+            }
+        }
+    } else if (events & (EPOLLHUP | EPOLLERR)) {
+        // drained and all writers are gone
+        if (close(service->pipefd[PIPE_READ]) != 0) {
+            print_error("(parent) close(pipefd[PIPE_READ]): %s", strerror(errno));
+        }
+        service->pipefd[PIPE_READ] = -1;
+    }
+}
+
+// Opens everything the service needs in the event loop.
+static bool setup_service(struct service *service, int epoll_fd) {
+    for (size_t index = 0; index < MAX_CONTROL_CLIENTS; ++ index) {
+        service->control_clients[index].fd      = -1;
+        service->control_clients[index].pending = CONTROL_PENDING_NONE;
+    }
+
+    for (size_t index = 0; index < MAX_METRICS_CLIENTS; ++ index) {
+        service->metrics_clients[index]    = -1;
+        service->metrics_clients_ms[index] = 0;
+    }
+
+    if (service->do_pipe) {
+        // logging pipe
+        // if no log-rotating is done stdout/stderr pipes directly to the logfile, no need for the pipe
+        if (pipe2(service->pipefd, O_CLOEXEC) != 0) {
+            print_error("pipe2(pipefd, O_CLOEXEC): %s", strerror(errno));
+            return false;
+        }
+
+        int flags = fcntl(service->pipefd[PIPE_READ], F_GETFL, 0);
+        if (flags == -1) {
+            print_error("fcntl(pipefd[PIPE_READ], F_GETFL, 0): %s", strerror(errno));
+            flags = 0;
+        }
+
+        if (fcntl(service->pipefd[PIPE_READ], F_SETFL, flags | O_NONBLOCK) == -1) {
+            print_error("fcntl(pipefd[PIPE_READ], F_SETFL, flags | O_NONBLOCK): %s", strerror(errno));
+        }
+
+        if (!add_event_source(epoll_fd, service->pipefd[PIPE_READ], EVENT_DATA(service, EVENT_LOGPIPE))) {
+            return false;
+        }
+    }
+
+    if (service->do_logrotate) {
+        struct logrotate_timer *timer = &service->logrotate_timer;
+        timer->fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer->fd == -1) {
+            print_error("timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC): %s -> checking logfile name on log output instead",
+                strerror(errno));
+        } else if (!schedule_logrotate(timer, service->logrotate_interval) ||
+                   !add_event_source(epoll_fd, timer->fd, EVENT_DATA(service, EVENT_LOGROTATE))) {
+            close(timer->fd);
+            timer->fd = -1;
+        }
+    }
+
+    service->restart_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (service->restart_timer_fd == -1) {
+        print_error("timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC): %s", strerror(errno));
+        return false;
+    }
+
+    if (!add_event_source(epoll_fd, service->restart_timer_fd, EVENT_DATA(service, EVENT_RESTART))) {
+        return false;
+    }
+
+    if (service->crash_report != NULL && service->crash_report_timeout > 0) {
+        service->report_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (service->report_timer_fd == -1) {
+            print_error("timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC): %s", strerror(errno));
+            return false;
+        }
+
+        if (!add_event_source(epoll_fd, service->report_timer_fd, EVENT_DATA(service, EVENT_REPORT_TIMEOUT))) {
+            return false;
+        }
+    }
+
+    if (service->start_limit_burst > 0) {
+        service->restart_times = calloc(service->start_limit_burst, sizeof(*service->restart_times));
+        if (service->restart_times == NULL) {
+            print_error("calloc(%u, %zu): %s", service->start_limit_burst, sizeof(*service->restart_times), strerror(errno));
+            return false;
+        }
+    }
+
+    if (service->watchdog_ms > 0) {
+        service->watchdog_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (service->watchdog_timer_fd == -1) {
+            print_error("timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC): %s", strerror(errno));
+            return false;
+        }
+
+        if (!add_event_source(epoll_fd, service->watchdog_timer_fd, EVENT_DATA(service, EVENT_WATCHDOG))) {
+            return false;
+        }
+    }
+
+    if (service->shutdown_timeout_ms >= 0) {
+        service->kill_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (service->kill_timer_fd == -1) {
+            print_error("timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC): %s", strerror(errno));
+            return false;
+        }
+
+        if (!add_event_source(epoll_fd, service->kill_timer_fd, EVENT_DATA(service, EVENT_KILL_TIMEOUT))) {
+            return false;
+        }
+    }
+
+    if (service->shutdown_timeout_ms >= 0 && service->restart_mode == RESTART_MODE_OVERLAP) {
+        service->old_kill_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (service->old_kill_timer_fd == -1) {
+            print_error("timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC): %s", strerror(errno));
+            return false;
+        }
+
+        if (!add_event_source(epoll_fd, service->old_kill_timer_fd, EVENT_DATA(service, EVENT_OLD_KILL_TIMEOUT))) {
+            return false;
+        }
+    }
+
+    if (service->shutdown_timeout_ms >= 0 && service->standby) {
+        service->standby_kill_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (service->standby_kill_timer_fd == -1) {
+            print_error("timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC): %s", strerror(errno));
+            return false;
+        }
+
+        if (!add_event_source(epoll_fd, service->standby_kill_timer_fd, EVENT_DATA(service, EVENT_STANDBY_KILL_TIMEOUT))) {
+            return false;
+        }
+    }
+
+    if (service->health_check != HEALTH_NONE) {
+        service->health_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (service->health_timer_fd == -1) {
+            print_error("timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC): %s", strerror(errno));
+            return false;
+        }
+
+        if (!add_event_source(epoll_fd, service->health_timer_fd, EVENT_DATA(service, EVENT_HEALTH))) {
+            return false;
+        }
+
+        service->health_timeout_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (service->health_timeout_fd == -1) {
+            print_error("timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC): %s", strerror(errno));
+            return false;
+        }
+
+        if (!add_event_source(epoll_fd, service->health_timeout_fd, EVENT_DATA(service, EVENT_HEALTH_TIMEOUT))) {
+            return false;
+        }
+
+        // periodic timer, probes are only started while the service is up
+        const struct itimerspec spec = {
+            .it_interval = {
+                .tv_sec  = service->health_interval_ms / 1000,
+                .tv_nsec = (service->health_interval_ms % 1000) * 1000000,
+            },
+            .it_value = {
+                .tv_sec  = service->health_interval_ms / 1000,
+                .tv_nsec = (service->health_interval_ms % 1000) * 1000000,
+            },
+        };
+
+        if (timerfd_settime(service->health_timer_fd, 0, &spec, NULL) != 0) {
+            print_error("(parent) timerfd_settime(health_timer_fd, ...): %s", strerror(errno));
+            return false;
+        }
+    }
+
+    // the watchdog keepalive messages are sent via the notify socket
+    if ((service->notify || service->watchdog_ms > 0) && !open_notify_socket(service, epoll_fd, false)) {
+        return false;
+    }
+
+    if (service->standby && service->notify_fd != -1 && !open_notify_socket(service, epoll_fd, true)) {
+        return false;
+    }
+
+    open_control_socket(service, epoll_fd);
+    open_state_record(service);
+    open_metrics(service, epoll_fd);
+
+    return true;
+}
+
+static bool is_service_active(const struct service *service) {
+    return service->pid > 0 || service->old_pid > 0 || service->standby_pid > 0 || service->restart_pending ||
+        service->failed || service->report_pid > 0 || service->pipefd[PIPE_READ] != -1;
+}
+
+static bool handle_service_event(struct service *service, int epoll_fd, const struct epoll_event *event) {
+    switch (EVENT_SOURCE(event->data.u64)) {
+        case EVENT_SIGNAL:
+            break;
+
+        case EVENT_SERVICE:
+            if (!reap_service(service, epoll_fd)) {
+                return false;
+            }
+            break;
+
+        case EVENT_LOGPIPE:
+            handle_log_pipe(service, event->events);
+            break;
+
+        case EVENT_LOGROTATE:
+        {
+            const double start = get_monotonic_seconds();
+            handle_logrotate_timer(
+                &service->logrotate_timer, service->logrotate_interval, service->logfile,
+                &service->logfile_fd, service->logfile_path_buf, sizeof(service->logfile_path_buf),
+                service->chown_logfile, service->logfile_uid, service->logfile_gid);
+            observe_histogram(&service->metrics.logrotate_seconds, get_monotonic_seconds() - start);
+            break;
+        }
+
+        case EVENT_RESTART:
+        {
+            uint64_t expirations = 0;
+            if (read(service->restart_timer_fd, &expirations, sizeof(expirations)) < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    print_error("(parent) read(restart_timer_fd, &expirations, sizeof(expirations)): %s", strerror(errno));
+                }
+            } else if (service->restart_pending) {
+                service->restart_due = true;
+                if (!restart_if_due(service, epoll_fd)) {
+                    return false;
+                }
+            }
+            break;
+        }
+
+        case EVENT_REPORT:
+            if (!reap_crash_report(service, epoll_fd)) {
+                return false;
+            }
+            break;
+
+        case EVENT_REPORT_TIMEOUT:
+            handle_crash_report_timeout(service);
+            break;
+
+        case EVENT_EXEC:
+            handle_service_exec(service, false);
+            break;
+
+        case EVENT_NOTIFY:
+            handle_notify(service, false);
+            break;
+
+        case EVENT_WATCHDOG:
+            handle_watchdog_timeout(service);
+            break;
+
+        case EVENT_KILL_TIMEOUT:
+            handle_kill_timeout(service);
+            break;
+
+        case EVENT_OLD_KILL_TIMEOUT:
+            handle_old_kill_timeout(service);
+            break;
+
+        case EVENT_STANDBY_KILL_TIMEOUT:
+            handle_standby_kill_timeout(service);
+            break;
+
+        case EVENT_HEALTH:
+            handle_health_timer(service, epoll_fd);
+            break;
+
+        case EVENT_HEALTH_PROBE:
+            if (service->health_probe_fd != -1) {
+                handle_health_probe_connect(service);
+            } else {
+                reap_health_probe(service);
+            }
+            break;
+
+        case EVENT_HEALTH_TIMEOUT:
+            handle_health_probe_timeout(service);
+            break;
+
+        case EVENT_OLD_SERVICE:
+            reap_old_service(service);
+            break;
+
+        case EVENT_STANDBY:
+            reap_standby(service);
+            break;
+
+        case EVENT_STANDBY_EXEC:
+            handle_standby_exec(service, false);
+            break;
+
+        case EVENT_STANDBY_NOTIFY:
+            handle_notify(service, true);
+            break;
+
+        case EVENT_CONTROL:
+            accept_control_clients(service, epoll_fd);
+            break;
+
+        case EVENT_CONTROL_CLIENT:
+            if (!handle_control_client(service, epoll_fd, EVENT_CLIENT_INDEX(event->data.u64), event->events)) {
+                return false;
+            }
+            break;
+
+        case EVENT_METRICS:
+            accept_metrics_clients(service, epoll_fd);
+            break;
+
+        case EVENT_METRICS_CLIENT:
+            handle_metrics_client(service, EVENT_CLIENT_INDEX(event->data.u64));
+            break;
+
+        case EVENT_METRICS_TIMER:
+            handle_metrics_timer(service);
+            break;
+    }
+
+    return true;
+}
+
+static void cleanup_service(struct service *service, int status) {
+    close_control_socket(service, status);
+    close_state_record(service);
+    close_metrics(service);
+    close_notify_socket(service);
+
+    // start --wait-ready fails if the service never got ready
+    report_startup(service, STARTUP_FAILED);
+
+    if (service->pidfd != -1) {
+        close(service->pidfd);
+        service->pidfd = -1;
+    }
+
+    if (service->old_pidfd != -1) {
+        close(service->old_pidfd);
+        service->old_pidfd = -1;
+    }
+
+    if (service->standby_pid > 0) {
+        // the standby process is of no use without the service-runner
+        send_signal(service->standby_pid, service->standby_pidfd, SIGKILL);
+        waitpid(service->standby_pid, NULL, 0);
+        service->standby_pid = 0;
+    }
+
+    if (service->standby_pidfd != -1) {
+        close(service->standby_pidfd);
+        service->standby_pidfd = -1;
+    }
+
+    if (service->standby_exec_fd != -1) {
+        close(service->standby_exec_fd);
+        service->standby_exec_fd = -1;
+    }
+
+    if (service->exec_fd != -1) {
+        close(service->exec_fd);
+        service->exec_fd = -1;
+    }
+
+    if (service->pipefd[PIPE_READ] != -1) {
+        close(service->pipefd[PIPE_READ]);
+        service->pipefd[PIPE_READ] = -1;
+    }
+
+    if (service->pipefd[PIPE_WRITE] != -1) {
+        close(service->pipefd[PIPE_WRITE]);
+        service->pipefd[PIPE_WRITE] = -1;
+    }
+
+    if (service->logrotate_timer.fd != -1) {
+        close(service->logrotate_timer.fd);
+        service->logrotate_timer.fd = -1;
+    }
+
+    discard_next_logfile(&service->logrotate_timer);
+
+    if (service->restart_timer_fd != -1) {
+        close(service->restart_timer_fd);
+        service->restart_timer_fd = -1;
+    }
+
+    if (service->report_pidfd != -1) {
+        close(service->report_pidfd);
+        service->report_pidfd = -1;
+    }
+
+    if (service->report_timer_fd != -1) {
+        close(service->report_timer_fd);
+        service->report_timer_fd = -1;
+    }
+
+    if (service->watchdog_timer_fd != -1) {
+        close(service->watchdog_timer_fd);
+        service->watchdog_timer_fd = -1;
+    }
+
+    if (service->kill_timer_fd != -1) {
+        close(service->kill_timer_fd);
+        service->kill_timer_fd = -1;
+    }
+
+    if (service->old_kill_timer_fd != -1) {
+        close(service->old_kill_timer_fd);
+        service->old_kill_timer_fd = -1;
+    }
+
+    if (service->standby_kill_timer_fd != -1) {
+        close(service->standby_kill_timer_fd);
+        service->standby_kill_timer_fd = -1;
+    }
+
+    if (service->health_probe_pid > 0) {
+        send_signal(service->health_probe_pid, service->health_probe_pidfd, SIGKILL);
+        waitpid(service->health_probe_pid, NULL, 0);
+        service->health_probe_pid = 0;
+    }
+
+    if (service->health_probe_pidfd != -1) {
+        close(service->health_probe_pidfd);
+        service->health_probe_pidfd = -1;
+    }
+
+    if (service->health_probe_fd != -1) {
+        close(service->health_probe_fd);
+        service->health_probe_fd = -1;
+    }
+
+    if (service->health_timer_fd != -1) {
+        close(service->health_timer_fd);
+        service->health_timer_fd = -1;
+    }
+
+    if (service->health_timeout_fd != -1) {
+        close(service->health_timeout_fd);
+        service->health_timeout_fd = -1;
+    }
+
+    free(service->restart_times);
+    service->restart_times = NULL;
+}
+
+static void remove_pidfiles(const struct service *service) {
+    if (unlink(service->pidfile) != 0 && errno != ENOENT) {
+        print_error("unlink(\"%s\"): %s", service->pidfile, strerror(errno));
+    }
+
+    if (unlink(service->pidfile_runner) != 0 && errno != ENOENT) {
+        print_error("unlink(\"%s\"): %s", service->pidfile_runner, strerror(errno));
+    }
+
+    if (unlink(service->pidfile_failed) != 0 && errno != ENOENT) {
+        print_error("unlink(\"%s\"): %s", service->pidfile_failed, strerror(errno));
+    }
+}
+
+// The service-runner event loop. Everything the runner waits for (signals,
+// the service processes, log output, timers) is a file descriptor in a
+// single epoll set, so nothing in here blocks. A supervisor runs all of its
+// services in this one loop until every one of them is stopped. Stopped
+// services are cleaned up right away, in case of a supervisor including
+// their pidfiles.
+static int run_services(struct service *services, size_t count) {
+    int status = 0;
+    int signal_fd = -1;
+    size_t setup_count = 0;
+    bool manual_logrotate = false;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        print_error("(parent) epoll_create1(EPOLL_CLOEXEC): %s", strerror(errno));
+        return 1;
+    }
+
+    for (size_t index = 0; index < count; ++ index) {
+        manual_logrotate = manual_logrotate || services[index].manual_logrotate;
+    }
+
+    // These signals are already blocked.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGCHLD);
+    if (manual_logrotate) {
+        sigaddset(&mask, SIGHUP);
+    }
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        print_error("(parent) signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC): %s", strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
+
+    if (!add_event_source(epoll_fd, signal_fd, EVENT_SIGNAL)) {
+        status = 1;
+        goto cleanup;
+    }
+
+    {
+        // for the restart delay jitter
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        srandom((unsigned int)(now.tv_nsec ^ now.tv_sec ^ getpid()));
+    }
+
+    for (; setup_count < count; ++ setup_count) {
+        struct service *service = &services[setup_count];
+        service->index = setup_count;
+        select_service_log(service);
+
+        if (!setup_service(service, epoll_fd)) {
+            ++ setup_count;
+            status = 1;
+            goto cleanup;
+        }
+    }
+
+    for (size_t index = 0; index < count; ++ index) {
+        struct service *service = &services[index];
+        select_service_log(service);
+
+        service->running = true;
+        if (!start_service(service, epoll_fd)) {
+            status = 1;
+            goto cleanup;
+        }
+    }
+
+    for (;;) {
+        bool active = false;
+        for (size_t index = 0; index < count; ++ index) {
+            struct service *service = &services[index];
+            if (service->finished) {
+                continue;
+            }
+
+            if (is_service_active(service)) {
+                active = true;
+                record_service_state(service);
+                publish_service_state(service);
+            } else {
+                record_service_state(service);
+                select_service_log(service);
+                if (service->supervised) {
+                    remove_pidfiles(service);
+                }
+                cleanup_service(service, 0);
+                service->finished = true;
+            }
+        }
+
+        if (!active) {
+            break;
+        }
+
+        // everything logged in this iteration in one write() per logfile
+        flush_runner_log();
+
+        struct epoll_event events[MAX_EVENTS];
+        int event_count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            print_error("(parent) epoll_wait(): %s", strerror(errno));
+            status = 1;
+            break;
+        }
+        ++ loop_wakeups;
+        TRACE(loop_wakeup, event_count);
+
+        // Handle signals first, so that e.g. a SIGTERM that arrived together
+        // with the exit of the service is known when handling the exit.
+        for (int index = 0; index < event_count; ++ index) {
+            if (EVENT_SOURCE(events[index].data.u64) == EVENT_SIGNAL && !handle_signals(services, count, epoll_fd, signal_fd)) {
+                status = 1;
+                goto cleanup;
+            }
+        }
+
+        for (int index = 0; index < event_count; ++ index) {
+            const struct epoll_event *event = &events[index];
+            if (EVENT_SOURCE(event->data.u64) == EVENT_SIGNAL) {
+                continue;
+            }
+
+            struct service *service = &services[EVENT_SERVICE_INDEX(event->data.u64)];
+            if (service->finished) {
+                continue;
+            }
+
+            select_service_log(service);
+            if (!handle_service_event(service, epoll_fd, event)) {
+                status = 1;
+                goto cleanup;
+            }
+        }
+
+        for (size_t index = 0; index < count; ++ index) {
+            struct service *service = &services[index];
+            if (!service->finished) {
+                select_service_log(service);
+                start_standby_if_due(service, epoll_fd);
+            }
+        }
+    }
+
+cleanup:
+    for (size_t index = 0; index < setup_count; ++ index) {
+        struct service *service = &services[index];
+        if (!service->finished) {
+            select_service_log(service);
+            if (status != 0) {
+                // the runner itself failed, keep what led up to it
+                char dump_path[PATH_MAX];
+                dump_flight_recorder(service, dump_path, sizeof(dump_path));
+            }
+            cleanup_service(service, status);
+            service->finished = true;
+        }
+    }
+
+    if (signal_fd != -1) {
+        close(signal_fd);
+    }
+
+    close(epoll_fd);
+
+    return status;
+}
+
+static int run_service(struct service *service) {
+    return run_services(service, 1);
+}
+
+// Resolves HOST:PORT (or [HOST]:PORT for IPv6 addresses) for --health-tcp
+// and --listen. An empty HOST means the loopback address, or with
+// AI_PASSIVE any address.
+static int resolve_host_port(const char *option, const char *arg, int flags, struct sockaddr_storage *addr, socklen_t *addr_len) {
+    const char *colon = strrchr(arg, ':');
+    if (colon == NULL || !colon[1]) {
+        fprintf(stderr, "*** error: illegal value for %s, expected HOST:PORT: %s\n", option, arg);
+        return -1;
+    }
+
+    char host[256];
+    const char *host_start = arg;
+    size_t host_len = colon - arg;
+    if (host_len >= 2 && arg[0] == '[' && arg[host_len - 1] == ']') {
+        ++ host_start;
+        host_len -= 2;
+    }
+
+    if (host_len >= sizeof(host)) {
+        fprintf(stderr, "*** error: illegal value for %s, host name too long: %s\n", option, arg);
+        return -1;
+    }
+    memcpy(host, host_start, host_len);
+    host[host_len] = 0;
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = flags;
+
+    struct addrinfo *result = NULL;
+    int errnum = getaddrinfo(host_len > 0 ? host : NULL, colon + 1, &hints, &result);
+    if (errnum != 0) {
+        fprintf(stderr, "*** error: resolving %s %s: %s\n", option, arg, gai_strerror(errnum));
+        return -1;
+    }
+
+    // only the first address is probed
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *addr_len = result->ai_addrlen;
+
+    freeaddrinfo(result);
+
+    return 0;
+}
+
+// Creates a listening socket for --listen. The sockets are created by the
+// start command, so that errors are reported to the user and the
+// service-runner keeps them open across restarts of the service.
+static bool open_listen_socket(struct listen_socket *sock) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    memset(&addr, 0, sizeof(addr));
+
+    const char *spec = sock->spec;
+    if (strncmp(spec, "unix:", strlen("unix:")) == 0) {
+        const char *path = spec + strlen("unix:");
+        struct sockaddr_un *addr_un = (struct sockaddr_un*)&addr;
+        if (!*path || strlen(path) >= sizeof(addr_un->sun_path)) {
+            fprintf(stderr, "*** error: illegal value for --listen: %s\n", spec);
+            return false;
+        }
+
+        // remove stale socket of a previous run
+        struct stat meta;
+        if (lstat(path, &meta) == 0 && S_ISSOCK(meta.st_mode) && unlink(path) != 0) {
+            fprintf(stderr, "*** error: unlink(\"%s\"): %s\n", path, strerror(errno));
+            return false;
+        }
+
+        addr_un->sun_family = AF_UNIX;
+        strcpy(addr_un->sun_path, path);
+        addr_len = sizeof(*addr_un);
+    } else if (strncmp(spec, "tcp:", strlen("tcp:")) == 0) {
+        if (resolve_host_port("--listen", spec + strlen("tcp:"), AI_PASSIVE, &addr, &addr_len) != 0) {
+            return false;
+        }
+    } else {
+        fprintf(stderr, "*** error: illegal value for --listen, expected tcp:HOST:PORT or unix:PATH: %s\n", spec);
+        return false;
+    }
+
+    sock->fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock->fd == -1) {
+        fprintf(stderr, "*** error: socket(%d, SOCK_STREAM | SOCK_CLOEXEC, 0): %s\n", addr.ss_family, strerror(errno));
+        return false;
+    }
+
+    if (addr.ss_family != AF_UNIX) {
+        const int value = 1;
+        if (setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value)) != 0) {
+            fprintf(stderr, "*** error: setsockopt(%d, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value)): %s\n", sock->fd, strerror(errno));
+        }
+    }
+
+    if (bind(sock->fd, (const struct sockaddr*)&addr, addr_len) != 0) {
+        fprintf(stderr, "*** error: binding --listen=%s: %s\n", spec, strerror(errno));
+        close(sock->fd);
+        sock->fd = -1;
+        return false;
+    }
+
+    if (listen(sock->fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "*** error: listen --listen=%s: %s\n", spec, strerror(errno));
+        close(sock->fd);
+        sock->fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+// Prints what was written to the logfile since the service-runner was started.
+static void print_startup_log(const char *logfile_path, off_t log_offset) {
+    int fd = open(logfile_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "*** error: open(\"%s\", O_RDONLY | O_CLOEXEC): %s\n", logfile_path, strerror(errno));
+        return;
+    }
+
+    if (lseek(fd, log_offset, SEEK_SET) == -1) {
+        fprintf(stderr, "*** error: lseek(fd, %ld, SEEK_SET): %s\n", (long)log_offset, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    fflush(stderr);
+    for (;;) {
+        char buf[BUFSIZ];
+        ssize_t rcount = read(fd, buf, sizeof(buf));
+        if (rcount <= 0) {
+            if (rcount < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (write(STDERR_FILENO, buf, rcount) != rcount) {
+            break;
+        }
+    }
+
+    close(fd);
+}
+
+// Waits for the messages of the service-runner on the startup socketpair.
+// EOF means that the service-runner has exited.
+static int wait_for_startup(const char *name, int startup_fd, bool wait_ready, int timeout_ms, const char *logfile_path, off_t log_offset) {
+    bool running = false;
+    struct timespec ts_before = {
+        .tv_sec  = 0,
+        .tv_nsec = 0,
+    };
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts_before) != 0) {
+        fprintf(stderr, "*** error: clock_gettime(CLOCK_MONOTONIC, &ts_before): %s\n", strerror(errno));
         return 1;
     }
 
+    for (;;) {
+        int timeout = -1;
+        if (running && timeout_ms >= 0) {
+            struct timespec ts_after = {
+                .tv_sec  = 0,
+                .tv_nsec = 0,
+            };
+
+            if (clock_gettime(CLOCK_MONOTONIC, &ts_after) != 0) {
+                fprintf(stderr, "*** error: clock_gettime(CLOCK_MONOTONIC, &ts_after): %s\n", strerror(errno));
+                return 1;
+            }
+
+            const int64_t elapsed =
+                (int64_t)(ts_after.tv_sec - ts_before.tv_sec) * 1000 +
+                (ts_after.tv_nsec - ts_before.tv_nsec) / 1000000;
+            timeout = elapsed >= timeout_ms ? 0 : timeout_ms - (int)elapsed;
+        }
+
+        struct pollfd pollfds[] = {
+            { .fd = startup_fd, .events = POLLIN, .revents = 0 },
+        };
+
+        int result = poll(pollfds, 1, timeout);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "*** error: waiting for service-runner: %s\n", strerror(errno));
+            return 1;
+        }
+
+        if (result == 0) {
+            fprintf(stderr, "*** error: timeout waiting for %s to become ready, log output:\n", name);
+            print_startup_log(logfile_path, log_offset);
+            return 1;
+        }
+
+        char message = 0;
+        ssize_t rcount = read(startup_fd, &message, 1);
+        if (rcount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "*** error: waiting for service-runner: %s\n", strerror(errno));
+            return 1;
+        }
+
+        if (rcount == 0) {
+            if (!running) {
+                // The error message was already printed by the service-runner.
+                return 1;
+            }
+
+            if (!wait_ready) {
+                return 0;
+            }
+
+            message = STARTUP_FAILED;
+        }
+
+        switch (message) {
+            case STARTUP_RUNNING:
+                running = true;
+                if (!wait_ready) {
+                    return 0;
+                }
+                break;
+
+            case STARTUP_READY:
+                return 0;
+
+            case STARTUP_FAILED:
+                fprintf(stderr, "*** error: %s exited before becoming ready, log output:\n", name);
+                print_startup_log(logfile_path, log_offset);
+                return 1;
+
+            default:
+                fprintf(stderr, "*** error: illegal message from service-runner: %d\n", message);
+                return 1;
+        }
+    }
+}
+
+// Options of the start command that only concern the command itself and not
+// the service-runner process.
+struct start_command_options {
+    bool foreground;
+    bool wait_ready;
+    int wait_ready_timeout;
+};
+
+enum PrepareResult {
+    PREPARE_OK,
+    PREPARE_ERROR,
+    PREPARE_RUNNING,
+};
+
+// Parses and checks the arguments of the start command, opens the listening
+// sockets and the logfile and initializes *service. What is allocated here is
+// released again by free_service().
+static enum PrepareResult prepare_service(int argc, char *argv[], bool supervised, struct service *service, struct start_command_options *options) {
     int longind = 0;
 
     const char *pidfile = NULL;
@@ -1298,12 +4872,38 @@ int command_start(int argc, char *argv[]) {
     const char *group   = NULL;
     const char *chdir_path = NULL;
     char *chroot_path = NULL;
+    char *metrics_path = NULL;
+    bool metrics_unix = false;
+    struct log_template *log_template = NULL;
 
     bool chown_logfile = false;
     const char *crash_report = NULL;
-    unsigned int restart_sleep = 1;
+    unsigned int crash_report_timeout = 0;
+    uint64_t restart_sleep_ms = 1000;
+    uint64_t restart_sleep_max_ms = 300000;
+    double restart_sleep_factor = 1.0;
+    unsigned int restart_sleep_jitter = 0;
+    uint64_t restart_sleep_reset_ms = 60000;
+    bool has_restart_sleep_max = false;
+    unsigned int start_limit_burst = 0;
+    uint64_t start_limit_interval_ms = 10000;
+    bool notify = false;
+    uint64_t watchdog_ms = 0;
+    int64_t shutdown_timeout_ms = -1;
+    enum HealthCheck health_check = HEALTH_NONE;
+    const char *health_target = NULL;
+    struct sockaddr_storage health_addr;
+    socklen_t health_addr_len = 0;
+    uint64_t health_interval_ms = 10000;
+    uint64_t health_timeout_ms = 5000;
+    unsigned int health_retries = 3;
+    uint64_t health_start_period_ms = 0;
+    bool wait_ready = false;
+    int wait_ready_timeout = -1;
 
     enum Restart restart = RESTART_FAILURE;
+    enum RestartMode restart_mode = RESTART_MODE_STOP;
+    bool standby = false;
 
     bool set_priority = false;
     bool set_umask    = false;
@@ -1314,24 +4914,28 @@ int command_start(int argc, char *argv[]) {
     size_t rlimits_capacity = 0;
     size_t rlimits_count    = 0;
 
+    struct listen_socket *listen_sockets = NULL;
+    size_t listen_sockets_capacity = 0;
+    size_t listen_sockets_count    = 0;
+    bool unlink_listen_sockets = false;
+
     int status = 0;
     int logfile_fd = -1;
-    int pipefd[2] = { -1, -1 };
 
     bool free_pidfile = false;
     bool free_logfile = false;
     bool free_command = false;
     bool free_chdir_path  = false;
-    bool cleanup_pidfiles = false;
     bool rlimit_fsize = false;
     bool manual_logrotate = false;
     bool foreground = false;
 
     char *pidfile_runner = NULL;
+    char *pidfile_failed = NULL;
     char logfile_path_buf[PATH_MAX];
 
     for (;;) {
-        int opt = getopt_long(argc - 1, argv + 1, "p:l:u:g:N:k:r:C:", start_options, &longind);
+        int opt = getopt_long(argc - 1, argv + 1, START_SHORT_OPTIONS, start_options, &longind);
 
         if (opt == -1) {
             break;
@@ -1346,23 +4950,32 @@ int command_start(int argc, char *argv[]) {
 
                     case OPT_START_LOG_FORMAT:
                         if (strcasecmp(optarg, "text") == 0) {
-                            log_format = LOG_TEMPLATE_TEXT;
+                            log_format = get_builtin_log_template(LOG_FORMAT_TEXT);
                         } else if (strcasecmp(optarg, "json") == 0) {
-                            log_format = LOG_TEMPLATE_JSON;
+                            log_format = get_builtin_log_template(LOG_FORMAT_JSON);
                         } else if (strcasecmp(optarg, "xml") == 0) {
-                            log_format = LOG_TEMPLATE_XML;
+                            log_format = get_builtin_log_template(LOG_FORMAT_XML);
                         } else if (strcasecmp(optarg, "sql") == 0) {
-                            log_format = LOG_TEMPLATE_SQL;
+                            log_format = get_builtin_log_template(LOG_FORMAT_SQL);
                         } else if (strcasecmp(optarg, "csv") == 0) {
-                            log_format = LOG_TEMPLATE_CSV;
+                            log_format = get_builtin_log_template(LOG_FORMAT_CSV);
                         } else if (strncasecmp(optarg, "template:", strlen("template:")) == 0) {
-                            const char *template = optarg + strlen("template:");
-                            if (!is_valid_log_template(template)) {
-                                fprintf(stderr, "*** error: illegal value for --log-format: %s\n", optarg);
+                            struct log_template *template = compile_log_template(optarg + strlen("template:"));
+                            if (template == NULL) {
+                                if (errno == EINVAL) {
+                                    fprintf(stderr, "*** error: illegal value for --log-format: %s\n", optarg);
+                                } else {
+                                    fprintf(stderr, "*** error: compiling --log-format: %s\n", strerror(errno));
+                                }
                                 status = 1;
                                 goto cleanup;
                             }
-                            log_format = template;
+                            if (log_format == log_template) {
+                                log_format = NULL;
+                            }
+                            free_log_template(log_template);
+                            log_template = template;
+                            log_format   = template;
                         } else {
                             fprintf(stderr, "*** error: illegal value for --log-format: %s\n", optarg);
                             status = 1;
@@ -1388,6 +5001,49 @@ int command_start(int argc, char *argv[]) {
                         }
                         break;
 
+                    case OPT_START_RESTART_MODE:
+                        if (strcasecmp("STOP", optarg) == 0) {
+                            restart_mode = RESTART_MODE_STOP;
+                        } else if (strcasecmp("OVERLAP", optarg) == 0) {
+                            restart_mode = RESTART_MODE_OVERLAP;
+                        } else {
+                            fprintf(stderr, "*** error: illegal value for --restart-mode: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        break;
+
+                    case OPT_START_STANDBY:
+                        standby = true;
+                        break;
+
+                    case OPT_START_METRICS:
+                    {
+                        const bool unix_socket = strncmp(optarg, "unix:", strlen("unix:")) == 0;
+                        const char *path = unix_socket ? optarg + strlen("unix:") : optarg;
+                        if (!*path) {
+                            fprintf(stderr, "*** error: illegal value for --metrics: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+
+                        free(metrics_path);
+                        metrics_path = abspath(path);
+                        if (metrics_path == NULL) {
+                            fprintf(stderr, "*** error: getting absolute path of --metrics=%s: %s\n", optarg, strerror(errno));
+                            status = 1;
+                            goto cleanup;
+                        }
+
+                        if (unix_socket && strlen(metrics_path) >= sizeof(((struct sockaddr_un*)NULL)->sun_path)) {
+                            fprintf(stderr, "*** error: illegal value for --metrics: path too long: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        metrics_unix = unix_socket;
+                        break;
+                    }
+
                     case OPT_START_CHROOT:
                     {
                         if (!*optarg) {
@@ -1410,19 +5066,212 @@ int command_start(int argc, char *argv[]) {
                         crash_report = optarg;
                         break;
 
-                    case OPT_START_RESTART_SLEEP:
+                    case OPT_START_CRASH_REPORT_TIMEOUT:
                     {
                         char *endptr = NULL;
                         unsigned long value = strtoul(optarg, &endptr, 10);
                         if (!*optarg || *endptr || value > UINT_MAX) {
+                            fprintf(stderr, "*** error: illegal value for --crash-report-timeout: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        crash_report_timeout = value;
+                        break;
+                    }
+
+                    case OPT_START_RESTART_SLEEP:
+                        if (parse_seconds_ms(optarg, &restart_sleep_ms) != 0) {
                             fprintf(stderr, "*** error: illegal value for --restart-sleep: %s\n", optarg);
                             status = 1;
                             goto cleanup;
                         }
-                        restart_sleep = value;
+                        break;
+
+                    case OPT_START_RESTART_SLEEP_MAX:
+                        if (parse_seconds_ms(optarg, &restart_sleep_max_ms) != 0) {
+                            fprintf(stderr, "*** error: illegal value for --restart-sleep-max: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        has_restart_sleep_max = true;
+                        break;
+
+                    case OPT_START_RESTART_SLEEP_FACTOR:
+                    {
+                        char *endptr = NULL;
+                        double value = strtod(optarg, &endptr);
+                        if (!*optarg || *endptr || !(value >= 1.0 && value <= 1000.0)) {
+                            fprintf(stderr, "*** error: illegal value for --restart-sleep-factor: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        restart_sleep_factor = value;
+                        break;
+                    }
+
+                    case OPT_START_RESTART_SLEEP_JITTER:
+                    {
+                        char *endptr = NULL;
+                        unsigned long value = strtoul(optarg, &endptr, 10);
+                        if (!*optarg || *endptr || value > 100) {
+                            fprintf(stderr, "*** error: illegal value for --restart-sleep-jitter: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        restart_sleep_jitter = value;
+                        break;
+                    }
+
+                    case OPT_START_RESTART_SLEEP_RESET:
+                        if (parse_seconds_ms(optarg, &restart_sleep_reset_ms) != 0) {
+                            fprintf(stderr, "*** error: illegal value for --restart-sleep-reset: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        break;
+
+                    case OPT_START_START_LIMIT_BURST:
+                    {
+                        char *endptr = NULL;
+                        unsigned long value = strtoul(optarg, &endptr, 10);
+                        if (!*optarg || *endptr || value > 10000) {
+                            fprintf(stderr, "*** error: illegal value for --start-limit-burst: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        start_limit_burst = value;
+                        break;
+                    }
+
+                    case OPT_START_START_LIMIT_INTERVAL:
+                        if (parse_seconds_ms(optarg, &start_limit_interval_ms) != 0) {
+                            fprintf(stderr, "*** error: illegal value for --start-limit-interval: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        break;
+
+                    case OPT_START_NOTIFY:
+                        notify = true;
+                        break;
+
+                    case OPT_START_WATCHDOG:
+                        if (parse_seconds_ms(optarg, &watchdog_ms) != 0 || watchdog_ms == 0 || watchdog_ms > UINT64_MAX / 1000) {
+                            fprintf(stderr, "*** error: illegal value for --watchdog: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        break;
+
+                    case OPT_START_SHUTDOWN_TIMEOUT:
+                        if (strcmp(optarg, "-1") == 0) {
+                            shutdown_timeout_ms = -1;
+                        } else {
+                            uint64_t value = 0;
+                            if (parse_seconds_ms(optarg, &value) != 0 || value > INT64_MAX) {
+                                fprintf(stderr, "*** error: illegal value for --shutdown-timeout: %s\n", optarg);
+                                status = 1;
+                                goto cleanup;
+                            }
+                            shutdown_timeout_ms = (int64_t)value;
+                        }
+                        break;
+
+                    case OPT_START_HEALTH_CMD:
+                    case OPT_START_HEALTH_TCP:
+                    case OPT_START_HEALTH_UNIX:
+                        if (health_check != HEALTH_NONE) {
+                            fprintf(stderr, "*** error: only one of --health-cmd, --health-tcp, and --health-unix may be used\n");
+                            status = 1;
+                            goto cleanup;
+                        }
+
+                        if (!*optarg) {
+                            fprintf(stderr, "*** error: illegal value for --%s: %s\n", start_options[longind].name, optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+
+                        health_check =
+                            longind == OPT_START_HEALTH_CMD ? HEALTH_CMD :
+                            longind == OPT_START_HEALTH_TCP ? HEALTH_TCP :
+                            HEALTH_UNIX;
+                        health_target = optarg;
+                        break;
+
+                    case OPT_START_HEALTH_INTERVAL:
+                        if (parse_seconds_ms(optarg, &health_interval_ms) != 0 || health_interval_ms == 0) {
+                            fprintf(stderr, "*** error: illegal value for --health-interval: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        break;
+
+                    case OPT_START_HEALTH_TIMEOUT:
+                        if (parse_seconds_ms(optarg, &health_timeout_ms) != 0 || health_timeout_ms == 0) {
+                            fprintf(stderr, "*** error: illegal value for --health-timeout: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        break;
+
+                    case OPT_START_HEALTH_RETRIES:
+                    {
+                        char *endptr = NULL;
+                        unsigned long value = strtoul(optarg, &endptr, 10);
+                        if (!*optarg || *endptr || value == 0 || value > 10000) {
+                            fprintf(stderr, "*** error: illegal value for --health-retries: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        health_retries = value;
                         break;
                     }
 
+                    case OPT_START_HEALTH_START_PERIOD:
+                        if (parse_seconds_ms(optarg, &health_start_period_ms) != 0) {
+                            fprintf(stderr, "*** error: illegal value for --health-start-period: %s\n", optarg);
+                            status = 1;
+                            goto cleanup;
+                        }
+                        break;
+
+                    case OPT_START_LISTEN:
+                        if (listen_sockets_count == listen_sockets_capacity) {
+                            size_t new_capacity = listen_sockets_capacity + LISTEN_SOCKETS_GROW;
+                            struct listen_socket *new_listen_sockets = realloc(listen_sockets, new_capacity * sizeof(struct listen_socket));
+                            if (new_listen_sockets == NULL) {
+                                fprintf(stderr, "*** error: cannot allocate memory for --listen: %s\n", optarg);
+                                status = 1;
+                                goto cleanup;
+                            }
+
+                            listen_sockets = new_listen_sockets;
+                            listen_sockets_capacity = new_capacity;
+                        }
+
+                        listen_sockets[listen_sockets_count].spec = optarg;
+                        listen_sockets[listen_sockets_count].fd   = -1;
+                        ++ listen_sockets_count;
+                        break;
+
+                    case OPT_START_WAIT_READY:
+                        wait_ready = true;
+                        if (optarg != NULL) {
+                            uint64_t value = 0;
+                            if (parse_seconds_ms(optarg, &value) != 0 || value > INT_MAX) {
+                                fprintf(stderr, "*** error: illegal value for --wait-ready: %s\n", optarg);
+                                status = 1;
+                                goto cleanup;
+                            }
+                            wait_ready_timeout = (int)value;
+                        }
+                        break;
+
+                    case OPT_START_ALL:
+                        // handled by command_start()
+                        break;
+
                     default:
                         assert(false);
                 }
@@ -1522,6 +5371,14 @@ int command_start(int argc, char *argv[]) {
                 foreground = true;
                 break;
 
+            case 'c':
+                // already handled by expand_service_config()
+                break;
+
+            case 'j':
+                // handled by command_start()
+                break;
+
             case '?':
                 short_usage(argc, argv);
                 status = 1;
@@ -1532,6 +5389,55 @@ int command_start(int argc, char *argv[]) {
         }
     }
 
+    if (restart_sleep_max_ms < restart_sleep_ms) {
+        if (has_restart_sleep_max) {
+            fprintf(stderr, "*** error: --restart-sleep-max may not be less than --restart-sleep\n");
+            status = 1;
+            goto cleanup;
+        }
+        restart_sleep_max_ms = restart_sleep_ms;
+    }
+
+    if (supervised && (foreground || wait_ready)) {
+        fprintf(stderr, "*** error: --foreground and --wait-ready cannot be used with supervise\n");
+        status = 1;
+        goto cleanup;
+    }
+
+    if (wait_ready && foreground) {
+        fprintf(stderr, "*** error: --wait-ready cannot be used together with --foreground\n");
+        status = 1;
+        goto cleanup;
+    }
+
+    // Without READY=1 the standby process would be parked before it did any
+    // of its initialization.
+    if (standby && !notify) {
+        fprintf(stderr, "*** error: --standby requires --notify\n");
+        status = 1;
+        goto cleanup;
+    }
+
+    memset(&health_addr, 0, sizeof(health_addr));
+    if (health_check == HEALTH_UNIX) {
+        struct sockaddr_un *addr = (struct sockaddr_un*)&health_addr;
+        if (strlen(health_target) >= sizeof(addr->sun_path)) {
+            fprintf(stderr, "*** error: illegal value for --health-unix: path too long: %s\n", health_target);
+            status = 1;
+            goto cleanup;
+        }
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, health_target);
+        health_addr_len = sizeof(*addr);
+    } else if (health_check == HEALTH_TCP) {
+        // The address is resolved once here, so that the event loop never
+        // blocks on DNS.
+        if (resolve_host_port("--health-tcp", health_target, 0, &health_addr, &health_addr_len) != 0) {
+            status = 1;
+            goto cleanup;
+        }
+    }
+
     // because of skipped first argument:
     ++ optind;
 
@@ -1722,7 +5628,7 @@ int command_start(int argc, char *argv[]) {
         goto cleanup;
     }
 
-    if (set_priority) {
+    if (set_priority && !supervised) {
         // XXX: I just do not understand the getrlimit() interface for RLIMIT_NICE.
         //      It always returns rlim.rlim_cur == 0, which is outside of the range
         //      of values defined in the man-page.
@@ -1775,6 +5681,19 @@ int command_start(int argc, char *argv[]) {
         assert(count >= 0 && (size_t)count == pidfile_runner_size - 1); (void)count;
     }
 
+    {
+        size_t pidfile_failed_size = strlen(pidfile) + strlen(".failed") + 1;
+        pidfile_failed = malloc(pidfile_failed_size);
+        if (pidfile_failed == NULL) {
+            fprintf(stderr, "*** error: malloc(%zu): %s\n", pidfile_failed_size, strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
+        int count = snprintf(pidfile_failed, pidfile_failed_size, "%s.failed", pidfile);
+        assert(count >= 0 && (size_t)count == pidfile_failed_size - 1); (void)count;
+    }
+
     if (!can_read_write(pidfile, selfuid, selfgid)) {
         fprintf(stderr, "*** error: cannot read and write file: %s: %s\n", pidfile, strerror(errno));
         status = 1;
@@ -1812,6 +5731,12 @@ int command_start(int argc, char *argv[]) {
                     status = 1;
                     goto cleanup;
                 }
+
+                if (unlink(pidfile_failed) != 0 && errno != ENOENT) {
+                    fprintf(stderr, "*** error: unlink(\"%s\"): %s\n", pidfile_failed, strerror(errno));
+                    status = 1;
+                    goto cleanup;
+                }
             } else {
                 fprintf(stderr, "*** error: kill(%d, 0): %s\n", runner_pid, strerror(errno));
                 status = 1;
@@ -1820,11 +5745,19 @@ int command_start(int argc, char *argv[]) {
         }
     }
 
+    for (size_t index = 0; index < listen_sockets_count; ++ index) {
+        if (!open_listen_socket(&listen_sockets[index])) {
+            status = 1;
+            goto cleanup;
+        }
+        unlink_listen_sockets = true;
+    }
+
     const bool do_logrotate = strchr(logfile, '%') != NULL;
     const bool do_pipe = do_logrotate || rlimit_fsize || manual_logrotate;
     const char *logfile_path;
-
-    // TODO: validate log_format
+    const enum LogrotateInterval logrotate_interval = do_logrotate ? get_logrotate_interval(logfile) : LOGROTATE_NEVER;
+    struct timespec logrotate_deadline = { .tv_sec = 0, .tv_nsec = 0 };
 
     if (do_logrotate) {
         const time_t now = time(NULL);
@@ -1847,6 +5780,12 @@ int command_start(int argc, char *argv[]) {
             goto cleanup;
         }
 
+        if (!get_logrotate_deadline(logrotate_interval, &logrotate_deadline)) {
+            fprintf(stderr, "*** error: clock_gettime(): %s\n", strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
         logfile_path = logfile_path_buf;
     } else {
         logfile_path = logfile;
@@ -1865,7 +5804,597 @@ int command_start(int argc, char *argv[]) {
         goto cleanup;
     }
 
-    if (!foreground) {
+    *service = (struct service){
+        .name                    = name,
+        .command                 = command,
+        .command_argv            = command_argv,
+        .pidfile                 = pidfile,
+        .pidfile_failed          = pidfile_failed,
+        .logfile                 = logfile,
+        .user                    = user,
+        .group                   = group,
+        .uid                     = uid,
+        .gid                     = gid,
+        .logfile_uid             = xuid,
+        .logfile_gid             = xgid,
+        .chown_logfile           = chown_logfile,
+        .chroot_path             = chroot_path,
+        .chdir_path              = chdir_path,
+        .rlimits                 = rlimits,
+        .rlimits_count           = rlimits_count,
+        .listen_sockets          = listen_sockets,
+        .listen_sockets_count    = listen_sockets_count,
+        .set_umask               = set_umask,
+        .umask_value             = umask_value,
+        .crash_report            = crash_report,
+        .crash_report_timeout    = crash_report_timeout,
+        .restart                 = restart,
+        .restart_mode            = restart_mode,
+        .standby                 = standby,
+        .metrics_path            = metrics_path,
+        .metrics_unix            = metrics_unix,
+        .restart_sleep_ms        = restart_sleep_ms,
+        .restart_sleep_max_ms    = restart_sleep_max_ms,
+        .restart_sleep_factor    = restart_sleep_factor,
+        .restart_sleep_jitter    = restart_sleep_jitter,
+        .restart_sleep_reset_ms  = restart_sleep_reset_ms,
+        .start_limit_burst       = start_limit_burst,
+        .start_limit_interval_ms = start_limit_interval_ms,
+        .notify                  = notify,
+        .watchdog_ms             = watchdog_ms,
+        .shutdown_timeout_ms     = shutdown_timeout_ms,
+        .health_check            = health_check,
+        .health_target           = health_target,
+        .health_addr             = health_addr,
+        .health_addr_len         = health_addr_len,
+        .health_interval_ms      = health_interval_ms,
+        .health_timeout_ms       = health_timeout_ms,
+        .health_retries          = health_retries,
+        .health_start_period_ms  = health_start_period_ms,
+        .manual_logrotate        = manual_logrotate,
+        .do_pipe                 = do_pipe,
+        .do_logrotate            = do_logrotate,
+        .logrotate_interval      = logrotate_interval,
+        .log_format              = log_format,
+        .log_template            = log_template,
+        .supervised              = supervised,
+        .pidfile_runner          = pidfile_runner,
+        .set_priority            = set_priority,
+        .priority                = priority,
+        .free_pidfile            = free_pidfile,
+        .free_logfile            = free_logfile,
+        .free_command            = free_command,
+        .free_chdir_path         = free_chdir_path,
+        .unlink_listen_sockets   = unlink_listen_sockets,
+
+        .runner_pid              = 0,
+        .pid                     = 0,
+        .pidfd                   = -1,
+        .old_pid                 = 0,
+        .old_pidfd               = -1,
+        .old_stopping            = false,
+        .standby_pid             = 0,
+        .standby_pidfd           = -1,
+        .standby_exec_fd         = -1,
+        .standby_parked          = false,
+        .standby_stopping        = false,
+        .standby_failed          = false,
+        .is_standby              = false,
+        .exec_fd                 = -1,
+        .running                 = false,
+        .restart_issued          = false,
+        .restart_pending         = false,
+        .restart_due             = false,
+        .restart_delay_ms        = restart_sleep_ms,
+        .started_at              = { .tv_sec = 0, .tv_nsec = 0 },
+        .failed                  = false,
+        .restart_times           = NULL,
+        .restart_times_index     = 0,
+        .restart_timer_fd        = -1,
+        .report_pid              = 0,
+        .report_pidfd            = -1,
+        .report_timer_fd         = -1,
+        .pipefd                  = { -1, -1 },
+        .logfile_fd              = logfile_fd,
+        .logfile_path            = logfile_path,
+        .logrotate_deadline      = logrotate_deadline,
+        .logrotate_timer         = {
+            .fd              = -1,
+            .at_boundary     = false,
+            .boundary        = 0,
+            .next_logfile_fd = -1,
+        },
+        .restart_count           = 0,
+        .restart_old_pid         = 0,
+        .restart_requested_ms    = 0,
+        .exited_ms               = 0,
+        .startup_fd              = -1,
+        .notify_fd               = -1,
+        .notify_path             = "",
+        .standby_notify_fd       = -1,
+        .standby_notify_path     = "",
+        .ready                   = false,
+        .reloading               = false,
+        .status_text             = "",
+        .watchdog_timer_fd       = -1,
+        .kill_timer_fd           = -1,
+        .old_kill_timer_fd       = -1,
+        .standby_kill_timer_fd   = -1,
+        .health_timer_fd         = -1,
+        .health_timeout_fd       = -1,
+        .health_probe_fd         = -1,
+        .health_probe_pid        = 0,
+        .health_probe_pidfd      = -1,
+        .health_probe_service_pid = 0,
+        .health_probe_timed_out  = false,
+        .health_failures         = 0,
+        .control_fd              = -1,
+        .control_path            = "",
+        .state_record            = NULL,
+        .state_path              = "",
+        .exit_status             = -1,
+        .exit_signal             = 0,
+        .metrics_fd              = -1,
+        .report_started_ms       = 0,
+        .flight_state            = -1,
+    };
+
+    if (do_logrotate) {
+        strcpy(service->logfile_path_buf, logfile_path_buf);
+        service->logfile_path = service->logfile_path_buf;
+    }
+
+    options->foreground         = foreground;
+    options->wait_ready         = wait_ready;
+    options->wait_ready_timeout = wait_ready_timeout;
+
+    return PREPARE_OK;
+
+cleanup:
+    for (size_t index = 0; index < listen_sockets_count; ++ index) {
+        struct listen_socket *sock = &listen_sockets[index];
+        if (sock->fd == -1) {
+            continue;
+        }
+
+        close(sock->fd);
+
+        if (unlink_listen_sockets && strncmp(sock->spec, "unix:", strlen("unix:")) == 0) {
+            const char *path = sock->spec + strlen("unix:");
+            if (unlink(path) != 0 && errno != ENOENT) {
+                print_error("unlink(\"%s\"): %s", path, strerror(errno));
+            }
+        }
+    }
+
+    free(chroot_path);
+    free(metrics_path);
+    free(pidfile_runner);
+    free(pidfile_failed);
+    free(rlimits);
+    free(listen_sockets);
+
+    if (free_chdir_path) {
+        free((char*)chdir_path);
+    }
+
+    if (free_pidfile) {
+        free((char*)pidfile);
+    }
+
+    if (free_logfile) {
+        free((char*)logfile);
+    }
+
+    if (free_command) {
+        free((char*)command);
+    }
+
+    if (logfile_fd != -1) {
+        close(logfile_fd);
+    }
+
+    if (log_format == log_template) {
+        log_format = NULL;
+    }
+    free_log_template(log_template);
+
+    // status is only 0 here if the service is already running
+    return status == 0 ? PREPARE_RUNNING : PREPARE_ERROR;
+}
+
+// The arguments of the start command, with --config=FILE made from a service
+// definition file. Its keys are the long options of the start command, plus
+// name and command.
+struct start_arguments {
+    struct service_config config;
+    int argc;
+    char **argv;
+    bool free_argv;
+    char **options; // --KEY=VALUE arguments made from the definition
+    size_t options_count;
+    char *command_buf;
+};
+
+static void free_start_arguments(struct start_arguments *args) {
+    for (size_t index = 0; index < args->options_count; ++ index) {
+        free(args->options[index]);
+    }
+
+    if (args->free_argv) {
+        free(args->argv);
+    }
+
+    free(args->options);
+    free(args->command_buf);
+    free_service_config(&args->config);
+
+    args->options       = NULL;
+    args->options_count = 0;
+    args->argv          = NULL;
+    args->free_argv     = false;
+    args->command_buf   = NULL;
+}
+
+static bool parse_bool(const char *str, bool *value) {
+    if (strcasecmp(str, "yes") == 0 || strcasecmp(str, "true") == 0 || strcmp(str, "1") == 0) {
+        *value = true;
+        return true;
+    }
+
+    if (strcasecmp(str, "no") == 0 || strcasecmp(str, "false") == 0 || strcmp(str, "0") == 0) {
+        *value = false;
+        return true;
+    }
+
+    return false;
+}
+
+// Splits the command of a service definition into words. Quoting works like
+// in the shell: '...' is taken literally, in "..." and outside of quotes a
+// backslash escapes the next character. The words are stored in buf, which
+// needs to be at least as big as command.
+static size_t split_command(const char *command, char *buf, char **words) {
+    const char *ptr = command;
+    char *out = buf;
+    size_t count = 0;
+
+    for (;;) {
+        while (*ptr == ' ' || *ptr == '\t') {
+            ++ ptr;
+        }
+
+        if (!*ptr) {
+            return count;
+        }
+
+        words[count ++] = out;
+        char quote = 0;
+        while (*ptr && (quote || (*ptr != ' ' && *ptr != '\t'))) {
+            const char ch = *ptr ++;
+            if (quote == '\'') {
+                if (ch == '\'') {
+                    quote = 0;
+                } else {
+                    *out ++ = ch;
+                }
+            } else if (ch == '\\' && *ptr) {
+                *out ++ = *ptr ++;
+            } else if (quote == '"' && ch == '"') {
+                quote = 0;
+            } else if (!quote && (ch == '\'' || ch == '"')) {
+                quote = ch;
+            } else {
+                *out ++ = ch;
+            }
+        }
+        *out ++ = 0;
+
+        if (quote) {
+            errno = EINVAL;
+            return 0;
+        }
+    }
+}
+
+// For start --config=FILE the service definition file is turned into
+// arguments of the start command, so they are checked like the ones given on
+// the command line. Options given on the command line come after the ones
+// from the file and so take precedence. Without --config args just refers
+// to argc/argv.
+static bool expand_service_config(int argc, char *argv[], struct start_arguments *args) {
+    *args = (struct start_arguments){
+        .config        = {
+            .path    = NULL,
+            .name    = NULL,
+            .content = NULL,
+            .entries = NULL,
+            .count   = 0,
+        },
+        .argc          = argc,
+        .argv          = argv,
+        .free_argv     = false,
+        .options       = NULL,
+        .options_count = 0,
+        .command_buf   = NULL,
+    };
+
+    // Only look for --config. Errors are reported by prepare_service().
+    const char *config_path = NULL;
+    const int saved_opterr = opterr;
+    opterr = 0;
+    optind = 0;
+    for (;;) {
+        int opt = getopt_long(argc - 1, argv + 1, START_SHORT_OPTIONS, start_options, NULL);
+        if (opt == -1) {
+            break;
+        }
+
+        if (opt == 'c') {
+            config_path = optarg;
+        }
+    }
+    opterr = saved_opterr;
+
+    // getopt_long() has moved the options before the other arguments
+    const int options_end = optind + 1;
+    optind = 0;
+
+    if (config_path == NULL) {
+        return true;
+    }
+
+    if (options_end < argc) {
+        fprintf(stderr, "*** error: with --config <name> and <command> are taken from %s\n", config_path);
+        return false;
+    }
+
+    if (read_service_config(config_path, &args->config) != 0) {
+        return false;
+    }
+
+    const struct service_config *config = &args->config;
+    const char *command = get_service_config_value(config, "command");
+    if (command == NULL || !*command) {
+        fprintf(stderr, "*** error: %s: command is missing\n", config_path);
+        goto error;
+    }
+
+    const size_t command_len = strlen(command);
+    const size_t max_words = command_len / 2 + 1;
+    const size_t max_argc = 3 + config->count + (argc - 2) + 1 + max_words + 1;
+
+    args->command_buf = malloc(command_len + 1);
+    args->options     = calloc(config->count, sizeof(char*));
+    args->argv        = calloc(max_argc, sizeof(char*));
+    args->free_argv   = true;
+    if (args->command_buf == NULL || args->options == NULL || args->argv == NULL) {
+        fprintf(stderr, "*** error: allocating arguments for %s: %s\n", config_path, strerror(errno));
+        goto error;
+    }
+
+    int new_argc = 0;
+    args->argv[new_argc ++] = argv[0];
+    args->argv[new_argc ++] = argv[1];
+
+    for (size_t index = 0; index < config->count; ++ index) {
+        const struct service_config_entry *entry = &config->entries[index];
+        if (strcmp(entry->key, "name") == 0 || strcmp(entry->key, "command") == 0) {
+            continue;
+        }
+
+        const struct option *option = NULL;
+        for (size_t opt_index = 0; opt_index < OPT_START_COUNT; ++ opt_index) {
+            if (opt_index != OPT_START_CONFIG && opt_index != OPT_START_ALL && opt_index != OPT_START_JOBS &&
+                strcmp(start_options[opt_index].name, entry->key) == 0) {
+                option = &start_options[opt_index];
+                break;
+            }
+        }
+
+        if (option == NULL) {
+            fprintf(stderr, "*** error: %s:%u: unknown setting: %s\n", config_path, entry->lineno, entry->key);
+            goto error;
+        }
+
+        bool flag = false;
+        const bool is_bool = parse_bool(entry->value, &flag);
+        char *arg = NULL;
+
+        if (option->has_arg == no_argument && !is_bool) {
+            fprintf(stderr, "*** error: %s:%u: illegal value for %s, expected yes or no: %s\n",
+                config_path, entry->lineno, entry->key, entry->value);
+            goto error;
+        } else if (option->has_arg != required_argument && is_bool) {
+            if (!flag) {
+                continue;
+            }
+
+            if (asprintf(&arg, "--%s", entry->key) < 0) {
+                arg = NULL;
+            }
+        } else if (asprintf(&arg, "--%s=%s", entry->key, entry->value) < 0) {
+            arg = NULL;
+        }
+
+        if (arg == NULL) {
+            fprintf(stderr, "*** error: asprintf(): %s\n", strerror(errno));
+            goto error;
+        }
+
+        args->options[args->options_count ++] = arg;
+        args->argv[new_argc ++] = arg;
+    }
+
+    for (int index = 2; index < options_end; ++ index) {
+        if (strcmp(argv[index], "--") != 0) {
+            args->argv[new_argc ++] = argv[index];
+        }
+    }
+
+    args->argv[new_argc ++] = config->name;
+    args->argv[new_argc ++] = "--";
+
+    const size_t word_count = split_command(command, args->command_buf, args->argv + new_argc);
+    if (word_count == 0) {
+        fprintf(stderr, "*** error: %s: unterminated quote in command: %s\n", config_path, command);
+        goto error;
+    }
+
+    new_argc += (int)word_count;
+    args->argv[new_argc] = NULL;
+    args->argc = new_argc;
+
+    return true;
+
+error:
+    free_start_arguments(args);
+    return false;
+}
+
+static void free_service(struct service *service) {
+    for (size_t index = 0; index < service->listen_sockets_count; ++ index) {
+        const struct listen_socket *sock = &service->listen_sockets[index];
+        if (sock->fd == -1) {
+            continue;
+        }
+
+        close(sock->fd);
+
+        if (service->unlink_listen_sockets && strncmp(sock->spec, "unix:", strlen("unix:")) == 0) {
+            const char *path = sock->spec + strlen("unix:");
+            if (unlink(path) != 0 && errno != ENOENT) {
+                print_error("unlink(\"%s\"): %s", path, strerror(errno));
+            }
+        }
+    }
+
+    free((char*)service->chroot_path);
+    free((char*)service->metrics_path);
+    free(service->pidfile_runner);
+    free((char*)service->pidfile_failed);
+    free((struct rlimit_params*)service->rlimits);
+    free((struct listen_socket*)service->listen_sockets);
+
+    if (service->free_chdir_path) {
+        free((char*)service->chdir_path);
+    }
+
+    if (service->free_pidfile) {
+        free((char*)service->pidfile);
+    }
+
+    if (service->free_logfile) {
+        free((char*)service->logfile);
+    }
+
+    if (service->free_command) {
+        free((char*)service->command);
+    }
+
+    if (service->logfile_fd != -1) {
+        close(service->logfile_fd);
+        service->logfile_fd = -1;
+    }
+
+    if (log_format == service->log_template) {
+        log_format = NULL;
+    }
+    free_log_template(service->log_template);
+    service->log_template = NULL;
+}
+
+// Block signals for the whole lifetime of the service-runner. They are
+// received via a signalfd in the event loop instead, so service-runner can't
+// terminate in an invalid state concerning created pidfiles and such. The
+// service process unblocks them again before execv().
+static bool block_runner_signals(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+        fprintf(stderr, "*** error: sigprocmask(SIG_BLOCK, &mask, NULL): %s\n", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool redirect_stdin(void) {
+    if (close(STDIN_FILENO) != 0 && errno != EBADFD) {
+        fprintf(stderr, "*** error: close(STDIN_FILENO): %s\n", strerror(errno));
+        return false;
+    }
+
+    int stdin_fd = open("/dev/null", O_RDONLY);
+    if (stdin_fd == -1) {
+        fprintf(stderr, "*** error: open(\"/dev/null\", O_RDONLY): %s\n", strerror(errno));
+        return false;
+    }
+
+    if (stdin_fd != STDIN_FILENO) {
+        if (dup2(stdin_fd, STDIN_FILENO) == -1) {
+            fprintf(stderr, "*** error: dup2(stdin_fd, STDIN_FILENO): %s\n", strerror(errno));
+            return false;
+        }
+
+        if (close(stdin_fd) != 0) {
+            fprintf(stderr, "*** error: close(stdin_fd): %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int start_single_service(int argc, char *argv[]) {
+    struct service service;
+    struct start_command_options options;
+    int status = 0;
+    int startup_fds[2] = { -1, -1 };
+    off_t log_offset = 0;
+    bool cleanup_pidfiles = false;
+    struct start_arguments args;
+
+    if (!expand_service_config(argc, argv, &args)) {
+        return 1;
+    }
+
+    switch (prepare_service(args.argc, args.argv, false, &service, &options)) {
+        case PREPARE_OK:
+            break;
+
+        case PREPARE_RUNNING:
+            free_start_arguments(&args);
+            return 0;
+
+        case PREPARE_ERROR:
+            free_start_arguments(&args);
+            return 1;
+    }
+
+    if (!options.foreground) {
+        // The shell command waits until the service-runner has written its
+        // pidfile, so that following commands find it, and with
+        // --wait-ready until the service is ready.
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, startup_fds) != 0) {
+            fprintf(stderr, "*** error: socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, startup_fds): %s\n", strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
+        log_offset = lseek(service.logfile_fd, 0, SEEK_END);
+        if (log_offset == -1) {
+            log_offset = 0;
+        }
+
+        flush_runner_log();
         const pid_t pid = fork();
         if (pid < 0) {
             fprintf(stderr, "*** error: fork for deamonize failed: %s\n", strerror(errno));
@@ -1873,700 +6402,535 @@ int command_start(int argc, char *argv[]) {
             goto cleanup;
         } else if (pid != 0) {
             // parent: shell command quitting
+            close(startup_fds[STARTUP_RUNNER]);
+            startup_fds[STARTUP_RUNNER] = -1;
+
+            // the unix domain sockets belong to the service-runner now
+            service.unlink_listen_sockets = false;
+
+            status = wait_for_startup(service.name, startup_fds[STARTUP_COMMAND], options.wait_ready, options.wait_ready_timeout, service.logfile_path, log_offset);
             goto cleanup;
         }
+
+        close(startup_fds[STARTUP_COMMAND]);
+        startup_fds[STARTUP_COMMAND] = -1;
     }
 
     // child: service-runner process
     cleanup_pidfiles = true;
-    {
-        // block signals until forked service process
-        // Can't install the signal handlers in here, because they would
-        // also run in the child, but if I don't block these signals
-        // service-runner might terminate in an invalid state concerning
-        // created pidfiles and such.
-        sigset_t mask;
-        sigemptyset(&mask);
-        sigaddset(&mask, SIGHUP);
-        sigaddset(&mask, SIGTERM);
-        sigaddset(&mask, SIGQUIT);
-        sigaddset(&mask, SIGINT);
-        sigaddset(&mask, SIGUSR1);
-        sigaddset(&mask, SIGCHLD);
-        if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
-            fprintf(stderr, "*** error: sigprocmask(SIG_BLOCK, &mask, NULL): %s\n", strerror(errno));
-            status = 1;
-            goto cleanup;
-        }
+    if (!block_runner_signals()) {
+        status = 1;
+        goto cleanup;
     }
 
     const pid_t runner_pid = getpid();
     {
-        if (write_pidfile(pidfile_runner, runner_pid) != 0) {
-            fprintf(stderr, "*** error: write_pidfile(\"%s\", %u): %s\n", pidfile_runner, getpid(), strerror(errno));
+        if (write_pidfile(service.pidfile_runner, runner_pid) != 0) {
+            fprintf(stderr, "*** error: write_pidfile(\"%s\", %u): %s\n", service.pidfile_runner, getpid(), strerror(errno));
             status = 1;
             goto cleanup;
         }
 
-        // setup standard I/O
-        if (close(STDIN_FILENO) != 0 && errno != EBADFD) {
-            fprintf(stderr, "*** error: close(STDIN_FILENO): %s\n", strerror(errno));
-            status = 1;
-            goto cleanup;
+        if (startup_fds[STARTUP_RUNNER] != -1) {
+            const char running = STARTUP_RUNNING;
+            if (send(startup_fds[STARTUP_RUNNER], &running, 1, MSG_NOSIGNAL) != 1) {
+                fprintf(stderr, "*** error: send(startup_fd, &running, 1, MSG_NOSIGNAL): %s\n", strerror(errno));
+            }
+
+            if (!options.wait_ready) {
+                close(startup_fds[STARTUP_RUNNER]);
+                startup_fds[STARTUP_RUNNER] = -1;
+            }
         }
 
-        int stdin_fd = open("/dev/null", O_RDONLY);
-        if (stdin_fd == -1) {
-            fprintf(stderr, "*** error: open(\"/dev/null\", O_RDONLY): %s\n", strerror(errno));
+        // setup standard I/O
+        if (!redirect_stdin()) {
             status = 1;
             goto cleanup;
         }
 
-        if (stdin_fd != STDIN_FILENO) {
-            if (dup2(stdin_fd, STDIN_FILENO) == -1) {
-                fprintf(stderr, "*** error: dup2(stdin_fd, STDIN_FILENO): %s\n", strerror(errno));
-                status = 1;
-                goto cleanup;
-            }
-
-            if (close(stdin_fd) != 0) {
-                fprintf(stderr, "*** error: close(stdin_fd): %s\n", strerror(errno));
-                status = 1;
-                goto cleanup;
-            }
-        }
-
         fflush(stdout);
-        if (dup2(logfile_fd, STDOUT_FILENO) == -1) {
-            fprintf(stderr, "*** error: dup2(logfile_fd, STDOUT_FILENO): %s\n", strerror(errno));
+        if (dup2(service.logfile_fd, STDOUT_FILENO) == -1) {
+            fprintf(stderr, "*** error: dup2(service.logfile_fd, STDOUT_FILENO): %s\n", strerror(errno));
             status = 1;
             goto cleanup;
         }
 
         fflush(stderr);
-        if (dup2(logfile_fd, STDERR_FILENO) == -1) {
-            fprintf(stderr, "*** error: dup2(logfile_fd, STDERR_FILENO): %s\n", strerror(errno));
+        if (dup2(service.logfile_fd, STDERR_FILENO) == -1) {
+            fprintf(stderr, "*** error: dup2(service.logfile_fd, STDERR_FILENO): %s\n", strerror(errno));
             status = 1;
             goto cleanup;
         }
     }
 
-    print_info("starting...");
-
-    running = true;
-    while (running) {
-        if (do_pipe) {
-            pipefd[PIPE_READ ] = -1;
-            pipefd[PIPE_WRITE] = -1;
-
-            // logging pipe
-            // if no log-rotating is done stdout/stderr pipes directly to the logfile, no need for the pipe
-            int result = pipe(pipefd);
-            if (result != 0) {
-                print_error("pipe(pipefd): %s", strerror(errno));
-                status = 1;
-                goto cleanup;
-            }
+    print_info("starting...");
+
+    service.runner_pid = runner_pid;
+    service.startup_fd = startup_fds[STARTUP_RUNNER];
+
+    // closed by run_service()
+    startup_fds[STARTUP_RUNNER] = -1;
+
+    status = run_service(&service);
+
+cleanup:
+    if (cleanup_pidfiles) {
+        remove_pidfiles(&service);
+    }
+
+    free_service(&service);
+    free_start_arguments(&args);
 
-            int flags = fcntl(pipefd[PIPE_READ], F_GETFL, 0);
-            if (flags == -1) {
-                print_error("fcntl(pipefd[PIPE_READ], F_GETFL, 0): %s", strerror(errno));
-                flags = 0;
-            }
+    if (startup_fds[STARTUP_COMMAND] != -1) {
+        close(startup_fds[STARTUP_COMMAND]);
+    }
 
-            if (fcntl(pipefd[PIPE_READ], F_SETFL, flags | O_NONBLOCK) == -1) {
-                print_error("fcntl(pipefd[PIPE_READ], F_SETFL, flags | O_NONBLOCK): %s", strerror(errno));
-            }
-        }
+    if (startup_fds[STARTUP_RUNNER] != -1) {
+        close(startup_fds[STARTUP_RUNNER]);
+    }
 
-        service_pid = fork();
+    return status;
+}
 
-        if (service_pid < 0) {
-            print_error("fork for starting service failed: %s", strerror(errno));
-            status = 1;
-            goto cleanup;
-        } else if (service_pid == 0) {
-            // child: service process
-            cleanup_pidfiles = false;
+#define SERVICE_FILE_EXT ".service"
 
-            if (write_pidfile(pidfile, getpid()) != 0) {
-                print_error("(child) write_pidfile(\"%s\", %u): %s", pidfile, getpid(), strerror(errno));
-                signal_premature_exit(runner_pid);
-                status = 1;
-                goto cleanup;
-            }
+static int filter_service_files(const struct dirent *entry) {
+    const size_t len = strlen(entry->d_name);
+    const size_t ext_len = strlen(SERVICE_FILE_EXT);
 
-            if (do_pipe) {
-                if (close(pipefd[PIPE_READ]) != 0) {
-                    print_error("(child) close(pipefd[PIPE_READ]): %s", strerror(errno));
-                }
-                pipefd[PIPE_READ] = -1;
-            }
+    return entry->d_name[0] != '.' && len > ext_len &&
+        strcmp(entry->d_name + len - ext_len, SERVICE_FILE_EXT) == 0;
+}
 
-            if (close(logfile_fd) != 0) {
-                print_error("(child) close(logfile_fd): %s", strerror(errno));
-            } else {
-                logfile_fd = -1;
-            }
-
-            // Because I don't know how to check if the target priority value is
-            // allowed I have to already set it for the whole service-runner
-            // process. (See above.)
-
-            // Maybe I should do setrlimit() in the parent, too?
-            // But a user would expect things like RLIMIT_FSIZE to only apply to the service and
-            // not the service runner, i.e. the logfile shouldn't be limited by it.
-            for (size_t index = 0; index < rlimits_count; ++ index) {
-                struct rlimit_params *lim = &rlimits[index];
-                if (setrlimit(lim->resource, &lim->limit) != 0) {
-                    print_error("(child) setrlimit(%d, { .rlim_cur = %ld, .rlim_max = %ld }): %s",
-                        lim->resource,
-                        lim->limit.rlim_cur,
-                        lim->limit.rlim_max,
-                        strerror(errno));
-                    signal_premature_exit(runner_pid);
-                    status = 1;
-                    goto cleanup;
-                }
-            }
+// Looks for --all=DIR and --jobs=N. Other errors are reported later by
+// prepare_service(). The options that name files of a single service are
+// rejected together with --all, because every service would get them.
+static bool get_bulk_start_options(int argc, char *argv[], const char **dirname_ptr, size_t *jobs_ptr, int *options_end_ptr) {
+    bool per_service_option = false;
+    const int saved_opterr = opterr;
+    bool ok = true;
+    int longind = 0;
 
-            if (set_umask) {
-                umask(umask_value);
-            }
+    opterr = 0;
+    optind = 0;
+    for (;;) {
+        int opt = getopt_long(argc - 1, argv + 1, START_SHORT_OPTIONS, start_options, &longind);
+        if (opt == -1) {
+            break;
+        }
 
-            if (do_pipe) {
-                if (pipefd[PIPE_WRITE] != STDOUT_FILENO) {
-                    fflush(stdout);
-                    if (dup2(pipefd[PIPE_WRITE], STDOUT_FILENO) == -1) {
-                        print_error("(child) dup2(pipefd[PIPE_WRITE], STDOUT_FILENO): %s", strerror(errno));
-                        signal_premature_exit(runner_pid);
-                        status = 1;
-                        goto cleanup;
-                    }
-                }
+        if (opt == 0 && longind == OPT_START_ALL) {
+            *dirname_ptr = optarg;
+        } else if (opt == 'c' || opt == 'p' || opt == 'l') {
+            per_service_option = true;
+        } else if (opt == 'j' && parse_jobs(optarg, jobs_ptr) != 0) {
+            fprintf(stderr, "*** error: illegal value for --jobs: %s\n", optarg);
+            ok = false;
+        }
+    }
+    opterr = saved_opterr;
 
-                if (pipefd[PIPE_WRITE] != STDERR_FILENO) {
-                    fflush(stderr);
-                    if (dup2(pipefd[PIPE_WRITE], STDERR_FILENO) == -1) {
-                        print_error("(child) dup2(pipefd[PIPE_WRITE], STDERR_FILENO): %s", strerror(errno));
-                        signal_premature_exit(runner_pid);
-                        status = 1;
-                        goto cleanup;
-                    }
-                }
+    // getopt_long() has moved the options before the other arguments
+    *options_end_ptr = optind + 1;
+    optind = 0;
 
-                if (pipefd[PIPE_WRITE] != STDOUT_FILENO && pipefd[PIPE_WRITE] != STDERR_FILENO && close(pipefd[PIPE_WRITE]) != 0) {
-                    print_error("(child) close(pipefd[PIPE_WRITE]): %s", strerror(errno));
-                    // though, ignore it anyway?
-                }
-                pipefd[PIPE_WRITE] = -1;
-            }
+    if (ok && *dirname_ptr != NULL && per_service_option) {
+        fprintf(stderr, "*** error: --pidfile, --logfile and --config can only be used with a single service\n");
+        ok = false;
+    }
 
-            if (chroot_path != NULL && chroot(chroot_path) != 0) {
-                print_error("(child) chroot(\"%s\"): %s", chroot_path, strerror(errno));
-                signal_premature_exit(runner_pid);
-                status = 1;
-                goto cleanup;
-            }
+    return ok;
+}
 
-            if (chdir_path != NULL && chdir(chdir_path) != 0) {
-                print_error("(child) chdir(\"%s\"): %s", chdir_path, strerror(errno));
-                signal_premature_exit(runner_pid);
-                status = 1;
-                goto cleanup;
-            }
+// Starts the service definitions DIR/NAME.service (all or the given names),
+// each by its own service-runner. Up to jobs services are started at once by
+// child processes that do the same as start --config=DIR/NAME.service with
+// the remaining options, so e.g. --wait-ready waits for all of them.
+static int start_services(int argc, char *argv[], const char *dirname, size_t jobs, int options_end) {
+    struct dirent **entries = NULL;
+    int entry_count = 0;
+    char **paths = NULL;
+    size_t count = 0;
+    pid_t *pids = NULL;
+    char **child_argv = NULL;
+    int status = 0;
 
-            // signal masks are preserved across exec*()
-            sigset_t mask;
-            sigemptyset(&mask);
-            sigaddset(&mask, SIGTERM);
-            sigaddset(&mask, SIGQUIT);
-            sigaddset(&mask, SIGINT);
-            sigaddset(&mask, SIGUSR1);
-            sigaddset(&mask, SIGCHLD);
-            if (sigprocmask(SIG_UNBLOCK, &mask, NULL) != 0) {
-                print_error("(child) sigprocmask(SIG_UNBLOCK, &mask, NULL): %s", strerror(errno));
-                signal_premature_exit(runner_pid);
-                status = 1;
-                goto cleanup;
-            }
+    if (options_end < argc) {
+        paths = calloc(argc - options_end, sizeof(char*));
+        if (paths == NULL) {
+            fprintf(stderr, "*** error: calloc(%d, %zu): %s\n", argc - options_end, sizeof(char*), strerror(errno));
+            return 1;
+        }
 
-            // drop _supplementary_ group IDs
-            if (group != NULL && setgroups(0, NULL) != 0) {
-                print_error("(child) setgroups(0, NULL): %s", strerror(errno));
-                signal_premature_exit(runner_pid);
+        for (int index = options_end; index < argc; ++ index) {
+            char filename[NAME_MAX + 1];
+            int len = snprintf(filename, sizeof(filename), "%s" SERVICE_FILE_EXT, argv[index]);
+            if (len < 0 || (size_t)len >= sizeof(filename) || strchr(argv[index], '/') != NULL) {
+                fprintf(stderr, "*** error: illegal service name: %s\n", argv[index]);
                 status = 1;
                 goto cleanup;
             }
 
-            if (group != NULL && setgid(gid) != 0) {
-                print_error("(child) setgid(%u): %s", gid, strerror(errno));
-                signal_premature_exit(runner_pid);
+            char *path = join_path(dirname, filename);
+            if (path == NULL) {
+                fprintf(stderr, "*** error: join_path(\"%s\", \"%s\"): %s\n", dirname, filename, strerror(errno));
                 status = 1;
                 goto cleanup;
             }
+            paths[count ++] = path;
 
-            if (user != NULL && setuid(uid) != 0) {
-                print_error("(child) setuid(%u): %s", uid, strerror(errno));
-                signal_premature_exit(runner_pid);
+            if (access(path, R_OK) != 0) {
+                fprintf(stderr, "*** error: %s: %s\n", path, strerror(errno));
                 status = 1;
                 goto cleanup;
             }
+        }
+    } else {
+        entry_count = scandir(dirname, &entries, filter_service_files, alphasort);
+        if (entry_count < 0) {
+            fprintf(stderr, "*** error: scandir(\"%s\", ...): %s\n", dirname, strerror(errno));
+            return 1;
+        }
 
-            // start service
-            execv(command, command_argv);
-
-            print_error("(child) execv(\"%s\", command_argv): %s", command, strerror(errno));
-            signal_premature_exit(runner_pid);
+        if (entry_count == 0) {
+            fprintf(stderr, "*** error: no *" SERVICE_FILE_EXT " files in %s\n", dirname);
             status = 1;
             goto cleanup;
-        } else {
-            // parent: service-runner process
-            {
-                // setup signal handling
-                if (signal(SIGTERM, handle_stop_signal) == SIG_ERR) {
-                    print_error("(parent) signal(SIGTERM, handle_stop_signal): %s", strerror(errno));
-                }
-
-                if (signal(SIGQUIT, handle_stop_signal) == SIG_ERR) {
-                    print_error("(parent) signal(SIGQUIT, handle_stop_signal): %s", strerror(errno));
-                }
+        }
 
-                if (signal(SIGINT, handle_stop_signal) == SIG_ERR) {
-                    print_error("(parent) signal(SIGINT, handle_stop_signal): %s", strerror(errno));
-                }
+        paths = calloc(entry_count, sizeof(char*));
+        if (paths == NULL) {
+            fprintf(stderr, "*** error: calloc(%d, %zu): %s\n", entry_count, sizeof(char*), strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
 
-                if (manual_logrotate && signal(SIGHUP, handles_logrotate) == SIG_ERR) {
-                    print_error("(parent) signal(SIGHUP, handles_logrotate): %s", strerror(errno));
-                }
+        for (int index = 0; index < entry_count; ++ index) {
+            char *path = join_path(dirname, entries[index]->d_name);
+            if (path == NULL) {
+                fprintf(stderr, "*** error: join_path(\"%s\", \"%s\"): %s\n", dirname, entries[index]->d_name, strerror(errno));
+                status = 1;
+                goto cleanup;
+            }
+            paths[count ++] = path;
+        }
+    }
 
-                if (signal(SIGUSR1, handle_restart_signal) == SIG_ERR) {
-                    print_error("(parent) signal(SIGUSR1, handle_restart_signal): %s", strerror(errno));
-                }
+    // argv[0], start, the options without a bare --, --config, FILE, NULL
+    int child_argc = 0;
+    child_argv = calloc(options_end + 3, sizeof(char*));
+    pids = calloc(count, sizeof(pid_t));
+    if (child_argv == NULL || pids == NULL) {
+        fprintf(stderr, "*** error: calloc(): %s\n", strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
 
-                sigset_t mask;
-                sigemptyset(&mask);
-                sigaddset(&mask, SIGTERM);
-                sigaddset(&mask, SIGQUIT);
-                sigaddset(&mask, SIGINT);
-                if (manual_logrotate) {
-                    sigaddset(&mask, SIGHUP);
-                }
-                sigaddset(&mask, SIGUSR1);
-                if (sigprocmask(SIG_UNBLOCK, &mask, NULL) != 0) {
-                    print_error("(parent) sigprocmask(SIG_UNBLOCK, &mask, NULL): %s", strerror(errno));
-                }
+    for (int index = 0; index < options_end; ++ index) {
+        if (index < 2 || strcmp(argv[index], "--") != 0) {
+            child_argv[child_argc ++] = argv[index];
+        }
+    }
+    child_argv[child_argc ++] = "--config";
+
+    size_t next = 0;
+    size_t running = 0;
+    size_t start_count = count;
+    while (next < start_count || running > 0) {
+        while (running < jobs && next < start_count) {
+            // don't duplicate buffered output in the child
+            fflush(stdout);
+            fflush(stderr);
+
+            const pid_t pid = fork();
+            if (pid < 0) {
+                fprintf(stderr, "*** error: fork(): %s\n", strerror(errno));
+                status = 1;
+                // don't start any more services, but wait for the others
+                start_count = next;
+                break;
             }
 
-            if (do_pipe && close(pipefd[PIPE_WRITE]) != 0) {
-                print_error("(parent) close(pipefd[PIPE_WRITE]): %s", strerror(errno));
-                // though, ignore it anyway?
+            if (pid == 0) {
+                child_argv[child_argc] = paths[next];
+                exit(start_single_service(child_argc + 1, child_argv));
             }
-            pipefd[PIPE_WRITE] = -1;
 
-            service_pidfd = pidfd_open(service_pid, 0);
-            if (service_pidfd == -1 && errno != ENOSYS) {
-                print_error("(parent) pidfd_open(%u): %s", service_pid, strerror(errno));
+            pids[next ++] = pid;
+            ++ running;
+        }
 
-                // wait a bit so the signal handlers are resetted again in child
-                struct timespec wait_time = {
-                    .tv_sec  = 0,
-                    .tv_nsec = 500000000,
-                };
-                nanosleep(&wait_time, NULL);
+        if (running == 0) {
+            break;
+        }
 
-                if (kill(service_pid, SIGTERM) != 0 && errno != ESRCH) {
-                    print_error("(parent) kill(%u, SIGTERM): %s", service_pid, strerror(errno));
-                }
+        int child_status = 0;
+        const pid_t pid = waitpid(-1, &child_status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "*** error: waitpid(-1, &child_status, 0): %s\n", strerror(errno));
+            status = 1;
+            break;
+        }
 
-                for (;;) {
-                    int child_status = 0;
-                    int result = waitpid(service_pid, &child_status, 0);
-                    if (result < 0) {
-                        if (errno == EINTR) {
-                            continue;
-                        }
-                        if (errno != ECHILD) {
-                            print_error("(parent) waitpid(%u, &status, 0): %s", service_pid, strerror(errno));
-                        }
-                    } else if (result == 0) {
-                        assert(false);
-                        continue;
-                    } else if (child_status != 0) {
-                        if (WIFSIGNALED(child_status)) {
-                            print_error("service PID %u exited with signal %d", service_pid, WTERMSIG(child_status));
-                        } else {
-                            print_error("service PID %u exited with status %d", service_pid, WEXITSTATUS(child_status));
-                        }
-                    }
-                    break;
-                }
+        for (size_t index = 0; index < next; ++ index) {
+            if (pids[index] == pid) {
+                pids[index] = 0;
+                -- running;
 
-                status = 1;
-                goto cleanup;
+                if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0) {
+                    fprintf(stderr, "*** error: starting %s failed\n", paths[index]);
+                    status = 1;
+                }
+                break;
             }
+        }
+    }
 
-            // setup polling
-            #define POLLFD_PID  0
-            #define POLLFD_PIPE 1
+cleanup:
+    for (int index = 0; index < entry_count; ++ index) {
+        free(entries[index]);
+    }
+    free(entries);
 
-            struct pollfd pollfds[] = {
-                [POLLFD_PID ] = { service_pidfd,     POLLIN, 0 },
-                [POLLFD_PIPE] = { pipefd[PIPE_READ], do_pipe ? POLLIN : 0, 0 },
-            };
+    if (paths != NULL) {
+        for (size_t index = 0; index < count; ++ index) {
+            free(paths[index]);
+        }
+        free(paths);
+    }
 
-            if (service_pidfd == -1) {
-                // for systems that don't support pidfd
-                pollfds[POLLFD_PID ].revents = 0;
-                if (signal(SIGCHLD, handle_child) == SIG_ERR) {
-                    print_error("signal(SIGCHLD, handle_child): %s", strerror(errno));
-                }
-            }
+    free(pids);
+    free(child_argv);
 
-            sigset_t mask;
-            sigemptyset(&mask);
-            sigaddset(&mask, SIGCHLD);
-            if (sigprocmask(SIG_UNBLOCK, &mask, NULL) != 0) {
-                print_error("(parent) sigprocmask(SIG_UNBLOCK, &mask, NULL): %s", strerror(errno));
-            }
+    return status;
+}
 
-            while (pollfds[POLLFD_PID].events != 0 || pollfds[POLLFD_PIPE].events != 0) {
-                pollfds[POLLFD_PID ].revents = 0;
-                pollfds[POLLFD_PIPE].revents = 0;
+int command_start(int argc, char *argv[]) {
+    if (argc < 2) {
+        return 1;
+    }
 
-                int result =
-                    pollfds[0].events == 0 ? poll(pollfds + 1, 1, -1) :
-                    pollfds[1].events == 0 ? poll(pollfds,     1, -1) :
-                                             poll(pollfds,     2, -1);
-                if (result < 0) {
-                    if (errno != EINTR) {
-                        print_error("(parent) poll(): %s", strerror(errno));
-                        break;
-                    }
-                }
+    // Ensure that stdout is buffered the same, no matter if it is a tty.
+    // Whole lines are written in batches, so they appear correctly in the
+    // logfile. This needs to happen before any write to stdout.
+    if (!set_runner_log_buffer()) {
+        return 1;
+    }
 
-                if (do_pipe) {
-                    const bool has_logdata = pollfds[POLLFD_PIPE].revents & POLLIN;
-                    if (has_logdata || logrotate_issued) {
-                        // log-handling
-                        char new_logfile_path_buf[PATH_MAX];
-                        const char *new_logfile_path = NULL;
-                        if (do_logrotate) {
-                            const time_t now = time(NULL);
-                            struct tm local_now;
-
-                            if (localtime_r(&now, &local_now) == NULL) {
-                                print_error("(parent) getting local time: %s", strerror(errno));
-                            } else if (strftime(new_logfile_path_buf, sizeof(new_logfile_path_buf), logfile, &local_now) == 0) {
-                                print_error("(parent) cannot format logfile \"%s\": %s", logfile, strerror(errno));
-                            } else if (strcmp(new_logfile_path_buf, logfile_path_buf) != 0) {
-                                new_logfile_path = new_logfile_path_buf;
-                            }
-                        } else if (logrotate_issued) {
-                            logrotate_issued = false;
-                            // just re-open the same file
-                            new_logfile_path = logfile_path;
-                        }
+    // Set stderr to be line buffered so that concurrent writes
+    // between the service-runner process and the service itself have
+    // a smaller chance to interfere.
+    // This is ok since log messages as written here are always single
+    // and whole lines (assuming strerror(errno) never returns a
+    // multiline string).
+    if (setvbuf(stderr, NULL, _IOLBF, 0) != 0) {
+        perror("*** error: setvbuf(stderr, NULL, _IOLBF, 0)");
+        return 1;
+    }
 
-                        if (new_logfile_path != NULL) {
-                            // (re-)open logfile
-                            int new_logfile_fd = open(new_logfile_path, O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND, 0644);
-                            if (logfile_fd == -1) {
-                                print_error("(parent) cannot open logfile: %s: %s", new_logfile_path, strerror(errno));
-                            }
+    const char *all_dir = NULL;
+    size_t jobs = DEFAULT_JOBS;
+    int options_end = 0;
 
-                            if (chown_logfile && fchown(new_logfile_fd, xuid, xgid) != 0) {
-                                print_error("(parent) cannot change owner of logfile: %s: %s", new_logfile_path, strerror(errno));
-                            }
+    if (!get_bulk_start_options(argc, argv, &all_dir, &jobs, &options_end)) {
+        return 1;
+    }
 
-                            if (close(logfile_fd) != 0) {
-                                print_error("(parent) close(logfile_fd): %s", strerror(errno));
-                            }
+    if (all_dir != NULL) {
+        return start_services(argc, argv, all_dir, jobs, options_end);
+    }
 
-                            logfile_fd = new_logfile_fd;
-                            fflush(stdout);
-                            if (dup2(logfile_fd, STDOUT_FILENO) == -1) {
-                                print_error("(parent) dup2(logfile_fd, STDOUT_FILENO): %s", strerror(errno));
-                            }
+    return start_single_service(argc, argv);
+}
 
-                            fflush(stderr);
-                            if (dup2(logfile_fd, STDERR_FILENO) == -1) {
-                                print_error("(parent) dup2(logfile_fd, STDERR_FILENO): %s", strerror(errno));
-                            }
+// supervise reads the service definitions DIR/NAME.service, as used by
+// start --config=FILE.
+struct service_definition {
+    char *path;
+    char *argv[5];
+    struct start_arguments args;
+};
 
-                            if (new_logfile_path == new_logfile_path_buf) {
-                                strcpy(logfile_path_buf, new_logfile_path_buf);
-                            }
-                        }
+static bool read_service_definition(const char *progname, const char *dirname, const char *filename, struct service_definition *def) {
+    def->path = join_path(dirname, filename);
+    if (def->path == NULL) {
+        fprintf(stderr, "*** error: join_path(\"%s\", \"%s\"): %s\n", dirname, filename, strerror(errno));
+        return false;
+    }
 
-                        if (has_logdata) {
-                            // handle log messages
-                            const ssize_t count = splice(pipefd[PIPE_READ], NULL, logfile_fd, NULL, SPLICE_SIZE, SPLICE_F_NONBLOCK);
-                            if (count < 0 && errno != EINTR) {
-                                if (errno == EINVAL) {
-                                    // The docker volume filesystem doesn't support splice()
-                                    // and sendfile() doesn't support out_fd with O_APPEND set
-                                    // -> manual read()/write()
-                                    char buf[BUFSIZ];
-                                    ssize_t rcount = read(pipefd[PIPE_READ], buf, sizeof(buf));
-                                    if (rcount < 0) {
-                                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                                            print_error("(parent) read(pipefd[PIPE_READ], buf, sizeof(buf)): %s",
-                                                strerror(errno));
-                                        }
-                                        break;
-                                    } else {
-                                        size_t offset = 0;
-                                        while (offset < rcount) {
-                                            ssize_t wcount = write(logfile_fd, buf + offset, rcount - offset);
-                                            if (wcount < 0) {
-                                                if (errno == EINTR) {
-                                                    continue;
-                                                }
-                                                print_error("(parent) write(logfile_fd, buf + offset, rcount - offset): %s",
-                                                    strerror(errno));
-                                                break;
-                                            }
-
-                                            offset += wcount;
-                                        }
-                                    }
-                                } else {
-                                    print_error("(parent) splice(pipefd[PIPE_READ], NULL, logfile_fd, NULL, SPLICE_SIZE, SPLICE_F_NONBLOCK): %s",
-                                        strerror(errno));
-                                }
-                            }
-                        }
-                    }
+    def->argv[0] = (char*)progname;
+    def->argv[1] = "start";
+    def->argv[2] = "--config";
+    def->argv[3] = def->path;
+    def->argv[4] = NULL;
 
-                    if (pollfds[POLLFD_PIPE].revents & (POLLHUP | POLLERR | POLLNVAL)) {
-                        pollfds[POLLFD_PIPE].events = 0;
-                    }
-                }
+    return expand_service_config(4, def->argv, &def->args);
+}
 
-                if ((pollfds[POLLFD_PID].revents & POLLIN) || got_sigchld) {
-                    got_sigchld = false;
-                    // waitid() doesn't work for some reason! always produces ECHLD
-                    int service_status = 0;
-                    pid_t result = waitpid(service_pid, &service_status, WNOHANG);
-                    if (result == 0) {
-                        // would have blocked
-                    } else if (result == -1) {
-                        pollfds[POLLFD_PID].events = 0;
-                        print_error("(parent) waitpid(%d, &service_status, WNOHANG): %s", service_pid, strerror(errno));
-                    } else {
-                        // block signals again until we're ready again
-                        // Should that be done before waitpid()?
-                        // (and unblock again in the other two branches of this if-else-if-block)
-                        sigset_t mask;
-                        sigemptyset(&mask);
-                        sigaddset(&mask, SIGTERM);
-                        sigaddset(&mask, SIGQUIT);
-                        sigaddset(&mask, SIGINT);
-                        sigaddset(&mask, SIGUSR1);
-                        sigaddset(&mask, SIGCHLD);
-                        if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
-                            print_error("(parent) sigprocmask(SIG_BLOCK, &mask, NULL): %s", strerror(errno));
-                        }
+int command_supervise(int argc, char *argv[]) {
+    if (argc < 2) {
+        return 1;
+    }
 
-                        pollfds[POLLFD_PID].events = 0;
-                        bool crash = false;
-                        int param = 0;
-                        const char *code_str = NULL;
+    if (argc != 3) {
+        fprintf(stderr, "*** error: illegal number of arguments\n");
+        short_usage(argc, argv);
+        return 1;
+    }
 
-                        if (WIFEXITED(service_status)) {
-                            param = WEXITSTATUS(service_status);
-                            code_str = "EXITED";
+    if (!set_runner_log_buffer()) {
+        return 1;
+    }
 
-                            if (param == 0) {
-                                print_info("%s exited normally", name);
-                                if (!restart_issued && restart != RESTART_ALWAYS) {
-                                    running = false;
-                                }
-                            } else {
-                                print_error("%s exited with error status %d", name, param);
-                                crash = true;
-                                if (!restart_issued && restart == RESTART_NEVER) {
-                                    running = false;
-                                }
-                            }
-                        } else if (WIFSIGNALED(service_status)) {
-                            param = WTERMSIG(service_status);
-                            if (WCOREDUMP(service_status)) {
-                                code_str = "DUMPED";
-                                print_error("%s was killed by signal %d and dumped core", name, param);
-                                crash = true;
-                                if (!restart_issued && restart == RESTART_NEVER) {
-                                    running = false;
-                                }
-                            } else {
-                                code_str = "KILLED";
-                                print_error("%s was killed by signal %d", name, param);
-
-                                switch (param) {
-                                    case SIGTERM:
-                                        // We send SIGTERM for restart (no other signal),
-                                        // so only do this in the SIGTERM case.
-                                        if (restart_issued) {
-                                            // don't set running to false
-                                            break;
-                                        }
-                                    case SIGQUIT:
-                                    case SIGINT:
-                                    case SIGKILL:
-                                        if (restart != RESTART_ALWAYS) {
-                                            print_info("service stopped via signal %d -> don't restart", param);
-                                            running = false;
-                                        }
-                                        break;
-
-                                    default:
-                                        crash = true;
-                                        if (!restart_issued && restart == RESTART_NEVER) {
-                                            running = false;
-                                        }
-                                        break;
-                                }
-                            }
-                        } else {
-                            assert(false);
-                        }
+    if (setvbuf(stderr, NULL, _IOLBF, 0) != 0) {
+        perror("*** error: setvbuf(stderr, NULL, _IOLBF, 0)");
+        return 1;
+    }
 
-                        restart_issued = false;
-                        service_pid = -1;
+    const char *dirname = argv[2];
+    struct dirent **entries = NULL;
+    struct service_definition *defs = NULL;
+    struct service *services = NULL;
+    size_t service_count = 0;
+    int status = 0;
+    int stdout_fd = -1;
+    bool cleanup_pidfiles = false;
 
-                        if (crash) {
-                            struct timespec ts_before;
-                            struct timespec ts_after;
-                            bool time_ok = true;
+    int entry_count = scandir(dirname, &entries, filter_service_files, alphasort);
+    if (entry_count < 0) {
+        fprintf(stderr, "*** error: scandir(\"%s\", ...): %s\n", dirname, strerror(errno));
+        return 1;
+    }
 
-                            if (crash_report == NULL) {
-                                time_ok = false;
-                            } else {
-                                if (clock_gettime(CLOCK_MONOTONIC, &ts_before) != 0) {
-                                    time_ok = false;
-                                    print_error("(parent) clock_gettime(CLOCK_MONOTONIC, &ts_before): %s", strerror(errno));
-                                }
+    if (entry_count == 0) {
+        fprintf(stderr, "*** error: no *" SERVICE_FILE_EXT " files in %s\n", dirname);
+        status = 1;
+        goto cleanup;
+    }
 
-                                char param_str[24];
-                                int result = snprintf(param_str, sizeof(param_str), "%d", param);
-                                assert(result > 0 && result < sizeof(param_str));
+    defs     = calloc(entry_count, sizeof(*defs));
+    services = calloc(entry_count, sizeof(*services));
+    if (defs == NULL || services == NULL) {
+        fprintf(stderr, "*** error: calloc(%d, ...): %s\n", entry_count, strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
 
-                                pid_t report_pid = 0;
-                                result = posix_spawn(&report_pid, crash_report, NULL, NULL,
-                                    (char*[]){ (char*)crash_report, (char*)name, (char*)code_str, param_str, (char*)logfile_path, NULL },
-                                    environ);
+    // All definitions are checked before any service is started.
+    for (int index = 0; index < entry_count; ++ index) {
+        struct service_definition *def = &defs[index];
+        if (!read_service_definition(argv[0], dirname, entries[index]->d_name, def)) {
+            status = 1;
+            goto cleanup;
+        }
 
-                                if (result != 0) {
-                                    print_error("(parent) starting crash reporter: %s", strerror(errno));
-                                } else {
-                                    for (;;) {
-                                        int report_status = 0;
-                                        int result = waitpid(report_pid, &report_status, 0);
-                                        if (result < 0) {
-                                            if (errno == EINTR) {
-                                                continue;
-                                            }
-                                            print_error("(parent) waitpid(%u, &report_status, 0): %s", report_pid, strerror(errno));
-                                        } else if (result == 0) {
-                                            assert(false);
-                                            continue;
-                                        } else if (report_status != 0) {
-                                            if (WIFSIGNALED(report_status)) {
-                                                print_error("crash report PID %u exited with signal %d", report_pid, WTERMSIG(report_status));
-                                            } else {
-                                                print_error("crash report PID %u exited with status %d", report_pid, WEXITSTATUS(report_status));
-                                            }
-                                        }
-                                        break;
-                                    }
-                                }
+        struct service *service = &services[service_count];
+        struct start_command_options options;
 
-                                if (time_ok && clock_gettime(CLOCK_MONOTONIC, &ts_after) != 0) {
-                                    time_ok = false;
-                                    print_error("(parent) clock_gettime(CLOCK_MONOTONIC, &ts_after): %s", strerror(errno));
-                                }
-                            }
+        // reset getopt() and the options that are global state
+        optind = 0;
+        log_format = NULL;
 
-                            if (running && restart_sleep) {
-                                if (time_ok) {
-                                    time_t secs = ts_after.tv_sec - ts_before.tv_sec;
-                                    if (secs <= restart_sleep) {
-                                        sleep(restart_sleep - secs);
-                                    }
-                                } else {
-                                    sleep(restart_sleep);
-                                }
-                            }
-                        }
-                    }
-                }
+        enum PrepareResult result = prepare_service(def->args.argc, def->args.argv, true, service, &options);
+        if (result == PREPARE_ERROR) {
+            status = 1;
+            goto cleanup;
+        }
 
-                if (pollfds[POLLFD_PID].revents & (POLLHUP | POLLERR | POLLNVAL)) {
-                    pollfds[POLLFD_PID].events = 0;
-                }
-            }
+        if (result == PREPARE_RUNNING) {
+            continue;
+        }
 
-            if (do_pipe) {
-                if (close(pipefd[PIPE_READ]) != 0) {
-                    print_error("(parent) close(pipefd[PIPE_READ]): %s", strerror(errno));
-                }
-                pipefd[PIPE_READ] = -1;
-            }
+        ++ service_count;
 
-            if (service_pidfd != -1 && close(service_pidfd) != 0) {
-                print_error("(parent) close(pidfd): %s", strerror(errno));
+        for (size_t other_index = 0; other_index + 1 < service_count; ++ other_index) {
+            if (strcmp(services[other_index].pidfile, service->pidfile) == 0) {
+                fprintf(stderr, "*** error: %s and %s use the same pidfile: %s\n",
+                    services[other_index].name, service->name, service->pidfile);
+                status = 1;
+                goto cleanup;
             }
-            service_pidfd = -1;
         }
+    }
 
-        if (running) {
-            print_info("restarting %s...", name);
-        }
+    if (service_count == 0) {
+        goto cleanup;
     }
 
-cleanup:
-    if (cleanup_pidfiles) {
-        if (unlink(pidfile) != 0 && errno != ENOENT) {
-            print_error("unlink(\"%s\"): %s", pidfile, strerror(errno));
-        }
+    if (!block_runner_signals() || !redirect_stdin()) {
+        status = 1;
+        goto cleanup;
+    }
+
+    // The supervisor's own messages go to the original stdout, the ones
+    // concerning a service to the logfile of that service.
+    stdout_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (stdout_fd == -1) {
+        fprintf(stderr, "*** error: fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0): %s\n", strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
 
-        if (unlink(pidfile_runner) != 0 && errno != ENOENT) {
-            print_error("unlink(\"%s\"): %s", pidfile_runner, strerror(errno));
+    const pid_t runner_pid = getpid();
+    cleanup_pidfiles = true;
+    for (size_t index = 0; index < service_count; ++ index) {
+        struct service *service = &services[index];
+        if (write_pidfile(service->pidfile_runner, runner_pid) != 0) {
+            fprintf(stderr, "*** error: write_pidfile(\"%s\", %u): %s\n", service->pidfile_runner, runner_pid, strerror(errno));
+            status = 1;
+            goto cleanup;
         }
+        service->runner_pid = runner_pid;
     }
 
-    free(chroot_path);
-    free(pidfile_runner);
-    free(rlimits);
+    printf("supervising %zu services from %s\n", service_count, dirname);
 
-    if (free_chdir_path) {
-        free((char*)chdir_path);
+    for (size_t index = 0; index < service_count; ++ index) {
+        select_service_log(&services[index]);
+        print_info("starting...");
     }
 
-    if (free_pidfile) {
-        free((char*)pidfile);
-    }
+    status = run_services(services, service_count);
 
-    if (free_logfile) {
-        free((char*)logfile);
+    fflush(stdout);
+    fflush(stderr);
+    if (dup2(stdout_fd, STDOUT_FILENO) == -1 || dup2(stdout_fd, STDERR_FILENO) == -1) {
+        status = 1;
     }
+    log_service = NULL;
 
-    if (free_command) {
-        free((char*)command);
+    printf("all services of %s have stopped\n", dirname);
+
+cleanup:
+    for (size_t index = 0; index < service_count; ++ index) {
+        if (cleanup_pidfiles) {
+            remove_pidfiles(&services[index]);
+        }
+        free_service(&services[index]);
     }
 
-    if (pipefd[PIPE_READ] != -1) {
-        close(pipefd[PIPE_READ]);
+    if (stdout_fd != -1) {
+        close(stdout_fd);
     }
 
-    if (pipefd[PIPE_WRITE] != -1) {
-        close(pipefd[PIPE_WRITE]);
+    if (defs != NULL) {
+        for (int index = 0; index < entry_count; ++ index) {
+            free_start_arguments(&defs[index].args);
+            free(defs[index].path);
+        }
     }
 
-    if (logfile_fd != -1) {
-        close(logfile_fd);
+    for (int index = 0; index < entry_count; ++ index) {
+        free(entries[index]);
     }
 
+    free(entries);
+    free(defs);
+    free(services);
+
     return status;
 }
@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 1
+#define _DEFAULT_SOURCE 1
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,41 +6,418 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <signal.h>
 #include <assert.h>
+#include <limits.h>
+#include <time.h>
 
 #include "service-runner.h"
 
 enum {
     OPT_STATUS_PIDFILE,
+    OPT_STATUS_CONFIG,
+    OPT_STATUS_ALL,
+    OPT_STATUS_JSON,
     OPT_STATUS_COUNT,
 };
 
 static const struct option status_options[] = {
     [OPT_STATUS_PIDFILE] = { "pidfile", required_argument, 0, 'p' },
+    [OPT_STATUS_CONFIG]  = { "config",  required_argument, 0, 'c' },
+    [OPT_STATUS_ALL]     = { "all",     optional_argument, 0,  0  },
+    [OPT_STATUS_JSON]    = { "json",    no_argument,       0,  0  },
     [OPT_STATUS_COUNT]   = { 0, 0, 0, 0 },
 };
 
+// don't let one hanging service-runner block the status of all the others
+#define STATUS_REQUEST_TIMEOUT_MS 1000
+
+struct service_status {
+    const char *name;
+    const char *pidfile;
+    const char *state;
+    pid_t runner_pid;
+    pid_t service_pid;
+    bool pidfile_runner_ok;
+    bool pidfile_ok;
+    bool runner_pid_ok;
+    bool service_pid_ok;
+    bool failed;
+    // -1 if unknown
+    long long uptime;
+    long long restarts;
+    long long exit_status;
+    long long exit_signal;
+    long long bytes_logged;
+    char logfile[PATH_MAX];
+    char state_buf[32];
+    int status;
+};
+
+static int check_pid(const char *name, const char *what, const char *pidfile, pid_t pid, time_t mtime, uint64_t start_ticks, bool *alive_ptr) {
+    switch (is_pidfile_process_alive(pid, mtime, start_ticks)) {
+        case 1:
+            *alive_ptr = true;
+            return 0;
+
+        case 0:
+            *alive_ptr = false;
+            return 0;
+
+        default:
+            fprintf(stderr, "*** error: %s: checking %s PID %d of %s: %s\n", name, what, pid, pidfile, strerror(errno));
+            return -1;
+    }
+}
+
+// Parses the reply of the status control request:
+// state=STATE pid=PID runner_pid=PID restarts=COUNT logfile=PATH[ status=TEXT]
+static void parse_status_reply(char *reply, struct service_status *info) {
+    char *status_text = strstr(reply, " status=");
+    if (status_text != NULL) {
+        *status_text = 0;
+    }
+
+    char *logfile = strstr(reply, " logfile=");
+    if (logfile != NULL) {
+        *logfile = 0;
+        snprintf(info->logfile, sizeof(info->logfile), "%s", logfile + strlen(" logfile="));
+    }
+
+    char *saveptr = NULL;
+    for (char *field = strtok_r(reply, " ", &saveptr); field != NULL; field = strtok_r(NULL, " ", &saveptr)) {
+        if (strncmp(field, "state=", 6) == 0) {
+            snprintf(info->state_buf, sizeof(info->state_buf), "%s", field + 6);
+            info->state = info->state_buf;
+        } else if (strncmp(field, "restarts=", 9) == 0) {
+            info->restarts = strtoll(field + 9, NULL, 10);
+        }
+    }
+}
+
+// Copies what the service-runner published in its state record.
+static void copy_state_record(const struct service_state *record, struct service_status *info) {
+    snprintf(info->state_buf, sizeof(info->state_buf), "%s", get_service_state_name(record->state));
+    info->state    = info->state_buf;
+    info->restarts = record->restarts;
+    snprintf(info->logfile, sizeof(info->logfile), "%s", record->logfile);
+
+    if (record->pid > 0 && record->started_at > 0) {
+        const time_t now = time(NULL);
+        info->uptime = now > record->started_at ? now - record->started_at : 0;
+    }
+
+    info->exit_status  = record->exit_status;
+    info->exit_signal  = record->exit_signal > 0 ? record->exit_signal : -1;
+    info->bytes_logged = (long long)record->bytes_logged;
+}
+
+// Gathers the status of one service without starting any process: the
+// pidfiles, /proc and, unless verbose, the state record or the control
+// socket of the service-runner. verbose prints inconsistencies of the pidfiles. Errors are
+// printed and give status 150, otherwise status is an LSB status code.
+static void get_service_status(const char *name, const char *pidfile, bool verbose, struct service_status *info) {
+    *info = (struct service_status){
+        .name         = name,
+        .pidfile      = pidfile,
+        .state        = NULL,
+        .uptime       = -1,
+        .restarts     = -1,
+        .exit_status  = -1,
+        .exit_signal  = -1,
+        .bytes_logged = -1,
+        .logfile      = "",
+        .status       = 0,
+    };
+
+    char pidfile_runner[PATH_MAX];
+    char pidfile_failed[PATH_MAX];
+
+    if (snprintf(pidfile_runner, sizeof(pidfile_runner), "%s.runner", pidfile) >= (int)sizeof(pidfile_runner) ||
+        snprintf(pidfile_failed, sizeof(pidfile_failed), "%s.failed", pidfile) >= (int)sizeof(pidfile_failed)) {
+        fprintf(stderr, "*** error: pidfile path too long: %s\n", pidfile);
+        info->status = 150;
+        info->state  = "error";
+        return;
+    }
+
+    time_t runner_mtime  = 0;
+    time_t service_mtime = 0;
+    info->pidfile_runner_ok = read_pidfile_mtime(pidfile_runner, &info->runner_pid, &runner_mtime) == 0;
+    info->pidfile_ok        = read_pidfile_mtime(pidfile, &info->service_pid, &service_mtime) == 0;
+    info->failed            = access(pidfile_failed, F_OK) == 0;
+
+    // The start ticks in the state record tell for sure if the PIDs in the
+    // pidfiles still are the same processes. A record left behind by a killed
+    // runner still has the right ones for the PIDs it left behind.
+    struct service_state record;
+    const bool record_ok = info->pidfile_runner_ok && read_service_state(pidfile, &record) == 0 &&
+        record.runner_pid == info->runner_pid;
+    const uint64_t runner_start_ticks = record_ok ? record.runner_start_ticks : 0;
+    const uint64_t service_start_ticks = record_ok && info->pidfile_ok && record.last_pid == info->service_pid ?
+        record.last_start_ticks : 0;
+
+    if (info->pidfile_runner_ok) {
+        if (check_pid(name, "service-runner", pidfile_runner, info->runner_pid, runner_mtime, runner_start_ticks, &info->runner_pid_ok) != 0) {
+            info->status = 150;
+            info->state  = "error";
+            return;
+        }
+
+        if (!info->runner_pid_ok && verbose) {
+            fprintf(stderr, "%s: error: service-runner pidfile %s exists, but PID %d does not\n", name, pidfile_runner, info->runner_pid);
+        }
+    }
+
+    if (info->pidfile_ok) {
+        if (check_pid(name, "service", pidfile, info->service_pid, service_mtime, service_start_ticks, &info->service_pid_ok) != 0) {
+            info->status = 150;
+            info->state  = "error";
+            return;
+        }
+
+        // A failed service keeps its pidfile.
+        if (!info->service_pid_ok && !info->failed && verbose) {
+            fprintf(stderr, "%s: error: service pidfile %s exists, but PID %d does not\n", name, pidfile, info->service_pid);
+        }
+    }
+
+    if (info->service_pid_ok) {
+        time_t uptime = 0;
+        if (get_process_uptime(info->service_pid, &uptime) == 0) {
+            info->uptime = uptime;
+        }
+    }
+
+    // the classic output of a single service doesn't need more
+    if (info->runner_pid_ok && !verbose) {
+        if (record_ok) {
+            copy_state_record(&record, info);
+        } else {
+            char reply[CONTROL_MESSAGE_SIZE];
+            if (control_request(pidfile, "status", reply, sizeof(reply), STATUS_REQUEST_TIMEOUT_MS) == 0) {
+                parse_status_reply(reply, info);
+            }
+        }
+    }
+
+    // Trying to map LSB service status exit codes to what I do here.
+    // https://refspecs.linuxbase.org/LSB_3.0.0/LSB-PDA/LSB-PDA/iniscrptact.html
+    const char *state = NULL;
+    if (!info->runner_pid_ok && !info->service_pid_ok) {
+        state = info->pidfile_ok || info->pidfile_runner_ok ? "dead" : "stopped";
+        info->status = info->pidfile_ok || info->pidfile_runner_ok ? 1 : 3;
+    } else if (info->runner_pid_ok && info->service_pid_ok) {
+        state = "running";
+        info->status = 0;
+    } else if (!info->runner_pid_ok && info->service_pid_ok) {
+        state = "orphaned";
+        info->status = 1; // maybe?
+    } else if (info->runner_pid_ok && !info->service_pid_ok && info->failed) {
+        state = "failed";
+        info->status = 1;
+    } else {
+        state = "starting";
+        info->status = info->pidfile_ok ? 1 : 4; // maybe?
+    }
+
+    // the service-runner knows better, e.g. that it is restarting the service
+    if (info->state == NULL) {
+        info->state = state;
+    }
+}
+
+// Prints the status of one service like it always did.
+static void print_service_status(const struct service_status *info) {
+    const char *name = info->name;
+
+    if (!info->runner_pid_ok && !info->service_pid_ok) {
+        fprintf(stderr, "%s is not running\n", name);
+    } else if (info->runner_pid_ok && info->service_pid_ok) {
+        printf("%s is running\n", name);
+    } else if (!info->runner_pid_ok && info->service_pid_ok) {
+        fprintf(stderr, "%s is running, but it's service-runner is not\n", name);
+    } else if (info->runner_pid_ok && !info->service_pid_ok && info->failed) {
+        fprintf(stderr, "%s has failed: it was restarted too often. Use the restart command to try again.\n", name);
+    } else {
+        fprintf(stderr, "%s is not running, but it's service-runner is.\n", name);
+        fprintf(stderr, "This means the service is probably currently (re)starting.\n");
+    }
+}
+
+static void format_uptime(char *buf, size_t size, long long uptime) {
+    if (uptime < 0) {
+        snprintf(buf, size, "-");
+    } else if (uptime >= 24 * 60 * 60) {
+        snprintf(buf, size, "%lldd %02lld:%02lld:%02lld", uptime / (24 * 60 * 60),
+            uptime / (60 * 60) % 24, uptime / 60 % 60, uptime % 60);
+    } else {
+        snprintf(buf, size, "%02lld:%02lld:%02lld", uptime / (60 * 60), uptime / 60 % 60, uptime % 60);
+    }
+}
+
+static void format_pid(char *buf, size_t size, bool ok, pid_t pid) {
+    if (ok) {
+        snprintf(buf, size, "%d", pid);
+    } else {
+        snprintf(buf, size, "-");
+    }
+}
+
+static void print_status_table(const struct service_status *infos, size_t count) {
+    int name_width  = (int)strlen("NAME");
+    int state_width = (int)strlen("STATE");
+
+    for (size_t index = 0; index < count; ++ index) {
+        int name_len  = (int)strlen(infos[index].name);
+        int state_len = (int)strlen(infos[index].state);
+        if (name_len > name_width) {
+            name_width = name_len;
+        }
+        if (state_len > state_width) {
+            state_width = state_len;
+        }
+    }
+
+    printf("%-*s  %-*s  %7s  %7s  %11s  %8s  %s\n", name_width, "NAME", state_width, "STATE",
+        "PID", "RUNNER", "UPTIME", "RESTARTS", "LOGFILE");
+
+    for (size_t index = 0; index < count; ++ index) {
+        const struct service_status *info = &infos[index];
+        char pid[16];
+        char runner_pid[16];
+        char uptime[32];
+        char restarts[24];
+
+        format_pid(pid, sizeof(pid), info->service_pid_ok, info->service_pid);
+        format_pid(runner_pid, sizeof(runner_pid), info->runner_pid_ok, info->runner_pid);
+        format_uptime(uptime, sizeof(uptime), info->uptime);
+        if (info->restarts < 0) {
+            snprintf(restarts, sizeof(restarts), "-");
+        } else {
+            snprintf(restarts, sizeof(restarts), "%lld", info->restarts);
+        }
+
+        printf("%-*s  %-*s  %7s  %7s  %11s  %8s  %s\n", name_width, info->name, state_width, info->state,
+            pid, runner_pid, uptime, restarts, info->logfile[0] ? info->logfile : "-");
+    }
+}
+
+static void print_json_string(const char *str) {
+    putchar('"');
+    for (const unsigned char *ptr = (const unsigned char*)str; *ptr; ++ ptr) {
+        switch (*ptr) {
+            case '"':  fputs("\\\"", stdout); break;
+            case '\\': fputs("\\\\", stdout); break;
+            case '\n': fputs("\\n",  stdout); break;
+            case '\r': fputs("\\r",  stdout); break;
+            case '\t': fputs("\\t",  stdout); break;
+            default:
+                if (*ptr < 0x20) {
+                    printf("\\u%04x", *ptr);
+                } else {
+                    putchar(*ptr);
+                }
+        }
+    }
+    putchar('"');
+}
+
+static void print_json_pid(bool ok, pid_t pid) {
+    if (ok) {
+        printf("%d", pid);
+    } else {
+        fputs("null", stdout);
+    }
+}
+
+static void print_json_number(long long value) {
+    if (value >= 0) {
+        printf("%lld", value);
+    } else {
+        fputs("null", stdout);
+    }
+}
+
+static void print_status_json(const struct service_status *infos, size_t count) {
+    putchar('[');
+    for (size_t index = 0; index < count; ++ index) {
+        const struct service_status *info = &infos[index];
+
+        fputs(index > 0 ? ",\n{" : "\n{", stdout);
+        fputs("\"name\":", stdout);
+        print_json_string(info->name);
+        fputs(",\"state\":", stdout);
+        print_json_string(info->state);
+        fputs(",\"pid\":", stdout);
+        print_json_pid(info->service_pid_ok, info->service_pid);
+        fputs(",\"runner_pid\":", stdout);
+        print_json_pid(info->runner_pid_ok, info->runner_pid);
+        fputs(",\"uptime\":", stdout);
+        print_json_number(info->uptime);
+        fputs(",\"restarts\":", stdout);
+        print_json_number(info->restarts);
+        fputs(",\"pidfile\":", stdout);
+        print_json_string(info->pidfile);
+        fputs(",\"logfile\":", stdout);
+        if (info->logfile[0]) {
+            print_json_string(info->logfile);
+        } else {
+            fputs("null", stdout);
+        }
+        fputs(",\"exit_status\":", stdout);
+        print_json_number(info->exit_status);
+        fputs(",\"exit_signal\":", stdout);
+        print_json_number(info->exit_signal);
+        fputs(",\"bytes_logged\":", stdout);
+        print_json_number(info->bytes_logged);
+        fputs(",\"status\":", stdout);
+        printf("%d}", info->status);
+    }
+    fputs(count > 0 ? "\n]\n" : "]\n", stdout);
+}
+
 int command_status(int argc, char *argv[]) {
     if (argc < 2) {
         return 150;
     }
 
     const char *pidfile = NULL;
+    const char *config_path = NULL;
+    const char *all_dir = NULL;
+    bool json = false;
+    int longind = 0;
 
     for (;;) {
-        int opt = getopt_long(argc - 1, argv + 1, "p:", status_options, NULL);
+        int opt = getopt_long(argc - 1, argv + 1, "p:c:", status_options, &longind);
 
         if (opt == -1) {
             break;
         }
 
         switch (opt) {
+            case 0:
+                switch (longind) {
+                    case OPT_STATUS_ALL:
+                        all_dir = optarg == NULL ? "/var/run" : optarg;
+                        break;
+
+                    case OPT_STATUS_JSON:
+                        json = true;
+                        break;
+                }
+                break;
+
             case 'p':
                 pidfile = optarg;
                 break;
 
+            case 'c':
+                config_path = optarg;
+                break;
+
             case '?':
                 short_usage(argc, argv);
                 return 150;
@@ -50,18 +427,61 @@ int command_status(int argc, char *argv[]) {
     // because of skipped first argument:
     ++ optind;
 
-    int count = argc - optind;
-    if (count != 1) {
-        fprintf(stderr, "*** error: illegal number of arguments\n");
-        short_usage(argc, argv);
-        return 150;
+    if (all_dir != NULL || argc - optind > 1) {
+        if (pidfile != NULL || config_path != NULL) {
+            fprintf(stderr, "*** error: --pidfile and --config can only be used with a single service\n");
+            return 150;
+        }
+
+        struct service_ref *refs = NULL;
+        size_t count = 0;
+        if (get_service_refs(argc, argv, all_dir, &refs, &count) != 0) {
+            return 150;
+        }
+
+        struct service_status *infos = calloc(count > 0 ? count : 1, sizeof(*infos));
+        if (infos == NULL) {
+            fprintf(stderr, "*** error: calloc(%zu, %zu): %s\n", count, sizeof(*infos), strerror(errno));
+            free_service_refs(refs, count);
+            return 150;
+        }
+
+        // the worst status of all services
+        int status = 0;
+        for (size_t index = 0; index < count; ++ index) {
+            get_service_status(refs[index].name, refs[index].pidfile, false, &infos[index]);
+            if (infos[index].status > status) {
+                status = infos[index].status;
+            }
+        }
+
+        if (json) {
+            print_status_json(infos, count);
+        } else {
+            print_status_table(infos, count);
+        }
+
+        free(infos);
+        free_service_refs(refs, count);
+
+        return status;
     }
 
-    const char *name = argv[optind ++];
+    const char *name = NULL;
+    struct service_config config = {
+        .path    = NULL,
+        .name    = NULL,
+        .content = NULL,
+        .entries = NULL,
+        .count   = 0,
+    };
+
+    if (get_service_name(argc, argv, config_path, &config, &name, &pidfile) != 0) {
+        return 150;
+    }
 
     int status = 0;
     bool free_pidfile = false;
-    char *pidfile_runner = NULL;
 
     switch (get_pidfile_abspath((char**)&pidfile, name)) {
         case ABS_PATH_NEW:
@@ -76,75 +496,22 @@ int command_status(int argc, char *argv[]) {
             goto cleanup;
     }
 
-    {
-        size_t pidfile_runner_size = strlen(pidfile) + strlen(".runner") + 1;
-        pidfile_runner = malloc(pidfile_runner_size);
-        if (pidfile_runner == NULL) {
-            fprintf(stderr, "*** error: malloc(%zu): %s\n", pidfile_runner_size, strerror(errno));
-            status = 150;
-            goto cleanup;
-        }
-
-        int count = snprintf(pidfile_runner, pidfile_runner_size, "%s.runner", pidfile);
-        assert(count >= 0 && (size_t)count == pidfile_runner_size - 1); (void)count;
-    }
-
-    pid_t runner_pid  = 0;
-    pid_t service_pid = 0;
-    bool pidfile_runner_ok = read_pidfile(pidfile_runner, &runner_pid) == 0;
-    bool pidfile_ok        = read_pidfile(pidfile, &service_pid) == 0;
-    bool runner_pid_ok  = false;
-    bool service_pid_ok = false;
+    struct service_status info;
+    get_service_status(name, pidfile, !json, &info);
+    status = info.status;
 
-    if (pidfile_runner_ok) {
-        errno = 0;
-        if (kill(runner_pid, 0) == 0 || errno == EPERM) {
-            runner_pid_ok = true;
-        } else if (errno == ESRCH) {
-            fprintf(stderr, "%s: error: service-runner pidfile %s exists, but PID %d does not\n", name, pidfile_runner, runner_pid);
-        } else {
-            fprintf(stderr, "*** error: kill(%d, 0): %s\n", runner_pid, strerror(errno));
-            status = 150;
-            goto cleanup;
-        }
-    }
-
-    if (pidfile_ok) {
-        errno = 0;
-        if (kill(service_pid, 0) == 0 || errno == EPERM) {
-            service_pid_ok = true;
-        } else if (errno == ESRCH) {
-            fprintf(stderr, "%s: error: service pidfile %s exists, but PID %d does not\n", name, pidfile, service_pid);
-        } else {
-            fprintf(stderr, "*** error: kill(%d, 0): %s\n", runner_pid, strerror(errno));
-            status = 150;
-            goto cleanup;
-        }
-    }
-
-    // Trying to map LSB service status exit codes to what I do here.
-    // https://refspecs.linuxbase.org/LSB_3.0.0/LSB-PDA/LSB-PDA/iniscrptact.html
-    if (!runner_pid_ok && !service_pid_ok) {
-        fprintf(stderr, "%s is not running\n", name);
-        status = pidfile_ok || pidfile_runner_ok ? 1 : 3;
-    } else if (runner_pid_ok && service_pid_ok) {
-        printf("%s is running\n", name);
-        status = 0;
-    } else if (!runner_pid_ok && service_pid_ok) {
-        fprintf(stderr, "%s is running, but it's service-runner is not\n", name);
-        status = 1; // maybe?
-    } else if (runner_pid_ok && !service_pid_ok) {
-        fprintf(stderr, "%s is not running, but it's service-runner is.\n", name);
-        fprintf(stderr, "This means the service is probably currently (re)starting.\n");
-        status = pidfile_ok ? 1 : 4; // maybe?
+    if (json) {
+        print_status_json(&info, 1);
+    } else if (status != 150) {
+        print_service_status(&info);
     }
 
 cleanup:
-    free(pidfile_runner);
-
     if (free_pidfile) {
         free((char*)pidfile);
     }
 
+    free_service_config(&config);
+
     return status;
 }
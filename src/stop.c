@@ -13,21 +13,396 @@
 #include <assert.h>
 #include <limits.h>
 #include <poll.h>
+#include <inttypes.h>
 
 #include "service-runner.h"
 
 enum {
     OPT_STOP_PIDFILE,
+    OPT_STOP_CONFIG,
     OPT_STOP_SHUTDOWN_TIMEOUT,
+    OPT_STOP_ALL,
+    OPT_STOP_JOBS,
     OPT_STOP_COUNT,
 };
 
 static const struct option stop_options[] = {
     [OPT_STOP_PIDFILE]          = { "pidfile", required_argument, 0, 'p' },
+    [OPT_STOP_CONFIG]           = { "config",  required_argument, 0, 'c' },
     [OPT_STOP_SHUTDOWN_TIMEOUT] = { "shutdown-timeout", required_argument, 0, 0 },
+    [OPT_STOP_ALL]              = { "all",     optional_argument, 0,  0  },
+    [OPT_STOP_JOBS]             = { "jobs",    required_argument, 0, 'j' },
     [OPT_STOP_COUNT]            = { 0, 0, 0, 0 },
 };
 
+// A pid of 0 means there is no such process.
+static void kill_after_timeout(const char *name, const char *pidfile, pid_t service_pid, const char *pidfile_runner, pid_t runner_pid) {
+    pid_t pid = 0;
+
+    fprintf(stderr, "*** error: timeout waiting for %s to shutdown, sending SIGKILL...\n", name);
+
+    if (service_pid != 0) {
+        if (kill(service_pid, SIGKILL) != 0 && errno != ESRCH) {
+            fprintf(stderr, "*** error: sending SIGKILL to service PID %d\n", service_pid);
+        }
+
+        if (read_pidfile(pidfile, &pid) == 0 && pid == service_pid && unlink(pidfile) != 0 && errno != ENOENT) {
+            fprintf(stderr, "*** error: unlink(\"%s\"): %s\n", pidfile, strerror(errno));
+        }
+    }
+
+    if (runner_pid != 0) {
+        if (kill(runner_pid, SIGKILL) != 0 && errno != ESRCH) {
+            fprintf(stderr, "*** error: sending SIGKILL to service-runner PID %d\n", runner_pid);
+        }
+
+        if (read_pidfile(pidfile_runner, &pid) == 0 && pid == runner_pid && unlink(pidfile_runner) != 0 && errno != ENOENT) {
+            fprintf(stderr, "*** error: unlink(\"%s\"): %s\n", pidfile_runner, strerror(errno));
+        }
+    }
+}
+
+// A supervisor writes its own PID into the runner pidfile of every one of its
+// services, so it must never be signaled on behalf of just one of them.
+static bool is_supervised(const char *pidfile, pid_t runner_pid) {
+    struct service_state state;
+    return runner_pid != 0 && read_service_state(pidfile, &state) == 0 &&
+           state.runner_pid == runner_pid && (state.flags & SERVICE_STATE_FLAG_SUPERVISED);
+}
+
+// State of one service while stopping many of them at once. All services
+// are stopped concurrently (at most --jobs at a time) by waiting for the
+// replies of their control sockets and their pidfds in a single poll().
+struct stop_job {
+    const struct service_ref *ref;
+    char *pidfile_runner;
+    pid_t runner_pid;
+    pid_t service_pid;
+    pid_t pid;
+    const char *which;
+    int pidfd;
+    int control_fd;
+    uint64_t started_ms;
+    bool waiting;
+    bool supervised;
+};
+
+// pidfd isn't supported, check with kill(pid, 0) this often instead
+#define STOP_POLL_INTERVAL_MS 500
+
+static void end_stop_job(struct stop_job *job) {
+    if (job->pidfd != -1) {
+        close(job->pidfd);
+        job->pidfd = -1;
+    }
+
+    if (job->control_fd != -1) {
+        close(job->control_fd);
+        job->control_fd = -1;
+    }
+
+    free(job->pidfile_runner);
+    job->pidfile_runner = NULL;
+    job->waiting = false;
+}
+
+static bool send_sigterm(struct stop_job *job) {
+    printf("Sending SIGTERM to %s at PID %d...\n", job->which, job->pid);
+
+    if (job->pidfd != -1) {
+        if (pidfd_send_signal(job->pidfd, SIGTERM, NULL, 0) == 0) {
+            return true;
+        }
+
+        if (errno != EBADFD && errno != ENOSYS) {
+            fprintf(stderr, "*** error: pidfd_send_signal(pidfd, SIGTERM, NULL, 0): %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    if (kill(job->pid, SIGTERM) != 0) {
+        fprintf(stderr, "*** error: sending SIGTERM to %s PID %d: %s\n", job->which, job->pid, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool open_stop_pidfd(struct stop_job *job, int *status) {
+    job->pidfd = pidfd_open(job->pid, 0);
+    if (job->pidfd == -1 && errno != ENOSYS) {
+        fprintf(stderr, "*** error: opening %s PID %d as pidfd: %s\n", job->which, job->pid, strerror(errno));
+        *status = 1;
+        end_stop_job(job);
+        return false;
+    }
+    return true;
+}
+
+// The service of a supervisor is signaled directly, not the supervisor.
+static bool fall_back_to_sigterm(struct stop_job *job) {
+    if (job->supervised) {
+        if (job->pid == 0) {
+            fprintf(stderr, "*** error: %s isn't running and its supervisor PID %d can't be reached\n", job->ref->name, job->runner_pid);
+            return false;
+        }
+
+        job->pidfd = pidfd_open(job->pid, 0);
+        if (job->pidfd == -1 && errno != ENOSYS) {
+            fprintf(stderr, "*** error: opening %s PID %d as pidfd: %s\n", job->which, job->pid, strerror(errno));
+            return false;
+        }
+    }
+
+    return send_sigterm(job);
+}
+
+// Returns true if the job is now waiting for the service to stop.
+static bool begin_stop_job(struct stop_job *job, int *status) {
+    const char *name = job->ref->name;
+    const char *pidfile = job->ref->pidfile;
+
+    job->pidfile_runner = malloc(strlen(pidfile) + strlen(".runner") + 1);
+    if (job->pidfile_runner == NULL) {
+        fprintf(stderr, "*** error: malloc: %s\n", strerror(errno));
+        *status = 1;
+        return false;
+    }
+    sprintf(job->pidfile_runner, "%s.runner", pidfile);
+
+    if (read_pidfile(job->pidfile_runner, &job->runner_pid) != 0) {
+        job->runner_pid = 0;
+    }
+
+    if (read_pidfile(pidfile, &job->service_pid) != 0) {
+        job->service_pid = 0;
+    }
+
+    job->supervised = is_supervised(pidfile, job->runner_pid);
+
+    if (job->supervised) {
+        // Only the supervisor can stop it if the service isn't running right
+        // now, so job->pid may be 0 here.
+        job->pid = job->service_pid;
+        job->which = name;
+    } else if (job->runner_pid != 0) {
+        job->pid = job->runner_pid;
+        job->which = "service-runner";
+    } else if (job->service_pid != 0) {
+        job->pid = job->service_pid;
+        job->which = name;
+    } else {
+        fprintf(stderr, "*** error: %s is not running\n", name);
+        end_stop_job(job);
+        return false;
+    }
+
+    job->started_ms = get_monotonic_ms();
+    if (!job->supervised && !open_stop_pidfd(job, status)) {
+        return false;
+    }
+
+    if (job->runner_pid != 0) {
+        // Prefer the control socket of the service-runner. It replies once
+        // the service has stopped.
+        job->control_fd = control_connect(pidfile, "stop");
+        if (job->control_fd != -1) {
+            job->waiting = true;
+            return true;
+        }
+
+        if (errno != ENOENT && errno != ECONNREFUSED) {
+            fprintf(stderr, "*** error: sending stop request to service-runner PID %d: %s, falling back to SIGTERM\n", job->runner_pid, strerror(errno));
+        }
+    }
+
+    if (!fall_back_to_sigterm(job)) {
+        *status = 1;
+        end_stop_job(job);
+        return false;
+    }
+
+    job->waiting = true;
+    return true;
+}
+
+// Returns true if the job is still waiting for the service to stop.
+static bool handle_stop_reply(struct stop_job *job, int *status) {
+    char reply[CONTROL_MESSAGE_SIZE];
+    int result = control_read_reply(job->control_fd, reply, sizeof(reply));
+    const int errnum = errno;
+
+    close(job->control_fd);
+    job->control_fd = -1;
+
+    if (result == 0 && strcmp(reply, "stopped supervised") == 0) {
+        // A supervisor keeps running for its other services.
+        end_stop_job(job);
+        return false;
+    }
+
+    if (result == 0 || (result == -1 && errnum == ECONNRESET)) {
+        // the service-runner exits right after the reply
+        return true;
+    }
+
+    if (result == 1) {
+        fprintf(stderr, "*** error: stopping %s: %s\n", job->ref->name, reply);
+        *status = 1;
+        end_stop_job(job);
+        return false;
+    }
+
+    fprintf(stderr, "*** error: reading reply of service-runner PID %d: %s, falling back to SIGTERM\n", job->runner_pid, strerror(errnum));
+    if (!fall_back_to_sigterm(job)) {
+        *status = 1;
+        end_stop_job(job);
+        return false;
+    }
+
+    return true;
+}
+
+static int stop_services(const struct service_ref *refs, size_t count, size_t jobs, int shutdown_timeout) {
+    int status = 0;
+    size_t next = 0;
+    size_t active = 0;
+
+    if (jobs > count) {
+        jobs = count;
+    }
+
+    struct stop_job *stop_jobs = calloc(count, sizeof(*stop_jobs));
+    struct pollfd *pollfds     = calloc(jobs * 2, sizeof(*pollfds));
+    size_t *poll_jobs          = calloc(jobs * 2, sizeof(*poll_jobs));
+    if (stop_jobs == NULL || pollfds == NULL || poll_jobs == NULL) {
+        fprintf(stderr, "*** error: calloc(): %s\n", strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
+
+    for (size_t index = 0; index < count; ++ index) {
+        stop_jobs[index].ref        = &refs[index];
+        stop_jobs[index].pidfd      = -1;
+        stop_jobs[index].control_fd = -1;
+    }
+
+    for (;;) {
+        while (active < jobs && next < count) {
+            if (begin_stop_job(&stop_jobs[next ++], &status)) {
+                ++ active;
+            }
+        }
+
+        if (active == 0) {
+            break;
+        }
+
+        const uint64_t now_ms = get_monotonic_ms();
+        int timeout = -1;
+        nfds_t nfds = 0;
+
+        for (size_t index = 0; index < next; ++ index) {
+            struct stop_job *job = &stop_jobs[index];
+            if (!job->waiting) {
+                continue;
+            }
+
+            if (shutdown_timeout >= 0) {
+                const uint64_t elapsed = now_ms - job->started_ms;
+                if (elapsed >= (uint64_t)shutdown_timeout) {
+                    kill_after_timeout(job->ref->name, job->ref->pidfile, job->service_pid, job->pidfile_runner, job->supervised ? 0 : job->runner_pid);
+                    status = 1;
+                    end_stop_job(job);
+                    -- active;
+                    continue;
+                }
+
+                const int remaining = shutdown_timeout - (int)elapsed;
+                if (timeout == -1 || remaining < timeout) {
+                    timeout = remaining;
+                }
+            }
+
+            if (job->control_fd != -1) {
+                pollfds[nfds]   = (struct pollfd){ .fd = job->control_fd, .events = POLLIN, .revents = 0 };
+                poll_jobs[nfds] = index;
+                ++ nfds;
+            }
+
+            if (job->pidfd != -1) {
+                pollfds[nfds]   = (struct pollfd){ .fd = job->pidfd, .events = POLLIN, .revents = 0 };
+                poll_jobs[nfds] = index;
+                ++ nfds;
+            } else if (timeout == -1 || timeout > STOP_POLL_INTERVAL_MS) {
+                timeout = STOP_POLL_INTERVAL_MS;
+            }
+        }
+
+        if (active == 0) {
+            // the finished jobs make room for the next ones
+            continue;
+        }
+
+        int result = poll(pollfds, nfds, timeout);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "*** error: poll(): %s\n", strerror(errno));
+            status = 1;
+            break;
+        }
+
+        for (nfds_t poll_index = 0; poll_index < nfds; ++ poll_index) {
+            struct pollfd *pollfd = &pollfds[poll_index];
+            struct stop_job *job = &stop_jobs[poll_jobs[poll_index]];
+
+            if (pollfd->revents == 0 || !job->waiting) {
+                continue;
+            }
+
+            bool waiting = true;
+            if (pollfd->fd == job->control_fd) {
+                waiting = handle_stop_reply(job, &status);
+            } else if (pollfd->revents & POLLERR) {
+                fprintf(stderr, "*** error: waiting for %s PID %d: POLLERR\n", job->which, job->pid);
+                status = 1;
+                waiting = false;
+            } else {
+                // the process has exited
+                waiting = false;
+            }
+
+            if (!waiting) {
+                end_stop_job(job);
+                -- active;
+            }
+        }
+
+        for (size_t index = 0; index < next; ++ index) {
+            struct stop_job *job = &stop_jobs[index];
+            if (job->waiting && job->pidfd == -1 && kill(job->pid, 0) != 0 && errno == ESRCH) {
+                end_stop_job(job);
+                -- active;
+            }
+        }
+    }
+
+cleanup:
+    if (stop_jobs != NULL) {
+        for (size_t index = 0; index < next; ++ index) {
+            end_stop_job(&stop_jobs[index]);
+        }
+    }
+
+    free(stop_jobs);
+    free(pollfds);
+    free(poll_jobs);
+
+    return status;
+}
+
 int command_stop(int argc, char *argv[]) {
     if (argc < 2) {
         return 1;
@@ -36,10 +411,13 @@ int command_stop(int argc, char *argv[]) {
     int longind = 0;
 
     const char *pidfile = NULL;
+    const char *config_path = NULL;
+    const char *all_dir = NULL;
+    size_t jobs = DEFAULT_JOBS;
     int shutdown_timeout = -1;
 
     for (;;) {
-        int opt = getopt_long(argc - 1, argv + 1, "p:", stop_options, &longind);
+        int opt = getopt_long(argc - 1, argv + 1, "p:c:j:", stop_options, &longind);
 
         if (opt == -1) {
             break;
@@ -59,6 +437,17 @@ int command_stop(int argc, char *argv[]) {
                         shutdown_timeout = value == -1 ? -1 : value * 1000;
                         break;
                     }
+
+                    case OPT_STOP_ALL:
+                        all_dir = optarg == NULL ? "/var/run" : optarg;
+                        break;
+                }
+                break;
+
+            case 'j':
+                if (parse_jobs(optarg, &jobs) != 0) {
+                    fprintf(stderr, "*** error: illegal value for --jobs: %s\n", optarg);
+                    return 1;
                 }
                 break;
 
@@ -66,6 +455,10 @@ int command_stop(int argc, char *argv[]) {
                 pidfile = optarg;
                 break;
 
+            case 'c':
+                config_path = optarg;
+                break;
+
             case '?':
                 short_usage(argc, argv);
                 return 1;
@@ -75,14 +468,36 @@ int command_stop(int argc, char *argv[]) {
     // because of skipped first argument:
     ++ optind;
 
-    int count = argc - optind;
-    if (count != 1) {
-        fprintf(stderr, "*** error: illegal number of arguments\n");
-        short_usage(argc, argv);
-        return 1;
+    if (all_dir != NULL || argc - optind > 1) {
+        if (pidfile != NULL || config_path != NULL) {
+            fprintf(stderr, "*** error: --pidfile and --config can only be used with a single service\n");
+            return 1;
+        }
+
+        struct service_ref *refs = NULL;
+        size_t count = 0;
+        if (get_service_refs(argc, argv, all_dir, &refs, &count) != 0) {
+            return 1;
+        }
+
+        int status = count == 0 ? 0 : stop_services(refs, count, jobs, shutdown_timeout);
+        free_service_refs(refs, count);
+
+        return status;
     }
 
-    const char *name = argv[optind ++];
+    const char *name = NULL;
+    struct service_config config = {
+        .path    = NULL,
+        .name    = NULL,
+        .content = NULL,
+        .entries = NULL,
+        .count   = 0,
+    };
+
+    if (get_service_name(argc, argv, config_path, &config, &name, &pidfile) != 0) {
+        return 1;
+    }
 
     int status = 0;
     int pidfd = -1;
@@ -120,9 +535,31 @@ int command_stop(int argc, char *argv[]) {
     bool pidfile_runner_ok = read_pidfile(pidfile_runner, &runner_pid) == 0;
     bool pidfile_ok        = read_pidfile(pidfile, &service_pid) == 0;
 
+    const bool supervised = pidfile_runner_ok && is_supervised(pidfile, runner_pid);
+    const pid_t kill_runner_pid = pidfile_runner_ok && !supervised ? runner_pid : 0;
+
     pid_t pid = 0;
     const char *which = NULL;
-    if (pidfile_runner_ok) {
+    if (supervised) {
+        if (!pidfile_ok) {
+            // nothing to signal, only the supervisor can stop it
+            char reply[CONTROL_MESSAGE_SIZE];
+            int result = control_request(pidfile, "stop", reply, sizeof(reply), shutdown_timeout);
+            if (result == 1) {
+                fprintf(stderr, "*** error: stopping %s: %s\n", name, reply);
+                status = 1;
+            } else if (result == -1) {
+                fprintf(stderr, "*** error: sending stop request to supervisor PID %d: %s\n", runner_pid, strerror(errno));
+                status = 1;
+            }
+            goto cleanup;
+        }
+
+        // The supervisor keeps running for its other services, so only the
+        // service itself is ever signaled.
+        pid = service_pid;
+        which = name;
+    } else if (pidfile_runner_ok) {
         pid = runner_pid;
         which = "service-runner";
     } else if (pidfile_ok) {
@@ -185,29 +622,7 @@ int command_stop(int argc, char *argv[]) {
                 }
 
                 if (ts_after.tv_sec - ts_before.tv_sec > shutdown_timeout) {
-                    // timeout
-                    fprintf(stderr, "*** error: timeout waiting for %s to shutdown, sending SIGKILL...\n", name);
-
-                    if (pidfile_ok) {
-                        if (kill(service_pid, SIGKILL) != 0 && errno != ESRCH) {
-                            fprintf(stderr, "*** error: sending SIGKILL to service PID %d\n", service_pid);
-                        }
-
-                        if (read_pidfile(pidfile, &pid) == 0 && pid == service_pid && unlink(pidfile) != 0 && errno != ENOENT) {
-                            fprintf(stderr, "*** error: unlink(\"%s\"): %s\n", pidfile, strerror(errno));
-                        }
-                    }
-
-                    if (pidfile_runner_ok) {
-                        if (kill(runner_pid, SIGKILL) != 0 && errno != ESRCH) {
-                            fprintf(stderr, "*** error: sending SIGKILL to service-runner PID %d\n", runner_pid);
-                        }
-
-                        if (read_pidfile(pidfile_runner, &pid) == 0 && pid == runner_pid && unlink(pidfile_runner) != 0 && errno != ENOENT) {
-                            fprintf(stderr, "*** error: unlink(\"%s\"): %s\n", pidfile_runner, strerror(errno));
-                        }
-                    }
-
+                    kill_after_timeout(name, pidfile, pidfile_ok ? service_pid : 0, pidfile_runner, kill_runner_pid);
                     status = 1;
                     goto cleanup;
                 }
@@ -224,20 +639,76 @@ int command_stop(int argc, char *argv[]) {
         goto cleanup;
     }
 
-    printf("Sending SIGTERM to %s at PID %d...\n", which, pid);
-    if (pidfd_send_signal(pidfd, SIGTERM, NULL, 0) != 0) {
-        if (errno == EBADFD || errno == ENOSYS) {
-            fprintf(stderr, "*** error: pidfd_send_signal(pidfd, SIGTERM, NULL, 0) failed, using kill(%d, SIGTERM): %s\n",
-                pid, strerror(errno));
-            if (kill(pid, SIGTERM) != 0) {
-                fprintf(stderr, "*** error: sending SIGTERM to %s PID %d: %s\n", which, pid, strerror(errno));
-                status = 1;
-                goto cleanup;
+    int timeout = shutdown_timeout;
+    bool stop_requested = false;
+
+    if (pidfile_runner_ok) {
+        // Prefer the control socket of the service-runner. It replies once
+        // the service has stopped.
+        struct timespec ts_before = {
+            .tv_sec  = 0,
+            .tv_nsec = 0,
+        };
+
+        if (shutdown_timeout >= 0 && clock_gettime(CLOCK_MONOTONIC, &ts_before) != 0) {
+            fprintf(stderr, "*** error: clock_gettime(CLOCK_MONOTONIC, &ts_before): %s\n", strerror(errno));
+            status = 1;
+            goto cleanup;
+        }
+
+        char reply[CONTROL_MESSAGE_SIZE];
+        int result = control_request(pidfile, "stop", reply, sizeof(reply), shutdown_timeout);
+        if (result == 0 && strcmp(reply, "stopped supervised") == 0) {
+            // A supervisor keeps running for its other services.
+            goto cleanup;
+        } else if (result == 0) {
+            stop_requested = true;
+
+            if (shutdown_timeout >= 0) {
+                struct timespec ts_after = {
+                    .tv_sec  = 0,
+                    .tv_nsec = 0,
+                };
+
+                if (clock_gettime(CLOCK_MONOTONIC, &ts_after) != 0) {
+                    fprintf(stderr, "*** error: clock_gettime(CLOCK_MONOTONIC, &ts_after): %s\n", strerror(errno));
+                    status = 1;
+                    goto cleanup;
+                }
+
+                // the service-runner itself exits right after the reply
+                int64_t elapsed = (int64_t)(ts_after.tv_sec - ts_before.tv_sec) * 1000 + (ts_after.tv_nsec - ts_before.tv_nsec) / 1000000;
+                timeout = elapsed >= shutdown_timeout ? 0 : shutdown_timeout - (int)elapsed;
             }
-        } else {
-            fprintf(stderr, "*** error: pidfd_send_signal(pidfd, SIGTERM, NULL, 0): %s\n", strerror(errno));
+        } else if (result == 1) {
+            fprintf(stderr, "*** error: stopping %s: %s\n", name, reply);
+            status = 1;
+            goto cleanup;
+        } else if (errno == ETIMEDOUT) {
+            kill_after_timeout(name, pidfile, pidfile_ok ? service_pid : 0, pidfile_runner, kill_runner_pid);
             status = 1;
             goto cleanup;
+        } else if (errno != ENOENT && errno != ECONNREFUSED) {
+            fprintf(stderr, "*** error: sending stop request to service-runner PID %d: %s, falling back to SIGTERM\n", pid, strerror(errno));
+        }
+    }
+
+    if (!stop_requested) {
+        printf("Sending SIGTERM to %s at PID %d...\n", which, pid);
+        if (pidfd_send_signal(pidfd, SIGTERM, NULL, 0) != 0) {
+            if (errno == EBADFD || errno == ENOSYS) {
+                fprintf(stderr, "*** error: pidfd_send_signal(pidfd, SIGTERM, NULL, 0) failed, using kill(%d, SIGTERM): %s\n",
+                    pid, strerror(errno));
+                if (kill(pid, SIGTERM) != 0) {
+                    fprintf(stderr, "*** error: sending SIGTERM to %s PID %d: %s\n", which, pid, strerror(errno));
+                    status = 1;
+                    goto cleanup;
+                }
+            } else {
+                fprintf(stderr, "*** error: pidfd_send_signal(pidfd, SIGTERM, NULL, 0): %s\n", strerror(errno));
+                status = 1;
+                goto cleanup;
+            }
         }
     }
 
@@ -245,7 +716,7 @@ int command_stop(int argc, char *argv[]) {
         { .fd = pidfd, .events = POLLIN, .revents = 0 },
     };
 
-    int result = poll(pollfds, 1, shutdown_timeout);
+    int result = poll(pollfds, 1, timeout);
     if (result == -1) {
         fprintf(stderr, "*** error: waiting for %s PID %d: %s\n", which, pid, strerror(errno));
         status = 1;
@@ -253,29 +724,7 @@ int command_stop(int argc, char *argv[]) {
     }
 
     if (result == 0) {
-        // timeout
-        fprintf(stderr, "*** error: timeout waiting for %s to shutdown, sending SIGKILL...\n", name);
-
-        if (pidfile_ok) {
-            if (kill(service_pid, SIGKILL) != 0 && errno != ESRCH) {
-                fprintf(stderr, "*** error: sending SIGKILL to service PID %d\n", service_pid);
-            }
-
-            if (read_pidfile(pidfile, &pid) == 0 && pid == service_pid && unlink(pidfile) != 0 && errno != ENOENT) {
-                fprintf(stderr, "*** error: unlink(\"%s\"): %s\n", pidfile, strerror(errno));
-            }
-        }
-
-        if (pidfile_runner_ok) {
-            if (kill(runner_pid, SIGKILL) != 0 && errno != ESRCH) {
-                fprintf(stderr, "*** error: sending SIGKILL to service-runner PID %d\n", runner_pid);
-            }
-
-            if (read_pidfile(pidfile_runner, &pid) == 0 && pid == runner_pid && unlink(pidfile_runner) != 0 && errno != ENOENT) {
-                fprintf(stderr, "*** error: unlink(\"%s\"): %s\n", pidfile_runner, strerror(errno));
-            }
-        }
-
+        kill_after_timeout(name, pidfile, pidfile_ok ? service_pid : 0, pidfile_runner, kill_runner_pid);
         status = 1;
         goto cleanup;
     }
@@ -322,5 +771,7 @@ cleanup:
         free((char*)pidfile);
     }
 
+    free_service_config(&config);
+
     return status;
 }
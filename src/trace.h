@@ -0,0 +1,20 @@
+#ifndef SERVICE_RUNNER_TRACE_H
+#define SERVICE_RUNNER_TRACE_H
+#pragma once
+
+// Static tracepoints (USDT) for the event loop of the service-runner. They are
+// only compiled in with `make TRACE=ON`, which needs <sys/sdt.h> (systemtap-sdt
+// development package). Even then a probe is just a nop until a tracer like
+// bpftrace attaches to it. See trace-latency.bt for the probes and arguments.
+//
+// Without TRACE=ON the arguments aren't evaluated at all.
+
+#ifdef SERVICE_RUNNER_TRACE
+    #include <sys/sdt.h>
+
+    #define TRACE(...) STAP_PROBEV(service_runner, __VA_ARGS__)
+#else
+    #define TRACE(...) do {} while (0)
+#endif
+
+#endif // SERVICE_RUNNER_TRACE_H
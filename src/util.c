@@ -10,6 +10,16 @@
 #include <assert.h>
 #include <string.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sched.h>
 
 #include "service-runner.h"
 
@@ -171,41 +181,166 @@ enum AbsPathResult get_logfile_abspath(char **logfile_ptr, const char *name) {
     }
 }
 
+// The pidfile is replaced atomically, so that readers never see a partially
+// written file.
 int write_pidfile(const char *pidfile, pid_t pid) {
-    FILE *fp = fopen(pidfile, "w");
+    char tmpfile[PATH_MAX];
+    int count = snprintf(tmpfile, sizeof(tmpfile), "%s.%d.tmp", pidfile, getpid());
+    if (count < 0 || (size_t)count >= sizeof(tmpfile)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    FILE *fp = fopen(tmpfile, "w");
     if (fp == NULL) {
         return -1;
     }
 
     if (fprintf(fp, "%d\n", pid) < 0) {
+        const int errnum = errno;
         fclose(fp);
+        unlink(tmpfile);
+        errno = errnum;
         return -1;
     }
 
-    return fclose(fp) == 0 ? 0 : -1;
+    if (fclose(fp) != 0 || rename(tmpfile, pidfile) != 0) {
+        const int errnum = errno;
+        unlink(tmpfile);
+        errno = errnum;
+        return -1;
+    }
+
+    return 0;
 }
 
-int read_pidfile(const char *pidfile, pid_t *pidptr) {
-    int value = 0;
+// The pidfile is read with a single read(), it is small and always replaced
+// as a whole. mtime_ptr, if not NULL, receives the time it was written.
+int read_pidfile_mtime(const char *pidfile, pid_t *pidptr, time_t *mtime_ptr) {
+    char buf[32];
 
-    FILE *fp = fopen(pidfile, "r");
-    if (fp == NULL) {
+    int fd = open(pidfile, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
         return -1;
     }
 
-    if (fscanf(fp, "%d", &value) != 1) {
-        fclose(fp);
+    ssize_t count = read(fd, buf, sizeof(buf) - 1);
+    struct stat meta;
+    if (count <= 0 || (mtime_ptr != NULL && fstat(fd, &meta) != 0)) {
+        const int errnum = count == 0 ? EINVAL : errno;
+        close(fd);
+        errno = errnum;
+        return -1;
+    }
+    close(fd);
+    buf[count] = 0;
+
+    char *endptr = NULL;
+    long value = strtol(buf, &endptr, 10);
+    if (endptr == buf || value <= 0 || value > INT_MAX) {
+        errno = EINVAL;
         return -1;
     }
-    fclose(fp);
 
     if (pidptr != NULL) {
-        *pidptr = value;
+        *pidptr = (pid_t)value;
+    }
+
+    if (mtime_ptr != NULL) {
+        *mtime_ptr = meta.st_mtime;
+    }
+
+    return 0;
+}
+
+int read_pidfile(const char *pidfile, pid_t *pidptr) {
+    return read_pidfile_mtime(pidfile, pidptr, NULL);
+}
+
+// Gets the start time of a process from /proc/PID/stat, in clock ticks since
+// boot. Unlike a wall clock time derived from it (btime in /proc/stat moves
+// when the clock is stepped) it identifies a process for good.
+int get_process_start_ticks(pid_t pid, uint64_t *ticks_ptr) {
+    char path[64];
+    char buf[1024];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
     }
 
+    ssize_t count = read(fd, buf, sizeof(buf) - 1);
+    const int errnum = errno;
+    close(fd);
+    if (count <= 0) {
+        errno = count == 0 ? EINVAL : errnum;
+        return -1;
+    }
+    buf[count] = 0;
+
+    // the command name in parenthesis may contain anything, even ')'
+    const char *ptr = strrchr(buf, ')');
+    unsigned long long start_ticks = 0;
+    if (ptr == NULL || sscanf(ptr + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &start_ticks) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *ticks_ptr = start_ticks;
+
     return 0;
 }
 
+// Gets how long a process is running. The start ticks count from boot, just
+// like CLOCK_BOOTTIME, so neither one is affected by clock steps.
+int get_process_uptime(pid_t pid, time_t *uptime_ptr) {
+    uint64_t start_ticks = 0;
+    if (get_process_start_ticks(pid, &start_ticks) != 0) {
+        return -1;
+    }
+
+    struct timespec now;
+    const long ticks_per_second = sysconf(_SC_CLK_TCK);
+    if (ticks_per_second <= 0 || clock_gettime(CLOCK_BOOTTIME, &now) != 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    const time_t start = (time_t)(start_ticks / (uint64_t)ticks_per_second);
+    *uptime_ptr = now.tv_sec > start ? now.tv_sec - start : 0;
+
+    return 0;
+}
+
+// kill(pid, 0) is fooled when the PID of a stopped service was reused by
+// another process. If the start ticks of the process that wrote the pidfile
+// are known (see struct service_state), the process has to have the same ones.
+// Otherwise the process that wrote a pidfile was started before that, so if it
+// started much later it is a different process. Much later, because the wall
+// clock might have been stepped since the pidfile was written. Returns 1 if
+// the process is alive, 0 if not and -1 on error.
+int is_pidfile_process_alive(pid_t pid, time_t pidfile_mtime, uint64_t start_ticks) {
+    errno = 0;
+    if (kill(pid, 0) != 0 && errno != EPERM) {
+        return errno == ESRCH ? 0 : -1;
+    }
+
+    uint64_t ticks = 0;
+    time_t uptime = 0;
+    if (start_ticks != 0 ? get_process_start_ticks(pid, &ticks) != 0 : get_process_uptime(pid, &uptime) != 0) {
+        // Either the process just exited or there is no /proc (which also
+        // means ENOENT), so ask kill() again and trust it.
+        return kill(pid, 0) != 0 && errno == ESRCH ? 0 : 1;
+    }
+
+    if (start_ticks != 0) {
+        return ticks == start_ticks;
+    }
+
+    return time(NULL) - uptime <= pidfile_mtime + PIDFILE_CLOCK_SLACK;
+}
+
 char *join_pathv(const char *basepath, ...) {
     if (basepath == NULL || !*basepath) {
         errno = EINVAL;
@@ -370,3 +505,573 @@ char *normpath_no_escape(const char *path) {
 
     return newpath;
 }
+
+// Parses a number of seconds with up to millisecond precision, e.g. "1.5".
+int parse_seconds_ms(const char *str, uint64_t *msptr) {
+    const char *ptr = str;
+    uint64_t secs = 0;
+    uint64_t msecs = 0;
+
+    if (*ptr < '0' || *ptr > '9') {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (*ptr >= '0' && *ptr <= '9') {
+        if (secs > (UINT64_MAX / 1000 - 9) / 10) {
+            errno = ERANGE;
+            return -1;
+        }
+        secs = secs * 10 + (*ptr - '0');
+        ++ ptr;
+    }
+
+    if (*ptr == '.') {
+        ++ ptr;
+        uint64_t scale = 100;
+        while (*ptr >= '0' && *ptr <= '9') {
+            if (scale == 0) {
+                // more precision than milliseconds
+                errno = EINVAL;
+                return -1;
+            }
+            msecs += (*ptr - '0') * scale;
+            scale /= 10;
+            ++ ptr;
+        }
+    }
+
+    if (*ptr) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (msptr != NULL) {
+        *msptr = secs * 1000 + msecs;
+    }
+
+    return 0;
+}
+
+// Milliseconds since some unspecified point in time, for measuring durations.
+// Returns 0 if the clock can't be read, which CLOCK_MONOTONIC never fails to
+// do in practice.
+uint64_t get_monotonic_ms(void) {
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+        return 0;
+    }
+
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static const char *const service_state_names[] = {
+    [SERVICE_STATE_STARTING]   = "starting",
+    [SERVICE_STATE_RUNNING]    = "running",
+    [SERVICE_STATE_RELOADING]  = "reloading",
+    [SERVICE_STATE_STOPPING]   = "stopping",
+    [SERVICE_STATE_RESTARTING] = "restarting",
+    [SERVICE_STATE_FAILED]     = "failed",
+};
+
+const char *get_service_state_name(uint32_t state) {
+    return state < SERVICE_STATE_COUNT ? service_state_names[state] : "unknown";
+}
+
+// how often a reader retries while the record is being updated
+#define SERVICE_STATE_MAX_TRIES 1000
+
+// Copies the state record of the service-runner of pidfile. Returns -1 with
+// errno set if there is none (ENOENT) or it is no valid record (EINVAL).
+int read_service_state(const char *pidfile, struct service_state *state) {
+    char path[PATH_MAX];
+    int count = snprintf(path, sizeof(path), "%s.state", pidfile);
+    if (count < 0 || (size_t)count >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    const struct service_state *record = mmap(NULL, sizeof(*record), PROT_READ, MAP_SHARED, fd, 0);
+    const int errnum = errno;
+    close(fd);
+
+    if (record == MAP_FAILED) {
+        errno = errnum;
+        return -1;
+    }
+
+    int result = -1;
+    int read_errnum = EAGAIN;
+    for (unsigned int tries = 0; tries < SERVICE_STATE_MAX_TRIES; ++ tries) {
+        const uint32_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(state, record, sizeof(*state));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) == seq) {
+            if (state->magic != SERVICE_STATE_MAGIC || state->version != SERVICE_STATE_VERSION) {
+                read_errnum = EINVAL;
+            } else {
+                state->logfile[sizeof(state->logfile) - 1] = 0;
+                result = 0;
+            }
+            break;
+        }
+    }
+
+    munmap((void*)record, sizeof(*record));
+
+    if (result == -1) {
+        errno = read_errnum;
+    }
+
+    return result;
+}
+
+// Connects to the control socket of the service-runner (PIDFILE.sock) and
+// sends request. Returns the socket, whose reply can be read with
+// control_read_reply() once it is readable, or -1 with errno set. ENOENT and
+// ECONNREFUSED mean that the service-runner has no control socket, so the
+// caller may fall back to signals.
+int control_connect(const char *pidfile, const char *request) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int count = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.sock", pidfile);
+    if (count < 0 || (size_t)count >= sizeof(addr.sun_path)) {
+        // the service-runner couldn't have created it either
+        errno = ENOENT;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        send(fd, request, strlen(request), MSG_NOSIGNAL) == -1) {
+        const int errnum = errno;
+        close(fd);
+        errno = errnum;
+        return -1;
+    }
+
+    return fd;
+}
+
+// Reads the reply to a request sent with control_connect(). The reply text
+// after "ok"/"error" is written to reply. Returns 0 for an "ok" reply, 1 for
+// an "error" reply, and -1 with errno set if there was no reply.
+int control_read_reply(int fd, char *reply, size_t reply_size) {
+    char buf[CONTROL_MESSAGE_SIZE];
+
+    ssize_t rcount = recv(fd, buf, sizeof(buf) - 1, 0);
+    if (rcount < 0) {
+        return -1;
+    }
+
+    if (rcount == 0) {
+        // service-runner exited without replying
+        errno = ECONNRESET;
+        return -1;
+    }
+    buf[rcount] = 0;
+
+    int result = -1;
+    const char *message = NULL;
+    if (strncmp(buf, "ok", 2) == 0 && (buf[2] == 0 || buf[2] == ' ')) {
+        result = 0;
+        message = buf[2] ? buf + 3 : buf + 2;
+    } else if (strncmp(buf, "error", 5) == 0 && (buf[5] == 0 || buf[5] == ' ')) {
+        result = 1;
+        message = buf[5] ? buf + 6 : buf + 5;
+    } else {
+        errno = EPROTO;
+        return -1;
+    }
+
+    if (reply != NULL && reply_size > 0) {
+        snprintf(reply, reply_size, "%s", message);
+    }
+
+    return result;
+}
+
+// Sends request to the control socket of the service-runner and waits up to
+// timeout_ms (-1 means forever) for the reply. See control_connect() and
+// control_read_reply() for the return value.
+int control_request(const char *pidfile, const char *request, char *reply, size_t reply_size, int timeout_ms) {
+    int fd = control_connect(pidfile, request);
+    if (fd == -1) {
+        return -1;
+    }
+
+    int result = -1;
+    int errnum = 0;
+
+    struct pollfd pollfds[] = {
+        { .fd = fd, .events = POLLIN, .revents = 0 },
+    };
+
+    for (;;) {
+        int poll_result = poll(pollfds, 1, timeout_ms);
+        if (poll_result > 0) {
+            break;
+        }
+
+        if (poll_result == 0) {
+            errnum = ETIMEDOUT;
+            goto cleanup;
+        }
+
+        if (errno != EINTR) {
+            errnum = errno;
+            goto cleanup;
+        }
+    }
+
+    result = control_read_reply(fd, reply, reply_size);
+    errnum = errno;
+
+cleanup:
+    close(fd);
+
+    if (result == -1) {
+        errno = errnum;
+    }
+
+    return result;
+}
+
+static char *strip(char *str) {
+    while (*str == ' ' || *str == '\t') {
+        ++ str;
+    }
+
+    char *end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+        -- end;
+    }
+    *end = 0;
+
+    return str;
+}
+
+// Service definition files consist of KEY = VALUE lines. Empty lines and
+// lines starting with # are ignored. The file is read and split up once,
+// what the keys mean is up to the caller. Errors are printed to stderr.
+int read_service_config(const char *path, struct service_config *config) {
+    *config = (struct service_config){
+        .path    = path,
+        .name    = NULL,
+        .content = NULL,
+        .entries = NULL,
+        .count   = 0,
+    };
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "*** error: fopen(\"%s\", \"r\"): %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    size_t size = 0;
+    if (getdelim(&config->content, &size, 0, fp) < 0) {
+        free(config->content);
+        config->content = NULL;
+
+        if (ferror(fp)) {
+            fprintf(stderr, "*** error: reading \"%s\": %s\n", path, strerror(errno));
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+
+    if (config->content == NULL) {
+        fprintf(stderr, "*** error: %s: file is empty\n", path);
+        return -1;
+    }
+
+    size_t capacity = 1;
+    for (const char *ptr = config->content; *ptr; ++ ptr) {
+        if (*ptr == '\n') {
+            ++ capacity;
+        }
+    }
+
+    config->entries = calloc(capacity, sizeof(*config->entries));
+    if (config->entries == NULL) {
+        fprintf(stderr, "*** error: calloc(%zu, %zu): %s\n", capacity, sizeof(*config->entries), strerror(errno));
+        free_service_config(config);
+        return -1;
+    }
+
+    unsigned int lineno = 0;
+    char *line = config->content;
+    while (*line) {
+        ++ lineno;
+
+        char *end = strchr(line, '\n');
+        char *next = end == NULL ? line + strlen(line) : end + 1;
+        if (end != NULL) {
+            *end = 0;
+        }
+
+        line = strip(line);
+        if (line[0] && line[0] != '#') {
+            char *eq = strchr(line, '=');
+            if (eq == NULL) {
+                fprintf(stderr, "*** error: %s:%u: expected KEY = VALUE: %s\n", path, lineno, line);
+                free_service_config(config);
+                return -1;
+            }
+            *eq = 0;
+
+            struct service_config_entry *entry = &config->entries[config->count ++];
+            entry->key    = strip(line);
+            entry->value  = strip(eq + 1);
+            entry->lineno = lineno;
+
+            if (!entry->key[0]) {
+                fprintf(stderr, "*** error: %s:%u: empty key\n", path, lineno);
+                free_service_config(config);
+                return -1;
+            }
+        }
+
+        line = next;
+    }
+
+    // default name is the file name without extension
+    const char *name = get_service_config_value(config, "name");
+    if (name != NULL) {
+        config->name = strdup(name);
+    } else {
+        const char *filename = strrchr(path, '/');
+        filename = filename == NULL ? path : filename + 1;
+
+        const char *ext = strrchr(filename, '.');
+        config->name = ext == NULL || ext == filename ? strdup(filename) : strndup(filename, ext - filename);
+    }
+
+    if (config->name == NULL) {
+        fprintf(stderr, "*** error: strdup(): %s\n", strerror(errno));
+        free_service_config(config);
+        return -1;
+    }
+
+    return 0;
+}
+
+void free_service_config(struct service_config *config) {
+    free(config->name);
+    free(config->entries);
+    free(config->content);
+
+    config->name    = NULL;
+    config->entries = NULL;
+    config->content = NULL;
+    config->count   = 0;
+}
+
+// Returns the value of the last occurrence of key, or NULL.
+const char *get_service_config_value(const struct service_config *config, const char *key) {
+    for (size_t index = config->count; index > 0; -- index) {
+        const struct service_config_entry *entry = &config->entries[index - 1];
+        if (strcmp(entry->key, key) == 0) {
+            return entry->value;
+        }
+    }
+
+    return NULL;
+}
+
+// Gets <name> of the commands that address a running service. With
+// --config=FILE it is taken from the service definition file instead, as is
+// the pidfile if not given via --pidfile. The arguments start at optind.
+int get_service_name(int argc, char *argv[], const char *config_path, struct service_config *config, const char **name_ptr, const char **pidfile_ptr) {
+    const int count = argc - optind;
+    if (count != (config_path == NULL ? 1 : 0)) {
+        fprintf(stderr, "*** error: illegal number of arguments\n");
+        short_usage(argc, argv);
+        return -1;
+    }
+
+    if (config_path == NULL) {
+        *name_ptr = argv[optind ++];
+        return 0;
+    }
+
+    if (read_service_config(config_path, config) != 0) {
+        return -1;
+    }
+
+    *name_ptr = config->name;
+    if (*pidfile_ptr == NULL) {
+        *pidfile_ptr = get_service_config_value(config, "pidfile");
+    }
+
+    return 0;
+}
+
+#define RUNNER_PIDFILE_EXT ".runner"
+
+static int filter_runner_pidfiles(const struct dirent *entry) {
+    const size_t len = strlen(entry->d_name);
+    const size_t ext_len = strlen(RUNNER_PIDFILE_EXT);
+
+    return entry->d_name[0] != '.' && len > ext_len &&
+        strcmp(entry->d_name + len - ext_len, RUNNER_PIDFILE_EXT) == 0;
+}
+
+static int add_service_ref(struct service_ref *ref, const char *name, size_t name_len, char *pidfile) {
+    ref->name    = strndup(name, name_len);
+    ref->pidfile = pidfile;
+
+    if (ref->name == NULL) {
+        fprintf(stderr, "*** error: strndup(): %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// Gets the services addressed by the bulk variants of the commands. With
+// dirname (--all=DIR) these are all services with a service-runner pidfile
+// DIR/NAME.pid.runner, otherwise the <name> arguments starting at optind
+// with their default pidfiles.
+int get_service_refs(int argc, char *argv[], const char *dirname, struct service_ref **refs_ptr, size_t *count_ptr) {
+    struct service_ref *refs = NULL;
+    size_t count = 0;
+    struct dirent **entries = NULL;
+    int entry_count = 0;
+    char *dirpath = NULL;
+
+    if (dirname == NULL) {
+        if (optind >= argc) {
+            fprintf(stderr, "*** error: illegal number of arguments\n");
+            short_usage(argc, argv);
+            return -1;
+        }
+
+        refs = calloc(argc - optind, sizeof(*refs));
+        if (refs == NULL) {
+            fprintf(stderr, "*** error: calloc(%d, %zu): %s\n", argc - optind, sizeof(*refs), strerror(errno));
+            return -1;
+        }
+
+        for (; optind < argc; ++ optind) {
+            const char *name = argv[optind];
+            char *pidfile = NULL;
+            if (get_pidfile_abspath(&pidfile, name) == ABS_PATH_ERR) {
+                goto error;
+            }
+
+            if (add_service_ref(&refs[count ++], name, strlen(name), pidfile) != 0) {
+                goto error;
+            }
+        }
+    } else {
+        if (optind < argc) {
+            fprintf(stderr, "*** error: --all and <name> arguments are mutually exclusive\n");
+            short_usage(argc, argv);
+            return -1;
+        }
+
+        dirpath = dirname[0] == '/' ? strdup(dirname) : abspath(dirname);
+        if (dirpath == NULL) {
+            fprintf(stderr, "*** error: abspath(\"%s\"): %s\n", dirname, strerror(errno));
+            return -1;
+        }
+
+        entry_count = scandir(dirpath, &entries, filter_runner_pidfiles, alphasort);
+        if (entry_count < 0) {
+            fprintf(stderr, "*** error: scandir(\"%s\", ...): %s\n", dirpath, strerror(errno));
+            entry_count = 0;
+            goto error;
+        }
+
+        refs = calloc(entry_count > 0 ? entry_count : 1, sizeof(*refs));
+        if (refs == NULL) {
+            fprintf(stderr, "*** error: calloc(%d, %zu): %s\n", entry_count, sizeof(*refs), strerror(errno));
+            goto error;
+        }
+
+        for (int index = 0; index < entry_count; ++ index) {
+            const char *filename = entries[index]->d_name;
+            size_t len = strlen(filename) - strlen(RUNNER_PIDFILE_EXT);
+
+            char *pidfile = join_path(dirpath, filename);
+            if (pidfile == NULL) {
+                fprintf(stderr, "*** error: join_path(\"%s\", \"%s\"): %s\n", dirpath, filename, strerror(errno));
+                goto error;
+            }
+            pidfile[strlen(pidfile) - strlen(RUNNER_PIDFILE_EXT)] = 0;
+
+            // NAME.pid is the default, but any other pidfile works too
+            if (len > 4 && strncmp(filename + len - 4, ".pid", 4) == 0) {
+                len -= 4;
+            }
+
+            if (add_service_ref(&refs[count ++], filename, len, pidfile) != 0) {
+                goto error;
+            }
+        }
+    }
+
+    for (int index = 0; index < entry_count; ++ index) {
+        free(entries[index]);
+    }
+    free(entries);
+    free(dirpath);
+
+    *refs_ptr  = refs;
+    *count_ptr = count;
+
+    return 0;
+
+error:
+    for (int index = 0; index < entry_count; ++ index) {
+        free(entries[index]);
+    }
+    free(entries);
+    free(dirpath);
+    free_service_refs(refs, count);
+
+    return -1;
+}
+
+void free_service_refs(struct service_ref *refs, size_t count) {
+    if (refs == NULL) {
+        return;
+    }
+
+    for (size_t index = 0; index < count; ++ index) {
+        free(refs[index].name);
+        free(refs[index].pidfile);
+    }
+
+    free(refs);
+}
+
+int parse_jobs(const char *str, size_t *jobs_ptr) {
+    char *endptr = NULL;
+    unsigned long value = strtoul(str, &endptr, 10);
+    if (!*str || *endptr || *str == '-' || value == 0 || value > MAX_JOBS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *jobs_ptr = value;
+    return 0;
+}
@@ -11,6 +11,7 @@ function test_01_help_ok () {
     assert_ok "$SERVICE_RUNNER" help logrotate
     assert_ok "$SERVICE_RUNNER" help logs
     assert_ok "$SERVICE_RUNNER" help help
+    assert_ok "$SERVICE_RUNNER" help supervise
 }
 
 function test_02_start_status_stop_service () {
@@ -113,6 +114,17 @@ function test_09_crash_report () {
     assert_fail pgrep service-runner
 }
 
+function test_09_crash_report_timeout () {
+    assert_ok "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart=never --crash-report=./tests/services/slow_crash_reporter.sh --crash-report-timeout=1 ./tests/services/crashing_service.sh 0
+    sleep 0.5
+    assert_grep "SLOW CRASH REPORT: test" "$LOGFILE"
+    sleep 1.5
+    assert_grep "service-runner: \[ERROR\].* crash report PID .* didn't finish within 1 seconds, sending SIGKILL" "$LOGFILE"
+    assert_grep "service-runner: \[ERROR\].* crash report PID .* exited with signal 9" "$LOGFILE"
+    assert_fail "$SERVICE_RUNNER" status test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
 function test_10_logrotate () {
     local LOGFILE
     local logfile1
@@ -137,6 +149,44 @@ function test_10_logrotate () {
     rm -- "$LOGFILE" "$logfile1" "$logfile2" "$logfile3" "$logfile4" || true
 }
 
+function test_10_logrotate_idle () {
+    local LOGFILE
+    local logfile
+
+    LOGFILE="/tmp/service-runner.tests.$TEST_SUIT.$CURRENT_TEST_NUMBER.$$.logrotate_idle.%Y-%m-%d_%H-%M-%S.log"
+    assert_ok "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" ./tests/services/long_running_service.sh 60
+    sleep 2.5
+    # the service didn't write anything since it started, but the logfile has to be rotated anyway
+    logfile=$(date +"$LOGFILE")
+    assert_ok test -e "$logfile"
+    assert_ok   "$SERVICE_RUNNER" stop   test --pidfile="$PIDFILE"
+    assert_fail "$SERVICE_RUNNER" status test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+    rm -f -- "/tmp/service-runner.tests.$TEST_SUIT.$CURRENT_TEST_NUMBER.$$.logrotate_idle."*.log || true
+}
+
+function test_10_logrotate_modifiers () {
+    local LOGFILE
+    local logfile1
+    local logfile2
+    local logfile3
+
+    # flags, field widths and E/O modifiers must not hide that the name changes every second
+    LOGFILE="/tmp/service-runner.tests.$TEST_SUIT.$CURRENT_TEST_NUMBER.$$.logrotate_modifiers.%%.%Ey-%m-%d_%OH-%03M-%-S.log"
+    logfile1=$(date -d '1 seconds' +"$LOGFILE")
+    logfile2=$(date -d '2 seconds' +"$LOGFILE")
+    logfile3=$(date -d '3 seconds' +"$LOGFILE")
+    assert_ok "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" ./tests/services/long_running_service.sh 0.1
+    sleep 4
+    assert_ok   "$SERVICE_RUNNER" stop   test --pidfile="$PIDFILE"
+    assert_fail "$SERVICE_RUNNER" status test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+    assert_grep message "$logfile1"
+    assert_grep message "$logfile2"
+    assert_grep message "$logfile3"
+    rm -f -- "/tmp/service-runner.tests.$TEST_SUIT.$CURRENT_TEST_NUMBER.$$.logrotate_modifiers."*.log || true
+}
+
 function test_10_manual_logrotate () {
     assert_ok "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --manual-logrotate ./tests/services/long_running_service.sh 0.1
     sleep 0.5
@@ -348,3 +398,633 @@ function test_23_auto_restart_failure_and_crash () {
     assert_ok   "$SERVICE_RUNNER" stop   test --pidfile="$PIDFILE"
     assert_fail "$SERVICE_RUNNER" status test --pidfile="$PIDFILE"
 }
+
+function test_24_stop_during_restart_sleep () {
+    assert_ok   "$SERVICE_RUNNER" start  test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart-sleep=30 ./tests/services/failing_service.sh 0
+    sleep 1
+    assert_grep "service-runner: \[ERROR\].* test exited with error status 1" "$LOGFILE"
+    # the runner is waiting to restart the service and has to react to SIGTERM right away
+    assert_ok   "$SERVICE_RUNNER" stop   test --pidfile="$PIDFILE" --shutdown-timeout=2
+    assert_grep "service-runner: \[INFO\].* received signal 15 while waiting to restart test -> don't restart" "$LOGFILE"
+    assert_grepv "restarting test" "$LOGFILE"
+    assert_fail "$SERVICE_RUNNER" status test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_25_restart_backoff () {
+    assert_ok   "$SERVICE_RUNNER" start  test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart-sleep=0.2 --restart-sleep-factor=2 --restart-sleep-max=0.8 ./tests/services/failing_service.sh 0
+    sleep 2.5
+    assert_grep "service-runner: \[INFO\].* test will be restarted in 0.200 seconds" "$LOGFILE"
+    assert_grep "service-runner: \[INFO\].* test will be restarted in 0.400 seconds" "$LOGFILE"
+    assert_grep "service-runner: \[INFO\].* test will be restarted in 0.800 seconds" "$LOGFILE"
+    assert_grepv "test will be restarted in 1.600 seconds" "$LOGFILE"
+    assert_ok   "$SERVICE_RUNNER" stop   test --pidfile="$PIDFILE"
+    assert_fail "$SERVICE_RUNNER" status test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_25_restart_backoff_illegal_values () {
+    assert_fail "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart-sleep=0.0001 ./tests/services/failing_service.sh 0
+    assert_fail "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart-sleep-factor=0.5 ./tests/services/failing_service.sh 0
+    assert_fail "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart-sleep-jitter=101 ./tests/services/failing_service.sh 0
+    assert_fail "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart-sleep=2 --restart-sleep-max=1 ./tests/services/failing_service.sh 0
+    assert_fail test -e "$PIDFILE.runner"
+}
+
+function test_26_start_limit () {
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart-sleep=0.1 --start-limit-burst=3 --start-limit-interval=10 ./tests/services/failing_service.sh 0
+    sleep 1.5
+    assert_grep "service-runner: \[ERROR\].* test was restarted 3 times within 10.000 seconds -> giving up" "$LOGFILE"
+    assert_run 1 "" "test has failed: it was restarted too often. Use the restart command to try again." "$SERVICE_RUNNER" status test --pidfile="$PIDFILE"
+    assert_ok test -e "$PIDFILE"
+    assert_ok   "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE"
+    sleep 0.5
+    assert_grep "service-runner: \[INFO\].* received signal .*, restarting failed service" "$LOGFILE"
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail "$SERVICE_RUNNER" status  test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_26_start_limit_restart_wait () {
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --notify --restart-sleep=0.1 --start-limit-burst=3 --start-limit-interval=10 ./tests/services/failing_service.sh 0
+    sleep 0.2
+    # the new process never becomes ready, so the reply is the failed state
+    assert_run 1 "" "*** error: restarting test: service entered failed state" timeout 5 "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE" --wait
+    assert_run 1 "" "test has failed: it was restarted too often. Use the restart command to try again." "$SERVICE_RUNNER" status test --pidfile="$PIDFILE"
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_27_control_socket () {
+    local pid
+
+    assert_ok   "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" ./tests/services/long_running_service.sh 0.5
+    sleep 0.5
+    assert_ok test -S "$PIDFILE.sock"
+    pid=$(cat "$PIDFILE")
+    assert_ok   "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE"
+    assert_grep "service-runner: \[INFO\].* received restart request via control socket" "$LOGFILE"
+    sleep 0.5
+    assert_grep "service-runner: \[INFO\].* restarting test" "$LOGFILE"
+    assert_fail test "$pid" = "$(cat "$PIDFILE")"
+    assert_run 1 "" "*** error: log-rotating test: manual log-rotation is not enabled, see --manual-logrotate" "$SERVICE_RUNNER" logrotate test --pidfile="$PIDFILE"
+    assert_ok   "$SERVICE_RUNNER" stop test --pidfile="$PIDFILE"
+    assert_grep "service-runner: \[INFO\].* received stop request via control socket" "$LOGFILE"
+    assert_fail test -e "$PIDFILE.sock"
+    assert_fail "$SERVICE_RUNNER" status test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_28_restart_wait () {
+    local pid
+    local output
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" ./tests/services/long_running_service.sh 0.5
+    sleep 0.5
+    pid=$(cat "$PIDFILE")
+    output=$("$SERVICE_RUNNER" restart test --pidfile="$PIDFILE" --wait=5)
+    assert_ok   test "${output%%,*}" = "test restarted: PID $pid -> $(cat "$PIDFILE")"
+    assert_ok   kill -0 "$(cat "$PIDFILE")"
+    assert_fail "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE" --wait=x
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_28_restart_wait_timeout () {
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" ./tests/services/refusing_to_terminate_service.sh
+    sleep 0.5 # so that trap SIGTERM is for sure installed
+    assert_run 1 "" "*** error: timeout waiting for test to restart" "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE" --wait=0.5
+    # without --wait restart doesn't wait for the old process to stop
+    assert_ok   timeout 2 "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE"
+    assert_fail "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE" --shutdown-timeout=1
+    assert_fail "$SERVICE_RUNNER" status  test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_29_notify_ready () {
+    local service_runner
+
+    service_runner=$(realpath "$SERVICE_RUNNER")
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --notify --wait-ready=5 ./tests/services/notifying_service.sh "$service_runner" 0.5
+    assert_grep "test is ready" "$LOGFILE"
+    assert_grep "notifying_service ready" "$LOGFILE"
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail test -e "$PIDFILE.notify"
+    assert_fail pgrep service-runner
+}
+
+function test_29_wait_ready_failure () {
+    assert_status 1 "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart=NEVER --notify --wait-ready ./tests/services/failing_service.sh 0.2
+    assert_grep "exiting now with status 1" "$LOGFILE"
+    sleep 0.5
+    assert_fail pgrep service-runner
+
+    assert_status 1 "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --notify --wait-ready=0.5 ./tests/services/long_running_service.sh
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+
+    assert_fail "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --wait-ready=x ./tests/services/long_running_service.sh
+    assert_fail "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --wait-ready --foreground ./tests/services/long_running_service.sh
+}
+
+function test_30_watchdog () {
+    local service_runner
+    local pid
+
+    service_runner=$(realpath "$SERVICE_RUNNER")
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --notify --watchdog=1 ./tests/services/notifying_service.sh "$service_runner" 0.2
+    sleep 0.5
+    pid=$(cat "$PIDFILE")
+    sleep 2
+    assert_ok   test "$pid" = "$(cat "$PIDFILE")"
+    assert_fail grep -q "missed its watchdog deadline" "$LOGFILE"
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_30_watchdog_timeout () {
+    local pid
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --watchdog=1 --shutdown-timeout=0.5 ./tests/services/refusing_to_terminate_service.sh 0.2
+    sleep 0.5
+    pid=$(cat "$PIDFILE")
+    sleep 2
+    assert_grep "test missed its watchdog deadline of 1.000 seconds, restarting..." "$LOGFILE"
+    assert_grep "test didn't exit within 0.500 seconds, sending SIGKILL" "$LOGFILE"
+    assert_fail test "$pid" = "$(cat "$PIDFILE")"
+    assert_ok   kill -0 "$(cat "$PIDFILE")"
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE" --shutdown-timeout=2
+    assert_fail "$SERVICE_RUNNER" status  test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+    assert_fail "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --watchdog=0 ./tests/services/long_running_service.sh
+}
+
+function test_31_health_cmd () {
+    local pid
+    local healthfile="$PIDFILE.healthy"
+
+    touch "$healthfile"
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --health-cmd="test -e '$healthfile'" --health-interval=0.2 --health-retries=2 ./tests/services/long_running_service.sh 0.2
+    sleep 0.5
+    pid=$(cat "$PIDFILE")
+    sleep 1
+    assert_ok   test "$pid" = "$(cat "$PIDFILE")"
+    rm -- "$healthfile"
+    sleep 1.5
+    assert_grep "health check of test failed (2/2): command exited with status 1" "$LOGFILE"
+    assert_grep "test is unhealthy, restarting..." "$LOGFILE"
+    assert_fail test "$pid" = "$(cat "$PIDFILE")"
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_31_health_socket () {
+    local pid
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --health-unix="$PIDFILE.missing.sock" --health-interval=0.2 --health-retries=2 --health-start-period=0.5 ./tests/services/long_running_service.sh 0.2
+    pid=$(cat "$PIDFILE")
+    sleep 1.5
+    assert_grep "health check of test failed (1/2): No such file or directory" "$LOGFILE"
+    assert_fail test "$pid" = "$(cat "$PIDFILE")"
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --health-tcp=127.0.0.1:1 --health-interval=0.2 --health-retries=1 ./tests/services/long_running_service.sh 0.2
+    sleep 1
+    assert_grep "health check of test failed (1/1): Connection refused" "$LOGFILE"
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+
+    assert_fail "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --health-tcp=localhost ./tests/services/long_running_service.sh
+    assert_fail "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --health-cmd=true --health-unix=/tmp/x.sock ./tests/services/long_running_service.sh
+    assert_fail "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --health-cmd=true --health-retries=0 ./tests/services/long_running_service.sh
+}
+
+function test_32_listen () {
+    local port=$((20000 + $$ % 10000))
+    local socket_path="$PIDFILE.listen.sock"
+    local sockets
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --listen="tcp:127.0.0.1:$port" --listen="unix:$socket_path" ./tests/services/listening_service.sh 0.2
+    sleep 0.5
+    assert_ok   test -S "$socket_path"
+    sockets=$(grep -o "listening on .*" "$LOGFILE")
+    assert_ok   test "$(echo "$sockets" | wc -l)" -eq 2
+
+    # the runner keeps the sockets open, so connections are queued while restarting
+    assert_ok   "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE"
+    assert_ok   bash -c "exec 5<>/dev/tcp/127.0.0.1/$port"
+    sleep 0.5
+    assert_ok   test "$(grep -o "listening on .*" "$LOGFILE" | tail -n 2)" = "$sockets"
+
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+    assert_fail test -e "$socket_path"
+    assert_fail bash -c "exec 5<>/dev/tcp/127.0.0.1/$port" 2>/dev/null
+
+    assert_fail "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --listen="udp:127.0.0.1:$port" ./tests/services/listening_service.sh
+    assert_fail test -e "$PIDFILE.runner"
+}
+
+function test_33_restart_overlap () {
+    local service_runner
+    local failfile="$PIDFILE.fail"
+    local old_pid
+    local new_pid
+
+    service_runner=$(realpath "$SERVICE_RUNNER")
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --notify --wait-ready=5 --restart-mode=overlap ./tests/services/notifying_service.sh "$service_runner" 0.5 "$failfile"
+    old_pid=$(cat "$PIDFILE")
+    assert_ok   "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE" --wait=5
+    new_pid=$(cat "$PIDFILE")
+    assert_fail test "$old_pid" = "$new_pid"
+    assert_grep "test PID $new_pid is ready, stopping old PID $old_pid" "$LOGFILE"
+    sleep 0.5
+    assert_fail kill -0 "$old_pid"
+    assert_grep "old test PID $old_pid exited with status 0" "$LOGFILE"
+
+    # a new process that fails doesn't replace the old one
+    touch "$failfile"
+    assert_run 1 "" "*** error: restarting test: new service process exited before becoming ready" "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE" --wait=5
+    assert_ok   test "$new_pid" = "$(cat "$PIDFILE")"
+    assert_ok   kill -0 "$new_pid"
+    assert_grep "keeping old PID $new_pid" "$LOGFILE"
+    rm -- "$failfile"
+
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+    assert_fail "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart-mode=x ./tests/services/long_running_service.sh
+}
+
+function test_33_restart_overlap_kill_old () {
+    local service_runner
+    local ignorefile="$PIDFILE.ignore"
+    local old_pid
+    local new_pid
+
+    service_runner=$(realpath "$SERVICE_RUNNER")
+
+    touch "$ignorefile"
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --notify --wait-ready=5 --restart-mode=overlap --shutdown-timeout=1 ./tests/services/notifying_service.sh "$service_runner" 0.5 "" "$ignorefile"
+    old_pid=$(cat "$PIDFILE")
+    assert_ok   "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE" --wait=5
+    new_pid=$(cat "$PIDFILE")
+
+    # the old process still gets SIGKILL if the new one exits first
+    assert_ok   kill -USR2 "$new_pid"
+    sleep 1.5
+    assert_grep "old test PID $old_pid didn't exit within 1.000 seconds, sending SIGKILL" "$LOGFILE"
+    assert_fail kill -0 "$old_pid"
+    rm -- "$ignorefile"
+
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+}
+
+function test_34_standby () {
+    local service_runner
+    local primary_pid
+    local standby_pid
+
+    service_runner=$(realpath "$SERVICE_RUNNER")
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --notify --wait-ready=5 --standby ./tests/services/notifying_service.sh "$service_runner" 0.5
+    sleep 1.5
+    primary_pid=$(cat "$PIDFILE")
+    standby_pid=$(grep -o "standby test PID [0-9]* is ready and parked" "$LOGFILE" | cut -d' ' -f4)
+    assert_ok   test -n "$standby_pid"
+    assert_streq "$(ps -o stat= -p "$standby_pid" | cut -c1)" "T"
+
+    # the standby process takes over right away
+    assert_ok   kill -USR2 "$primary_pid"
+    sleep 0.5
+    assert_streq "$(cat "$PIDFILE")" "$standby_pid"
+    assert_grep "promoting standby test PID $standby_pid" "$LOGFILE"
+    assert_fail test "$(ps -o stat= -p "$standby_pid" | cut -c1)" = "T"
+    sleep 1.5
+    assert_ok   test "$(grep -c "is ready and parked" "$LOGFILE")" -eq 2
+
+    # a restart discards the standby process
+    standby_pid=$(grep -o "standby test PID [0-9]* is ready and parked" "$LOGFILE" | tail -n1 | cut -d' ' -f4)
+    assert_ok   "$SERVICE_RUNNER" restart test --pidfile="$PIDFILE" --wait=5
+    assert_grep "standby test PID $standby_pid stopped" "$LOGFILE"
+
+    standby_pid=$(grep -o "starting standby test process PID [0-9]*" "$LOGFILE" | tail -n1 | cut -d' ' -f6)
+    assert_ok   "$SERVICE_RUNNER" stop    test --pidfile="$PIDFILE"
+    assert_fail pgrep service-runner
+    assert_fail kill -0 "$standby_pid"
+
+    # without READY=1 it would be parked before it is initialized
+    assert_run 1 "" "*** error: --standby requires --notify" "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --standby ./tests/services/long_running_service.sh
+    assert_fail test -e "$PIDFILE.runner"
+}
+
+function test_34_standby_kill () {
+    local service_runner
+    local ignorefile="$PIDFILE.ignore"
+    local standby_pid
+
+    service_runner=$(realpath "$SERVICE_RUNNER")
+
+    assert_ok   "$SERVICE_RUNNER" start   test --pidfile="$PIDFILE" --logfile="$LOGFILE" --notify --wait-ready=5 --standby --shutdown-timeout=1 ./tests/services/notifying_service.sh "$service_runner" 0.5 "" "$ignorefile"
+    sleep 1.5
+
+    # the next standby process ignores SIGTERM, the promoted one doesn't
+    touch "$ignorefile"
+    assert_ok   kill -USR2 "$(cat "$PIDFILE")"
+    sleep 1.5
+    standby_pid=$(grep -o "standby test PID [0-9]* is ready and parked" "$LOGFILE" | tail -n1 | cut -d' ' -f4)
+    assert_ok   test "$(grep -c "is ready and parked" "$LOGFILE")" -eq 2
+    rm -- "$ignorefile"
+
+    # it still gets SIGKILL after the service process exited
+    assert_ok   timeout 5 "$SERVICE_RUNNER" stop test --pidfile="$PIDFILE"
+    assert_grep "standby test PID $standby_pid didn't exit within 1.000 seconds, sending SIGKILL" "$LOGFILE"
+    assert_fail pgrep service-runner
+    assert_fail kill -0 "$standby_pid"
+}
+
+function test_35_supervise () {
+    local config_dir
+    local supervisor_pid
+
+    config_dir=$(mktemp -d)
+    printf '%s\n' "# first service" "pidfile = $PIDFILE.a" "logfile = $LOGFILE.a" "command = ./tests/services/long_running_service.sh 0.5" > "$config_dir/a.service"
+    printf '%s\n' "pidfile = $PIDFILE.b" "logfile = $LOGFILE.b" "restart = ALWAYS" "command = ./tests/services/long_running_service.sh 0.5" > "$config_dir/b.service"
+    printf '%s\n' "pidfile = $PIDFILE.c" "logfile = $LOGFILE.c" "command = ./tests/services/refusing_to_terminate_service.sh 0.5" > "$config_dir/c.service"
+
+    "$SERVICE_RUNNER" supervise "$config_dir" > "$LOGFILE" 2>&1 &
+    supervisor_pid=$!
+    sleep 1
+
+    # one service-runner process for both services
+    assert_ok   "$SERVICE_RUNNER" status a --pidfile="$PIDFILE.a"
+    assert_ok   "$SERVICE_RUNNER" status b --pidfile="$PIDFILE.b"
+    assert_streq "$(cat "$PIDFILE.a.runner")" "$supervisor_pid"
+    assert_streq "$(cat "$PIDFILE.b.runner")" "$supervisor_pid"
+    assert_grep "message" "$LOGFILE.a"
+    assert_grep "message" "$LOGFILE.b"
+
+    # stopping one service keeps the others running
+    assert_ok   "$SERVICE_RUNNER" stop a --pidfile="$PIDFILE.a"
+    assert_grep "received SIGTERM, exiting" "$LOGFILE.a"
+    assert_fail "$SERVICE_RUNNER" status a --pidfile="$PIDFILE.a"
+    assert_ok   "$SERVICE_RUNNER" status b --pidfile="$PIDFILE.b"
+    assert_ok   kill -0 "$supervisor_pid"
+
+    # a shutdown timeout only kills the service, never the shared supervisor
+    local service_pid_c
+    service_pid_c=$(cat "$PIDFILE.c")
+    assert_fail "$SERVICE_RUNNER" stop c --pidfile="$PIDFILE.c" --shutdown-timeout=1
+    sleep 0.5
+    assert_fail kill -0 "$service_pid_c"
+    assert_ok   kill -0 "$supervisor_pid"
+    assert_ok   "$SERVICE_RUNNER" status b --pidfile="$PIDFILE.b"
+    assert_streq "$(cat "$PIDFILE.b.runner")" "$supervisor_pid"
+
+    # SIGTERM stops all services and then the supervisor
+    assert_ok   kill -TERM "$supervisor_pid"
+    assert_ok   wait "$supervisor_pid"
+    assert_grep "received SIGTERM, exiting" "$LOGFILE.b"
+    assert_fail "$SERVICE_RUNNER" status b --pidfile="$PIDFILE.b"
+    assert_fail test -e "$PIDFILE.b.runner"
+    assert_grep "all services of $config_dir have stopped" "$LOGFILE"
+
+    rm -r -- "$config_dir" "$LOGFILE.a" "$LOGFILE.b" "$LOGFILE.c"
+}
+
+function test_36_config () {
+    local config
+
+    config=$PIDFILE.service
+    cat > "$config" <<EOF
+# comment
+name = test
+pidfile = $PIDFILE
+logfile = $LOGFILE
+restart = ALWAYS
+manual-logrotate = yes
+notify = no
+log-format = template:%L %s
+command = ./tests/services/long_running_service.sh "0.5"
+EOF
+
+    assert_ok   "$SERVICE_RUNNER" start  --config="$config"
+    sleep 0.5
+    assert_run 0 "test is running" "" "$SERVICE_RUNNER" status -c "$config"
+    assert_grep "^INFO starting" "$LOGFILE"
+    assert_grep "message" "$LOGFILE"
+    assert_ok   "$SERVICE_RUNNER" logrotate --config="$config"
+    assert_ok   "$SERVICE_RUNNER" stop   --config="$config"
+    assert_fail "$SERVICE_RUNNER" status --config="$config"
+
+    # everything is checked before the service is started
+    echo "log-format = template:%q" >> "$config"
+    assert_run 1 "" "*** error: illegal value for --log-format: template:%q" "$SERVICE_RUNNER" start --config="$config"
+    sed -i '$d' "$config"
+    echo "no-such-option = 1" >> "$config"
+    assert_run 1 "" "*** error: $config:10: unknown setting: no-such-option" "$SERVICE_RUNNER" start --config="$config"
+    sed -i '$d' "$config"
+    echo "chown-logfile = maybe" >> "$config"
+    assert_run 1 "" "*** error: $config:10: illegal value for chown-logfile, expected yes or no: maybe" "$SERVICE_RUNNER" start --config="$config"
+    assert_fail test -e "$PIDFILE.runner"
+
+    rm -- "$config"
+}
+
+function test_37_bulk () {
+    local config_dir
+    local run_dir
+
+    config_dir=$(mktemp -d)
+    run_dir=$(mktemp -d)
+    for name in a b c; do
+        printf '%s\n' "pidfile = $run_dir/$name.pid" "logfile = $LOGFILE.$name" "command = ./tests/services/long_running_service.sh 0.5" > "$config_dir/$name.service"
+    done
+
+    assert_ok   "$SERVICE_RUNNER" start --all="$config_dir" --jobs=2 --wait-ready
+    assert_ok   "$SERVICE_RUNNER" status --all="$run_dir"
+    "$SERVICE_RUNNER" status --all="$run_dir" > "$LOGFILE"
+    assert_grep "^NAME *STATE *PID *RUNNER *UPTIME *RESTARTS *LOGFILE$" "$LOGFILE"
+    assert_grep "^a *running *$(cat "$run_dir/a.pid") *$(cat "$run_dir/a.pid.runner") *00:00:0[0-9] *0 *$LOGFILE.a$" "$LOGFILE"
+    assert_grep "^c *running " "$LOGFILE"
+    "$SERVICE_RUNNER" status --all="$run_dir" --json > "$LOGFILE"
+    assert_grep "^{\"name\":\"b\",\"state\":\"running\",\"pid\":$(cat "$run_dir/b.pid"),\"runner_pid\":$(cat "$run_dir/b.pid.runner"),\"uptime\":[0-9]*,\"restarts\":0,\"pidfile\":\"$run_dir/b.pid\",\"logfile\":\"$LOGFILE.b\",\"exit_status\":null,\"exit_signal\":null,\"bytes_logged\":[0-9]*,\"status\":0}" "$LOGFILE"
+    assert_ok   test -f "$run_dir/b.pid.state"
+
+    # a stale pidfile whose PID was reused by a process started after it
+    echo 1 > "$run_dir/x.pid.runner"
+    touch -d "2000-01-01" "$run_dir/x.pid.runner"
+    assert_status 1 "$SERVICE_RUNNER" status --all="$run_dir" --json
+    "$SERVICE_RUNNER" status --all="$run_dir" > "$LOGFILE" || true
+    assert_grep "^x *dead *- *- *- *- *-$" "$LOGFILE"
+    rm -- "$run_dir/x.pid.runner"
+
+    # as if the clock was stepped forward since the pidfiles were written
+    touch -d "2000-01-01" "$run_dir/a.pid" "$run_dir/a.pid.runner"
+    assert_ok   "$SERVICE_RUNNER" status a --pidfile="$run_dir/a.pid"
+    "$SERVICE_RUNNER" status --all="$run_dir" > "$LOGFILE"
+    assert_grep "^a *running " "$LOGFILE"
+
+    assert_ok   "$SERVICE_RUNNER" stop --all="$run_dir" --jobs=2
+    assert_grep "received SIGTERM, exiting" "$LOGFILE.a"
+    assert_grep "received SIGTERM, exiting" "$LOGFILE.b"
+    assert_grep "received SIGTERM, exiting" "$LOGFILE.c"
+    assert_fail test -e "$run_dir/b.pid.state"
+    assert_run 0 "[]" "" "$SERVICE_RUNNER" status --all="$run_dir" --json
+    assert_fail pgrep service-runner
+
+    # only the given services
+    assert_ok   "$SERVICE_RUNNER" start --all="$config_dir" a c
+    "$SERVICE_RUNNER" status --all="$run_dir" > "$LOGFILE"
+    assert_grep "^a *running " "$LOGFILE"
+    assert_grep "^c *running " "$LOGFILE"
+    assert_fail grep -q "^b " "$LOGFILE"
+    assert_ok   "$SERVICE_RUNNER" stop --all="$run_dir"
+    assert_fail pgrep service-runner
+
+    assert_run 1 "" "*** error: $config_dir/d.service: No such file or directory" "$SERVICE_RUNNER" start --all="$config_dir" a d
+    assert_run 1 "" "*** error: illegal value for --jobs: 0" "$SERVICE_RUNNER" stop --all="$run_dir" --jobs=0
+    assert_run 1 "" "*** error: --pidfile and --config can only be used with a single service" "$SERVICE_RUNNER" stop a b --pidfile="$run_dir/a.pid"
+    assert_run 1 "" "*** error: --pidfile, --logfile and --config can only be used with a single service" "$SERVICE_RUNNER" start --all="$config_dir" --pidfile="$run_dir/a.pid"
+    assert_run 1 "" "*** error: --pidfile, --logfile and --config can only be used with a single service" "$SERVICE_RUNNER" start --all="$config_dir" --logfile="$LOGFILE.a"
+    assert_fail pgrep service-runner
+
+    rm -r -- "$config_dir" "$run_dir" "$LOGFILE.a" "$LOGFILE.b" "$LOGFILE.c"
+}
+
+function test_38_metrics () {
+    local socket_path="$PIDFILE.metrics.sock"
+    local metrics_file="$LOGFILE.prom"
+
+    # the file is written once more when stopping
+    assert_ok   "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --metrics="$metrics_file" --restart-sleep=0.1 ./tests/services/crashing_service.sh 0
+    sleep 1
+    assert_ok   "$SERVICE_RUNNER" stop  test --pidfile="$PIDFILE"
+    assert_grep '^service_runner_up{service="test"} 0$' "$metrics_file"
+    assert_grep '^service_runner_restarts_total{service="test"} [1-9][0-9]*$' "$metrics_file"
+    assert_grep '^service_runner_exits_total{service="test",code="\(KILLED\|DUMPED\)"} [1-9][0-9]*$' "$metrics_file"
+    assert_grep '^service_runner_restart_delay_seconds_count{service="test"} [1-9][0-9]*$' "$metrics_file"
+    assert_grep '^service_runner_restart_delay_seconds_bucket{service="test",le="+Inf"} [1-9][0-9]*$' "$metrics_file"
+    rm -- "$metrics_file"
+
+    assert_ok   "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --metrics="unix:$socket_path" ./tests/services/long_running_service.sh
+    assert_ok   test -S "$socket_path"
+    if command -v curl >/dev/null; then
+        curl --silent --show-error --unix-socket "$socket_path" http://localhost/metrics > "$metrics_file"
+        assert_grep '^service_runner_up{service="test"} 1$' "$metrics_file"
+        assert_grep '^# TYPE service_runner_log_bytes_total counter$' "$metrics_file"
+        rm -- "$metrics_file"
+    fi
+    assert_ok   "$SERVICE_RUNNER" stop  test --pidfile="$PIDFILE"
+    assert_fail test -e "$socket_path"
+
+    assert_run 1 "" "*** error: illegal value for --metrics: unix:" "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --metrics=unix: ./tests/services/long_running_service.sh
+}
+
+function test_39_debug_dump () {
+    local dump_file="$PIDFILE.dump"
+
+    assert_ok   "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --restart-sleep=0.1 ./tests/services/crashing_service.sh 0
+    sleep 0.5
+    "$SERVICE_RUNNER" debug-dump test --pidfile="$PIDFILE" > "$LOGFILE.dump"
+    assert_grep "^# flight recorder of test (service-runner PID $(cat "$PIDFILE.runner"))" "$LOGFILE.dump"
+    assert_grep " -[0-9]*\.[0-9]\{6\} fork  *pid=[0-9]*$" "$LOGFILE.dump"
+    assert_grep " state  *none -> \(starting\|running\)$" "$LOGFILE.dump"
+    assert_grep " state  *running -> restarting$" "$LOGFILE.dump"
+    assert_grep " reap  *pid=[0-9]* \(signal\|exited\)=" "$LOGFILE.dump"
+    assert_grep " error  *line=[0-9]* errno=[0-9]* \"%s was killed by signal %d\"$" "$LOGFILE.dump"
+    assert_ok   cmp "$LOGFILE.dump" "$dump_file"
+    rm -- "$LOGFILE.dump" "$dump_file"
+
+    # without control request
+    assert_ok   kill -USR2 "$(cat "$PIDFILE.runner")"
+    sleep 0.2
+    assert_grep " signal  *signal=12 " "$dump_file"
+    assert_grep "wrote flight recorder to $dump_file" "$LOGFILE"
+    assert_ok   "$SERVICE_RUNNER" stop  test --pidfile="$PIDFILE"
+    rm -- "$dump_file"
+
+    assert_run 1 "" "*** error: reading pidfile: $PIDFILE.runner: No such file or directory" "$SERVICE_RUNNER" debug-dump test --pidfile="$PIDFILE"
+}
+
+function test_40_signal_storm () {
+    assert_ok   "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" ./tests/services/long_running_service.sh
+    local runner_pid
+    runner_pid=$(cat "$PIDFILE.runner")
+    for _ in {1..200}; do
+        kill -USR2 "$runner_pid"
+    done
+    sleep 0.5
+    assert_ok   kill -0 "$runner_pid"
+    assert_grep "wrote flight recorder to $PIDFILE.dump$" "$LOGFILE"
+    # batched log lines are still whole lines
+    assert_fail grep -v '^\[[0-9-]* [0-9:]*[-+][0-9]*\] ' "$LOGFILE"
+    assert_ok   "$SERVICE_RUNNER" stop  test --pidfile="$PIDFILE"
+    rm -- "$PIDFILE.dump"
+}
+
+function test_41_log_template () {
+    assert_ok   "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --log-format='template:%a %b %ga %gb %gt|%L|%js|%%' ./tests/services/long_running_service.sh
+    assert_ok   "$SERVICE_RUNNER" stop  test --pidfile="$PIDFILE"
+    assert_grep "^\(Sun\|Mon\|Tue\|Wed\|Thu\|Fri\|Sat\) \(Jan\|Feb\|Mar\|Apr\|May\|Jun\|Jul\|Aug\|Sep\|Oct\|Nov\|Dec\) \(Sun\|Mon\|Tue\|Wed\|Thu\|Fri\|Sat\) [A-Z][a-z][a-z] [0-9]\{4\}-[0-9][0-9]-[0-9][0-9] [0-9][0-9]:[0-9][0-9]:[0-9][0-9]Z|INFO|starting...|%$" "$LOGFILE"
+
+    assert_run 1 "" "*** error: illegal value for --log-format: template:%s %gz" "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" '--log-format=template:%s %gz' ./tests/services/long_running_service.sh
+    assert_run 1 "" "*** error: illegal value for --log-format: template:%L" "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" '--log-format=template:%L' ./tests/services/long_running_service.sh
+}
+
+function test_42_log_escaping () {
+    local executable="$PIDFILE.$(printf 'bad\001"exe\377')"
+    printf '\177ELFjunk' > "$executable"
+    chmod +x "$executable"
+
+    assert_ok   "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" --log-format=json --restart=NEVER "$executable"
+    sleep 0.5
+    rm -f "$executable"
+
+    assert_grep '"message":"(child) execv(\\"[^"]*bad\\u0001\\"exe\\ufffd\\", command_argv): Exec format error"}$' "$LOGFILE"
+
+    # %Js passes invalid UTF-8 through unchanged
+    printf '\177ELFjunk' > "$executable"
+    chmod +x "$executable"
+
+    assert_ok   "$SERVICE_RUNNER" start test --pidfile="$PIDFILE" --logfile="$LOGFILE.raw" --log-format='template:%Js' --restart=NEVER "$executable"
+    sleep 0.5
+    rm -f "$executable"
+
+    LC_ALL=C assert_grep $'^(child) execv(\\\\"[^"]*bad\\\\u0001\\\\"exe\377\\\\", command_argv): Exec format error$' "$LOGFILE.raw"
+    rm -f "$LOGFILE.raw"
+}
+
+function test_43_tracepoints () {
+    local probe
+    local probes
+    local trace_build="/tmp/service-runner.tests.$TEST_SUIT.$CURRENT_TEST_NUMBER.$$.trace-build"
+
+    # every probe trace-latency.bt attaches to has to exist in the code
+    probes=$(sed -n 's/^usdt:\*:service_runner:\([a-z_]*\).*/\1/p' trace-latency.bt)
+    assert_ok test -n "$probes"
+    for probe in $probes; do
+        assert_grep "TRACE($probe[,)]" src/start.c
+    done
+
+    # a TRACE=ON build needs <sys/sdt.h>
+    if echo '#include <sys/sdt.h>' | gcc -E - >/dev/null 2>&1 && command -v readelf >/dev/null; then
+        assert_ok make -s TRACE=ON BUILDDIR="$trace_build"
+        readelf -n "$trace_build/bin/service-runner" > "$trace_build/notes"
+        for probe in $probes; do
+            assert_grep "Name: $probe$" "$trace_build/notes"
+        done
+
+        # the probes are nops while no tracer is attached
+        assert_ok   "$trace_build/bin/service-runner" start test --pidfile="$PIDFILE" --logfile="$LOGFILE" ./tests/services/long_running_service.sh 0.1
+        sleep 0.5
+        assert_ok   "$trace_build/bin/service-runner" stop  test --pidfile="$PIDFILE"
+        assert_fail pgrep service-runner
+        assert_grep message "$LOGFILE"
+        rm -rf -- "$trace_build"
+    fi
+}
@@ -0,0 +1,30 @@
+#!/usr/bin/bash
+
+set -eo pipefail
+
+name=$(basename "$0" .sh)
+wait=${1:-5}
+
+function handle_sigterm () {
+    printf '[%(%Y-%m-%d %H:%M:%S%z)T] %s received SIGTERM, exiting...\n' -1 "$name"
+    exit
+}
+
+trap handle_sigterm SIGTERM
+
+if [[ "$LISTEN_PID" != "$$" ]]; then
+    printf '[%(%Y-%m-%d %H:%M:%S%z)T] %s: LISTEN_PID=%s, but PID is %d\n' -1 "$name" "$LISTEN_PID" "$$" >&2
+    exit 1
+fi
+
+for ((fd = 3; fd < 3 + LISTEN_FDS; ++ fd)); do
+    if [[ ! -S "/proc/$$/fd/$fd" ]]; then
+        printf '[%(%Y-%m-%d %H:%M:%S%z)T] %s: file descriptor %d is not a socket\n' -1 "$name" "$fd" >&2
+        exit 1
+    fi
+    printf '[%(%Y-%m-%d %H:%M:%S%z)T] %s: listening on %s\n' -1 "$name" "$(readlink "/proc/$$/fd/$fd")"
+done
+
+while true; do
+    sleep "$wait"
+done
@@ -0,0 +1,41 @@
+#!/usr/bin/bash
+
+set -eo pipefail
+
+name=$(basename "$0" .sh)
+service_runner=$1
+wait=${2:-5}
+failfile=$3
+ignorefile=$4 # SIGTERM is ignored if this file exists when the service starts
+
+ignore_sigterm=0
+if [[ -n "$ignorefile" && -e "$ignorefile" ]]; then
+    ignore_sigterm=1
+fi
+
+function handle_sigterm () {
+    if [[ "$ignore_sigterm" -eq 1 ]]; then
+        printf '[%(%Y-%m-%d %H:%M:%S%z)T] %s received SIGTERM, but ignores it\n' -1 "$name"
+        return
+    fi
+    printf '[%(%Y-%m-%d %H:%M:%S%z)T] %s received SIGTERM, exiting...\n' -1 "$name"
+    exit
+}
+
+trap handle_sigterm SIGTERM
+
+printf '[%(%Y-%m-%d %H:%M:%S%z)T] %s started\n' -1 "$name"
+sleep "$wait"
+
+if [[ -n "$failfile" && -e "$failfile" ]]; then
+    printf '[%(%Y-%m-%d %H:%M:%S%z)T] %s: %s exists, failing...\n' -1 "$name" "$failfile" >&2
+    exit 1
+fi
+
+printf '[%(%Y-%m-%d %H:%M:%S%z)T] %s ready\n' -1 "$name"
+"$service_runner" notify READY=1 "STATUS=waiting for nothing"
+
+while true; do
+    sleep "$wait"
+    "$service_runner" notify WATCHDOG=1
+done
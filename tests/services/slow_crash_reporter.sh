@@ -0,0 +1,4 @@
+#!/usr/bin/bash
+
+echo "[$(date +'%Y-%m-%d %H:%M:%S%z')] SLOW CRASH REPORT:" "$@"
+sleep "${CRASH_REPORT_SLEEP:-60}"